@@ -0,0 +1,911 @@
+// Audio.cpp: sound effects and streamed music
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include "Audio.h"
+#include "AudioMix.h"
+#include "AudioSink.h"
+#include "Logger.h"
+#include "QSGSoftwareSpans.h"
+#include "Thread.h"
+#include "Timer.h"
+#include "TraceEvents.h"
+#include "VorbisSimd.h"
+#include "stb_vorbis.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+// Frames mixed and written to the sink at a time.
+#define AUDIO_PERIOD 512
+
+// Buffering asked of the ALSA device, in milliseconds.
+#define AUDIO_LATENCY 50
+
+// Commands the queue holds; a power of two.
+#define AUDIO_COMMANDS 256
+
+#define AUDIO_MAX_SOUNDS 256
+#define AUDIO_MAX_VOICES 64
+
+// Music streams: the one playing, and any still fading out.
+#define AUDIO_MAX_STREAMS 4
+
+// Bytes read from a music file at a time.
+#define AUDIO_STREAM_CHUNK 4096
+
+// Frames decoded ahead of the mixer for each stream; a power of two.
+#define AUDIO_STREAM_FRAMES 32768
+
+// How long the decoder sleeps when it has nothing to do, in milliseconds.
+#define AUDIO_DECODER_SLEEP 5
+
+// Frames stopped music takes to fade out.
+#define AUDIO_FADE_FRAMES 4096
+
+// Most frames of a stream's ring a period can need, with the taps either
+// side of them.
+#define AUDIO_WINDOW_FRAMES (AUDIO_PERIOD * MIX_MAX_STEP + MIX_PAD * 2)
+
+// Who has a sound or stream slot. The main thread fills in a free slot
+// and makes it LOADING, which hands it to the decoder; the decoder makes
+// it READY, or FAILED. Streams end when the mixer makes them RELEASED,
+// and the decoder closes them and makes them FREE again.
+enum AudioSlotState
+{
+	SLOT_FREE,
+	SLOT_LOADING,
+	SLOT_READY,
+	SLOT_FAILED,
+	SLOT_RELEASED
+};
+
+struct AudioSound
+{
+	volatile long m_nState;				// AudioSlotState
+	std::vector<unsigned char> m_file;	// until decoded
+	std::vector<float> m_samples;		// interleaved, between MIX_PAD frames of
+										// silence; read only once READY
+	int m_nChannels;					// 1 or 2
+	int m_nRate;
+	long m_nFrames;
+};
+
+struct AudioStream
+{
+	volatile long m_nState;				// AudioSlotState
+
+	// set by the main thread while the slot is free.
+	std::string m_strFilename;
+	bool m_bLoop;
+
+	// the decoder's.
+	FILE* m_pFile;
+	stb_vorbis* m_pVorbis;
+	std::vector<unsigned char> m_input;	// read from the file, not yet decoded
+	int m_nMaxFrame;					// most frames a packet decodes to
+	long m_nDecoded;					// frames since the file was opened
+
+	// decoded frames, left and right, in a ring the decoder writes and the
+	// mixer reads. m_nRate is set before the stream is READY.
+	std::vector<float> m_ring;
+	int m_nRate;
+	volatile long m_nWritten;
+	volatile long m_nRead;
+	volatile long m_bEnded;				// nothing more will be written
+
+	// the mixer's.
+	bool m_bActive;						// being mixed (or waiting to be)
+	unsigned int m_nFrac;				// 16.16 position past m_nRead
+	float m_fFade;						// 1, or falling to 0 once stopped
+	float m_fFadeStep;
+	float m_fGain;						// where the last period's gain ended
+};
+
+struct AudioVoice
+{
+	int m_nHandle;						// from audio_PlaySound
+	int m_nSound;
+	long m_nPos;						// frame, and 16.16 fraction
+	unsigned int m_nFrac;
+	float m_fGain;						// as last set
+	float m_fPan;
+	float m_fPitch;
+	float m_fLeft;						// gains the last period ended at
+	float m_fRight;
+	bool m_bStopping;					// fading out over the next period
+	long m_nStarted;					// period it started in
+};
+
+enum AudioCommandType
+{
+	CMD_PLAY_SOUND,
+	CMD_PLAY_MUSIC,
+	CMD_STOP_MUSIC,
+	CMD_MUSIC_GAIN,
+	CMD_MASTER_GAIN,
+	CMD_SET_VOICE,
+	CMD_STOP_VOICE,
+	CMD_RESAMPLER
+};
+
+struct AudioCommand
+{
+	int m_nType;
+	int m_nId;							// sound id, stream slot or filter
+	int m_nVoice;						// voice handle
+	float m_fGain;
+	float m_fPan;
+	float m_fPitch;
+};
+
+static AudioSink* s_pSink = NULL;
+static Thread* s_pMixer = NULL;
+static Thread* s_pDecoder = NULL;
+static volatile long s_nStop = 0;
+
+static AudioSound s_aSounds[AUDIO_MAX_SOUNDS];
+static volatile long s_nSounds = 0;		// slots given out, from the first
+static AudioStream s_aStreams[AUDIO_MAX_STREAMS];
+
+// One producer (the main thread) and one consumer (the mixer), so each
+// end only needs to publish its own position.
+static AudioCommand s_aCommands[AUDIO_COMMANDS];
+static volatile long s_nCommandsWritten = 0;
+static volatile long s_nCommandsRead = 0;
+
+// the main thread's.
+static int s_nNextVoice = 1;			// handle for the next voice played
+
+// the mixer's. Voices are taken from the free list and put back on it;
+// those playing are kept together at the front of s_anPlaying.
+static AudioVoice s_aVoices[AUDIO_MAX_VOICES];
+static int s_anFree[AUDIO_MAX_VOICES];
+static int s_nFree = 0;
+static int s_anPlaying[AUDIO_MAX_VOICES];
+static int s_nPlaying = 0;
+static int s_nMusic = -1;				// stream playing as music
+static float s_fMusicGain = 1;
+static float s_fMasterGain = 1;
+static int s_nFilter = MIX_POLYPHASE;
+static double s_fMixTotal = 0;			// seconds spent mixing
+
+static volatile long s_nPeriods = 0;
+static volatile long s_nStarved = 0;
+static volatile long s_nDropped = 0;
+static volatile long s_nVoicesPlaying = 0;
+static volatile long s_nStolen = 0;
+static volatile long s_nMixLast = 0;	// microseconds
+static volatile long s_nMixMean = 0;
+static volatile long s_nMixMax = 0;
+static volatile long s_nOverBudget = 0;
+
+
+//////////////////////////////////////////////////////////////////////
+// Decoder
+//////////////////////////////////////////////////////////////////////
+
+static void decodeSound( AudioSound* pSound, int nId )
+{
+	int nError = 0;
+	stb_vorbis* pVorbis = stb_vorbis_open_memory( &pSound->m_file[0], (int) pSound->m_file.size(), &nError, NULL );
+	if( !pVorbis )
+	{
+		log_Writef( LOG_WARN, "Audio: sound %d is not Ogg Vorbis (error %d)", nId, nError );
+		std::vector<unsigned char>().swap( pSound->m_file );
+		atomic_Store( &pSound->m_nState, SLOT_FAILED );
+		return;
+	}
+
+	stb_vorbis_info info = stb_vorbis_get_info( pVorbis );
+	int nChannels = info.channels > 1 ? 2 : 1;		// the first two of any more
+	pSound->m_samples.reserve( (stb_vorbis_stream_length_in_samples( pVorbis ) + MIX_PAD * 2) * nChannels );
+	pSound->m_samples.assign( MIX_PAD * nChannels, 0.0f );
+	int nFrameChannels, nFrames;
+	float** ppOutput;
+	while( (nFrames = stb_vorbis_get_frame_float( pVorbis, &nFrameChannels, &ppOutput )) > 0 )
+	{
+		for( int i = 0; i < nFrames; i++ )
+			for( int c = 0; c < nChannels; c++ )
+				pSound->m_samples.push_back( ppOutput[c][i] );
+	}
+	stb_vorbis_close( pVorbis );
+	std::vector<unsigned char>().swap( pSound->m_file );
+
+	pSound->m_nChannels = nChannels;
+	pSound->m_nRate = info.sample_rate;
+	pSound->m_nFrames = (long)(pSound->m_samples.size() / nChannels) - MIX_PAD;
+	pSound->m_samples.resize( pSound->m_samples.size() + MIX_PAD * nChannels, 0.0f );
+	atomic_Store( &pSound->m_nState, SLOT_READY );
+}
+
+// Append a chunk of the file to the input; false at its end.
+static bool readInput( AudioStream* pStream )
+{
+	size_t nSize = pStream->m_input.size();
+	pStream->m_input.resize( nSize + AUDIO_STREAM_CHUNK );
+	size_t nRead = fread( &pStream->m_input[nSize], 1, AUDIO_STREAM_CHUNK, pStream->m_pFile );
+	pStream->m_input.resize( nSize + nRead );
+	return nRead > 0;
+}
+
+static void consumeInput( AudioStream* pStream, int nBytes )
+{
+	pStream->m_input.erase( pStream->m_input.begin(), pStream->m_input.begin() + nBytes );
+}
+
+// Read the headers from the start of the file.
+static bool startVorbis( AudioStream* pStream )
+{
+	rewind( pStream->m_pFile );
+	pStream->m_input.clear();
+	pStream->m_nDecoded = 0;
+	int nUsed = 0;
+	for( ;; )
+	{
+		int nError = VORBIS_need_more_data;
+		if( !pStream->m_input.empty() )
+		{
+			pStream->m_pVorbis = stb_vorbis_open_pushdata( &pStream->m_input[0], (int) pStream->m_input.size(),
+				&nUsed, &nError, NULL );
+		}
+		if( pStream->m_pVorbis ) break;
+		if( nError != VORBIS_need_more_data || !readInput( pStream ) )
+		{
+			log_Writef( LOG_WARN, "Audio: %s is not Ogg Vorbis (error %d)", pStream->m_strFilename.c_str(), nError );
+			return false;
+		}
+	}
+	consumeInput( pStream, nUsed );
+
+	stb_vorbis_info info = stb_vorbis_get_info( pStream->m_pVorbis );
+	pStream->m_nRate = info.sample_rate;
+	pStream->m_nMaxFrame = info.max_frame_size;
+	return true;
+}
+
+static void closeStream( AudioStream* pStream )
+{
+	if( pStream->m_pVorbis ) stb_vorbis_close( pStream->m_pVorbis );
+	if( pStream->m_pFile ) fclose( pStream->m_pFile );
+	pStream->m_pVorbis = NULL;
+	pStream->m_pFile = NULL;
+	std::vector<unsigned char>().swap( pStream->m_input );
+}
+
+static void openStream( AudioStream* pStream )
+{
+	pStream->m_pFile = fopen( pStream->m_strFilename.c_str(), "rb" );
+	if( !pStream->m_pFile )
+		log_Writef( LOG_WARN, "Audio: cannot open %s", pStream->m_strFilename.c_str() );
+	if( !pStream->m_pFile || !startVorbis( pStream ) )
+	{
+		closeStream( pStream );
+		atomic_Store( &pStream->m_nState, SLOT_FAILED );
+		return;
+	}
+	atomic_Store( &pStream->m_nState, SLOT_READY );
+}
+
+// Decode packets until the ring is full or the file runs out. Returns
+// whether anything was decoded.
+static bool fillStream( AudioStream* pStream )
+{
+	bool bBusy = false;
+	while( !pStream->m_bEnded )
+	{
+		// the mixer's taps reach back past the frame it has read up to.
+		long nWritten = pStream->m_nWritten;
+		long nFree = AUDIO_STREAM_FRAMES - MIX_PAD - (nWritten - atomic_Load( &pStream->m_nRead ));
+		if( nFree < pStream->m_nMaxFrame )
+			break;
+
+		int nChannels = 0, nFrames = 0, nUsed = 0;
+		float** ppOutput = NULL;
+		if( !pStream->m_input.empty() )
+		{
+			nUsed = stb_vorbis_decode_frame_pushdata( pStream->m_pVorbis, &pStream->m_input[0],
+				(int) pStream->m_input.size(), &nChannels, &ppOutput, &nFrames );
+		}
+		if( nUsed == 0 )
+		{
+			// a whole page is needed first.
+			if( readInput( pStream ) ) continue;
+			stb_vorbis_close( pStream->m_pVorbis );
+			pStream->m_pVorbis = NULL;
+			if( pStream->m_bLoop && pStream->m_nDecoded > 0 && startVorbis( pStream ) ) continue;
+			atomic_Store( &pStream->m_bEnded, 1 );
+			break;
+		}
+		consumeInput( pStream, nUsed );
+		bBusy = true;
+		if( nFrames <= 0 ) continue;
+
+		const float* pLeft = ppOutput[0];
+		const float* pRight = ppOutput[nChannels > 1 ? 1 : 0];
+		for( int i = 0; i < nFrames; i++ )
+		{
+			float* pFrame = &pStream->m_ring[((nWritten + i) & (AUDIO_STREAM_FRAMES - 1)) * 2];
+			pFrame[0] = pLeft[i];
+			pFrame[1] = pRight[i];
+		}
+		pStream->m_nDecoded += nFrames;
+		atomic_Store( &pStream->m_nWritten, nWritten + nFrames );
+	}
+	return bBusy;
+}
+
+static void decoderMain( void* pArg )
+{
+	trace_SetThreadName( "audio decoder" );
+	while( !atomic_Load( &s_nStop ) )
+	{
+		bool bBusy = false;
+		long nSounds = atomic_Load( &s_nSounds );
+		for( long i = 0; i < nSounds; i++ )
+		{
+			if( atomic_Load( &s_aSounds[i].m_nState ) == SLOT_LOADING )
+			{
+				decodeSound( &s_aSounds[i], (int) i + 1 );
+				bBusy = true;
+			}
+		}
+		for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+		{
+			AudioStream* pStream = &s_aStreams[i];
+			switch( atomic_Load( &pStream->m_nState ) )
+			{
+			case SLOT_LOADING:
+				openStream( pStream );
+				bBusy = true;
+				break;
+			case SLOT_READY:
+				if( fillStream( pStream ) ) bBusy = true;
+				break;
+			case SLOT_RELEASED:
+				closeStream( pStream );
+				atomic_Store( &pStream->m_nState, SLOT_FREE );
+				break;
+			}
+		}
+		if( !bBusy ) thread_Sleep( AUDIO_DECODER_SLEEP );
+	}
+
+	for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+		closeStream( &s_aStreams[i] );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Mixer
+//////////////////////////////////////////////////////////////////////
+
+// 16.16 step through a source at nRate for each output frame, scaled by
+// fPitch and capped at MIX_MAX_STEP.
+static unsigned int rateStep( int nRate, float fPitch )
+{
+	double fStep = (double) nRate * fPitch * 65536 / AUDIO_RATE;
+	if( fStep > MIX_MAX_STEP * 65536.0 ) fStep = MIX_MAX_STEP * 65536.0;
+	return fStep < 1 ? 1 : (unsigned int) fStep;
+}
+
+// Constant power panning.
+static void panGains( float fGain, float fPan, float* pLeft, float* pRight )
+{
+	fPan = fPan < -1 ? -1 : fPan > 1 ? 1 : fPan;
+	float fAngle = (fPan + 1) * 0.785398163f;
+	*pLeft = fGain * cosf( fAngle );
+	*pRight = fGain * sinf( fAngle );
+}
+
+static void releaseStream( AudioStream* pStream )
+{
+	pStream->m_bActive = false;
+	atomic_Store( &pStream->m_nState, SLOT_RELEASED );
+}
+
+static void fadeOutMusic()
+{
+	if( s_nMusic < 0 ) return;
+	s_aStreams[s_nMusic].m_fFadeStep = -1.0f / AUDIO_FADE_FRAMES;
+	s_nMusic = -1;
+}
+
+static AudioVoice* findVoice( int nHandle )
+{
+	for( int i = 0; i < s_nPlaying; i++ )
+	{
+		if( s_aVoices[s_anPlaying[i]].m_nHandle == nHandle ) return &s_aVoices[s_anPlaying[i]];
+	}
+	return NULL;
+}
+
+static void setVoice( AudioVoice* pVoice, const AudioCommand& cmd )
+{
+	pVoice->m_fGain = cmd.m_fGain;
+	pVoice->m_fPan = cmd.m_fPan;
+	pVoice->m_fPitch = cmd.m_fPitch > 0 ? cmd.m_fPitch : 1;
+}
+
+static void startVoice( const AudioCommand& cmd )
+{
+	if( cmd.m_nId < 1 || cmd.m_nId > AUDIO_MAX_SOUNDS ) return;
+
+	// a free voice, or else the one that has played longest.
+	int nVoice;
+	if( s_nFree > 0 )
+	{
+		nVoice = s_anFree[--s_nFree];
+		s_anPlaying[s_nPlaying++] = nVoice;
+	}
+	else
+	{
+		nVoice = s_anPlaying[0];
+		for( int i = 1; i < s_nPlaying; i++ )
+		{
+			if( s_aVoices[s_anPlaying[i]].m_nStarted < s_aVoices[nVoice].m_nStarted ) nVoice = s_anPlaying[i];
+		}
+		atomic_Add( &s_nStolen, 1 );
+	}
+
+	// it starts at full gain, for the attack; later changes are ramped.
+	AudioVoice* pVoice = &s_aVoices[nVoice];
+	pVoice->m_nHandle = cmd.m_nVoice;
+	pVoice->m_nSound = cmd.m_nId;
+	pVoice->m_nPos = 0;
+	pVoice->m_nFrac = 0;
+	pVoice->m_bStopping = false;
+	pVoice->m_nStarted = s_nPeriods;
+	setVoice( pVoice, cmd );
+	panGains( pVoice->m_fGain, pVoice->m_fPan, &pVoice->m_fLeft, &pVoice->m_fRight );
+}
+
+// Put the voice at nPlaying in s_anPlaying back on the free list.
+static void freeVoice( int nPlaying )
+{
+	s_anFree[s_nFree++] = s_anPlaying[nPlaying];
+	s_anPlaying[nPlaying] = s_anPlaying[--s_nPlaying];
+}
+
+static void runCommands()
+{
+	long nWritten = atomic_Load( &s_nCommandsWritten );
+	long nRead = s_nCommandsRead;
+	for( ; nRead != nWritten; nRead++ )
+	{
+		const AudioCommand& cmd = s_aCommands[nRead & (AUDIO_COMMANDS - 1)];
+		AudioVoice* pVoice;
+		switch( cmd.m_nType )
+		{
+		case CMD_PLAY_SOUND:
+			startVoice( cmd );
+			break;
+		case CMD_SET_VOICE:
+			pVoice = findVoice( cmd.m_nVoice );
+			if( pVoice ) setVoice( pVoice, cmd );
+			break;
+		case CMD_STOP_VOICE:
+			pVoice = findVoice( cmd.m_nVoice );
+			if( pVoice ) pVoice->m_bStopping = true;
+			break;
+		case CMD_PLAY_MUSIC:
+			fadeOutMusic();
+			s_nMusic = cmd.m_nId;
+			s_aStreams[s_nMusic].m_bActive = true;
+			s_aStreams[s_nMusic].m_nFrac = 0;
+			s_aStreams[s_nMusic].m_fFade = 1;
+			s_aStreams[s_nMusic].m_fFadeStep = 0;
+			s_aStreams[s_nMusic].m_fGain = s_fMusicGain;
+			break;
+		case CMD_STOP_MUSIC:
+			fadeOutMusic();
+			break;
+		case CMD_MUSIC_GAIN:
+			s_fMusicGain = cmd.m_fGain;
+			break;
+		case CMD_MASTER_GAIN:
+			s_fMasterGain = cmd.m_fGain;
+			break;
+		case CMD_RESAMPLER:
+			s_nFilter = cmd.m_nId;
+			break;
+		}
+	}
+	atomic_Store( &s_nCommandsRead, nRead );
+}
+
+// Add a voice into the mix, its gains ramped from where the last period
+// left them; false once it is done.
+static bool mixVoice( AudioVoice* pVoice, float* pMix, int nFrames )
+{
+	AudioSound& sound = s_aSounds[pVoice->m_nSound - 1];
+	long nState = atomic_Load( &sound.m_nState );
+	if( nState == SLOT_LOADING ) return !pVoice->m_bStopping;		// starts once decoded
+	if( nState != SLOT_READY ) return false;
+
+	float fLeft = 0, fRight = 0;
+	if( !pVoice->m_bStopping ) panGains( pVoice->m_fGain, pVoice->m_fPan, &fLeft, &fRight );
+
+	MixVoice voice;
+	voice.m_pSamples = &sound.m_samples[MIX_PAD * sound.m_nChannels];
+	voice.m_nChannels = sound.m_nChannels;
+	voice.m_nPos = pVoice->m_nPos;
+	voice.m_nFrac = pVoice->m_nFrac;
+	voice.m_nStep = rateStep( sound.m_nRate, pVoice->m_fPitch );
+	voice.m_fLeft = pVoice->m_fLeft;
+	voice.m_fRight = pVoice->m_fRight;
+	voice.m_fLeftStep = (fLeft - pVoice->m_fLeft) / nFrames;
+	voice.m_fRightStep = (fRight - pVoice->m_fRight) / nFrames;
+	int nPlay = mix_FramesBefore( voice, sound.m_nFrames - 1, nFrames );
+	mix_Voice( pMix, nPlay, &voice, s_nFilter );
+
+	pVoice->m_nPos = voice.m_nPos;
+	pVoice->m_nFrac = voice.m_nFrac;
+	pVoice->m_fLeft = fLeft;
+	pVoice->m_fRight = fRight;
+	return nPlay == nFrames && !pVoice->m_bStopping;
+}
+
+// Add a music stream into the mix. The frames its taps reach are copied
+// out of the ring into a window, so it goes through the same loops as a
+// voice, at the music gain times its fade.
+static void mixStream( AudioStream* pStream, float* pMix, int nFrames )
+{
+	static float s_aWindow[AUDIO_WINDOW_FRAMES * 2];
+	long nState = atomic_Load( &pStream->m_nState );
+	if( nState == SLOT_LOADING ) return;
+	if( nState != SLOT_READY )
+	{
+		if( s_nMusic == pStream - s_aStreams ) s_nMusic = -1;
+		releaseStream( pStream );
+		return;
+	}
+
+	// read the end flag first, so the frames written before it are seen.
+	bool bEnded = atomic_Load( &pStream->m_bEnded ) != 0;
+	long nWritten = atomic_Load( &pStream->m_nWritten );
+	long nFirst = pStream->m_nRead - (MIX_PAD - 1);		// the window's first frame
+
+	float fFade = pStream->m_fFade + pStream->m_fFadeStep * nFrames;
+	if( fFade < 0 ) fFade = 0;
+	float fGain = s_fMusicGain * fFade;
+	MixVoice voice;
+	voice.m_pSamples = s_aWindow;
+	voice.m_nChannels = 2;
+	voice.m_nPos = MIX_PAD - 1;
+	voice.m_nFrac = pStream->m_nFrac;
+	voice.m_nStep = rateStep( pStream->m_nRate, 1 );
+	voice.m_fLeft = voice.m_fRight = pStream->m_fGain;
+	voice.m_fLeftStep = voice.m_fRightStep = (fGain - pStream->m_fGain) / nFrames;
+
+	// until the stream ends, a frame plays once its last tap is decoded.
+	long nLast = bEnded ? nWritten - 1 : nWritten - 1 - MIX_PAD;
+	int nPlay = mix_FramesBefore( voice, nLast - nFirst, nFrames );
+	if( nPlay > 0 )
+	{
+		unsigned long long nEnd = voice.m_nFrac + (unsigned long long) voice.m_nStep * (nPlay - 1);
+		long nWindow = voice.m_nPos + (long)(nEnd >> 16) + MIX_PAD + 1;
+		for( long i = 0; i < nWindow; i++ )
+		{
+			long nFrame = nFirst + i;
+			float* pFrame = &s_aWindow[i * 2];
+			if( nFrame < 0 || nFrame >= nWritten )
+			{
+				pFrame[0] = pFrame[1] = 0;
+				continue;
+			}
+			const float* pRing = &pStream->m_ring[(nFrame & (AUDIO_STREAM_FRAMES - 1)) * 2];
+			pFrame[0] = pRing[0];
+			pFrame[1] = pRing[1];
+		}
+		mix_Voice( pMix, nPlay, &voice, s_nFilter );
+	}
+
+	pStream->m_nFrac = voice.m_nFrac;
+	pStream->m_fFade = fFade;
+	pStream->m_fGain = fGain;
+	atomic_Store( &pStream->m_nRead, nFirst + voice.m_nPos );
+	if( nPlay < nFrames )
+	{
+		if( bEnded )
+		{
+			if( s_nMusic == pStream - s_aStreams ) s_nMusic = -1;
+			releaseStream( pStream );
+			return;
+		}
+		atomic_Add( &s_nStarved, 1 );
+	}
+	if( fFade <= 0 ) releaseStream( pStream );
+}
+
+static void mixPeriod( float* pMix, short* pOut )
+{
+	TRACE_ZONE( "mix", "audio" );
+	runCommands();
+
+	memset( pMix, 0, AUDIO_PERIOD * 2 * sizeof(float) );
+	for( int i = 0; i < s_nPlaying; )
+	{
+		if( mixVoice( &s_aVoices[s_anPlaying[i]], pMix, AUDIO_PERIOD ) ) i++;
+		else freeVoice( i );
+	}
+	for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+	{
+		if( s_aStreams[i].m_bActive ) mixStream( &s_aStreams[i], pMix, AUDIO_PERIOD );
+	}
+	atomic_Store( &s_nVoicesPlaying, s_nPlaying );
+
+	mix_ToShorts( pMix, pOut, AUDIO_PERIOD * 2, s_fMasterGain );
+}
+
+// Publish how long a period took to mix.
+static void measureMix( double fSeconds )
+{
+	long nMicros = (long)(fSeconds * 1000000);
+	s_fMixTotal += fSeconds;
+	atomic_Store( &s_nMixLast, nMicros );
+	atomic_Store( &s_nMixMean, (long)(s_fMixTotal * 1000000 / (s_nPeriods + 1)) );
+	if( nMicros > s_nMixMax ) atomic_Store( &s_nMixMax, nMicros );
+	if( fSeconds > (double) AUDIO_PERIOD / AUDIO_RATE ) atomic_Add( &s_nOverBudget, 1 );
+}
+
+static void mixerMain( void* pArg )
+{
+	trace_SetThreadName( "audio mixer" );
+	static float s_aMix[AUDIO_PERIOD * 2];
+	static short s_aOut[AUDIO_PERIOD * 2];
+	while( !atomic_Load( &s_nStop ) )
+	{
+		double fStart = timer_Now();
+		mixPeriod( s_aMix, s_aOut );
+		measureMix( timer_Now() - fStart );
+		if( !s_pSink->Write( s_aOut, AUDIO_PERIOD ) ) break;
+		atomic_Add( &s_nPeriods, 1 );
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Main thread
+//////////////////////////////////////////////////////////////////////
+
+// The next command to fill in and publish, or NULL if the queue is full.
+static AudioCommand* claimCommand( int nType )
+{
+	if( !s_pMixer ) return NULL;
+	long nWritten = s_nCommandsWritten;
+	if( nWritten - atomic_Load( &s_nCommandsRead ) >= AUDIO_COMMANDS )
+	{
+		atomic_Add( &s_nDropped, 1 );
+		return NULL;
+	}
+	AudioCommand* pCmd = &s_aCommands[nWritten & (AUDIO_COMMANDS - 1)];
+	pCmd->m_nType = nType;
+	pCmd->m_nId = 0;
+	pCmd->m_nVoice = 0;
+	pCmd->m_fGain = 1;
+	pCmd->m_fPan = 0;
+	pCmd->m_fPitch = 1;
+	return pCmd;
+}
+
+static void publishCommand()
+{
+	atomic_Store( &s_nCommandsWritten, s_nCommandsWritten + 1 );
+}
+
+static void resetState()
+{
+	for( int i = 0; i < AUDIO_MAX_SOUNDS; i++ )
+	{
+		AudioSound* pSound = &s_aSounds[i];
+		pSound->m_nState = SLOT_FREE;
+		std::vector<unsigned char>().swap( pSound->m_file );
+		std::vector<float>().swap( pSound->m_samples );
+	}
+	s_nSounds = 0;
+	for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+	{
+		AudioStream* pStream = &s_aStreams[i];
+		pStream->m_nState = SLOT_FREE;
+		pStream->m_pFile = NULL;
+		pStream->m_pVorbis = NULL;
+		pStream->m_bActive = false;
+	}
+	memset( s_aVoices, 0, sizeof(s_aVoices) );
+	for( int i = 0; i < AUDIO_MAX_VOICES; i++ )
+		s_anFree[i] = AUDIO_MAX_VOICES - 1 - i;
+	s_nFree = AUDIO_MAX_VOICES;
+	s_nPlaying = 0;
+	s_nNextVoice = 1;
+	s_nCommandsWritten = s_nCommandsRead = 0;
+	s_nMusic = -1;
+	s_fMusicGain = s_fMasterGain = 1;
+	s_nFilter = MIX_POLYPHASE;
+	s_fMixTotal = 0;
+	s_nPeriods = s_nStarved = s_nDropped = s_nVoicesPlaying = s_nStolen = 0;
+	s_nMixLast = s_nMixMean = s_nMixMax = s_nOverBudget = 0;
+}
+
+bool audio_Open( const char* szSink )
+{
+	if( s_pMixer ) audio_Close();
+
+	AudioSink* pSink = NULL;
+	if( !szSink || !strcmp( szSink, "alsa" ) ) pSink = audiosink_OpenAlsa( AUDIO_RATE, AUDIO_LATENCY );
+	if( (!szSink && !pSink) || (szSink && !strcmp( szSink, "null" )) ) pSink = audiosink_OpenNull( AUDIO_RATE );
+	else if( szSink && !strncmp( szSink, "wav:", 4 ) ) pSink = audiosink_OpenWav( szSink + 4, AUDIO_RATE );
+	if( !pSink )
+	{
+		log_Writef( LOG_WARN, "Audio: no sink, running silent" );
+		return false;
+	}
+
+	resetState();
+	for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+		s_aStreams[i].m_ring.assign( AUDIO_STREAM_FRAMES * 2, 0.0f );
+	mix_Init();
+	mix_SetLevel( qsgSpanCpuLevel() );
+	vorbis_InstallSimd( qsgSpanCpuLevel() );
+	s_pSink = pSink;
+	atomic_Store( &s_nStop, 0 );
+	s_pDecoder = thread_Start( decoderMain, NULL );
+	s_pMixer = thread_Start( mixerMain, NULL );
+	if( !s_pDecoder || !s_pMixer )
+	{
+		log_Write( LOG_ERROR, "Audio: cannot start the audio threads" );
+		audio_Close();
+		return false;
+	}
+	log_Logf( "Audio: %d Hz stereo, %d frame periods, %d voices, mixer level %d, decoder level %d",
+		AUDIO_RATE, AUDIO_PERIOD, AUDIO_MAX_VOICES, mix_Level(), vorbis_SimdLevel() );
+	return true;
+}
+
+void audio_Close()
+{
+	atomic_Store( &s_nStop, 1 );
+	if( s_pMixer ) thread_Join( s_pMixer );
+	if( s_pDecoder ) thread_Join( s_pDecoder );
+	s_pMixer = NULL;
+	s_pDecoder = NULL;
+	if( s_pSink )
+	{
+		AudioStats stats;
+		audio_GetStats( &stats );
+		log_Logf( "Audio: %ld periods, %ld underruns, %ld starved, %ld commands dropped, %ld voices stolen",
+			stats.m_nPeriods, stats.m_nUnderruns, stats.m_nStarved, stats.m_nDropped, stats.m_nStolen );
+		log_Logf( "Audio: mixing took %ld us mean, %ld us max of a %ld us budget; %ld periods over",
+			stats.m_nMixMean, stats.m_nMixMax, stats.m_nBudget, stats.m_nOverBudget );
+	}
+	delete s_pSink;
+	s_pSink = NULL;
+	resetState();
+	for( int i = 0; i < AUDIO_MAX_STREAMS; i++ )
+		std::vector<float>().swap( s_aStreams[i].m_ring );
+}
+
+int audio_LoadSound( const unsigned char* pData, int nSize )
+{
+	if( !s_pMixer || nSize <= 0 ) return 0;
+	long nSound = s_nSounds;
+	if( nSound >= AUDIO_MAX_SOUNDS )
+	{
+		log_Writef( LOG_WARN, "Audio: more than %d sounds", AUDIO_MAX_SOUNDS );
+		return 0;
+	}
+	AudioSound* pSound = &s_aSounds[nSound];
+	pSound->m_file.assign( pData, pData + nSize );
+	pSound->m_nState = SLOT_LOADING;
+	atomic_Store( &s_nSounds, nSound + 1 );
+	return (int) nSound + 1;
+}
+
+int audio_PlaySound( int nSound, float fGain, float fPan, float fPitch )
+{
+	if( nSound <= 0 ) return 0;
+	AudioCommand* pCmd = claimCommand( CMD_PLAY_SOUND );
+	if( !pCmd ) return 0;
+	int nVoice = s_nNextVoice;
+	s_nNextVoice = nVoice == 0x7fffffff ? 1 : nVoice + 1;
+	pCmd->m_nId = nSound;
+	pCmd->m_nVoice = nVoice;
+	pCmd->m_fGain = fGain;
+	pCmd->m_fPan = fPan;
+	pCmd->m_fPitch = fPitch;
+	publishCommand();
+	return nVoice;
+}
+
+void audio_SetVoice( int nVoice, float fGain, float fPan, float fPitch )
+{
+	if( nVoice <= 0 ) return;
+	AudioCommand* pCmd = claimCommand( CMD_SET_VOICE );
+	if( !pCmd ) return;
+	pCmd->m_nVoice = nVoice;
+	pCmd->m_fGain = fGain;
+	pCmd->m_fPan = fPan;
+	pCmd->m_fPitch = fPitch;
+	publishCommand();
+}
+
+void audio_StopVoice( int nVoice )
+{
+	if( nVoice <= 0 ) return;
+	AudioCommand* pCmd = claimCommand( CMD_STOP_VOICE );
+	if( !pCmd ) return;
+	pCmd->m_nVoice = nVoice;
+	publishCommand();
+}
+
+void audio_PlayMusic( const char* szFilename, bool bLoop )
+{
+	AudioCommand* pCmd = claimCommand( CMD_PLAY_MUSIC );
+	if( !pCmd ) return;
+	int nSlot = 0;
+	while( nSlot < AUDIO_MAX_STREAMS && atomic_Load( &s_aStreams[nSlot].m_nState ) != SLOT_FREE ) nSlot++;
+	if( nSlot == AUDIO_MAX_STREAMS )
+	{
+		log_Writef( LOG_WARN, "Audio: no stream free for %s", szFilename );
+		return;
+	}
+
+	AudioStream* pStream = &s_aStreams[nSlot];
+	pStream->m_strFilename = szFilename;
+	pStream->m_bLoop = bLoop;
+	pStream->m_nWritten = pStream->m_nRead = 0;
+	pStream->m_bEnded = 0;
+	atomic_Store( &pStream->m_nState, SLOT_LOADING );
+	pCmd->m_nId = nSlot;
+	publishCommand();
+}
+
+void audio_StopMusic()
+{
+	if( claimCommand( CMD_STOP_MUSIC ) ) publishCommand();
+}
+
+void audio_SetMusicGain( float fGain )
+{
+	AudioCommand* pCmd = claimCommand( CMD_MUSIC_GAIN );
+	if( !pCmd ) return;
+	pCmd->m_fGain = fGain;
+	publishCommand();
+}
+
+void audio_SetMasterGain( float fGain )
+{
+	AudioCommand* pCmd = claimCommand( CMD_MASTER_GAIN );
+	if( !pCmd ) return;
+	pCmd->m_fGain = fGain;
+	publishCommand();
+}
+
+void audio_SetResampler( int nFilter )
+{
+	AudioCommand* pCmd = claimCommand( CMD_RESAMPLER );
+	if( !pCmd ) return;
+	pCmd->m_nId = nFilter == MIX_LINEAR ? MIX_LINEAR : MIX_POLYPHASE;
+	publishCommand();
+}
+
+void audio_GetStats( AudioStats* pStats )
+{
+	pStats->m_nPeriods = atomic_Load( &s_nPeriods );
+	pStats->m_nUnderruns = s_pSink ? s_pSink->Underruns() : 0;
+	pStats->m_nStarved = atomic_Load( &s_nStarved );
+	pStats->m_nDropped = atomic_Load( &s_nDropped );
+	pStats->m_nVoices = atomic_Load( &s_nVoicesPlaying );
+	pStats->m_nSounds = s_nSounds;
+	pStats->m_nStolen = atomic_Load( &s_nStolen );
+	pStats->m_nMixLast = atomic_Load( &s_nMixLast );
+	pStats->m_nMixMean = atomic_Load( &s_nMixMean );
+	pStats->m_nMixMax = atomic_Load( &s_nMixMax );
+	pStats->m_nBudget = (long)((long long) AUDIO_PERIOD * 1000000 / AUDIO_RATE);
+	pStats->m_nOverBudget = atomic_Load( &s_nOverBudget );
+}
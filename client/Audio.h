@@ -0,0 +1,82 @@
+// Audio.h: sound effects and streamed music
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_AUDIO_H
+#define FGM_AUDIO_H
+
+// Ogg Vorbis sounds and music, mixed on a thread of their own into 16 bit
+// stereo at AUDIO_RATE and written to a sink (AudioSink.h). A second
+// thread decodes with stb_vorbis: sounds are decoded whole when they are
+// loaded, and music is streamed from its file a few kilobytes at a time
+// through the pushdata API, about a second ahead of the mixer.
+//
+// The calls below are for the main thread, and none of them decode,
+// read files or wait. Playing, stopping and gain changes go to the mixer
+// on a lock-free queue; sounds and music streams change hands between
+// the threads by atomically changing the state of their slot. Without
+// audio_Open they do nothing.
+//
+// Voices come from a pool allocated once, so playing a sound allocates
+// nothing on either thread; when every voice is busy the one playing
+// longest is taken. Each has its own gain, pan and pitch, and changes to
+// them are ramped over a period so they do not click. Voices and music
+// are resampled linearly or through a polyphase filter (AudioMix.h).
+
+#define AUDIO_RATE 44100
+
+// Start the mixer and decoder with a sink: "alsa", "null" or
+// "wav:filename". NULL tries ALSA and falls back to null.
+bool audio_Open( const char* szSink );
+
+// Stop both threads and forget every sound.
+void audio_Close();
+
+// A sound from the bytes of an Ogg Vorbis file, which are copied and
+// decoded on the decoder thread; a sound played before then starts as
+// soon as it is ready. Returns its id, or 0 if audio is not open or the
+// sounds are all in use. Sounds last until audio_Close.
+int audio_LoadSound( const unsigned char* pData, int nSize );
+
+// Play a sound once. fPan runs from -1 (left) to 1 (right), and fPitch
+// scales its rate (2 is an octave up). Returns a voice handle for the
+// calls below, or 0 if audio is not open or the command queue is full.
+int audio_PlaySound( int nSound, float fGain, float fPan, float fPitch );
+
+// Change or stop a voice while it plays; nothing once it has finished.
+void audio_SetVoice( int nVoice, float fGain, float fPan, float fPitch );
+void audio_StopVoice( int nVoice );
+
+// Stream an Ogg Vorbis file as music in place of what is playing, which
+// fades out; with bLoop it starts again at its end.
+void audio_PlayMusic( const char* szFilename, bool bLoop );
+void audio_StopMusic();
+
+void audio_SetMusicGain( float fGain );
+void audio_SetMasterGain( float fGain );
+
+// MIX_LINEAR or MIX_POLYPHASE (the default), for sounds and music.
+void audio_SetResampler( int nFilter );
+
+struct AudioStats
+{
+	long m_nPeriods;		// periods mixed and written to the sink
+	long m_nUnderruns;		// times the sink ran dry
+	long m_nStarved;		// periods the music ran out of decoded frames
+	long m_nDropped;		// commands dropped because the queue was full
+	long m_nVoices;			// sounds playing in the last period
+	long m_nSounds;			// sounds loaded
+	long m_nStolen;			// voices taken from a sound still playing
+
+	// microseconds taken to mix a period, and the budget they must stay
+	// under: the time a period takes to play.
+	long m_nMixLast;
+	long m_nMixMean;
+	long m_nMixMax;
+	long m_nBudget;
+	long m_nOverBudget;		// periods that took longer to mix than to play
+};
+
+void audio_GetStats( AudioStats* pStats );
+
+#endif // FGM_AUDIO_H
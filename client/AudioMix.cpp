@@ -0,0 +1,403 @@
+// AudioMix.cpp: the inner loops of the audio mixer
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include "AudioMix.h"
+#include "QSGSoftwareSpans.h"
+
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define MIX_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+#define MIX_TAPS (MIX_PAD * 2)
+
+// Taps for each phase, and the same again with each tap twice over to
+// run across interleaved left, right frames.
+static float s_aTaps[MIX_PHASES][MIX_TAPS];
+static float s_aPairs[MIX_PHASES][MIX_TAPS * 2];
+
+static int s_nLevel = QSGSpanPortable;
+
+typedef void (*MixFunc)( float* pMix, int nFrames, MixVoice* pVoice );
+
+
+//////////////////////////////////////////////////////////////////////
+// Polyphase table
+//////////////////////////////////////////////////////////////////////
+
+// A sinc cut off at the output's Nyquist frequency under a Blackman
+// window, with each phase scaled to unity gain. The cut off does not move
+// with the step, so sources played more than an octave up alias a little.
+void mix_Init( void )
+{
+	const double fPi = 3.14159265358979323846;
+	for( int p = 0; p < MIX_PHASES; p++ )
+	{
+		double aTaps[MIX_TAPS];
+		double fSum = 0;
+		for( int k = 0; k < MIX_TAPS; k++ )
+		{
+			// distance from the position to the tap's frame.
+			double x = (k - (MIX_PAD - 1)) - (double) p / MIX_PHASES;
+			double fSinc = x == 0 ? 1 : sin( fPi * x ) / (fPi * x);
+			double w = x / MIX_PAD;
+			double fWindow = 0.42 + 0.5 * cos( fPi * w ) + 0.08 * cos( 2 * fPi * w );
+			aTaps[k] = fSinc * fWindow;
+			fSum += aTaps[k];
+		}
+		for( int k = 0; k < MIX_TAPS; k++ )
+		{
+			s_aTaps[p][k] = (float)(aTaps[k] / fSum);
+			s_aPairs[p][k * 2] = s_aPairs[p][k * 2 + 1] = s_aTaps[p][k];
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Portable loops
+//////////////////////////////////////////////////////////////////////
+
+// The SSE2 loops do the same sums in the same order, so these give the
+// very same samples; keep the two in step.
+
+#define MIX_ADVANCE( nPos, nFrac, nStep ) \
+	nFrac += nStep; \
+	nPos += nFrac >> 16; \
+	nFrac &= 0xffff
+
+static void linearMono( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + nPos;
+		float t = nFrac * (1.0f / 65536);
+		float x = s[0] + (s[1] - s[0]) * t;
+		pMix[i * 2] += x * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+		pMix[i * 2 + 1] += x * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+static void linearStereo( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + nPos * 2;
+		float t = nFrac * (1.0f / 65536);
+		pMix[i * 2] += (s[0] + (s[2] - s[0]) * t) * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+		pMix[i * 2 + 1] += (s[1] + (s[3] - s[1]) * t) * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+static void polyphaseMono( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + nPos - (MIX_PAD - 1);
+		const float* c = s_aTaps[nFrac >> 8];
+		float x = ((s[0] * c[0] + s[4] * c[4]) + (s[2] * c[2] + s[6] * c[6])) +
+			((s[1] * c[1] + s[5] * c[5]) + (s[3] * c[3] + s[7] * c[7]));
+		pMix[i * 2] += x * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+		pMix[i * 2 + 1] += x * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+static void polyphaseStereo( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + (nPos - (MIX_PAD - 1)) * 2;
+		const float* c = s_aTaps[nFrac >> 8];
+		for( int n = 0; n < 2; n++, s++ )
+		{
+			float x = ((s[0] * c[0] + s[4] * c[2]) + (s[8] * c[4] + s[12] * c[6])) +
+				((s[2] * c[1] + s[6] * c[3]) + (s[10] * c[5] + s[14] * c[7]));
+			if( n == 0 ) pMix[i * 2] += x * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+			else pMix[i * 2 + 1] += x * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		}
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+// Rounds to nearest even as cvtps2dq does; good while |x| < 2^22.
+static inline float roundEven( float x )
+{
+	return (x + 12582912.0f) - 12582912.0f;
+}
+
+static void toShorts( const float* pMix, short* pOut, int nSamples, float fGain )
+{
+	for( int i = 0; i < nSamples; i++ )
+	{
+		float x = pMix[i] * fGain * 32767;
+		x = x < -32768 ? -32768 : x > 32767 ? 32767 : x;
+		pOut[i] = (short) roundEven( x );
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SSE2 loops
+//////////////////////////////////////////////////////////////////////
+
+#ifdef MIX_SIMD_X86
+
+// Gains for frame i in the low two lanes, and for i + 1 in the high two.
+static inline __m128 gainsAt( const MixVoice* pVoice, __m128 index )
+{
+	__m128 base = _mm_setr_ps( pVoice->m_fLeft, pVoice->m_fRight, pVoice->m_fLeft, pVoice->m_fRight );
+	__m128 step = _mm_setr_ps( pVoice->m_fLeftStep, pVoice->m_fRightStep, pVoice->m_fLeftStep, pVoice->m_fRightStep );
+	return _mm_add_ps( base, _mm_mul_ps( step, index ) );
+}
+
+// Two output frames a vector: left, right for each, from the two source
+// frames either side of each position.
+static void linearMonoSSE2( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	__m128 index = _mm_setr_ps( 0, 0, 1, 1 );
+	const __m128 two = _mm_set1_ps( 2 );
+	int i = 0;
+	for( ; i + 2 <= nFrames; i += 2 )
+	{
+		const float* a = pSamples + nPos;
+		float ta = nFrac * (1.0f / 65536);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+		const float* b = pSamples + nPos;
+		float tb = nFrac * (1.0f / 65536);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+
+		__m128 lo = _mm_setr_ps( a[0], a[0], b[0], b[0] );
+		__m128 hi = _mm_setr_ps( a[1], a[1], b[1], b[1] );
+		__m128 t = _mm_setr_ps( ta, ta, tb, tb );
+		__m128 x = _mm_add_ps( lo, _mm_mul_ps( _mm_sub_ps( hi, lo ), t ) );
+		__m128 mix = _mm_loadu_ps( pMix + i * 2 );
+		_mm_storeu_ps( pMix + i * 2, _mm_add_ps( mix, _mm_mul_ps( x, gainsAt( pVoice, index ) ) ) );
+		index = _mm_add_ps( index, two );
+	}
+
+	if( i < nFrames )
+	{
+		float* p = pMix + i * 2;
+		const float* s = pSamples + nPos;
+		float t = nFrac * (1.0f / 65536);
+		float x = s[0] + (s[1] - s[0]) * t;
+		p[0] += x * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+		p[1] += x * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+static void linearStereoSSE2( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	__m128 index = _mm_setr_ps( 0, 0, 1, 1 );
+	const __m128 two = _mm_set1_ps( 2 );
+	int i = 0;
+	for( ; i + 2 <= nFrames; i += 2 )
+	{
+		// each load is a frame and the one after it.
+		__m128 a = _mm_loadu_ps( pSamples + nPos * 2 );
+		float ta = nFrac * (1.0f / 65536);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+		__m128 b = _mm_loadu_ps( pSamples + nPos * 2 );
+		float tb = nFrac * (1.0f / 65536);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+
+		__m128 lo = _mm_shuffle_ps( a, b, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+		__m128 hi = _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+		__m128 t = _mm_setr_ps( ta, ta, tb, tb );
+		__m128 x = _mm_add_ps( lo, _mm_mul_ps( _mm_sub_ps( hi, lo ), t ) );
+		__m128 mix = _mm_loadu_ps( pMix + i * 2 );
+		_mm_storeu_ps( pMix + i * 2, _mm_add_ps( mix, _mm_mul_ps( x, gainsAt( pVoice, index ) ) ) );
+		index = _mm_add_ps( index, two );
+	}
+	if( i < nFrames )
+	{
+		float* p = pMix + i * 2;
+		const float* s = pSamples + nPos * 2;
+		float t = nFrac * (1.0f / 65536);
+		p[0] += (s[0] + (s[2] - s[0]) * t) * (pVoice->m_fLeft + pVoice->m_fLeftStep * (float) i);
+		p[1] += (s[1] + (s[3] - s[1]) * t) * (pVoice->m_fRight + pVoice->m_fRightStep * (float) i);
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+// One output frame at a time, the taps in two vectors.
+static void polyphaseMonoSSE2( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + nPos - (MIX_PAD - 1);
+		const float* c = s_aTaps[nFrac >> 8];
+		__m128 acc = _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( s ), _mm_loadu_ps( c ) ),
+			_mm_mul_ps( _mm_loadu_ps( s + 4 ), _mm_loadu_ps( c + 4 ) ) );
+		acc = _mm_add_ps( acc, _mm_movehl_ps( acc, acc ) );
+		acc = _mm_add_ss( acc, _mm_shuffle_ps( acc, acc, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+		__m128 x = _mm_shuffle_ps( acc, acc, _MM_SHUFFLE( 0, 0, 0, 0 ) );
+
+		float* p = pMix + i * 2;
+		__m128 mix = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) p );
+		mix = _mm_add_ps( mix, _mm_mul_ps( x, gainsAt( pVoice, _mm_set1_ps( (float) i ) ) ) );
+		_mm_storel_pi( (__m64*) p, mix );
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+// One output frame at a time, both channels' taps together: the four
+// vectors of interleaved frames against the taps doubled up leave even
+// taps' sums in the low lanes and odd taps' in the high.
+static void polyphaseStereoSSE2( float* pMix, int nFrames, MixVoice* pVoice )
+{
+	const float* pSamples = pVoice->m_pSamples;
+	long nPos = pVoice->m_nPos;
+	unsigned int nFrac = pVoice->m_nFrac;
+	for( int i = 0; i < nFrames; i++ )
+	{
+		const float* s = pSamples + (nPos - (MIX_PAD - 1)) * 2;
+		const float* c = s_aPairs[nFrac >> 8];
+		__m128 acc = _mm_add_ps(
+			_mm_add_ps( _mm_mul_ps( _mm_loadu_ps( s ), _mm_loadu_ps( c ) ),
+				_mm_mul_ps( _mm_loadu_ps( s + 4 ), _mm_loadu_ps( c + 4 ) ) ),
+			_mm_add_ps( _mm_mul_ps( _mm_loadu_ps( s + 8 ), _mm_loadu_ps( c + 8 ) ),
+				_mm_mul_ps( _mm_loadu_ps( s + 12 ), _mm_loadu_ps( c + 12 ) ) ) );
+		__m128 x = _mm_add_ps( acc, _mm_movehl_ps( acc, acc ) );
+
+		float* p = pMix + i * 2;
+		__m128 mix = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) p );
+		mix = _mm_add_ps( mix, _mm_mul_ps( x, gainsAt( pVoice, _mm_set1_ps( (float) i ) ) ) );
+		_mm_storel_pi( (__m64*) p, mix );
+		MIX_ADVANCE( nPos, nFrac, pVoice->m_nStep );
+	}
+	pVoice->m_nPos = nPos;
+	pVoice->m_nFrac = nFrac;
+}
+
+// Eight samples at a time, saturated to 16 bits by the pack.
+static void toShortsSSE2( const float* pMix, short* pOut, int nSamples, float fGain )
+{
+	const __m128 gain = _mm_set1_ps( fGain );
+	const __m128 scale = _mm_set1_ps( 32767 );
+	const __m128 lo = _mm_set1_ps( -32768 );
+	const __m128 hi = _mm_set1_ps( 32767 );
+	int i = 0;
+	for( ; i + 8 <= nSamples; i += 8 )
+	{
+		__m128 a = _mm_mul_ps( _mm_mul_ps( _mm_loadu_ps( pMix + i ), gain ), scale );
+		__m128 b = _mm_mul_ps( _mm_mul_ps( _mm_loadu_ps( pMix + i + 4 ), gain ), scale );
+		a = _mm_min_ps( _mm_max_ps( a, lo ), hi );
+		b = _mm_min_ps( _mm_max_ps( b, lo ), hi );
+		__m128i n = _mm_packs_epi32( _mm_cvtps_epi32( a ), _mm_cvtps_epi32( b ) );
+		_mm_storeu_si128( (__m128i*)(pOut + i), n );
+	}
+	toShorts( pMix + i, pOut + i, nSamples - i, fGain );
+}
+
+#endif // MIX_SIMD_X86
+
+
+//////////////////////////////////////////////////////////////////////
+// Choosing loops
+//////////////////////////////////////////////////////////////////////
+
+void mix_Voice( float* pMix, int nFrames, MixVoice* pVoice, int nFilter )
+{
+	static const MixFunc s_aPortable[MIX_FILTERS][2] = {
+		{ linearMono, linearStereo },
+		{ polyphaseMono, polyphaseStereo }
+	};
+#ifdef MIX_SIMD_X86
+	static const MixFunc s_aSSE2[MIX_FILTERS][2] = {
+		{ linearMonoSSE2, linearStereoSSE2 },
+		{ polyphaseMonoSSE2, polyphaseStereoSSE2 }
+	};
+#endif
+	if( nFrames <= 0 ) return;
+	int nChannel = pVoice->m_nChannels > 1 ? 1 : 0;
+	nFilter = nFilter == MIX_POLYPHASE ? MIX_POLYPHASE : MIX_LINEAR;
+#ifdef MIX_SIMD_X86
+	if( s_nLevel >= QSGSpanSSE2 )
+	{
+		s_aSSE2[nFilter][nChannel]( pMix, nFrames, pVoice );
+		return;
+	}
+#endif
+	s_aPortable[nFilter][nChannel]( pMix, nFrames, pVoice );
+}
+
+int mix_FramesBefore( const MixVoice& voice, long nLast, int nFrames )
+{
+	if( nLast < voice.m_nPos ) return 0;
+	if( !voice.m_nStep ) return nFrames;
+
+	// frames whose position is below nLast + 1.
+	unsigned long long nEnd = (unsigned long long)(nLast - voice.m_nPos + 1) << 16;
+	unsigned long long n = (nEnd - voice.m_nFrac - 1) / voice.m_nStep + 1;
+	return n < (unsigned long long) nFrames ? (int) n : nFrames;
+}
+
+void mix_ToShorts( const float* pMix, short* pOut, int nSamples, float fGain )
+{
+#ifdef MIX_SIMD_X86
+	if( s_nLevel >= QSGSpanSSE2 )
+	{
+		toShortsSSE2( pMix, pOut, nSamples, fGain );
+		return;
+	}
+#endif
+	toShorts( pMix, pOut, nSamples, fGain );
+}
+
+int mix_SetLevel( int nLevel )
+{
+	if( nLevel > qsgSpanCpuLevel() ) nLevel = qsgSpanCpuLevel();
+	if( nLevel < QSGSpanPortable ) nLevel = QSGSpanPortable;
+	s_nLevel = nLevel;
+	return nLevel;
+}
+
+int mix_Level( void )
+{
+	return s_nLevel;
+}
@@ -0,0 +1,66 @@
+// AudioMix.h: the inner loops of the audio mixer
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_AUDIOMIX_H
+#define FGM_AUDIOMIX_H
+
+// Voices are resampled into a block of interleaved left, right floats,
+// either linearly or through an 8 tap windowed sinc with MIX_PHASES
+// phases (polyphase), and added to what is there. The SSE2 loops work on
+// the interleaved frames directly: two output frames a vector for linear
+// resampling, and the taps of both channels at once for polyphase.
+//
+// Levels are those of the software span loops (QSGSpanLevel), capped at
+// what qsgSpanCpuLevel() finds the CPU supports; every level from SSE2
+// up uses the SSE2 loops. Each level mixes exactly the same samples, so
+// the portable loops can be used to check the others.
+
+// Frames a source must have readable either side of those played: the
+// taps run from MIX_PAD - 1 frames before the position to MIX_PAD after.
+#define MIX_PAD 4
+
+#define MIX_PHASES 256
+
+// Steps are capped at this many source frames per output frame.
+#define MIX_MAX_STEP 8
+
+enum MixFilter
+{
+	MIX_LINEAR,
+	MIX_POLYPHASE,
+	MIX_FILTERS
+};
+
+// A voice as the loops see it.
+struct MixVoice
+{
+	const float* m_pSamples;		// frame 0 of the source, interleaved
+	int m_nChannels;				// 1 or 2
+	long m_nPos;					// frame, and 16.16 fraction past it
+	unsigned int m_nFrac;
+	unsigned int m_nStep;			// 16.16 source frames per output frame
+	float m_fLeft;					// gains at the first output frame,
+	float m_fRight;
+	float m_fLeftStep;				// and added for each frame after
+	float m_fRightStep;
+};
+
+// Build the polyphase table; call once before mixing.
+void mix_Init( void );
+
+// Add nFrames frames of the voice into pMix, advancing its position.
+void mix_Voice( float* pMix, int nFrames, MixVoice* pVoice, int nFilter );
+
+// How many of nFrames output frames the voice can play before its
+// position passes frame nLast.
+int mix_FramesBefore( const MixVoice& voice, long nLast, int nFrames );
+
+// Scale interleaved samples by fGain into 16 bits, rounded to nearest
+// (even on ties) and clamped.
+void mix_ToShorts( const float* pMix, short* pOut, int nSamples, float fGain );
+
+int mix_SetLevel( int nLevel );		// returns the level set
+int mix_Level( void );
+
+#endif // FGM_AUDIOMIX_H
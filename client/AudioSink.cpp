@@ -0,0 +1,261 @@
+// AudioSink.cpp: where the mixed audio goes
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include "AudioSink.h"
+#include "Logger.h"
+#include "Thread.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef WINDOWS
+#include <dlfcn.h>
+#endif
+
+// How far ahead of the clock the null and WAV sinks let the mixer get,
+// in seconds; about what a device buffers.
+#define AUDIOSINK_AHEAD 0.05
+
+
+//////////////////////////////////////////////////////////////////////
+// Clock pacing
+//////////////////////////////////////////////////////////////////////
+
+// Sleeps in Write until the frames written so far are due.
+class PacedSink : public AudioSink
+{
+public:
+	PacedSink( int nRate ) : m_nRate( nRate ), m_fStart( -1 ), m_fWritten( 0 ) {}
+
+protected:
+	void Pace( int nFrames )
+	{
+		if( m_fStart < 0 ) m_fStart = timer_Now();
+		m_fWritten += nFrames;
+		for( ;; )
+		{
+			double fAhead = m_fWritten / m_nRate - (timer_Now() - m_fStart);
+			if( fAhead <= AUDIOSINK_AHEAD ) break;
+			thread_Sleep( 1 );
+		}
+	}
+
+	int m_nRate;
+	double m_fStart;		// when the first frames were written
+	double m_fWritten;		// frames written since
+};
+
+class NullSink : public PacedSink
+{
+public:
+	NullSink( int nRate ) : PacedSink( nRate ) {}
+	virtual bool Write( const short* pFrames, int nFrames )
+	{
+		Pace( nFrames );
+		return true;
+	}
+};
+
+AudioSink* audiosink_OpenNull( int nRate )
+{
+	return new NullSink( nRate );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// WAV file
+//////////////////////////////////////////////////////////////////////
+
+static void put16( unsigned char* p, unsigned int n )
+{
+	p[0] = (unsigned char) n;
+	p[1] = (unsigned char)(n >> 8);
+}
+
+static void put32( unsigned char* p, unsigned int n )
+{
+	put16( p, n );
+	put16( p + 2, n >> 16 );
+}
+
+class WavSink : public PacedSink
+{
+public:
+	WavSink( FILE* pFile, int nRate ) : PacedSink( nRate ), m_pFile( pFile ), m_nBytes( 0 ), m_bFailed( false )
+	{
+		WriteHeader();
+	}
+
+	virtual ~WavSink()
+	{
+		// the sizes, now they are known.
+		if( !m_bFailed && fseek( m_pFile, 0, SEEK_SET ) == 0 ) WriteHeader();
+		fclose( m_pFile );
+	}
+
+	virtual bool Write( const short* pFrames, int nFrames )
+	{
+		// samples are little endian in the file, as they are in memory here.
+		if( fwrite( pFrames, 4, nFrames, m_pFile ) != (size_t) nFrames )
+		{
+			log_Write( LOG_ERROR, "Audio: writing the WAV file failed" );
+			m_bFailed = true;
+			return false;
+		}
+		m_nBytes += nFrames * 4;
+		Pace( nFrames );
+		return true;
+	}
+
+private:
+	void WriteHeader()
+	{
+		unsigned char header[44];
+		memcpy( header, "RIFF", 4 );
+		put32( header + 4, 36 + m_nBytes );
+		memcpy( header + 8, "WAVEfmt ", 8 );
+		put32( header + 16, 16 );				// fmt chunk size
+		put16( header + 20, 1 );				// PCM
+		put16( header + 22, 2 );				// channels
+		put32( header + 24, m_nRate );
+		put32( header + 28, m_nRate * 4 );		// bytes per second
+		put16( header + 32, 4 );				// bytes per frame
+		put16( header + 34, 16 );				// bits per sample
+		memcpy( header + 36, "data", 4 );
+		put32( header + 40, m_nBytes );
+		fwrite( header, 1, sizeof(header), m_pFile );
+	}
+
+	FILE* m_pFile;
+	unsigned int m_nBytes;		// of samples written
+	bool m_bFailed;
+};
+
+AudioSink* audiosink_OpenWav( const char* szFilename, int nRate )
+{
+	FILE* pFile = fopen( szFilename, "wb" );
+	if( !pFile )
+	{
+		log_Writef( LOG_ERROR, "Audio: cannot create %s", szFilename );
+		return NULL;
+	}
+	return new WavSink( pFile, nRate );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// ALSA
+//////////////////////////////////////////////////////////////////////
+
+#ifdef WINDOWS
+
+AudioSink* audiosink_OpenAlsa( int nRate, int nLatencyMs )
+{
+	return NULL;
+}
+
+#else
+
+// The few calls used, from libasound.so.2. The enums are ints, and
+// their values are part of the ALSA ABI.
+struct snd_pcm_t;
+#define ALSA_STREAM_PLAYBACK		0
+#define ALSA_FORMAT_S16_LE			2
+#define ALSA_ACCESS_RW_INTERLEAVED	3
+
+struct AlsaApi
+{
+	int (*open)( snd_pcm_t** ppPcm, const char* szName, int nStream, int nMode );
+	int (*set_params)( snd_pcm_t* pPcm, int nFormat, int nAccess, unsigned int nChannels,
+		unsigned int nRate, int bSoftResample, unsigned int nLatencyUs );
+	long (*writei)( snd_pcm_t* pPcm, const void* pBuffer, unsigned long nFrames );
+	int (*recover)( snd_pcm_t* pPcm, int nError, int bSilent );
+	int (*close)( snd_pcm_t* pPcm );
+	const char* (*strerror)( int nError );
+};
+
+static bool loadAlsa( AlsaApi* pApi )
+{
+	static void* s_pLibrary = NULL;
+	if( !s_pLibrary ) s_pLibrary = dlopen( "libasound.so.2", RTLD_NOW );
+	if( !s_pLibrary ) return false;
+	*(void**) &pApi->open = dlsym( s_pLibrary, "snd_pcm_open" );
+	*(void**) &pApi->set_params = dlsym( s_pLibrary, "snd_pcm_set_params" );
+	*(void**) &pApi->writei = dlsym( s_pLibrary, "snd_pcm_writei" );
+	*(void**) &pApi->recover = dlsym( s_pLibrary, "snd_pcm_recover" );
+	*(void**) &pApi->close = dlsym( s_pLibrary, "snd_pcm_close" );
+	*(void**) &pApi->strerror = dlsym( s_pLibrary, "snd_strerror" );
+	return pApi->open && pApi->set_params && pApi->writei && pApi->recover &&
+		pApi->close && pApi->strerror;
+}
+
+class AlsaSink : public AudioSink
+{
+public:
+	AlsaSink( const AlsaApi& api, snd_pcm_t* pPcm ) : m_api( api ), m_pPcm( pPcm ), m_nUnderruns( 0 ) {}
+
+	virtual ~AlsaSink()
+	{
+		m_api.close( m_pPcm );
+	}
+
+	virtual bool Write( const short* pFrames, int nFrames )
+	{
+		while( nFrames > 0 )
+		{
+			long nWritten = m_api.writei( m_pPcm, pFrames, nFrames );
+			if( nWritten < 0 )
+			{
+				if( nWritten == -EPIPE ) atomic_Add( &m_nUnderruns, 1 );
+				int nError = m_api.recover( m_pPcm, (int) nWritten, 1 );
+				if( nError < 0 )
+				{
+					log_Writef( LOG_ERROR, "Audio: ALSA write failed: %s", m_api.strerror( nError ) );
+					return false;
+				}
+				continue;
+			}
+			pFrames += nWritten * 2;
+			nFrames -= (int) nWritten;
+		}
+		return true;
+	}
+
+	virtual long Underruns() { return atomic_Load( &m_nUnderruns ); }
+
+private:
+	AlsaApi m_api;
+	snd_pcm_t* m_pPcm;
+	volatile long m_nUnderruns;
+};
+
+AudioSink* audiosink_OpenAlsa( int nRate, int nLatencyMs )
+{
+	AlsaApi api;
+	if( !loadAlsa( &api ) )
+	{
+		log_Log( "Audio: libasound.so.2 not found" );
+		return NULL;
+	}
+	snd_pcm_t* pPcm = NULL;
+	int nError = api.open( &pPcm, "default", ALSA_STREAM_PLAYBACK, 0 );
+	if( nError >= 0 )
+	{
+		nError = api.set_params( pPcm, ALSA_FORMAT_S16_LE, ALSA_ACCESS_RW_INTERLEAVED, 2,
+			nRate, 1, nLatencyMs * 1000 );
+		if( nError < 0 ) api.close( pPcm );
+	}
+	if( nError < 0 )
+	{
+		log_Logf( "Audio: cannot open the ALSA device: %s", api.strerror( nError ) );
+		return NULL;
+	}
+	return new AlsaSink( api, pPcm );
+}
+
+#endif
@@ -0,0 +1,39 @@
+// AudioSink.h: where the mixed audio goes
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_AUDIOSINK_H
+#define FGM_AUDIOSINK_H
+
+// Sinks take 16 bit stereo frames from the mixer thread (see Audio.h).
+// Write blocks until the sink wants more, and that is what paces the
+// mixer: an ALSA device blocks as its buffer fills, and the null and
+// WAV sinks sleep to keep to the clock, so headless runs mix in real
+// time just as a device would make them.
+//
+class AudioSink
+{
+public:
+	virtual ~AudioSink() {}
+
+	// Write nFrames frames of left, right samples. False once the sink
+	// has failed for good.
+	virtual bool Write( const short* pFrames, int nFrames ) = 0;
+
+	// Times the sink ran dry before the mixer caught up.
+	virtual long Underruns() { return 0; }
+};
+
+// The default ALSA device, with about nLatencyMs of buffering. libasound
+// is loaded when this is called, so the client runs without it; NULL if
+// it or the device is missing.
+AudioSink* audiosink_OpenAlsa( int nRate, int nLatencyMs );
+
+// Throws the frames away.
+AudioSink* audiosink_OpenNull( int nRate );
+
+// Writes the frames to a WAV file; NULL if it cannot be created. The
+// sizes in its header are filled in when the sink is deleted.
+AudioSink* audiosink_OpenWav( const char* szFilename, int nRate );
+
+#endif // FGM_AUDIOSINK_H
@@ -0,0 +1,117 @@
+// BitStream.h: bit-level packing into byte buffers
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_BITSTREAM_H
+#define FGM_BITSTREAM_H
+
+// Writes values of 1 to 32 bits, most significant bit first. Writing
+// past the end of the buffer sets the overflow flag and is ignored.
+//
+class BitWriter
+{
+public:
+	BitWriter( unsigned char* pBuffer, int nCapacity ) :
+		m_pBuffer(pBuffer), m_nCapacity(nCapacity * 8), m_nBits(0),
+		m_bOverflow(false)
+	{
+	}
+
+	inline void Write( unsigned int nValue, int nBits );
+	inline void WriteSigned( int nValue, int nBits ) { Write( (unsigned int)nValue, nBits ); }
+
+	inline int GetBytes() const { return (m_nBits + 7) >> 3; }
+	inline bool IsOverflowed() const { return m_bOverflow; }
+
+protected:
+	unsigned char* m_pBuffer;
+	int m_nCapacity;
+	int m_nBits;
+	bool m_bOverflow;
+};
+
+// Reads values written by BitWriter. Reading past the end sets the
+// overflow flag and returns zero bits.
+//
+class BitReader
+{
+public:
+	BitReader( const unsigned char* pBuffer, int nLength ) :
+		m_pBuffer(pBuffer), m_nLength(nLength * 8), m_nBits(0),
+		m_bOverflow(false)
+	{
+	}
+
+	inline unsigned int Read( int nBits );
+	inline int ReadSigned( int nBits );
+
+	inline int GetBytes() const { return (m_nBits + 7) >> 3; }
+	inline bool IsOverflowed() const { return m_bOverflow; }
+
+protected:
+	const unsigned char* m_pBuffer;
+	int m_nLength;
+	int m_nBits;
+	bool m_bOverflow;
+};
+
+// Inline implementation functions
+//
+
+inline void BitWriter::Write( unsigned int nValue, int nBits )
+{
+	if( m_nBits + nBits > m_nCapacity )
+	{
+		m_bOverflow = true;
+		return;
+	}
+
+	while( nBits > 0 )
+	{
+		unsigned char* pByte = m_pBuffer + (m_nBits >> 3);
+		int nFree = 8 - (m_nBits & 7);
+		if( nFree == 8 ) *pByte = 0;
+
+		int nTake = (nBits < nFree) ? nBits : nFree;
+		unsigned int nChunk = (nValue >> (nBits - nTake)) & ((1U << nTake) - 1);
+		*pByte |= (unsigned char)(nChunk << (nFree - nTake));
+
+		m_nBits += nTake;
+		nBits -= nTake;
+	}
+}
+
+inline unsigned int BitReader::Read( int nBits )
+{
+	if( m_nBits + nBits > m_nLength )
+	{
+		m_bOverflow = true;
+		m_nBits = m_nLength;
+		return 0;
+	}
+
+	unsigned int nResult = 0;
+	while( nBits > 0 )
+	{
+		unsigned int nByte = m_pBuffer[m_nBits >> 3];
+		int nAvail = 8 - (m_nBits & 7);
+
+		int nTake = (nBits < nAvail) ? nBits : nAvail;
+		unsigned int nChunk = (nByte >> (nAvail - nTake)) & ((1U << nTake) - 1);
+		nResult = (nResult << nTake) | nChunk;
+
+		m_nBits += nTake;
+		nBits -= nTake;
+	}
+	return nResult;
+}
+
+inline int BitReader::ReadSigned( int nBits )
+{
+	unsigned int nValue = Read( nBits );
+	if( nBits < 32 && (nValue & (1U << (nBits - 1))) )
+		nValue |= ~((1U << nBits) - 1); // sign extend
+	return (int)nValue;
+}
+
+#endif // FGM_BITSTREAM_H
@@ -0,0 +1,449 @@
+// Codec.cpp: precompiled message formats for encode/decode
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Codec.h"
+
+#include <string>
+#include <string.h>
+#include <new>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+#define CODEC_MAX_FIELDS	4096
+#define CODEC_CACHE_SIZE	64
+#define CODEC_METATABLE		"codec.Format"
+
+// Encoded size of each op, excluding string payloads.
+static const size_t s_opSize[] = { 1, 1, 2, 2, 4, 4, 2, 1 };
+
+// Scratch space for encoding large records.
+static std::vector<unsigned char> s_scratch;
+
+
+//////////////////////////////////////////////////////////////////////
+// Codec
+//////////////////////////////////////////////////////////////////////
+
+const char* Codec::compile( const char* fmt )
+{
+	m_ops.clear();
+	m_fixedSize = 0;
+	m_variable = false;
+
+	while (*fmt)
+	{
+		// optional repeat count
+		const char* start = fmt;
+		size_t count = 1;
+		if (*fmt >= '0' && *fmt <= '9')
+		{
+			count = 0;
+			while (*fmt >= '0' && *fmt <= '9')
+			{
+				count = count * 10 + (*fmt - '0');
+				if (count > CODEC_MAX_FIELDS) return start;
+				++fmt;
+			}
+		}
+
+		unsigned char op;
+		switch (*fmt)
+		{
+		case 'B': op = CODEC_U8; break;
+		case 'b': op = CODEC_S8; break;
+		case 'H': op = CODEC_U16; break;
+		case 'h': op = CODEC_S16; break;
+		case 'I': op = CODEC_U32; break;
+		case 'i': op = CODEC_S32; break;
+		case 'S': op = CODEC_STR16; m_variable = true; break;
+		case 's': op = CODEC_STR8; m_variable = true; break;
+		default: return fmt;
+		}
+
+		if (m_ops.size() + count > CODEC_MAX_FIELDS) return start;
+		m_ops.insert(m_ops.end(), count, op);
+		m_fixedSize += s_opSize[op] * count;
+		++fmt;
+	}
+
+	return NULL;
+}
+
+void Codec::encode( lua_State* L, int arg ) const
+{
+	size_t n = m_ops.size();
+
+	// Size the record up front so the write loop needs no checks.
+	size_t total = m_fixedSize;
+	if (m_variable)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			size_t len = 0;
+			switch (m_ops[i])
+			{
+			case CODEC_STR16:
+				lua_tolstring(L, arg + (int)i, &len);
+				total += (len > 65535) ? 65535 : len;
+				break;
+			case CODEC_STR8:
+				lua_tolstring(L, arg + (int)i, &len);
+				total += (len > 255) ? 255 : len;
+				break;
+			}
+		}
+	}
+
+	unsigned char local[256];
+	unsigned char* out = local;
+	if (total > sizeof(local))
+	{
+		if (s_scratch.size() < total) s_scratch.resize(total);
+		out = &s_scratch[0];
+	}
+
+	unsigned char* p = out;
+	for (size_t i = 0; i < n; ++i, ++arg)
+	{
+		switch (m_ops[i])
+		{
+		case CODEC_U8:
+		case CODEC_S8: {
+			lua_Integer v = lua_tointeger(L, arg);
+			p[0] = (unsigned char) v;
+			p += 1;
+			break;
+		}
+		case CODEC_U16:
+		case CODEC_S16: {
+			lua_Integer v = lua_tointeger(L, arg);
+			p[0] = (unsigned char) (v >> 8);
+			p[1] = (unsigned char) v;
+			p += 2;
+			break;
+		}
+		case CODEC_U32:
+		case CODEC_S32: {
+			lua_Integer v = lua_tointeger(L, arg);
+			p[0] = (unsigned char) (v >> 24);
+			p[1] = (unsigned char) (v >> 16);
+			p[2] = (unsigned char) (v >> 8);
+			p[3] = (unsigned char) v;
+			p += 4;
+			break;
+		}
+		case CODEC_STR16: {
+			size_t len = 0;
+			const char* data = lua_tolstring(L, arg, &len);
+			if (len > 65535) len = 65535;
+			p[0] = (unsigned char) (len >> 8);
+			p[1] = (unsigned char) len;
+			if (len) memcpy(p + 2, data, len);
+			p += 2 + len;
+			break;
+		}
+		case CODEC_STR8: {
+			size_t len = 0;
+			const char* data = lua_tolstring(L, arg, &len);
+			if (len > 255) len = 255;
+			p[0] = (unsigned char) len;
+			if (len) memcpy(p + 1, data, len);
+			p += 1 + len;
+			break;
+		}
+		}
+	}
+
+	lua_pushlstring(L, (const char*)out, total);
+}
+
+bool Codec::decode( lua_State* L, const unsigned char* data, size_t size, int t, size_t* used ) const
+{
+	int n = (int)m_ops.size();
+
+	// Fixed-size records can be bounds-checked once.
+	if (size < m_fixedSize) return false;
+	bool check = m_variable;
+
+	const unsigned char* p = data;
+	const unsigned char* end = data + size;
+	for (int i = 0; i < n; ++i)
+	{
+		unsigned char op = m_ops[i];
+		if (check && (size_t)(end - p) < s_opSize[op])
+		{
+			if (!t) lua_pop(L, i);
+			return false;
+		}
+
+		switch (op)
+		{
+		case CODEC_U8:
+			lua_pushinteger(L, p[0]);
+			p += 1;
+			break;
+		case CODEC_S8:
+			lua_pushinteger(L, (signed char) p[0]);
+			p += 1;
+			break;
+		case CODEC_U16:
+			lua_pushinteger(L, (p[0] << 8) | p[1]);
+			p += 2;
+			break;
+		case CODEC_S16:
+			lua_pushinteger(L, (short) ((p[0] << 8) | p[1]));
+			p += 2;
+			break;
+		case CODEC_U32: {
+			unsigned int v = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+				((unsigned int)p[2] << 8) | p[3];
+			lua_pushnumber(L, (lua_Number) v);
+			p += 4;
+			break;
+		}
+		case CODEC_S32: {
+			unsigned int v = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+				((unsigned int)p[2] << 8) | p[3];
+			lua_pushinteger(L, (int) v);
+			p += 4;
+			break;
+		}
+		case CODEC_STR16: {
+			size_t len = ((size_t)p[0] << 8) | p[1];
+			if ((size_t)(end - p) - 2 < len)
+			{
+				if (!t) lua_pop(L, i);
+				return false;
+			}
+			lua_pushlstring(L, (const char*)(p + 2), len);
+			p += 2 + len;
+			break;
+		}
+		case CODEC_STR8: {
+			size_t len = p[0];
+			if ((size_t)(end - p) - 1 < len)
+			{
+				if (!t) lua_pop(L, i);
+				return false;
+			}
+			lua_pushlstring(L, (const char*)(p + 1), len);
+			p += 1 + len;
+			break;
+		}
+		}
+
+		if (t) lua_rawseti(L, t, i + 1);
+	}
+
+	*used = (size_t)(p - data);
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Format cache for the global encode/decode functions
+//////////////////////////////////////////////////////////////////////
+
+struct CodecCacheEntry
+{
+	std::string fmt;
+	Codec codec;
+};
+
+static CodecCacheEntry s_cache[CODEC_CACHE_SIZE];
+
+// Raise the error for a format that compile rejected at 'bad'.
+static void format_error(lua_State* L, const char* bad, const char* caller)
+{
+	if (!*bad) luaL_error(L, "repeat count without a specifier in %s", caller);
+	if (strchr("BbHhIiSs0123456789", *bad))
+		luaL_error(L, "too many fields (more than %d) in %s", CODEC_MAX_FIELDS, caller);
+	luaL_error(L, "unknown format specifier '%c' in %s", *bad, caller);
+}
+
+static const Codec* lookup_format(lua_State* L, int index, const char* caller)
+{
+	size_t len = 0;
+	const char* fmt = luaL_checklstring(L, index, &len);
+
+	// Lua strings are interned, so the address makes a cheap hash. The
+	// text is compared as well in case a collected string's address has
+	// been reused for a different format.
+	size_t slot = ((size_t)fmt >> 4) % CODEC_CACHE_SIZE;
+	CodecCacheEntry& entry = s_cache[slot];
+	if (entry.fmt.size() != len || memcmp(entry.fmt.data(), fmt, len) != 0)
+	{
+		entry.fmt.clear();
+		const char* bad = entry.codec.compile(fmt);
+		if (bad) {
+			// leave the slot as an empty format should compile.
+			entry.codec.compile("");
+			format_error(L, bad, caller);
+		}
+		entry.fmt.assign(fmt, len);
+	}
+	return &entry.codec;
+}
+
+static int codec_encode(lua_State *L) {
+	const Codec* codec = lookup_format(L, 1, "encode");
+	codec->encode(L, 2);
+	return 1;
+}
+
+static int codec_decode(lua_State *L) {
+	const Codec* codec = lookup_format(L, 1, "decode");
+	size_t size = 0;
+	const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 2, &size);
+	luaL_checkstack(L, codec->GetFieldCount(), "too many fields in decode");
+	size_t used;
+	if (!codec->decode(L, data, size, 0, &used))
+		luaL_error(L, "data truncated in decode");
+	return codec->GetFieldCount();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Compiled format objects
+//////////////////////////////////////////////////////////////////////
+
+static Codec* check_format(lua_State *L, int index) {
+	return (Codec*) luaL_checkudata(L, index, CODEC_METATABLE);
+}
+
+static size_t check_offset(lua_State *L, int index, size_t size) {
+	lua_Integer ofs = luaL_optinteger(L, index, 1);
+	if (ofs < 1 || (size_t)(ofs - 1) > size)
+		luaL_argerror(L, index, "offset out of range");
+	return (size_t)(ofs - 1);
+}
+
+static int codec_compile(lua_State *L) {
+	const char* fmt = luaL_checkstring(L, 1);
+	Codec* codec = new (lua_newuserdata(L, sizeof(Codec))) Codec();
+	luaL_getmetatable(L, CODEC_METATABLE);
+	lua_setmetatable(L, -2); // so __gc runs even if compile fails
+	const char* bad = codec->compile(fmt);
+	if (bad) format_error(L, bad, "compile");
+	return 1;
+}
+
+static int format_gc(lua_State *L) {
+	Codec* codec = check_format(L, 1);
+	codec->~Codec();
+	return 0;
+}
+
+static int format_encode(lua_State *L) {
+	Codec* codec = check_format(L, 1);
+	codec->encode(L, 2);
+	return 1;
+}
+
+// fmt:decode(data [, offset]) returns the fields followed by the
+// offset of the next record, so a stream can be walked without
+// slicing the string.
+static int format_decode(lua_State *L) {
+	Codec* codec = check_format(L, 1);
+	size_t size = 0;
+	const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 2, &size);
+	size_t ofs = check_offset(L, 3, size);
+	luaL_checkstack(L, codec->GetFieldCount() + 1, "too many fields in decode");
+	size_t used;
+	if (!codec->decode(L, data + ofs, size - ofs, 0, &used))
+		luaL_error(L, "data truncated at offset %d in decode", (int)ofs + 1);
+	lua_pushinteger(L, (lua_Integer)(ofs + used + 1));
+	return codec->GetFieldCount() + 1;
+}
+
+// fmt:decodeAll(data [, t]) decodes every record in data into t[1..n],
+// each record being an array of fields. Record tables already present
+// in t are reused, so decoding into the same table every frame does not
+// create garbage. Returns t and the record count.
+static int format_decode_all(lua_State *L) {
+	Codec* codec = check_format(L, 1);
+	size_t size = 0;
+	const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 2, &size);
+	int nfields = codec->GetFieldCount();
+	if (!nfields) luaL_error(L, "cannot decodeAll with an empty format");
+
+	if (lua_isnoneornil(L, 3)) {
+		int guess = 0;
+		if (!codec->IsVariable()) guess = (int)(size / codec->GetFixedSize());
+		lua_settop(L, 2);
+		lua_createtable(L, guess, 0);
+	}
+	else {
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_settop(L, 3);
+	}
+
+	int count = 0;
+	size_t ofs = 0;
+	while (ofs < size)
+	{
+		lua_rawgeti(L, 3, count + 1);
+		if (!lua_istable(L, -1)) {
+			lua_pop(L, 1);
+			lua_createtable(L, nfields, 0);
+		}
+		size_t used;
+		if (!codec->decode(L, data + ofs, size - ofs, 4, &used))
+			luaL_error(L, "data truncated at offset %d in decodeAll", (int)ofs + 1);
+		lua_rawseti(L, 3, ++count);
+		ofs += used;
+	}
+
+	// drop records left over from a longer batch.
+	for (int i = count + 1; ; ++i) {
+		lua_rawgeti(L, 3, i);
+		bool done = lua_isnil(L, -1);
+		lua_pop(L, 1);
+		if (done) break;
+		lua_pushnil(L);
+		lua_rawseti(L, 3, i);
+	}
+
+	lua_pushinteger(L, count);
+	return 2;
+}
+
+static int format_get_size(lua_State *L) {
+	Codec* codec = check_format(L, 1);
+	lua_pushinteger(L, (lua_Integer) codec->GetFixedSize());
+	lua_pushboolean(L, codec->IsVariable());
+	lua_pushinteger(L, codec->GetFieldCount());
+	return 3;
+}
+
+static const luaL_Reg format_methods[] = {
+	{"encode", format_encode},
+	{"decode", format_decode},
+	{"decodeAll", format_decode_all},
+	{"getSize", format_get_size},
+	{"__gc", format_gc},
+	{NULL, NULL}
+};
+
+static const luaL_Reg codec_funcs[] = {
+	{"compile", codec_compile},
+	{NULL, NULL}
+};
+
+int luaopen_codec( lua_State* L )
+{
+	luaL_newmetatable(L, CODEC_METATABLE);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_register(L, NULL, format_methods);
+	lua_pop(L, 1);
+
+	lua_register(L, "encode", codec_encode);
+	lua_register(L, "decode", codec_decode);
+	luaL_register(L, "codec", codec_funcs);
+	return 1;
+}
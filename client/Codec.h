@@ -0,0 +1,62 @@
+// Codec.h: precompiled message formats for encode/decode
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <vector>
+
+struct lua_State;
+
+// Field types a format string compiles to.
+//
+enum CodecOp {
+	CODEC_U8 = 0,	// 'B' unsigned byte
+	CODEC_S8,		// 'b' signed byte
+	CODEC_U16,		// 'H' unsigned 16-bit, big endian
+	CODEC_S16,		// 'h' signed 16-bit
+	CODEC_U32,		// 'I' unsigned 32-bit
+	CODEC_S32,		// 'i' signed 32-bit
+	CODEC_STR16,	// 'S' string with 16-bit length prefix
+	CODEC_STR8,		// 's' string with 8-bit length prefix
+};
+
+class Codec
+{
+public:
+	Codec() : m_fixedSize(0), m_variable(false) {}
+
+	// Compile a format string such as "BHs" or "4h". A decimal count
+	// before a specifier repeats it. Returns NULL on success, otherwise
+	// a pointer to the offending character in fmt.
+	const char* compile( const char* fmt );
+
+	// Record layout
+	//
+	inline int GetFieldCount() const { return (int)m_ops.size(); }
+	inline size_t GetFixedSize() const { return m_fixedSize; }
+	inline bool IsVariable() const { return m_variable; }
+
+	// Encode the values at stack index 'arg' onwards and push the
+	// resulting string.
+	void encode( lua_State* L, int arg ) const;
+
+	// Decode one record. If 't' is zero the fields are pushed on the
+	// stack, otherwise they are stored as t[1..n]. Returns false if the
+	// data is truncated, otherwise stores the number of bytes consumed
+	// (zero for an empty format) in *used.
+	bool decode( lua_State* L, const unsigned char* data, size_t size, int t, size_t* used ) const;
+
+protected:
+	std::vector<unsigned char> m_ops;
+	size_t m_fixedSize;
+	bool m_variable;
+};
+
+// Register the codec library and the global encode/decode functions.
+//
+int luaopen_codec( lua_State* L );
+
+#endif // CODEC_H
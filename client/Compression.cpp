@@ -0,0 +1,270 @@
+// Compression.cpp: streaming LZ77 compression for the packet stream
+//
+// Each compressed packet starts with a block type byte. Stored blocks
+// carry the original bytes; compressed blocks are a sequence of
+//
+//   token: literal count (high nibble), match length - 4 (low nibble)
+//   [extra literal count bytes] literals
+//   offset (2 bytes) [extra match length bytes]
+//
+// where a nibble of 15 is continued by bytes of 255 and a final byte
+// below 255. The last sequence has literals only. Offsets may reach
+// back into earlier packets on the same connection, which is where
+// most of the gain comes from for a repetitive protocol.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+#include "Compression.h"
+#include "Timer.h"
+
+#include <string.h>
+
+#define LZ_BLOCK_STORED		0
+#define LZ_BLOCK_COMPRESSED	1
+
+
+static inline unsigned int read32( const unsigned char* p )
+{
+	unsigned int v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+static inline int hash32( unsigned int v )
+{
+	return (int)((v * 2654435761U) >> (32 - LZ_HASH_BITS));
+}
+
+static unsigned char* putLength( unsigned char* p, unsigned char* pEnd, int n )
+{
+	while( n >= 255 )
+	{
+		if( p >= pEnd ) return NULL;
+		*p++ = 255;
+		n -= 255;
+	}
+	if( p >= pEnd ) return NULL;
+	*p++ = (unsigned char)n;
+	return p;
+}
+
+static bool getLength( const unsigned char** pp, const unsigned char* pEnd, int* pn )
+{
+	const unsigned char* p = *pp;
+	int b;
+	do
+	{
+		if( p >= pEnd || *pn > MAX_PACKET_DATA ) return false;
+		b = *p++;
+		*pn += b;
+	}
+	while( b == 255 );
+	*pp = p;
+	return true;
+}
+
+// Write one sequence; a match length of zero marks the final literal run.
+// Returns NULL if the output would not fit.
+static unsigned char* putSequence( unsigned char* p, unsigned char* pEnd,
+	const unsigned char* pLiterals, int nLiterals, int nMatch, int nOffset )
+{
+	int nExtra = nMatch ? nMatch - LZ_MIN_MATCH : 0;
+
+	if( p >= pEnd ) return NULL;
+	*p++ = (unsigned char)(((nLiterals < 15 ? nLiterals : 15) << 4) | (nExtra < 15 ? nExtra : 15));
+
+	if( nLiterals >= 15 && !(p = putLength( p, pEnd, nLiterals - 15 )) ) return NULL;
+	if( pEnd - p < nLiterals ) return NULL;
+	memcpy( p, pLiterals, nLiterals );
+	p += nLiterals;
+
+	if( nMatch )
+	{
+		if( pEnd - p < 2 ) return NULL;
+		p[0] = (unsigned char)(nOffset >> 8);
+		p[1] = (unsigned char)(nOffset & 255);
+		p += 2;
+		if( nExtra >= 15 && !(p = putLength( p, pEnd, nExtra - 15 )) ) return NULL;
+	}
+
+	return p;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// PacketCompressor
+//////////////////////////////////////////////////////////////////////
+
+PacketCompressor::PacketCompressor()
+{
+	Reset();
+}
+
+void PacketCompressor::Reset()
+{
+	m_nHistory = 0;
+	for( int i = 0; i < LZ_HASH_SIZE; i++ ) m_aHash[i] = -1;
+}
+
+void PacketCompressor::Slide( int nKeep )
+{
+	int nDelta = m_nHistory - nKeep;
+	if( nDelta <= 0 ) return;
+
+	memmove( m_aHistory, m_aHistory + nDelta, nKeep );
+	m_nHistory = nKeep;
+
+	// Rebase the hash chain heads, dropping anything that fell out.
+	for( int i = 0; i < LZ_HASH_SIZE; i++ )
+		m_aHash[i] = (m_aHash[i] >= nDelta) ? m_aHash[i] - nDelta : -1;
+}
+
+int PacketCompressor::Compress( const unsigned char* pSource, int nLength, unsigned char* pDest )
+{
+	// Even a stored block would not fit in a packet.
+	if( nLength < 0 || nLength > MAX_COMPRESSED_DATA ) return -1;
+
+	double fStart = timer_Now();
+
+	// Append the packet to the dictionary and compress it in place.
+	if( m_nHistory + nLength > LZ_HISTORY_SIZE ) Slide( LZ_WINDOW_SIZE );
+
+	unsigned char* pBase = m_aHistory;
+	int nStart = m_nHistory;
+	int nEnd = nStart + nLength;
+	memcpy( pBase + nStart, pSource, nLength );
+	m_nHistory = nEnd;
+
+	// Anything as large as a stored block is not worth sending.
+	unsigned char* p = pDest;
+	unsigned char* pEnd = pDest + nLength + 1;
+	*p++ = LZ_BLOCK_COMPRESSED;
+
+	int nAnchor = nStart;
+	int nPos = nStart;
+	int nLimit = nEnd - LZ_MIN_MATCH;
+	while( p && nPos <= nLimit )
+	{
+		unsigned int v = read32( pBase + nPos );
+		int h = hash32( v );
+		int nCandidate = m_aHash[h];
+		m_aHash[h] = nPos;
+
+		if( nCandidate >= 0 && nPos - nCandidate <= LZ_WINDOW_SIZE &&
+			read32( pBase + nCandidate ) == v )
+		{
+			int nMatch = LZ_MIN_MATCH;
+			while( nPos + nMatch < nEnd && pBase[nCandidate + nMatch] == pBase[nPos + nMatch] )
+				nMatch++;
+
+			p = putSequence( p, pEnd, pBase + nAnchor, nPos - nAnchor, nMatch, nPos - nCandidate );
+			nPos += nMatch;
+			nAnchor = nPos;
+		}
+		else
+		{
+			nPos++;
+		}
+	}
+	if( p ) p = putSequence( p, pEnd, pBase + nAnchor, nEnd - nAnchor, 0, 0 );
+
+	int nResult;
+	if( p )
+	{
+		nResult = (int)(p - pDest);
+	}
+	else
+	{
+		pDest[0] = LZ_BLOCK_STORED;
+		memcpy( pDest + 1, pSource, nLength );
+		nResult = nLength + 1;
+	}
+
+	m_stats.m_nPackets++;
+	m_stats.m_nBytesIn += nLength;
+	m_stats.m_nBytesOut += nResult;
+	m_stats.m_fSeconds += timer_Now() - fStart;
+
+	return nResult;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// PacketDecompressor
+//////////////////////////////////////////////////////////////////////
+
+const unsigned char* PacketDecompressor::Decompress( const unsigned char* pSource, int nLength, int* pResult )
+{
+	double fStart = timer_Now();
+
+	if( nLength < 1 ) return NULL;
+
+	// Make room for the largest possible packet.
+	if( m_nHistory + MAX_PACKET_DATA > LZ_HISTORY_SIZE )
+	{
+		memmove( m_aHistory, m_aHistory + m_nHistory - LZ_WINDOW_SIZE, LZ_WINDOW_SIZE );
+		m_nHistory = LZ_WINDOW_SIZE;
+	}
+
+	unsigned char* pOut = m_aHistory + m_nHistory;
+	unsigned char* pOutEnd = pOut + MAX_PACKET_DATA;
+	unsigned char* q = pOut;
+	const unsigned char* p = pSource + 1;
+	const unsigned char* pEnd = pSource + nLength;
+
+	switch( pSource[0] )
+	{
+	case LZ_BLOCK_STORED:
+		memcpy( q, p, nLength - 1 );
+		q += nLength - 1;
+		break;
+
+	case LZ_BLOCK_COMPRESSED:
+		for(;;)
+		{
+			if( p >= pEnd ) return NULL;
+			int nToken = *p++;
+
+			int nLiterals = nToken >> 4;
+			if( nLiterals == 15 && !getLength( &p, pEnd, &nLiterals ) ) return NULL;
+			if( pEnd - p < nLiterals || pOutEnd - q < nLiterals ) return NULL;
+			memcpy( q, p, nLiterals );
+			q += nLiterals;
+			p += nLiterals;
+
+			// The final sequence has no match.
+			if( p == pEnd ) break;
+
+			if( pEnd - p < 2 ) return NULL;
+			int nOffset = (p[0] << 8) | p[1];
+			p += 2;
+
+			int nMatch = nToken & 15;
+			if( nMatch == 15 && !getLength( &p, pEnd, &nMatch ) ) return NULL;
+			nMatch += LZ_MIN_MATCH;
+
+			if( nOffset == 0 || nOffset > LZ_WINDOW_SIZE || nOffset > q - m_aHistory ||
+				pOutEnd - q < nMatch ) return NULL;
+
+			// Byte by byte, since the match may overlap its own output.
+			const unsigned char* s = q - nOffset;
+			while( nMatch-- ) *q++ = *s++;
+		}
+		break;
+
+	default:
+		return NULL;
+	}
+
+	int nResult = (int)(q - pOut);
+	m_nHistory += nResult;
+	*pResult = nResult;
+
+	m_stats.m_nPackets++;
+	m_stats.m_nBytesIn += nLength;
+	m_stats.m_nBytesOut += nResult;
+	m_stats.m_fSeconds += timer_Now() - fStart;
+
+	return pOut;
+}
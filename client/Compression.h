@@ -0,0 +1,93 @@
+// Compression.h: streaming LZ77 compression for the packet stream
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_COMPRESSION_H
+#define FGM_COMPRESSION_H
+
+#include "Packet.h" // MAX_PACKET_DATA
+
+// Matches may reach this far back into previous packets.
+#define LZ_WINDOW_SIZE		32768
+#define LZ_HISTORY_SIZE		(LZ_WINDOW_SIZE + MAX_PACKET_DATA)
+#define LZ_HASH_BITS		12
+#define LZ_HASH_SIZE		(1 << LZ_HASH_BITS)
+#define LZ_MIN_MATCH		4
+
+// Largest payload that can be compressed; a packet that does not
+// compress is stored with a one byte prefix. Larger packets have to be
+// sent as they are.
+#define MAX_COMPRESSED_DATA	(MAX_PACKET_DATA - 1)
+
+// Counters for one direction of a connection.
+//
+struct CompressionStats
+{
+	CompressionStats() : m_nPackets(0), m_nBytesIn(0), m_nBytesOut(0),
+		m_fSeconds(0)
+	{
+	}
+
+	// Compressed size as a fraction of the original size.
+	double GetRatio() const
+	{
+		return m_nBytesIn ? (double)m_nBytesOut / (double)m_nBytesIn : 1.0;
+	}
+
+	long m_nPackets;
+	long m_nBytesIn;	// bytes given to the (de)compressor
+	long m_nBytesOut;	// bytes produced by the (de)compressor
+	double m_fSeconds;	// time spent (de)compressing
+};
+
+// Compresses packets against a dictionary of everything sent before,
+// so repeated records in later packets become short back-references.
+//
+class PacketCompressor
+{
+public:
+	PacketCompressor();
+
+	// Compress 'nLength' bytes into 'pDest', which must hold at least
+	// nLength + 1 bytes. Returns the compressed length, or -1 if the
+	// packet is larger than MAX_COMPRESSED_DATA.
+	int Compress( const unsigned char* pSource, int nLength, unsigned char* pDest );
+
+	// Forget the dictionary, keeping the counters.
+	void Reset();
+
+	const CompressionStats& GetStats() const { return m_stats; }
+
+protected:
+	void Slide( int nKeep );
+
+protected:
+	unsigned char m_aHistory[LZ_HISTORY_SIZE];
+	int m_aHash[LZ_HASH_SIZE];
+	int m_nHistory;
+	CompressionStats m_stats;
+};
+
+// Mirror of PacketCompressor for the receiving end of a connection.
+//
+class PacketDecompressor
+{
+public:
+	PacketDecompressor() : m_nHistory(0) {}
+
+	// Decompress a packet. Returns a pointer to the data, which is valid
+	// until the next call, or NULL if the data is corrupt.
+	const unsigned char* Decompress( const unsigned char* pSource, int nLength, int* pResult );
+
+	// Forget the dictionary, keeping the counters.
+	void Reset() { m_nHistory = 0; }
+
+	const CompressionStats& GetStats() const { return m_stats; }
+
+protected:
+	unsigned char m_aHistory[LZ_HISTORY_SIZE];
+	int m_nHistory;
+	CompressionStats m_stats;
+};
+
+#endif // FGM_COMPRESSION_H
@@ -0,0 +1,212 @@
+// FrameStats.cpp: per-frame phase timing over the last few seconds
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "FrameStats.h"
+#include "Timer.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+static FrameSample s_aFrames[FRAME_HISTORY];
+static int s_nNext = 0;			// slot of the frame in progress
+static int s_nCount = 0;		// finished frames in the ring
+static bool s_bInFrame = false;
+static double s_fMark = 0;		// time of the last mark
+static double s_fEnded = 0;		// time the last frame ended, or 0
+static double s_fStutter = FRAME_STUTTER;
+
+static const char* s_aPhaseNames[FRAME_PHASES] = {
+	"input", "update", "interpolate", "render", "swap"
+};
+
+
+//////////////////////////////////////////////////////////////////////
+// Recording
+//////////////////////////////////////////////////////////////////////
+
+void frame_Begin()
+{
+	double fNow = timer_Now();
+	FrameSample* pFrame = &s_aFrames[s_nNext];
+	memset( pFrame->m_aPhase, 0, sizeof(pFrame->m_aPhase) );
+	pFrame->m_aPhase[FRAME_INPUT] = s_fEnded ? fNow - s_fEnded : 0;
+	pFrame->m_fTotal = 0;
+	pFrame->m_fGpu = -1;
+	s_fMark = fNow;
+	s_bInFrame = true;
+}
+
+void frame_Mark( int nPhase )
+{
+	if( !s_bInFrame || nPhase < 0 || nPhase >= FRAME_PHASES ) return;
+	double fNow = timer_Now();
+	s_aFrames[s_nNext].m_aPhase[nPhase] += fNow - s_fMark;
+	s_fMark = fNow;
+}
+
+static void logFrame( const FrameSample* pFrame )
+{
+	char szPhases[FRAME_PHASES * 32 + 32];
+	char* p = szPhases;
+	for( int i = 0; i < FRAME_PHASES; i++ )
+		p += sprintf( p, " %s %.1f", s_aPhaseNames[i], pFrame->m_aPhase[i] * 1000 );
+	log_Logf( "Frame took %.1f ms:%s", pFrame->m_fTotal * 1000, szPhases );
+}
+
+void frame_End()
+{
+	if( !s_bInFrame ) return;
+	s_bInFrame = false;
+	s_fEnded = timer_Now();
+
+	FrameSample* pFrame = &s_aFrames[s_nNext];
+	double fTotal = 0;
+	for( int i = 0; i < FRAME_PHASES; i++ )
+		fTotal += pFrame->m_aPhase[i];
+	pFrame->m_fTotal = fTotal;
+
+	// The first frame waits on loading, not input.
+	if( s_fStutter > 0 && fTotal > s_fStutter && s_nCount )
+		logFrame( pFrame );
+
+	s_nNext = (s_nNext + 1) % FRAME_HISTORY;
+	if( s_nCount < FRAME_HISTORY ) s_nCount++;
+}
+
+void frame_SetGpuTime( double fSeconds, int nAge )
+{
+	// age 0 is the frame in progress, which is not counted yet.
+	if( nAge < 0 || nAge > s_nCount || nAge >= FRAME_HISTORY ) return;
+	int nSlot = (s_nNext - nAge + FRAME_HISTORY) % FRAME_HISTORY;
+	s_aFrames[nSlot].m_fGpu = fSeconds;
+}
+
+int frame_GetCount()
+{
+	return s_nCount;
+}
+
+const FrameSample* frame_GetSample( int nAge )
+{
+	if( nAge < 0 || nAge >= s_nCount ) return NULL;
+	return &s_aFrames[(s_nNext - 1 - nAge + FRAME_HISTORY) % FRAME_HISTORY];
+}
+
+void frame_SetStutter( double fSeconds )
+{
+	s_fStutter = fSeconds;
+}
+
+const char* frame_PhaseName( int nPhase )
+{
+	return (nPhase >= 0 && nPhase < FRAME_PHASES) ? s_aPhaseNames[nPhase] : "?";
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Summary
+//////////////////////////////////////////////////////////////////////
+
+// Mean, 99th percentile and worst of one column of the ring; 'nPhase'
+// FRAME_PHASES is the total and FRAME_PHASES + 1 the GPU time. Returns
+// the number of frames that had a value.
+static int summarise( int nPhase, double* pMean, double* pP99, double* pMax )
+{
+	std::vector<double> times;
+	times.reserve( s_nCount );
+	for( int i = 0; i < s_nCount; i++ )
+	{
+		const FrameSample* pFrame = frame_GetSample( i );
+		double fTime = nPhase < FRAME_PHASES ? pFrame->m_aPhase[nPhase] :
+			nPhase == FRAME_PHASES ? pFrame->m_fTotal : pFrame->m_fGpu;
+		if( fTime >= 0 ) times.push_back( fTime );
+	}
+	*pMean = *pP99 = *pMax = 0;
+	if( times.empty() ) return 0;
+
+	std::sort( times.begin(), times.end() );
+	double fSum = 0;
+	for( size_t i = 0; i < times.size(); i++ )
+		fSum += times[i];
+	*pMean = fSum / times.size();
+	*pP99 = times[(size_t)(0.99 * (times.size() - 1) + 0.5)];
+	*pMax = times.back();
+	return (int) times.size();
+}
+
+static const char* columnName( int nColumn )
+{
+	return nColumn < FRAME_PHASES ? s_aPhaseNames[nColumn] :
+		nColumn == FRAME_PHASES ? "total" : "gpu";
+}
+
+void frame_LogStats()
+{
+	log_Logf( "frames: last %d, mean / p99 / max ms", s_nCount );
+	for( int i = 0; i <= FRAME_PHASES + 1; i++ )
+	{
+		double fMean, fP99, fMax;
+		if( !summarise( i, &fMean, &fP99, &fMax ) ) continue;
+		log_Logf( "    %-11s %7.2f %7.2f %7.2f", columnName( i ),
+			fMean * 1000, fP99 * 1000, fMax * 1000 );
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Lua bindings
+//////////////////////////////////////////////////////////////////////
+
+// frametime.getStats() returns { input={mean=, p99=, max=}, ... total=,
+// gpu= } in milliseconds over the frames in the ring.
+static int frametime_get_stats(lua_State *L) {
+	lua_createtable(L, 0, FRAME_PHASES + 3);
+	for (int i = 0; i <= FRAME_PHASES + 1; ++i) {
+		double mean, p99, max;
+		if (!summarise(i, &mean, &p99, &max)) continue;
+		lua_createtable(L, 0, 3);
+		lua_pushnumber(L, mean * 1000);
+		lua_setfield(L, -2, "mean");
+		lua_pushnumber(L, p99 * 1000);
+		lua_setfield(L, -2, "p99");
+		lua_pushnumber(L, max * 1000);
+		lua_setfield(L, -2, "max");
+		lua_setfield(L, -2, columnName(i));
+	}
+	lua_pushinteger(L, s_nCount);
+	lua_setfield(L, -2, "frames");
+	return 1;
+}
+
+static int frametime_log_stats(lua_State *L) {
+	frame_LogStats();
+	return 0;
+}
+
+// frametime.setStutter(ms); 0 stops long frames being logged.
+static int frametime_set_stutter(lua_State *L) {
+	frame_SetStutter(luaL_checknumber(L, 1) * 0.001);
+	return 0;
+}
+
+static const luaL_Reg frametime_funcs[] = {
+	{"getStats", frametime_get_stats},
+	{"logStats", frametime_log_stats},
+	{"setStutter", frametime_set_stutter},
+	{NULL, NULL}
+};
+
+int luaopen_frametime( lua_State* L )
+{
+	luaL_register(L, "frametime", frametime_funcs);
+	return 1;
+}
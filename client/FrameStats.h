@@ -0,0 +1,66 @@
+// FrameStats.h: per-frame phase timing over the last few seconds
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_FRAMESTATS_H
+#define FGM_FRAMESTATS_H
+
+struct lua_State;
+
+// Phases of a frame, in the order they run.
+enum FramePhase
+{
+	FRAME_INPUT,		// events since the last frame ended
+	FRAME_UPDATE,		// sg_update in Lua
+	FRAME_INTERPOLATE,	// moving networked entities
+	FRAME_RENDER,		// scene walk, issuing the draw calls
+	FRAME_SWAP,			// buffer swap, including waits for the GPU
+	FRAME_PHASES
+};
+
+// Frames kept in the ring buffer.
+#define FRAME_HISTORY	240
+
+// Frames longer than this are logged with their phases, in seconds.
+#define FRAME_STUTTER	0.05
+
+struct FrameSample
+{
+	double m_aPhase[FRAME_PHASES];	// seconds spent in each phase
+	double m_fTotal;				// sum of the phases
+	double m_fGpu;					// GPU time of the draw calls, or -1
+};
+
+// Start a frame. The time since the previous frame ended is counted as
+// input, since both main loops dispatch their events between frames.
+void frame_Begin();
+
+// End a phase: the time since the last mark goes to 'nPhase'. Ignored
+// outside frame_Begin and frame_End, so code shared with the tools can
+// mark phases whether or not anyone is timing frames.
+void frame_Mark( int nPhase );
+
+// End the frame, and log it if it took longer than the stutter limit.
+void frame_End();
+
+// GPU times arrive some frames after the commands they measure; 'nAge'
+// is how many frames ago those were drawn, 0 for the current frame.
+void frame_SetGpuTime( double fSeconds, int nAge );
+
+// Finished frames in the ring, up to FRAME_HISTORY, and one of them by
+// age: 0 is the most recent.
+int frame_GetCount();
+const FrameSample* frame_GetSample( int nAge );
+
+// Log the mean, 99th percentile and worst time of each phase.
+void frame_LogStats();
+
+// Set the stutter limit in seconds; 0 stops stutters being logged.
+void frame_SetStutter( double fSeconds );
+
+const char* frame_PhaseName( int nPhase );
+
+// Register the frametime library with Lua.
+int luaopen_frametime( lua_State* L );
+
+#endif // FGM_FRAMESTATS_H
@@ -0,0 +1,126 @@
+// HeadlessContext.cpp: an offscreen GL context for the benchmark tools
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+#include "HeadlessContext.h"
+
+#define EGL_EGLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <string.h>
+
+#include "Logger.h"
+
+static EGLDisplay g_display = EGL_NO_DISPLAY;
+static EGLContext g_context = EGL_NO_CONTEXT;
+static GLuint g_framebuffer = 0;
+static GLuint g_colourBuffer = 0;
+
+static PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers_;
+static PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer_;
+static PFNGLDELETEFRAMEBUFFERSPROC glDeleteFramebuffers_;
+static PFNGLGENRENDERBUFFERSPROC glGenRenderbuffers_;
+static PFNGLBINDRENDERBUFFERPROC glBindRenderbuffer_;
+static PFNGLDELETERENDERBUFFERSPROC glDeleteRenderbuffers_;
+static PFNGLRENDERBUFFERSTORAGEPROC glRenderbufferStorage_;
+static PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer_;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus_;
+
+
+// ---------------------------------------------------------------------
+
+bool CreateHeadlessContext(int width, int height)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		g_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (g_display == EGL_NO_DISPLAY)
+		g_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (g_display == EGL_NO_DISPLAY || !eglInitialize(g_display, &major, &minor)) {
+		log_Log("CreateHeadlessContext: cannot initialise EGL");
+		return false;
+	}
+
+	const char* extensions = eglQueryString(g_display, EGL_EXTENSIONS);
+	if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+		log_Log("CreateHeadlessContext: EGL_KHR_surfaceless_context not supported");
+		return false;
+	}
+
+	// The renderer uses the fixed function pipeline, so ask for desktop
+	// GL rather than GLES.
+	static const EGLint configAttribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_SURFACE_TYPE, 0,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglBindAPI(EGL_OPENGL_API) ||
+		!eglChooseConfig(g_display, configAttribs, &config, 1, &numConfigs) || !numConfigs) {
+		log_Log("CreateHeadlessContext: no desktop GL config");
+		return false;
+	}
+
+	g_context = eglCreateContext(g_display, config, EGL_NO_CONTEXT, NULL);
+	if (g_context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(g_display, EGL_NO_SURFACE, EGL_NO_SURFACE, g_context)) {
+		log_Log("CreateHeadlessContext: cannot make rendering context current");
+		return false;
+	}
+
+	glGenFramebuffers_ = (PFNGLGENFRAMEBUFFERSPROC) eglGetProcAddress("glGenFramebuffers");
+	glBindFramebuffer_ = (PFNGLBINDFRAMEBUFFERPROC) eglGetProcAddress("glBindFramebuffer");
+	glDeleteFramebuffers_ = (PFNGLDELETEFRAMEBUFFERSPROC) eglGetProcAddress("glDeleteFramebuffers");
+	glGenRenderbuffers_ = (PFNGLGENRENDERBUFFERSPROC) eglGetProcAddress("glGenRenderbuffers");
+	glBindRenderbuffer_ = (PFNGLBINDRENDERBUFFERPROC) eglGetProcAddress("glBindRenderbuffer");
+	glDeleteRenderbuffers_ = (PFNGLDELETERENDERBUFFERSPROC) eglGetProcAddress("glDeleteRenderbuffers");
+	glRenderbufferStorage_ = (PFNGLRENDERBUFFERSTORAGEPROC) eglGetProcAddress("glRenderbufferStorage");
+	glFramebufferRenderbuffer_ = (PFNGLFRAMEBUFFERRENDERBUFFERPROC) eglGetProcAddress("glFramebufferRenderbuffer");
+	glCheckFramebufferStatus_ = (PFNGLCHECKFRAMEBUFFERSTATUSPROC) eglGetProcAddress("glCheckFramebufferStatus");
+	if (!glGenFramebuffers_ || !glBindFramebuffer_ || !glDeleteFramebuffers_ ||
+		!glGenRenderbuffers_ || !glBindRenderbuffer_ || !glDeleteRenderbuffers_ ||
+		!glRenderbufferStorage_ || !glFramebufferRenderbuffer_ || !glCheckFramebufferStatus_) {
+		log_Log("CreateHeadlessContext: framebuffer objects not supported");
+		return false;
+	}
+
+	// There is no window, so draw into an offscreen colour buffer.
+	glGenRenderbuffers_(1, &g_colourBuffer);
+	glBindRenderbuffer_(GL_RENDERBUFFER, g_colourBuffer);
+	glRenderbufferStorage_(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenFramebuffers_(1, &g_framebuffer);
+	glBindFramebuffer_(GL_FRAMEBUFFER, g_framebuffer);
+	glFramebufferRenderbuffer_(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, g_colourBuffer);
+	if (glCheckFramebufferStatus_(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		log_Log("CreateHeadlessContext: framebuffer incomplete");
+		return false;
+	}
+
+	log_Logf("EGL %d.%d, %s, %s", major, minor,
+		(const char*) glGetString(GL_RENDERER), (const char*) glGetString(GL_VERSION));
+	return true;
+}
+
+void ReleaseHeadlessContext()
+{
+	if (g_framebuffer) glDeleteFramebuffers_(1, &g_framebuffer);
+	if (g_colourBuffer) glDeleteRenderbuffers_(1, &g_colourBuffer);
+	g_framebuffer = g_colourBuffer = 0;
+
+	if (g_display != EGL_NO_DISPLAY) {
+		eglMakeCurrent(g_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (g_context != EGL_NO_CONTEXT)
+			eglDestroyContext(g_display, g_context);
+		eglTerminate(g_display);
+	}
+	g_context = EGL_NO_CONTEXT;
+	g_display = EGL_NO_DISPLAY;
+}
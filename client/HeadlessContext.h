@@ -0,0 +1,14 @@
+// HeadlessContext.h: an offscreen GL context for the benchmark tools
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_HEADLESS_CONTEXT_H
+#define FGM_HEADLESS_CONTEXT_H
+
+// Create a surfaceless EGL context with desktop GL and make it current,
+// drawing into a framebuffer object of the given size. Failures are
+// logged; call ReleaseHeadlessContext either way.
+bool CreateHeadlessContext( int width, int height );
+void ReleaseHeadlessContext();
+
+#endif // FGM_HEADLESS_CONTEXT_H
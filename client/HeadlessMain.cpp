@@ -0,0 +1,313 @@
+// HeadlessMain.cpp: runs the client with no display, for benchmarks
+//
+// Renders into an offscreen framebuffer (see HeadlessContext.h), so the
+// full QSGOpenGLRenderer path runs on build machines without X11. The
+// scene from core.lua is run for a fixed number of frames with a fixed
+// time step, and the time spent in each frame is written out as CSV
+// along with a summary in the log.
+//
+// With -renderer soft the scene is drawn by QSGSoftwareRenderer and no
+// GL context is needed; -span forces its span loops down to portable (0),
+// SSE2 (1) or AVX2 (2) code for comparison. -capture records the timed
+// frames into a render trace for the replay tool. -graph 1 draws the
+// frame time overlay (see FrameStats.h) into the scene, and -trace
+// writes the timed frames out as Chrome trace events (TraceEvents.h).
+// -binlog logs to a binary file for logdecode instead of headless.log.
+// -audio plays sounds and music (see Audio.h) into a sink: null, a WAV
+// file as wav:file.wav, or alsa; there is no audio without it.
+//
+//   headless [-frames N] [-warmup N] [-size WxH] [-step ms]
+//            [-timings file.csv] [-dump file.ppm]
+//            [-renderer gl|soft] [-span N] [-capture file.qsgt]
+//            [-graph 0|1] [-trace file.json] [-binlog file.qlog]
+//            [-audio null|wav:file.wav|alsa]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <GL/gl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "Logger.h"
+#include "Timer.h"
+#include "FrameStats.h"
+#include "TraceEvents.h"
+#include "LuaController.h"
+#include "Audio.h"
+#include "HeadlessContext.h"
+#include "QSGOpenGLRenderer.h"
+#include "QSGSoftwareRenderer.h"
+
+
+LuaController* g_controller = 0;
+ref_ptr<QSGRenderer> g_renderer;
+
+const char *c_logFilename = "headless.log";
+const char *c_apiFilename = "api_init.lua";
+const char *c_coreFilename = "core.lua";
+const char *c_packFilename = "data.qpak";
+
+static QSGSoftwareRenderer* g_software = NULL;	// when rendering in software
+
+// Time spent in one frame, in seconds.
+struct FrameTiming
+{
+	double m_fUpdate;	// Lua sg_update and interpolation
+	double m_fRender;	// scene traversal and GL submission, or rasterizing
+	double m_fFinish;	// waiting for the GL to complete the frame
+};
+
+struct HeadlessOptions
+{
+	int m_nFrames;
+	int m_nWarmup;
+	int m_nWidth;
+	int m_nHeight;
+	double m_fStep;				// ms per frame given to update
+	const char* m_szTimings;
+	const char* m_szDump;
+	bool m_bSoftware;			// QSGSoftwareRenderer instead of GL
+	int m_nSpanLevel;			// forced span level, or -1
+	const char* m_szCapture;	// render trace of the timed frames
+	bool m_bGraph;				// frame time overlay
+	const char* m_szTrace;		// trace events of the timed frames
+	const char* m_szBinLog;		// binary log in place of headless.log
+	const char* m_szAudio;		// audio sink, or NULL for none
+};
+
+
+// ---------------------------------------------------------------------
+
+// Write the colour buffer as a binary PPM, top row first.
+bool DumpFrame(const char* filename, int width, int height)
+{
+	std::vector<unsigned char> pixels(width * height * 3);
+	if (g_software) {
+		// software rows are already top first; flip them to match GL.
+		const unsigned char* src = (const unsigned char*) g_software->getPixels();
+		for (int y = 0; y < height; ++y) {
+			unsigned char* dst = &pixels[(height - 1 - y) * width * 3];
+			for (int x = 0; x < width; ++x, src += 4, dst += 3) {
+				dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+			}
+		}
+	}
+	else {
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+	}
+
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		log_Logf("DumpFrame: cannot open %s", filename);
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	for (int y = height - 1; y >= 0; --y)
+		fwrite(&pixels[y * width * 3], 1, width * 3, file);
+	fclose(file);
+	return true;
+}
+
+
+// ---------------------------------------------------------------------
+
+static double percentile(std::vector<double>& sorted, double fraction)
+{
+	size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void logPhase(const char* name, std::vector<double> times)
+{
+	std::sort(times.begin(), times.end());
+	double total = 0;
+	for (size_t i = 0; i < times.size(); ++i) total += times[i];
+	log_Logf("  %-7s mean %7.3f  min %7.3f  p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms",
+		name, total * 1000 / times.size(), times.front() * 1000,
+		percentile(times, 0.5) * 1000, percentile(times, 0.95) * 1000,
+		percentile(times, 0.99) * 1000, times.back() * 1000);
+}
+
+void ReportTimings(const HeadlessOptions& options, const std::vector<FrameTiming>& frames)
+{
+	if (frames.empty()) return;
+
+	std::vector<double> update, render, finish, total;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		update.push_back(frames[i].m_fUpdate);
+		render.push_back(frames[i].m_fRender);
+		finish.push_back(frames[i].m_fFinish);
+		total.push_back(frames[i].m_fUpdate + frames[i].m_fRender + frames[i].m_fFinish);
+	}
+
+	log_Logf("%d frames at %dx%d:", (int)frames.size(), options.m_nWidth, options.m_nHeight);
+	logPhase("update", update);
+	logPhase("render", render);
+	logPhase("finish", finish);
+	logPhase("total", total);
+
+	if (!options.m_szTimings) return;
+	FILE* file = fopen(options.m_szTimings, "w");
+	if (!file) {
+		log_Logf("ReportTimings: cannot open %s", options.m_szTimings);
+		return;
+	}
+	fprintf(file, "frame,update_ms,render_ms,finish_ms,total_ms\n");
+	for (size_t i = 0; i < frames.size(); ++i) {
+		fprintf(file, "%d,%.4f,%.4f,%.4f,%.4f\n", (int)i,
+			update[i] * 1000, render[i] * 1000, finish[i] * 1000, total[i] * 1000);
+	}
+	fclose(file);
+}
+
+bool ParseOptions(int argc, char** argv, HeadlessOptions* options)
+{
+	options->m_nFrames = 600;
+	options->m_nWarmup = 60;
+	options->m_nWidth = 800;
+	options->m_nHeight = 600;
+	options->m_fStep = 1000.0 / 60;
+	options->m_szTimings = "frames.csv";
+	options->m_szDump = NULL;
+	options->m_bSoftware = false;
+	options->m_nSpanLevel = -1;
+	options->m_szCapture = NULL;
+	options->m_bGraph = false;
+	options->m_szTrace = NULL;
+	options->m_szBinLog = NULL;
+	options->m_szAudio = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-frames")) options->m_nFrames = atoi(value);
+		else if (!strcmp(arg, "-warmup")) options->m_nWarmup = atoi(value);
+		else if (!strcmp(arg, "-step")) options->m_fStep = atof(value);
+		else if (!strcmp(arg, "-timings")) options->m_szTimings = value;
+		else if (!strcmp(arg, "-dump")) options->m_szDump = value;
+		else if (!strcmp(arg, "-span")) options->m_nSpanLevel = atoi(value);
+		else if (!strcmp(arg, "-capture")) options->m_szCapture = value;
+		else if (!strcmp(arg, "-graph")) options->m_bGraph = atoi(value) != 0;
+		else if (!strcmp(arg, "-trace")) options->m_szTrace = value;
+		else if (!strcmp(arg, "-binlog")) options->m_szBinLog = value;
+		else if (!strcmp(arg, "-audio")) options->m_szAudio = value;
+		else if (!strcmp(arg, "-renderer")) {
+			if (!strcmp(value, "soft")) options->m_bSoftware = true;
+			else if (strcmp(value, "gl")) return false;
+		}
+		else if (!strcmp(arg, "-size")) {
+			if (sscanf(value, "%dx%d", &options->m_nWidth, &options->m_nHeight) != 2)
+				return false;
+		}
+		else return false;
+		++i;
+	}
+
+	return options->m_nFrames > 0 && options->m_nWarmup >= 0 &&
+		options->m_nWidth > 0 && options->m_nHeight > 0 && options->m_fStep >= 0;
+}
+
+int main(int argc, char** argv)
+{
+	HeadlessOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s [-frames N] [-warmup N] [-size WxH] [-step ms]\n"
+			"       [-timings file.csv] [-dump file.ppm]\n"
+			"       [-renderer gl|soft] [-span N] [-capture file.qsgt]\n"
+			"       [-graph 0|1] [-trace file.json] [-binlog file.qlog]\n"
+			"       [-audio null|wav:file.wav|alsa]\n", argv[0]);
+		return 2;
+	}
+
+	// create the log file
+	if (options.m_szBinLog) log_OpenBinary( options.m_szBinLog, NULL );
+	else log_Open( c_logFilename, NULL );
+	trace_SetThreadName( "main" );
+
+	if (options.m_bSoftware) {
+		if (options.m_nSpanLevel >= 0)
+			qsgSetSpanLevel(options.m_nSpanLevel);
+		log_Logf("Software renderer, span level %d of %d", qsgSpanLevel(), qsgSpanCpuLevel());
+		g_software = new QSGSoftwareRenderer();
+		g_renderer = g_software;
+	}
+	else {
+		if (!CreateHeadlessContext(options.m_nWidth, options.m_nHeight)) {
+			log_Log("... failed to create headless GL context");
+			ReleaseHeadlessContext();
+			log_Close();
+			return 1;
+		}
+		g_renderer = new QSGOpenGLRenderer();
+	}
+	g_renderer->initialise();
+
+	if (options.m_szAudio) audio_Open(options.m_szAudio);
+	g_controller = new LuaController(g_renderer);
+
+	// use the asset pack if there is one; loose files otherwise
+	g_controller->mountPack(c_packFilename);
+
+	// init lua and start client
+	g_controller->execLua(c_apiFilename);
+	g_controller->execLua(c_coreFilename);
+	g_controller->resize(options.m_nWidth, options.m_nHeight);
+	if (options.m_bGraph) g_controller->showFrameGraph(true);
+
+	// A fixed step keeps runs comparable; frame rate does not feed back
+	// into what the scene does.
+	std::vector<FrameTiming> frames;
+	frames.reserve(options.m_nFrames);
+	for (int i = 0; i < options.m_nWarmup + options.m_nFrames; ++i) {
+		if (i == options.m_nWarmup && options.m_szCapture)
+			g_controller->captureFrames(options.m_szCapture, options.m_nFrames);
+		if (i == options.m_nWarmup && options.m_szTrace)
+			trace_Start(options.m_szTrace, TRACE_MAX_EVENTS);
+
+		FrameTiming timing;
+		TRACE_ZONE("frame", "frame");
+		frame_Begin();
+		double start = timer_Now();
+		g_controller->update(options.m_fStep);
+		double updated = timer_Now();
+		g_controller->render();
+		double rendered = timer_Now();
+		if (!g_software) {
+			TRACE_ZONE("glFinish", "frame");
+			glFinish();
+		}
+		double finished = timer_Now();
+		frame_Mark(FRAME_SWAP);
+		frame_End();
+
+		timing.m_fUpdate = updated - start;
+		timing.m_fRender = rendered - updated;
+		timing.m_fFinish = finished - rendered;
+		if (i >= options.m_nWarmup) frames.push_back(timing);
+	}
+
+	trace_Stop();
+	ReportTimings(options, frames);
+	frame_LogStats();
+	if (options.m_szDump)
+		DumpFrame(options.m_szDump, options.m_nWidth, options.m_nHeight);
+
+	delete g_controller; // manually tracked.
+	g_controller = 0;
+	g_software = NULL;
+	g_renderer = 0; // free ref_ptr before the context goes.
+	audio_Close();
+
+	ReleaseHeadlessContext();
+	log_Close();
+
+	return 0;
+}
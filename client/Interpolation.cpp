@@ -0,0 +1,225 @@
+// Interpolation.cpp: smoothing of networked entity motion
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Interpolation.h"
+#include "QSGTransformNode.h"
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Fraction of the clock error corrected per second. Small enough that
+// the playback rate never visibly changes.
+#define INTERP_SLEW		0.5
+
+typedef std::vector<EntityInterpolator*> InterpolatorList;
+static InterpolatorList s_interpolators;
+
+
+// Difference between two samples in one channel; angles take the
+// shorter way round.
+static inline float channelDelta( const InterpSample& a, const InterpSample& b, int c )
+{
+	float d = b.m_aValues[c] - a.m_aValues[c];
+	if( c == INTERP_ANGLE )
+	{
+		while( d > 180.0f ) d -= 360.0f;
+		while( d < -180.0f ) d += 360.0f;
+	}
+	return d;
+}
+
+
+void interp_ApplyChannels( QSGTransform& transform, const float* aValues, unsigned int nMask )
+{
+	if( nMask & (1U << INTERP_X) ) transform.pos.x = aValues[INTERP_X];
+	if( nMask & (1U << INTERP_Y) ) transform.pos.y = aValues[INTERP_Y];
+	if( nMask & (1U << INTERP_ANGLE) ) transform.angle = aValues[INTERP_ANGLE];
+	if( nMask & (1U << INTERP_SCALE_X) ) transform.scale.x = aValues[INTERP_SCALE_X];
+	if( nMask & (1U << INTERP_SCALE_Y) ) transform.scale.y = aValues[INTERP_SCALE_Y];
+	if( nMask & (1U << INTERP_RED) ) transform.col.r = aValues[INTERP_RED];
+	if( nMask & (1U << INTERP_GREEN) ) transform.col.g = aValues[INTERP_GREEN];
+	if( nMask & (1U << INTERP_BLUE) ) transform.col.b = aValues[INTERP_BLUE];
+	if( nMask & (1U << INTERP_ALPHA) ) transform.col.a = aValues[INTERP_ALPHA];
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// EntityInterpolator
+//////////////////////////////////////////////////////////////////////
+
+EntityInterpolator::EntityInterpolator() :
+	m_fDelay(0.1), m_fMaxExtrapolation(0.25), m_nMode(INTERP_HERMITE),
+	m_fClock(0), m_fNewest(0), m_bSynced(false)
+{
+	s_interpolators.push_back( this );
+}
+
+EntityInterpolator::~EntityInterpolator()
+{
+	InterpolatorList::iterator it = std::find( s_interpolators.begin(), s_interpolators.end(), this );
+	if( it != s_interpolators.end() ) s_interpolators.erase( it );
+}
+
+void EntityInterpolator::AddSample( unsigned short nId, double fTime, const float* aValues, unsigned int nMask )
+{
+	Track& track = m_tracks[nId];
+	track.m_nMask |= nMask;
+
+	// Channels this sample leaves out keep the values of the newest one
+	// (the one merged into, at the same time), or 0 on a new track.
+	float aPrevious[INTERP_CHANNELS] = { 0 };
+
+	// A sample far older than the newest means the sender's clock went
+	// back (a restart, say): the track starts again from it.
+	if( track.m_nCount )
+	{
+		InterpSample& newest = track.m_aSamples[(track.m_nHead + track.m_nCount - 1) % INTERP_MAX_SAMPLES];
+		if( newest.m_fTime - fTime > INTERP_RESYNC ) track.m_nCount = 0;
+	}
+
+	InterpSample* pSample;
+	if( track.m_nCount )
+	{
+		InterpSample& newest = track.m_aSamples[(track.m_nHead + track.m_nCount - 1) % INTERP_MAX_SAMPLES];
+		if( fTime < newest.m_fTime ) return;
+		for( int c = 0; c < INTERP_CHANNELS; c++ ) aPrevious[c] = newest.m_aValues[c];
+		if( fTime == newest.m_fTime )
+		{
+			pSample = &newest;
+		}
+		else if( track.m_nCount < INTERP_MAX_SAMPLES )
+		{
+			pSample = &track.m_aSamples[(track.m_nHead + track.m_nCount++) % INTERP_MAX_SAMPLES];
+		}
+		else
+		{
+			pSample = &track.m_aSamples[track.m_nHead];
+			track.m_nHead = (track.m_nHead + 1) % INTERP_MAX_SAMPLES;
+		}
+	}
+	else
+	{
+		track.m_nHead = 0;
+		track.m_nCount = 1;
+		pSample = &track.m_aSamples[0];
+	}
+
+	pSample->m_fTime = fTime;
+	for( int c = 0; c < INTERP_CHANNELS; c++ )
+		pSample->m_aValues[c] = (nMask & (1U << c)) ? aValues[c] : aPrevious[c];
+
+	if( !m_bSynced )
+	{
+		m_fClock = m_fNewest = fTime;
+		m_bSynced = true;
+	}
+	else if( fTime > m_fNewest || m_fNewest - fTime > INTERP_RESYNC )
+	{
+		m_fNewest = fTime;
+	}
+}
+
+void EntityInterpolator::Bind( unsigned short nId, QSGTransformNode* pNode )
+{
+	m_tracks[nId].m_node = pNode;
+}
+
+void EntityInterpolator::Remove( unsigned short nId )
+{
+	m_tracks.erase( nId );
+}
+
+void EntityInterpolator::Evaluate( const Track& track, double fTime, float* aResult ) const
+{
+	int n = track.m_nCount;
+	const InterpSample& first = track.GetSample( 0 );
+	const InterpSample& last = track.GetSample( n - 1 );
+
+	if( n == 1 || fTime <= first.m_fTime )
+	{
+		for( int c = 0; c < INTERP_CHANNELS; c++ ) aResult[c] = first.m_aValues[c];
+		return;
+	}
+
+	if( fTime >= last.m_fTime )
+	{
+		// Carry on at the last velocity for a while, then hold.
+		const InterpSample& prev = track.GetSample( n - 2 );
+		double fAhead = fTime - last.m_fTime;
+		if( fAhead > m_fMaxExtrapolation ) fAhead = m_fMaxExtrapolation;
+		float u = (float)(fAhead / (last.m_fTime - prev.m_fTime));
+		for( int c = 0; c < INTERP_CHANNELS; c++ )
+			aResult[c] = last.m_aValues[c] + channelDelta( prev, last, c ) * u;
+		return;
+	}
+
+	int i = n - 2;
+	while( i > 0 && track.GetSample( i ).m_fTime > fTime ) i--;
+
+	const InterpSample& p0 = track.GetSample( i );
+	const InterpSample& p1 = track.GetSample( i + 1 );
+	double h = p1.m_fTime - p0.m_fTime;
+	float u = (float)((fTime - p0.m_fTime) / h);
+
+	if( m_nMode == INTERP_LINEAR )
+	{
+		for( int c = 0; c < INTERP_CHANNELS; c++ )
+			aResult[c] = p0.m_aValues[c] + channelDelta( p0, p1, c ) * u;
+		return;
+	}
+
+	// Cubic Hermite on [p0, p1], with tangents scaled to this interval.
+	float u2 = u * u, u3 = u2 * u;
+	float h10 = u3 - 2 * u2 + u;
+	float h01 = -2 * u3 + 3 * u2;
+	float h11 = u3 - u2;
+	const InterpSample* pBefore = (i > 0) ? &track.GetSample( i - 1 ) : NULL;
+	const InterpSample* pAfter = (i + 2 < n) ? &track.GetSample( i + 2 ) : NULL;
+	float fBefore = pBefore ? (float)(h / (p1.m_fTime - pBefore->m_fTime)) : 0;
+	float fAfter = pAfter ? (float)(h / (pAfter->m_fTime - p0.m_fTime)) : 0;
+
+	for( int c = 0; c < INTERP_CHANNELS; c++ )
+	{
+		float d = channelDelta( p0, p1, c );
+		float m0 = pBefore ? (channelDelta( *pBefore, p0, c ) + d) * fBefore : d;
+		float m1 = pAfter ? (d + channelDelta( p1, *pAfter, c )) * fAfter : d;
+		aResult[c] = p0.m_aValues[c] + h10 * m0 + h01 * d + h11 * m1;
+	}
+}
+
+void EntityInterpolator::Update( double fSeconds )
+{
+	if( !m_bSynced ) return;
+
+	m_fClock += fSeconds;
+	double fError = m_fNewest - m_fClock;
+	if( fabs( fError ) > INTERP_RESYNC )
+	{
+		// first samples, we stalled, or the sender's clock went back
+		m_fClock = m_fNewest;
+	}
+	else
+	{
+		double fRate = fSeconds * INTERP_SLEW;
+		m_fClock += fError * (fRate < 1 ? fRate : 1);
+	}
+
+	double fTime = m_fClock - m_fDelay;
+	float aValues[INTERP_CHANNELS];
+	for( TrackMap::iterator it = m_tracks.begin(); it != m_tracks.end(); ++it )
+	{
+		Track& track = it->second;
+		if( !track.m_node || !track.m_nCount ) continue;
+
+		Evaluate( track, fTime, aValues );
+		interp_ApplyChannels( track.m_node->m_transform, aValues, track.m_nMask );
+	}
+}
+
+void EntityInterpolator::UpdateAll( double fSeconds )
+{
+	for( InterpolatorList::iterator it = s_interpolators.begin(); it != s_interpolators.end(); ++it )
+		(*it)->Update( fSeconds );
+}
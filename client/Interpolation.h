@@ -0,0 +1,118 @@
+// Interpolation.h: smoothing of networked entity motion
+//
+// Networked entities arrive as discrete, jittery samples. An
+// EntityInterpolator keeps a short history of samples for each entity
+// and, once per frame, evaluates every bound entity at a point slightly
+// in the past (the playout delay) and writes the result into its
+// QSGTransformNode. When samples stop arriving it extrapolates from the
+// last known velocity for a bounded time, then holds.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_INTERPOLATION_H
+#define FGM_INTERPOLATION_H
+
+#include <map>
+
+#include "QSGObject.h"
+
+class QSGTransformNode;
+class QSGTransform;
+
+#define INTERP_MAX_SAMPLES	16		// per entity
+#define INTERP_RESYNC		1.0		// seconds of clock error before we jump
+
+// Transform components an entity can drive.
+//
+enum InterpChannel {
+	INTERP_X = 0,
+	INTERP_Y,
+	INTERP_ANGLE,		// degrees, interpolated the short way round
+	INTERP_SCALE_X,
+	INTERP_SCALE_Y,
+	INTERP_RED,
+	INTERP_GREEN,
+	INTERP_BLUE,
+	INTERP_ALPHA,
+	INTERP_CHANNELS
+};
+
+enum InterpMode {
+	INTERP_LINEAR = 0,
+	INTERP_HERMITE,		// Catmull-Rom tangents from neighbouring samples
+};
+
+struct InterpSample
+{
+	double m_fTime;
+	float m_aValues[INTERP_CHANNELS];
+};
+
+class EntityInterpolator
+{
+public:
+	EntityInterpolator();
+	~EntityInterpolator();
+
+	// Playout delay and extrapolation limit, in seconds.
+	inline void SetDelay( double fSeconds ) { m_fDelay = fSeconds; }
+	inline void SetMaxExtrapolation( double fSeconds ) { m_fMaxExtrapolation = fSeconds; }
+	inline void SetMode( int nMode ) { m_nMode = nMode; }
+
+	inline double GetDelay() const { return m_fDelay; }
+	inline double GetMaxExtrapolation() const { return m_fMaxExtrapolation; }
+	inline int GetMode() const { return m_nMode; }
+
+	// Record the state of an entity at a time on the sender's clock.
+	// nMask has bit (1 << channel) set for each channel the entity
+	// drives; other channels of the node are left alone. Channels missing
+	// from nMask hold the values of the entity's newest sample. Samples
+	// older than the newest one for the entity are ignored.
+	void AddSample( unsigned short nId, double fTime, const float* aValues, unsigned int nMask );
+
+	// Bind a node, or NULL to stop driving it. Removing an entity drops
+	// its samples as well.
+	void Bind( unsigned short nId, QSGTransformNode* pNode );
+	void Remove( unsigned short nId );
+
+	// Advance the local clock and write every bound entity's transform.
+	void Update( double fSeconds );
+
+	// Update every live interpolator; called once per frame.
+	static void UpdateAll( double fSeconds );
+
+protected:
+	struct Track
+	{
+		Track() : m_nCount(0), m_nHead(0), m_nMask(0) {}
+
+		const InterpSample& GetSample( int i ) const { return m_aSamples[(m_nHead + i) % INTERP_MAX_SAMPLES]; }
+
+		ref_ptr<QSGTransformNode> m_node;
+		InterpSample m_aSamples[INTERP_MAX_SAMPLES];	// ring, oldest at m_nHead
+		int m_nCount;
+		int m_nHead;
+		unsigned int m_nMask;
+	};
+
+	typedef std::map<unsigned short, Track> TrackMap;
+
+	void Evaluate( const Track& track, double fTime, float* aResult ) const;
+
+protected:
+	TrackMap m_tracks;
+	double m_fDelay;
+	double m_fMaxExtrapolation;
+	int m_nMode;
+
+	// Estimate of the sender's clock, slewed toward the newest sample.
+	double m_fClock;
+	double m_fNewest;
+	bool m_bSynced;
+};
+
+// Write the channels selected by nMask into a transform.
+//
+void interp_ApplyChannels( QSGTransform& transform, const float* aValues, unsigned int nMask );
+
+#endif // FGM_INTERPOLATION_H
@@ -0,0 +1,629 @@
+// JpegSimd.cpp: SSE2 and AVX2 inner loops for the stb_image JPEG decoder
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "JpegSimd.h"
+#include "QSGSoftwareSpans.h"
+#include "stb_image.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define JPEG_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define JPEG_TARGET_AVX2
+#else
+#define JPEG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static int s_nLevel = QSGSpanPortable;
+
+#ifdef JPEG_SIMD_X86
+
+// Constants as stb_image.c computes them, so the products match.
+#define f2f(x)  (int) (((x) * 4096 + 0.5))
+#define float2fixed(x)  ((int) ((x) * 65536 + 0.5))
+
+// YCbCr to RGB multipliers that do not fit in 16 bits are split into a
+// power of two, added to y before it is shifted up to 16.16, and a 16-bit
+// remainder for _mm_madd_epi16:
+//     r = y + cr + cr * CR_R
+//     g = y - cr + cr * CR_G + cb * CB_G
+//     b = y + 2 cb + cb * CB_B
+#define CR_R	(float2fixed(1.40200f) - 65536)
+#define CR_G	(65536 - float2fixed(0.71414f))
+#define CB_G	(-float2fixed(0.34414f))
+#define CB_B	(float2fixed(1.77200f) - 131072)
+
+
+// ---------------------------------------------------------------------
+// Portable edges, as in stb_image.c.
+
+static inline stbi_uc clampSample( int x )
+{
+	if ((unsigned int) x > 255) return x < 0 ? 0 : 255;
+	return (stbi_uc) x;
+}
+
+static void YCbCrToRGB( stbi_uc* out, const stbi_uc* y, const stbi_uc* pcb, const stbi_uc* pcr,
+	int nCount, int nStep )
+{
+	for (int i = 0; i < nCount; ++i) {
+		int nFixed = (y[i] << 16) + 32768;
+		int cr = pcr[i] - 128;
+		int cb = pcb[i] - 128;
+		out[0] = clampSample( (nFixed + cr * float2fixed(1.40200f)) >> 16 );
+		out[1] = clampSample( (nFixed - cr * float2fixed(0.71414f) - cb * float2fixed(0.34414f)) >> 16 );
+		out[2] = clampSample( (nFixed + cb * float2fixed(1.77200f)) >> 16 );
+		out[3] = 255;
+		out += nStep;
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// IDCT. stb_image's IDCT_1D on vectors of 32-bit lanes, one lane per
+// column in the first pass and per row in the second. Integer adds wrap
+// the same in any order, so the sums are grouped as convenient.
+
+#define IDCT_1D_VEC(V, ADD, SUB, MUL, SHL12, s0,s1,s2,s3,s4,s5,s6,s7) \
+	V p1 = MUL( ADD( s2, s6 ), f2f( 0.5411961f ) );					\
+	V t2 = ADD( p1, MUL( s6, f2f( -1.847759065f ) ) );				\
+	V t3 = ADD( p1, MUL( s2, f2f( 0.765366865f ) ) );				\
+	V t0 = SHL12( ADD( s0, s4 ) );									\
+	V t1 = SHL12( SUB( s0, s4 ) );									\
+	V x0 = ADD( t0, t3 );											\
+	V x3 = SUB( t0, t3 );											\
+	V x1 = ADD( t1, t2 );											\
+	V x2 = SUB( t1, t2 );											\
+	V q3 = ADD( s7, s3 );											\
+	V q4 = ADD( s5, s1 );											\
+	V q1 = ADD( s7, s1 );											\
+	V q2 = ADD( s5, s3 );											\
+	V p5 = MUL( ADD( q3, q4 ), f2f( 1.175875602f ) );				\
+	t0 = MUL( s7, f2f( 0.298631336f ) );							\
+	t1 = MUL( s5, f2f( 2.053119869f ) );							\
+	t2 = MUL( s3, f2f( 3.072711026f ) );							\
+	t3 = MUL( s1, f2f( 1.501321110f ) );							\
+	q1 = ADD( p5, MUL( q1, f2f( -0.899976223f ) ) );				\
+	q2 = ADD( p5, MUL( q2, f2f( -2.562915447f ) ) );				\
+	q3 = MUL( q3, f2f( -1.961570560f ) );							\
+	q4 = MUL( q4, f2f( -0.390180644f ) );							\
+	t3 = ADD( t3, ADD( q1, q4 ) );									\
+	t2 = ADD( t2, ADD( q2, q3 ) );									\
+	t1 = ADD( t1, ADD( q2, q4 ) );									\
+	t0 = ADD( t0, ADD( q1, q3 ) );
+
+// Finish a pass: v[k] = ((xk +- tk) + nBias) >> nShift, plus nOffset.
+#define IDCT_OUT_VEC(ADD, SUB, SET1, SRA, v, nBias, nShift, nOffset)	\
+	x0 = ADD( x0, SET1( nBias ) );									\
+	x1 = ADD( x1, SET1( nBias ) );									\
+	x2 = ADD( x2, SET1( nBias ) );									\
+	x3 = ADD( x3, SET1( nBias ) );									\
+	v[0] = ADD( SRA( ADD( x0, t3 ), nShift ), SET1( nOffset ) );		\
+	v[7] = ADD( SRA( SUB( x0, t3 ), nShift ), SET1( nOffset ) );		\
+	v[1] = ADD( SRA( ADD( x1, t2 ), nShift ), SET1( nOffset ) );		\
+	v[6] = ADD( SRA( SUB( x1, t2 ), nShift ), SET1( nOffset ) );		\
+	v[2] = ADD( SRA( ADD( x2, t1 ), nShift ), SET1( nOffset ) );		\
+	v[5] = ADD( SRA( SUB( x2, t1 ), nShift ), SET1( nOffset ) );		\
+	v[3] = ADD( SRA( ADD( x3, t0 ), nShift ), SET1( nOffset ) );		\
+	v[4] = ADD( SRA( SUB( x3, t0 ), nShift ), SET1( nOffset ) );
+
+// _mm_mullo_epi32 is SSE4.1; the low halves of the unsigned products
+// are the same bits.
+static inline __m128i mulSSE2( __m128i a, int k )
+{
+	__m128i vk = _mm_set1_epi32( k );
+	__m128i even = _mm_mul_epu32( a, vk );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), vk );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ),
+		_mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+static inline __m128i shl12SSE2( __m128i a )
+{
+	return _mm_slli_epi32( a, 12 );
+}
+
+static inline __m128i sraSSE2( __m128i a, int nShift )
+{
+	return _mm_sra_epi32( a, _mm_cvtsi32_si128( nShift ) );
+}
+
+static inline void idctPassSSE2( __m128i* v, int nBias, int nShift, int nOffset )
+{
+	IDCT_1D_VEC( __m128i, _mm_add_epi32, _mm_sub_epi32, mulSSE2, shl12SSE2,
+		v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7] )
+	IDCT_OUT_VEC( _mm_add_epi32, _mm_sub_epi32, _mm_set1_epi32, sraSSE2, v, nBias, nShift, nOffset )
+}
+
+static inline void transpose4x32( __m128i* v )
+{
+	__m128i a0 = _mm_unpacklo_epi32( v[0], v[1] );
+	__m128i a1 = _mm_unpacklo_epi32( v[2], v[3] );
+	__m128i a2 = _mm_unpackhi_epi32( v[0], v[1] );
+	__m128i a3 = _mm_unpackhi_epi32( v[2], v[3] );
+	v[0] = _mm_unpacklo_epi64( a0, a1 );
+	v[1] = _mm_unpackhi_epi64( a0, a1 );
+	v[2] = _mm_unpacklo_epi64( a2, a3 );
+	v[3] = _mm_unpackhi_epi64( a2, a3 );
+}
+
+static inline void transpose8x16( __m128i* v )
+{
+	__m128i a0 = _mm_unpacklo_epi16( v[0], v[1] );
+	__m128i a1 = _mm_unpackhi_epi16( v[0], v[1] );
+	__m128i a2 = _mm_unpacklo_epi16( v[2], v[3] );
+	__m128i a3 = _mm_unpackhi_epi16( v[2], v[3] );
+	__m128i a4 = _mm_unpacklo_epi16( v[4], v[5] );
+	__m128i a5 = _mm_unpackhi_epi16( v[4], v[5] );
+	__m128i a6 = _mm_unpacklo_epi16( v[6], v[7] );
+	__m128i a7 = _mm_unpackhi_epi16( v[6], v[7] );
+	__m128i b0 = _mm_unpacklo_epi32( a0, a2 );
+	__m128i b1 = _mm_unpackhi_epi32( a0, a2 );
+	__m128i b2 = _mm_unpacklo_epi32( a1, a3 );
+	__m128i b3 = _mm_unpackhi_epi32( a1, a3 );
+	__m128i b4 = _mm_unpacklo_epi32( a4, a6 );
+	__m128i b5 = _mm_unpackhi_epi32( a4, a6 );
+	__m128i b6 = _mm_unpacklo_epi32( a5, a7 );
+	__m128i b7 = _mm_unpackhi_epi32( a5, a7 );
+	v[0] = _mm_unpacklo_epi64( b0, b4 );
+	v[1] = _mm_unpackhi_epi64( b0, b4 );
+	v[2] = _mm_unpacklo_epi64( b1, b5 );
+	v[3] = _mm_unpackhi_epi64( b1, b5 );
+	v[4] = _mm_unpacklo_epi64( b2, b6 );
+	v[5] = _mm_unpackhi_epi64( b2, b6 );
+	v[6] = _mm_unpacklo_epi64( b3, b7 );
+	v[7] = _mm_unpackhi_epi64( b3, b7 );
+}
+
+// col[k] holds output column k of rows 0..7, offset by 128; pack them
+// down to bytes with the clamp and store them a row at a time.
+static inline void storeIdctRows( stbi_uc* out, int nStride, __m128i* col )
+{
+	transpose8x16( col );
+	for (int i = 0; i < 8; i += 2) {
+		__m128i bytes = _mm_packus_epi16( col[i], col[i + 1] );
+		_mm_storel_epi64( (__m128i*) (out + i * nStride), bytes );
+		_mm_storel_epi64( (__m128i*) (out + (i + 1) * nStride), _mm_srli_si128( bytes, 8 ) );
+	}
+}
+
+static void idctSSE2( stbi_uc* out, int nStride, short data[64], unsigned short* dequantize )
+{
+	// dequantize to 32 bits: columns 0..3 and 4..7 of each row
+	__m128i left[8], right[8], ac = _mm_setzero_si128();
+	for (int i = 0; i < 8; ++i) {
+		__m128i d = _mm_loadu_si128( (const __m128i*) (data + i * 8) );
+		__m128i q = _mm_loadu_si128( (const __m128i*) (dequantize + i * 8) );
+		__m128i lo = _mm_mullo_epi16( d, q );
+		__m128i hi = _mm_mulhi_epi16( d, q );
+		left[i] = _mm_unpacklo_epi16( lo, hi );
+		right[i] = _mm_unpackhi_epi16( lo, hi );
+		if (i) ac = _mm_or_si128( ac, d );
+	}
+
+	// columns, keeping 2 extra bits as stb_image does
+	__m128i dcLeft = _mm_slli_epi32( left[0], 2 ), dcRight = _mm_slli_epi32( right[0], 2 );
+	idctPassSSE2( left, 512, 10, 0 );
+	idctPassSSE2( right, 512, 10, 0 );
+
+	// stb_image takes the DC term alone for columns with no AC terms. It
+	// is what the IDCT gives anyway, unless corrupt data overflows.
+	__m128i dcOnly = _mm_cmpeq_epi16( ac, _mm_setzero_si128() );
+	__m128i maskLeft = _mm_unpacklo_epi16( dcOnly, dcOnly );
+	__m128i maskRight = _mm_unpackhi_epi16( dcOnly, dcOnly );
+	for (int i = 0; i < 8; ++i) {
+		left[i] = _mm_or_si128( _mm_and_si128( maskLeft, dcLeft ), _mm_andnot_si128( maskLeft, left[i] ) );
+		right[i] = _mm_or_si128( _mm_and_si128( maskRight, dcRight ), _mm_andnot_si128( maskRight, right[i] ) );
+	}
+
+	// rows 0..3 and 4..7, each vector now holding one column
+	__m128i top[8] = { left[0], left[1], left[2], left[3], right[0], right[1], right[2], right[3] };
+	__m128i bottom[8] = { left[4], left[5], left[6], left[7], right[4], right[5], right[6], right[7] };
+	transpose4x32( top );
+	transpose4x32( top + 4 );
+	transpose4x32( bottom );
+	transpose4x32( bottom + 4 );
+	idctPassSSE2( top, 65536, 17, 128 );
+	idctPassSSE2( bottom, 65536, 17, 128 );
+
+	__m128i col[8];
+	for (int k = 0; k < 8; ++k)
+		col[k] = _mm_packs_epi32( top[k], bottom[k] );
+	storeIdctRows( out, nStride, col );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i mulAVX2( __m256i a, int k )
+{
+	return _mm256_mullo_epi32( a, _mm256_set1_epi32( k ) );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i addAVX2( __m256i a, __m256i b )
+{
+	return _mm256_add_epi32( a, b );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i subAVX2( __m256i a, __m256i b )
+{
+	return _mm256_sub_epi32( a, b );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i set1AVX2( int n )
+{
+	return _mm256_set1_epi32( n );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i shl12AVX2( __m256i a )
+{
+	return _mm256_slli_epi32( a, 12 );
+}
+
+JPEG_TARGET_AVX2 static inline __m256i sraAVX2( __m256i a, int nShift )
+{
+	return _mm256_sra_epi32( a, _mm_cvtsi32_si128( nShift ) );
+}
+
+JPEG_TARGET_AVX2 static inline void idctPassAVX2( __m256i* v, int nBias, int nShift, int nOffset )
+{
+	IDCT_1D_VEC( __m256i, addAVX2, subAVX2, mulAVX2, shl12AVX2,
+		v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7] )
+	IDCT_OUT_VEC( addAVX2, subAVX2, set1AVX2, sraAVX2, v, nBias, nShift, nOffset )
+}
+
+JPEG_TARGET_AVX2 static inline void transpose8x32( __m256i* v )
+{
+	__m256i a0 = _mm256_unpacklo_epi32( v[0], v[1] );
+	__m256i a1 = _mm256_unpackhi_epi32( v[0], v[1] );
+	__m256i a2 = _mm256_unpacklo_epi32( v[2], v[3] );
+	__m256i a3 = _mm256_unpackhi_epi32( v[2], v[3] );
+	__m256i a4 = _mm256_unpacklo_epi32( v[4], v[5] );
+	__m256i a5 = _mm256_unpackhi_epi32( v[4], v[5] );
+	__m256i a6 = _mm256_unpacklo_epi32( v[6], v[7] );
+	__m256i a7 = _mm256_unpackhi_epi32( v[6], v[7] );
+	__m256i b0 = _mm256_unpacklo_epi64( a0, a2 );
+	__m256i b1 = _mm256_unpackhi_epi64( a0, a2 );
+	__m256i b2 = _mm256_unpacklo_epi64( a1, a3 );
+	__m256i b3 = _mm256_unpackhi_epi64( a1, a3 );
+	__m256i b4 = _mm256_unpacklo_epi64( a4, a6 );
+	__m256i b5 = _mm256_unpackhi_epi64( a4, a6 );
+	__m256i b6 = _mm256_unpacklo_epi64( a5, a7 );
+	__m256i b7 = _mm256_unpackhi_epi64( a5, a7 );
+	v[0] = _mm256_permute2x128_si256( b0, b4, 0x20 );
+	v[1] = _mm256_permute2x128_si256( b1, b5, 0x20 );
+	v[2] = _mm256_permute2x128_si256( b2, b6, 0x20 );
+	v[3] = _mm256_permute2x128_si256( b3, b7, 0x20 );
+	v[4] = _mm256_permute2x128_si256( b0, b4, 0x31 );
+	v[5] = _mm256_permute2x128_si256( b1, b5, 0x31 );
+	v[6] = _mm256_permute2x128_si256( b2, b6, 0x31 );
+	v[7] = _mm256_permute2x128_si256( b3, b7, 0x31 );
+}
+
+// All eight columns of a row fit in one vector, so each pass is done once.
+JPEG_TARGET_AVX2 static void idctAVX2( stbi_uc* out, int nStride, short data[64], unsigned short* dequantize )
+{
+	__m256i v[8];
+	__m128i ac = _mm_setzero_si128();
+	for (int i = 0; i < 8; ++i) {
+		__m128i d = _mm_loadu_si128( (const __m128i*) (data + i * 8) );
+		__m256i q = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*) (dequantize + i * 8) ) );
+		v[i] = _mm256_mullo_epi32( _mm256_cvtepi16_epi32( d ), q );
+		if (i) ac = _mm_or_si128( ac, d );
+	}
+
+	__m256i dc = _mm256_slli_epi32( v[0], 2 );
+	idctPassAVX2( v, 512, 10, 0 );
+	__m256i dcOnly = _mm256_cvtepi16_epi32( _mm_cmpeq_epi16( ac, _mm_setzero_si128() ) );
+	for (int i = 0; i < 8; ++i)
+		v[i] = _mm256_blendv_epi8( v[i], dc, dcOnly );
+	transpose8x32( v );
+	idctPassAVX2( v, 65536, 17, 128 );
+
+	__m128i col[8];
+	for (int k = 0; k < 8; ++k)
+		col[k] = _mm_packs_epi32( _mm256_castsi256_si128( v[k] ), _mm256_extracti128_si256( v[k], 1 ) );
+	storeIdctRows( out, nStride, col );
+}
+
+
+// ---------------------------------------------------------------------
+// YCbCr to RGB, eight pixels at a time.
+
+// Multiplier pairs for _mm_madd_epi16 on interleaved cr, cb.
+static inline __m128i crcbPair( int nCr, int nCb )
+{
+	return _mm_set1_epi32( (int) (((unsigned int) nCb << 16) | ((unsigned int) nCr & 0xffff)) );
+}
+
+// One channel: (base << 16) + 32768 + the madd, shifted down to 16 bits.
+static inline __m128i channelSSE2( __m128i base, __m128i crcbLo, __m128i crcbHi, __m128i k )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32( 32768 );
+	__m128i lo = _mm_add_epi32( _mm_unpacklo_epi16( zero, base ), _mm_madd_epi16( crcbLo, k ) );
+	__m128i hi = _mm_add_epi32( _mm_unpackhi_epi16( zero, base ), _mm_madd_epi16( crcbHi, k ) );
+	lo = _mm_srai_epi32( _mm_add_epi32( lo, round ), 16 );
+	hi = _mm_srai_epi32( _mm_add_epi32( hi, round ), 16 );
+	return _mm_packs_epi32( lo, hi );
+}
+
+// y, cb and cr as 16 bits, to two vectors of four R, G, B, 255 pixels.
+static inline void convertSSE2( __m128i y, __m128i cb, __m128i cr, __m128i* rgba )
+{
+	__m128i crcbLo = _mm_unpacklo_epi16( cr, cb );
+	__m128i crcbHi = _mm_unpackhi_epi16( cr, cb );
+	__m128i r = channelSSE2( _mm_add_epi16( y, cr ), crcbLo, crcbHi, crcbPair( CR_R, 0 ) );
+	__m128i g = channelSSE2( _mm_sub_epi16( y, cr ), crcbLo, crcbHi, crcbPair( CR_G, CB_G ) );
+	__m128i b = channelSSE2( _mm_add_epi16( y, _mm_add_epi16( cb, cb ) ), crcbLo, crcbHi, crcbPair( 0, CB_B ) );
+
+	// packus does the clamp
+	__m128i rg = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), _mm_packus_epi16( g, g ) );
+	__m128i ba = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), _mm_set1_epi8( -1 ) );
+	rgba[0] = _mm_unpacklo_epi16( rg, ba );
+	rgba[1] = _mm_unpackhi_epi16( rg, ba );
+}
+
+// Pixels of nStep bytes, written four bytes at a time like stb_image
+// does; each fourth byte is overwritten by the next pixel.
+static inline void storePixels( stbi_uc* out, const __m128i* rgba, int nStep )
+{
+	if (nStep == 4) {
+		_mm_storeu_si128( (__m128i*) out, rgba[0] );
+		_mm_storeu_si128( (__m128i*) (out + 16), rgba[1] );
+		return;
+	}
+	for (int i = 0; i < 2; ++i) {
+		__m128i v = rgba[i];
+		for (int k = 0; k < 4; ++k, out += nStep) {
+			int nPixel = _mm_cvtsi128_si32( v );
+			memcpy( out, &nPixel, 4 );
+			v = _mm_srli_si128( v, 4 );
+		}
+	}
+}
+
+static void YCbCrToRGBSSE2( stbi_uc* out, const stbi_uc* y, const stbi_uc* cb, const stbi_uc* cr,
+	int nCount, int nStep )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i bias = _mm_set1_epi16( 128 );
+	int i = 0;
+	for (; i + 8 <= nCount; i += 8, out += 8 * nStep) {
+		__m128i y16 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (y + i) ), zero );
+		__m128i cb16 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (cb + i) ), zero );
+		__m128i cr16 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (cr + i) ), zero );
+		__m128i rgba[2];
+		convertSSE2( y16, _mm_sub_epi16( cb16, bias ), _mm_sub_epi16( cr16, bias ), rgba );
+		storePixels( out, rgba, nStep );
+	}
+	YCbCrToRGB( out, y + i, cb + i, cr + i, nCount - i, nStep );
+}
+
+// Sixteen pixels at a time; the arithmetic is done across both halves
+// and the pixels are interleaved a half at a time. Three byte pixels
+// are packed with pshufb (AVX2 implies SSSE3) and stored exactly.
+JPEG_TARGET_AVX2 static inline __m256i channelAVX2( __m256i base, __m256i crcbLo, __m256i crcbHi, __m256i k )
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i round = _mm256_set1_epi32( 32768 );
+	__m256i lo = _mm256_add_epi32( _mm256_unpacklo_epi16( zero, base ), _mm256_madd_epi16( crcbLo, k ) );
+	__m256i hi = _mm256_add_epi32( _mm256_unpackhi_epi16( zero, base ), _mm256_madd_epi16( crcbHi, k ) );
+	lo = _mm256_srai_epi32( _mm256_add_epi32( lo, round ), 16 );
+	hi = _mm256_srai_epi32( _mm256_add_epi32( hi, round ), 16 );
+	return _mm256_packs_epi32( lo, hi );
+}
+
+JPEG_TARGET_AVX2 static inline void storePixelsAVX2( stbi_uc* out, __m128i r, __m128i g, __m128i b, int nStep )
+{
+	__m128i rg = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), _mm_packus_epi16( g, g ) );
+	__m128i ba = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), _mm_set1_epi8( -1 ) );
+	__m128i rgba[2] = { _mm_unpacklo_epi16( rg, ba ), _mm_unpackhi_epi16( rg, ba ) };
+	if (nStep != 3) {
+		storePixels( out, rgba, nStep );
+		return;
+	}
+	__m128i pack = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+	__m128i p0 = _mm_shuffle_epi8( rgba[0], pack );
+	__m128i p1 = _mm_shuffle_epi8( rgba[1], pack );
+	_mm_storeu_si128( (__m128i*) out, _mm_or_si128( p0, _mm_slli_si128( p1, 12 ) ) );
+	_mm_storel_epi64( (__m128i*) (out + 16), _mm_srli_si128( p1, 4 ) );
+}
+
+JPEG_TARGET_AVX2 static void YCbCrToRGBAVX2( stbi_uc* out, const stbi_uc* y, const stbi_uc* cb, const stbi_uc* cr,
+	int nCount, int nStep )
+{
+	__m256i bias = _mm256_set1_epi16( 128 );
+	__m256i kR = _mm256_broadcastsi128_si256( crcbPair( CR_R, 0 ) );
+	__m256i kG = _mm256_broadcastsi128_si256( crcbPair( CR_G, CB_G ) );
+	__m256i kB = _mm256_broadcastsi128_si256( crcbPair( 0, CB_B ) );
+	int i = 0;
+	for (; i + 16 <= nCount; i += 16, out += 16 * nStep) {
+		__m256i y16 = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (y + i) ) );
+		__m256i cb16 = _mm256_sub_epi16( _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (cb + i) ) ), bias );
+		__m256i cr16 = _mm256_sub_epi16( _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (cr + i) ) ), bias );
+		__m256i crcbLo = _mm256_unpacklo_epi16( cr16, cb16 );
+		__m256i crcbHi = _mm256_unpackhi_epi16( cr16, cb16 );
+		__m256i r = channelAVX2( _mm256_add_epi16( y16, cr16 ), crcbLo, crcbHi, kR );
+		__m256i g = channelAVX2( _mm256_sub_epi16( y16, cr16 ), crcbLo, crcbHi, kG );
+		__m256i b = channelAVX2( _mm256_add_epi16( y16, _mm256_add_epi16( cb16, cb16 ) ), crcbLo, crcbHi, kB );
+		storePixelsAVX2( out, _mm256_castsi256_si128( r ), _mm256_castsi256_si128( g ),
+			_mm256_castsi256_si128( b ), nStep );
+		storePixelsAVX2( out + 8 * nStep, _mm256_extracti128_si256( r, 1 ), _mm256_extracti128_si256( g, 1 ),
+			_mm256_extracti128_si256( b, 1 ), nStep );
+	}
+	YCbCrToRGBSSE2( out, y + i, cb + i, cr + i, nCount - i, nStep );
+}
+
+
+// ---------------------------------------------------------------------
+// 2x upsampling. Output pairs are built as 16-bit words, first sample in
+// the low byte, so they store in order.
+
+#define div4(x) ((stbi_uc) ((x) >> 2))
+#define div16(x) ((stbi_uc) ((x) >> 4))
+
+static inline __m128i load8x16( const stbi_uc* p )
+{
+	return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) p ), _mm_setzero_si128() );
+}
+
+static inline __m128i pairSSE2( __m128i first, __m128i second )
+{
+	return _mm_or_si128( first, _mm_slli_epi16( second, 8 ) );
+}
+
+// Horizontal: out[2i] = (3 in[i] + in[i-1] + 2) / 4, and out[2i+1]
+// likewise with in[i+1], for i from nStart until the last but one.
+static stbi_uc* resampleRowH2Rest( stbi_uc* out, const stbi_uc* in, int w, int i )
+{
+	for (; i + 9 <= w; i += 8) {
+		__m128i n = _mm_add_epi16( _mm_mullo_epi16( load8x16( in + i ), _mm_set1_epi16( 3 ) ), _mm_set1_epi16( 2 ) );
+		__m128i even = _mm_srli_epi16( _mm_add_epi16( n, load8x16( in + i - 1 ) ), 2 );
+		__m128i odd = _mm_srli_epi16( _mm_add_epi16( n, load8x16( in + i + 1 ) ), 2 );
+		_mm_storeu_si128( (__m128i*) (out + i * 2), pairSSE2( even, odd ) );
+	}
+	for (; i < w - 1; ++i) {
+		int n = 3 * in[i] + 2;
+		out[i * 2 + 0] = div4( n + in[i - 1] );
+		out[i * 2 + 1] = div4( n + in[i + 1] );
+	}
+	out[i * 2 + 0] = div4( in[w - 2] * 3 + in[w - 1] + 2 );
+	out[i * 2 + 1] = in[w - 1];
+	return out;
+}
+
+static stbi_uc* resampleRowH2SSE2( stbi_uc* out, stbi_uc* inNear, stbi_uc* inFar, int w, int hs )
+{
+	if (w == 1) {
+		out[0] = out[1] = inNear[0];
+		return out;
+	}
+	out[0] = inNear[0];
+	out[1] = div4( inNear[0] * 3 + inNear[1] + 2 );
+	return resampleRowH2Rest( out, inNear, w, 1 );
+}
+
+JPEG_TARGET_AVX2 static stbi_uc* resampleRowH2AVX2( stbi_uc* out, stbi_uc* inNear, stbi_uc* inFar, int w, int hs )
+{
+	if (w == 1) {
+		out[0] = out[1] = inNear[0];
+		return out;
+	}
+	out[0] = inNear[0];
+	out[1] = div4( inNear[0] * 3 + inNear[1] + 2 );
+	int i = 1;
+	for (; i + 17 <= w; i += 16) {
+		__m256i n = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inNear + i) ) );
+		n = _mm256_add_epi16( _mm256_mullo_epi16( n, _mm256_set1_epi16( 3 ) ), _mm256_set1_epi16( 2 ) );
+		__m256i left = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inNear + i - 1) ) );
+		__m256i right = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inNear + i + 1) ) );
+		__m256i even = _mm256_srli_epi16( _mm256_add_epi16( n, left ), 2 );
+		__m256i odd = _mm256_srli_epi16( _mm256_add_epi16( n, right ), 2 );
+		_mm256_storeu_si256( (__m256i*) (out + i * 2), _mm256_or_si256( even, _mm256_slli_epi16( odd, 8 ) ) );
+	}
+	return resampleRowH2Rest( out, inNear, w, i );
+}
+
+// Both ways: t[i] = 3 near[i] + far[i], then out[2i-1] and out[2i] mix
+// t[i-1] and t[i] 3:1 and 1:3, for i from nStart to the end.
+static stbi_uc* resampleRowHV2Rest( stbi_uc* out, const stbi_uc* inNear, const stbi_uc* inFar, int w, int i )
+{
+	__m128i eight = _mm_set1_epi16( 8 );
+	for (; i + 8 <= w; i += 8) {
+		__m128i prev = _mm_add_epi16( _mm_mullo_epi16( load8x16( inNear + i - 1 ), _mm_set1_epi16( 3 ) ),
+			load8x16( inFar + i - 1 ) );
+		__m128i cur = _mm_add_epi16( _mm_mullo_epi16( load8x16( inNear + i ), _mm_set1_epi16( 3 ) ),
+			load8x16( inFar + i ) );
+		__m128i odd = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( prev, _mm_set1_epi16( 3 ) ), cur ), eight ), 4 );
+		__m128i even = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( cur, _mm_set1_epi16( 3 ) ), prev ), eight ), 4 );
+		_mm_storeu_si128( (__m128i*) (out + i * 2 - 1), pairSSE2( odd, even ) );
+	}
+	int t1 = 3 * inNear[i - 1] + inFar[i - 1];
+	for (; i < w; ++i) {
+		int t0 = t1;
+		t1 = 3 * inNear[i] + inFar[i];
+		out[i * 2 - 1] = div16( 3 * t0 + t1 + 8 );
+		out[i * 2] = div16( 3 * t1 + t0 + 8 );
+	}
+	out[w * 2 - 1] = div4( t1 + 2 );
+	return out;
+}
+
+static stbi_uc* resampleRowHV2SSE2( stbi_uc* out, stbi_uc* inNear, stbi_uc* inFar, int w, int hs )
+{
+	if (w == 1) {
+		out[0] = out[1] = div4( 3 * inNear[0] + inFar[0] + 2 );
+		return out;
+	}
+	out[0] = div4( 3 * inNear[0] + inFar[0] + 2 );
+	return resampleRowHV2Rest( out, inNear, inFar, w, 1 );
+}
+
+JPEG_TARGET_AVX2 static stbi_uc* resampleRowHV2AVX2( stbi_uc* out, stbi_uc* inNear, stbi_uc* inFar, int w, int hs )
+{
+	if (w == 1) {
+		out[0] = out[1] = div4( 3 * inNear[0] + inFar[0] + 2 );
+		return out;
+	}
+	out[0] = div4( 3 * inNear[0] + inFar[0] + 2 );
+	__m256i three = _mm256_set1_epi16( 3 );
+	__m256i eight = _mm256_set1_epi16( 8 );
+	int i = 1;
+	for (; i + 16 <= w; i += 16) {
+		__m256i prev = _mm256_add_epi16(
+			_mm256_mullo_epi16( _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inNear + i - 1) ) ), three ),
+			_mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inFar + i - 1) ) ) );
+		__m256i cur = _mm256_add_epi16(
+			_mm256_mullo_epi16( _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inNear + i) ) ), three ),
+			_mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*) (inFar + i) ) ) );
+		__m256i odd = _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( _mm256_mullo_epi16( prev, three ), cur ), eight ), 4 );
+		__m256i even = _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( _mm256_mullo_epi16( cur, three ), prev ), eight ), 4 );
+		_mm256_storeu_si256( (__m256i*) (out + i * 2 - 1), _mm256_or_si256( odd, _mm256_slli_epi16( even, 8 ) ) );
+	}
+	return resampleRowHV2Rest( out, inNear, inFar, w, i );
+}
+
+#endif // JPEG_SIMD_X86
+
+
+// ---------------------------------------------------------------------
+
+int jpeg_InstallSimd( int nLevel )
+{
+	if (nLevel > qsgSpanCpuLevel()) nLevel = qsgSpanCpuLevel();
+	if (nLevel < QSGSpanPortable) nLevel = QSGSpanPortable;
+
+	// NULL puts back stb_image's own loops.
+	stbi_idct_8x8 idct = NULL;
+	stbi_YCbCr_to_RGB_run colour = NULL;
+	stbi_resample_run h2 = NULL, hv2 = NULL;
+#ifdef JPEG_SIMD_X86
+	if (nLevel == QSGSpanSSE2) {
+		idct = idctSSE2;
+		colour = YCbCrToRGBSSE2;
+		h2 = resampleRowH2SSE2;
+		hv2 = resampleRowHV2SSE2;
+	}
+	else if (nLevel == QSGSpanAVX2) {
+		idct = idctAVX2;
+		colour = YCbCrToRGBAVX2;
+		h2 = resampleRowH2AVX2;
+		hv2 = resampleRowHV2AVX2;
+	}
+#endif
+	stbi_install_idct( idct );
+	stbi_install_YCbCr_to_RGB( colour );
+	stbi_install_resample_row_h_2( h2 );
+	stbi_install_resample_row_hv_2( hv2 );
+
+	s_nLevel = nLevel;
+	return nLevel;
+}
+
+int jpeg_SimdLevel( void )
+{
+	return s_nLevel;
+}
@@ -0,0 +1,21 @@
+// JpegSimd.h: SSE2 and AVX2 inner loops for the stb_image JPEG decoder
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_JPEGSIMD_H
+#define FGM_JPEGSIMD_H
+
+// The 8x8 IDCT, the YCbCr to RGB conversion and the 2x chroma upsampling
+// (resample_row_h_2 and resample_row_hv_2) are installed into stb_image
+// through its STBI_SIMD hooks. Every level decodes exactly the same
+// pixels as stb_image's own loops.
+//
+// Levels are those of the software span loops (QSGSpanLevel), and are
+// capped at what qsgSpanCpuLevel() finds the CPU supports.
+
+// Install the loops for nLevel, or put back stb_image's own for 0.
+// Returns the level installed. Call before any image is loaded.
+int jpeg_InstallSimd( int nLevel );
+int jpeg_SimdLevel( void );
+
+#endif
@@ -0,0 +1,170 @@
+// LogDecodeMain.cpp: expands binary logs into text
+//
+// Reads a log written by log_OpenBinary (headless -binlog, or any main
+// that opens its log that way) and writes each line as text, with the
+// seconds since the log was opened in front. Lines below -level are
+// left out. The log must come from a machine with the same byte order.
+//
+//   logdecode file.qlog [-level debug|info|warn|error] [-out file.txt]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+#include "LogFormat.h"
+
+// Longest line written, as in the logger.
+#define DECODE_LINE	4096
+
+struct DecodeOptions
+{
+	const char* m_szInput;
+	const char* m_szOutput;		// NULL for stdout
+	int m_nLevel;
+};
+
+static const char* c_levelNames[] = { "debug", "info", "warn", "error" };
+
+static const char* LevelPrefix(int level)
+{
+	switch (level) {
+	case LOG_DEBUG: return "debug: ";
+	case LOG_WARN: return "warning: ";
+	case LOG_ERROR: return "error: ";
+	}
+	return "";
+}
+
+bool ParseOptions(int argc, char** argv, DecodeOptions* options)
+{
+	options->m_szInput = NULL;
+	options->m_szOutput = NULL;
+	options->m_nLevel = LOG_DEBUG;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (arg[0] != '-') {
+			if (options->m_szInput) return false;
+			options->m_szInput = arg;
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-out")) options->m_szOutput = value;
+		else if (!strcmp(arg, "-level")) {
+			int level = -1;
+			for (int j = 0; j < 4; ++j)
+				if (!strcmp(value, c_levelNames[j])) level = j;
+			if (level < 0) return false;
+			options->m_nLevel = level;
+		}
+		else return false;
+		++i;
+	}
+
+	return options->m_szInput != NULL;
+}
+
+// Reads the fields of one record; false at the end of the file, or where
+// a record was cut short by a crash.
+static bool Read(FILE* file, void* data, size_t size)
+{
+	return fread(data, 1, size, file) == size;
+}
+
+static bool ReadString(FILE* file, std::string& str)
+{
+	unsigned short len;
+	if (!Read(file, &len, 2)) return false;
+	str.resize(len);
+	return len == 0 || Read(file, &str[0], len);
+}
+
+int main(int argc, char** argv)
+{
+	DecodeOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s file.qlog [-level debug|info|warn|error] [-out file.txt]\n", argv[0]);
+		return 2;
+	}
+
+	FILE* file = fopen(options.m_szInput, "rb");
+	if (!file) {
+		fprintf(stderr, "cannot open %s\n", options.m_szInput);
+		return 1;
+	}
+	char magic[4];
+	int version = 0;
+	if (!Read(file, magic, 4) || memcmp(magic, LOGFMT_MAGIC, 4) ||
+		!Read(file, &version, 4) || version != LOGFMT_VERSION) {
+		fprintf(stderr, "%s is not a version %d binary log\n", options.m_szInput, LOGFMT_VERSION);
+		fclose(file);
+		return 1;
+	}
+	FILE* out = options.m_szOutput ? fopen(options.m_szOutput, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", options.m_szOutput);
+		fclose(file);
+		return 1;
+	}
+
+	std::vector<std::string> formats;
+	std::string text;
+	static char line[DECODE_LINE];
+	long lines = 0, bad = 0;
+	bool complete = false;
+
+	for (;;) {
+		int tag = fgetc(file);
+		if (tag == EOF) {
+			complete = true;
+			break;
+		}
+		if (tag == 'F') {
+			unsigned int id;
+			if (!Read(file, &id, 4) || !ReadString(file, text)) break;
+			if (id >= formats.size()) formats.resize(id + 1);
+			formats[id] = text;
+			continue;
+		}
+		if (tag != 'T' && tag != 'R') {
+			fprintf(stderr, "unknown record '%c' at offset %ld\n", tag, ftell(file) - 1);
+			break;
+		}
+
+		unsigned char level;
+		double time;
+		unsigned int id = 0;
+		if (!Read(file, &level, 1) || !Read(file, &time, 8)) break;
+		if (tag == 'R' && !Read(file, &id, 4)) break;
+		if (!ReadString(file, text)) break;
+		if (level < options.m_nLevel) continue;
+
+		const char* str = text.c_str();
+		if (tag == 'R') {
+			if (id >= formats.size() ||
+				!logfmt_Format(formats[id].c_str(), text.data(), (int) text.size(), line, sizeof(line))) {
+				sprintf(line, "(cannot expand format %u)", id);
+				bad++;
+			}
+			str = line;
+		}
+		fprintf(out, "%12.6f %s%s\n", time, LevelPrefix(level), str);
+		lines++;
+	}
+
+	if (!complete) fprintf(stderr, "%s: log ends part way through a record\n", options.m_szInput);
+	if (bad) fprintf(stderr, "%ld lines could not be expanded\n", bad);
+	fprintf(stderr, "%ld lines, %d formats\n", lines, (int) formats.size());
+
+	fclose(file);
+	if (out != stdout) fclose(out);
+	return 0;
+}
@@ -0,0 +1,353 @@
+// LogFormat.cpp: printf arguments packed for binary logs, and expanded again
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "LogFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#define snprintf _snprintf
+typedef __int64 logfmt_int64;
+#else
+#include <stdint.h>
+typedef int64_t logfmt_int64;
+#endif
+
+// Longest conversion spec, "%-+#0*.*lld" and the like, that is expanded.
+#define LOGFMT_MAX_SPEC	32
+
+// One conversion in a format string.
+struct Conversion
+{
+	const char* m_pStart;		// the '%'
+	const char* m_pEnd;			// just past the conversion character
+	int m_nStars;				// '*' widths and precisions before the value
+	char m_cType;				// argument type; 0 for "%%", '?' if unsupported
+};
+
+// Argument types: 'i' int, 'l' long, 'L' long long, 'z' size_t,
+// 'p' pointer, 'd' double, 'D' long double, 's' string.
+static int typeSize( char cType )
+{
+	switch( cType )
+	{
+	case 'i': return 4;
+	case 's': return 2;		// the length; the characters are extra
+	}
+	return 8;
+}
+
+// Find the next conversion in 'p'; NULL once there are no more.
+static const char* findConversion( const char* p, Conversion* pConv )
+{
+	p = strchr( p, '%' );
+	if( !p ) return NULL;
+	pConv->m_pStart = p++;
+	pConv->m_nStars = 0;
+
+	if( *p == '%' )
+	{
+		pConv->m_pEnd = p + 1;
+		pConv->m_cType = 0;
+		return pConv->m_pEnd;
+	}
+
+	// flags, width and precision
+	while( *p && strchr( "-+ #0'", *p ) ) p++;
+	if( *p == '*' ) { pConv->m_nStars++; p++; }
+	else while( *p >= '0' && *p <= '9' ) p++;
+	if( *p == '.' )
+	{
+		p++;
+		if( *p == '*' ) { pConv->m_nStars++; p++; }
+		else while( *p >= '0' && *p <= '9' ) p++;
+	}
+
+	// length
+	int nLong = 0;
+	bool bSize = false, bLongDouble = false;
+	for( ;; p++ )
+	{
+		if( *p == 'h' ) continue;
+		else if( *p == 'l' ) nLong++;
+		else if( *p == 'q' || *p == 'j' ) nLong = 2;
+		else if( *p == 'z' || *p == 't' ) bSize = true;
+		else if( *p == 'L' ) bLongDouble = true;
+		else break;
+	}
+
+	char cType = '?';
+	switch( *p )
+	{
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		cType = bSize ? 'z' : nLong >= 2 ? 'L' : nLong ? 'l' : 'i';
+		break;
+	case 'c':
+		if( !nLong ) cType = 'i';
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		cType = bLongDouble ? 'D' : 'd';
+		break;
+	case 's':
+		if( !nLong ) cType = 's';
+		break;
+	case 'p':
+		cType = 'p';
+		break;
+	}
+	pConv->m_cType = cType;
+	pConv->m_pEnd = *p ? p + 1 : p;
+	return pConv->m_pEnd;
+}
+
+bool logfmt_Parse( const char* szFormat, char* szTypes )
+{
+	Conversion conv;
+	int nArgs = 0;
+	const char* p = szFormat;
+	while( (p = findConversion( p, &conv )) != NULL )
+	{
+		if( !conv.m_cType ) continue;
+		if( conv.m_cType == '?' ) return false;
+		if( nArgs + conv.m_nStars + 1 > LOGFMT_MAX_ARGS ) return false;
+		for( int i = 0; i < conv.m_nStars; i++ )
+			szTypes[nArgs++] = 'i';
+		szTypes[nArgs++] = conv.m_cType;
+	}
+	szTypes[nArgs] = '\0';
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Packing
+//////////////////////////////////////////////////////////////////////
+
+int logfmt_Pack( const char* szTypes, va_list vaArgs, char* pBuffer, int nSize )
+{
+	// the numbers always fit; strings share what is left over.
+	int nSpare = nSize;
+	for( const char* t = szTypes; *t; t++ )
+		nSpare -= typeSize( *t );
+	if( nSpare < 0 ) return -1;
+
+	char* p = pBuffer;
+	for( const char* t = szTypes; *t; t++ )
+	{
+		switch( *t )
+		{
+		case 'i':
+			{
+				int n = va_arg( vaArgs, int );
+				memcpy( p, &n, 4 );
+				break;
+			}
+		case 'l':
+			{
+				logfmt_int64 n = va_arg( vaArgs, long );
+				memcpy( p, &n, 8 );
+				break;
+			}
+		case 'L':
+			{
+				logfmt_int64 n = va_arg( vaArgs, long long );
+				memcpy( p, &n, 8 );
+				break;
+			}
+		case 'z':
+			{
+				logfmt_int64 n = (logfmt_int64) va_arg( vaArgs, size_t );
+				memcpy( p, &n, 8 );
+				break;
+			}
+		case 'p':
+			{
+				logfmt_int64 n = (logfmt_int64)(size_t) va_arg( vaArgs, void* );
+				memcpy( p, &n, 8 );
+				break;
+			}
+		case 'd':
+			{
+				double f = va_arg( vaArgs, double );
+				memcpy( p, &f, 8 );
+				break;
+			}
+		case 'D':
+			{
+				double f = (double) va_arg( vaArgs, long double );
+				memcpy( p, &f, 8 );
+				break;
+			}
+		case 's':
+			{
+				const char* sz = va_arg( vaArgs, const char* );
+				if( !sz ) sz = "(null)";
+				size_t nLen = strlen( sz );
+				if( nLen > (size_t) nSpare ) nLen = nSpare;
+				if( nLen > 0xffff ) nLen = 0xffff;
+				unsigned short nShort = (unsigned short) nLen;
+				memcpy( p, &nShort, 2 );
+				memcpy( p + 2, sz, nLen );
+				p += nLen;
+				nSpare -= (int) nLen;
+				break;
+			}
+		}
+		p += typeSize( *t );
+	}
+	return (int)(p - pBuffer);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Expanding
+//////////////////////////////////////////////////////////////////////
+
+// Read one number of type 'cType' from the packed arguments.
+static bool readArg( const char*& p, const char* pEnd, char cType, void* pValue )
+{
+	int nSize = typeSize( cType );
+	if( p + nSize > pEnd ) return false;
+	memcpy( pValue, p, nSize );
+	p += nSize;
+	return true;
+}
+
+#define LOGFMT_PRINT( value ) \
+	( nStars == 0 ? snprintf( szOut, nOut, szSpec, value ) : \
+	  nStars == 1 ? snprintf( szOut, nOut, szSpec, aStars[0], value ) : \
+	  snprintf( szOut, nOut, szSpec, aStars[0], aStars[1], value ) )
+
+bool logfmt_Format( const char* szFormat, const char* pArgs, int nArgs,
+	char* szText, int nSize )
+{
+	const char* pEnd = pArgs + nArgs;
+	char* szOut = szText;
+	int nOut = nSize;
+	Conversion conv;
+	const char* p = szFormat;
+	const char* pNext;
+	bool bOk = true;
+
+	if( nSize <= 0 ) return false;
+	szText[0] = '\0';
+
+	while( nOut > 1 && (pNext = findConversion( p, &conv )) != NULL )
+	{
+		// the text up to the conversion
+		int nText = (int)(conv.m_pStart - p);
+		if( nText > nOut - 1 ) nText = nOut - 1;
+		memcpy( szOut, p, nText );
+		szOut += nText;
+		nOut -= nText;
+		*szOut = '\0';
+		p = pNext;
+
+		if( !conv.m_cType )
+		{
+			if( nOut > 1 ) { *szOut++ = '%'; nOut--; *szOut = '\0'; }
+			continue;
+		}
+		int nSpec = (int)(conv.m_pEnd - conv.m_pStart);
+		if( conv.m_cType == '?' || nSpec >= LOGFMT_MAX_SPEC || conv.m_nStars > 2 )
+		{
+			bOk = false;
+			break;
+		}
+		char szSpec[LOGFMT_MAX_SPEC];
+		memcpy( szSpec, conv.m_pStart, nSpec );
+		szSpec[nSpec] = '\0';
+
+		int aStars[2];
+		int nStars = conv.m_nStars;
+		for( int i = 0; i < nStars; i++ )
+			if( !readArg( pArgs, pEnd, 'i', &aStars[i] ) ) { bOk = false; break; }
+		if( !bOk ) break;
+
+		int nWritten = 0;
+		switch( conv.m_cType )
+		{
+		case 'i':
+			{
+				int n;
+				if( !(bOk = readArg( pArgs, pEnd, 'i', &n )) ) break;
+				nWritten = LOGFMT_PRINT( n );
+				break;
+			}
+		case 'l':
+			{
+				logfmt_int64 n;
+				if( !(bOk = readArg( pArgs, pEnd, 'l', &n )) ) break;
+				nWritten = LOGFMT_PRINT( (long) n );
+				break;
+			}
+		case 'L':
+			{
+				logfmt_int64 n;
+				if( !(bOk = readArg( pArgs, pEnd, 'L', &n )) ) break;
+				nWritten = LOGFMT_PRINT( (long long) n );
+				break;
+			}
+		case 'z':
+			{
+				logfmt_int64 n;
+				if( !(bOk = readArg( pArgs, pEnd, 'z', &n )) ) break;
+				nWritten = LOGFMT_PRINT( (size_t) n );
+				break;
+			}
+		case 'p':
+			{
+				logfmt_int64 n;
+				if( !(bOk = readArg( pArgs, pEnd, 'p', &n )) ) break;
+				nWritten = LOGFMT_PRINT( (void*)(size_t) n );
+				break;
+			}
+		case 'd':
+			{
+				double f;
+				if( !(bOk = readArg( pArgs, pEnd, 'd', &f )) ) break;
+				nWritten = LOGFMT_PRINT( f );
+				break;
+			}
+		case 'D':
+			{
+				double f;
+				if( !(bOk = readArg( pArgs, pEnd, 'D', &f )) ) break;
+				nWritten = LOGFMT_PRINT( (long double) f );
+				break;
+			}
+		case 's':
+			{
+				unsigned short nLen;
+				if( !(bOk = readArg( pArgs, pEnd, 's', &nLen )) ) break;
+				if( !(bOk = pArgs + nLen <= pEnd) ) break;
+				char szArg[1024];
+				if( nLen >= sizeof(szArg) ) nLen = sizeof(szArg) - 1;
+				memcpy( szArg, pArgs, nLen );
+				szArg[nLen] = '\0';
+				pArgs += nLen;
+				nWritten = LOGFMT_PRINT( szArg );
+				break;
+			}
+		}
+		if( !bOk ) break;
+
+		// snprintf says what it would have written, which may not fit.
+		if( nWritten < 0 || nWritten > nOut - 1 ) nWritten = nOut - 1;
+		szOut += nWritten;
+		nOut -= nWritten;
+		*szOut = '\0';
+	}
+
+	// the text after the last conversion
+	if( bOk && nOut > 1 )
+	{
+		int nText = (int) strlen( p );
+		if( nText > nOut - 1 ) nText = nOut - 1;
+		memcpy( szOut, p, nText );
+		szOut[nText] = '\0';
+	}
+	return bOk;
+}
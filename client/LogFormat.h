@@ -0,0 +1,42 @@
+// LogFormat.h: printf arguments packed for binary logs, and expanded again
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_LOGFORMAT_H
+#define FGM_LOGFORMAT_H
+
+#include <stdarg.h>
+
+// A binary log starts with LOGFMT_MAGIC and LOGFMT_VERSION (four bytes
+// each), followed by records that begin with a tag byte. Numbers are in
+// the byte order of the machine that wrote the log.
+//
+//   'F'  u32 id, u16 length, format string
+//        Defines a format before the first record that uses it.
+//   'T'  u8 level, f64 seconds, u16 length, text
+//        A line logged without a format, or one that could not be packed.
+//   'R'  u8 level, f64 seconds, u32 id, u16 length, packed arguments
+//        A line to be expanded from format 'id' and its arguments.
+//
+#define LOGFMT_MAGIC	"QLOG"
+#define LOGFMT_VERSION	1
+
+// Conversions, '*' widths included, that one format may have.
+#define LOGFMT_MAX_ARGS	16
+
+// Find the argument types of 'szFormat', one character per argument, in
+// szTypes[LOGFMT_MAX_ARGS + 1]. Returns false for formats that cannot be
+// packed: %n, wide strings, unknown conversions or too many arguments.
+bool logfmt_Parse( const char* szFormat, char* szTypes );
+
+// Pack the arguments for 'szTypes' into pBuffer. Integers and pointers are
+// stored raw, strings copied and cut short to fit. Returns the bytes used,
+// or -1 if even the numbers do not fit.
+int logfmt_Pack( const char* szTypes, va_list vaArgs, char* pBuffer, int nSize );
+
+// Expand packed arguments with their format into szText, as vsnprintf
+// would have. Returns false if the arguments do not match the format.
+bool logfmt_Format( const char* szFormat, const char* pArgs, int nArgs,
+	char* szText, int nSize );
+
+#endif // FGM_LOGFORMAT_H
@@ -12,6 +12,9 @@
 #endif
 
 #include "Logger.h"
+#include "LogFormat.h"
+#include "Thread.h"
+#include "Timer.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -20,22 +23,385 @@
 
 #include <string.h>
 #include <stdarg.h>
+#include <vector>
+#include <map>
+
+#ifdef WINDOWS
+#define vsnprintf _vsnprintf
+#endif
 
 #define LOG_BUFFER 1024
 
+// Lines the queue holds; a power of two.
+#define LOG_QUEUE 512
+
+// Lines per second let through by default.
+#define LOG_RATE_LIMIT 1000
+
+// How long the writer sleeps once the queue is empty, in milliseconds.
+#define LOG_WRITER_SLEEP 2
+
+// Formats each thread remembers the types of; a power of two.
+#define LOG_FORMAT_CACHE 256
+
+// Binary logs still show lines from this level up on the console.
+#define LOG_BINARY_ECHO LOG_WARN
+
+// One line in the queue. A slot whose sequence equals the enqueue
+// position is free for that position; one whose sequence is the position
+// plus one holds a finished line. The writer frees it for the position a
+// whole lap later.
+struct LogSlot
+{
+	volatile long m_nSequence;
+	long m_nPosition;				// claimed for, until published
+	int m_nLevel;
+	int m_nFormat;					// binary records: format id; -1 for text
+	int m_nSize;					// binary records: bytes of arguments
+	double m_fTime;					// binary logs: seconds since opening
+	char m_szText[LOG_BUFFER + 1];	// the text, or the packed arguments
+};
+
+// Sets up the slot sequences before anything can log.
+class LogQueue
+{
+public:
+	LogQueue();
+	LogSlot* Claim();
+	void Publish( LogSlot* pSlot );
+	LogSlot* Peek();
+	void Release( LogSlot* pSlot );
+private:
+	LogSlot m_aSlots[LOG_QUEUE];
+	volatile long m_nEnqueue;		// next position for a producer to claim
+	long m_nDequeue;				// writer thread only
+};
+
+static LogQueue s_queue;
 
 static FILE* m_file = NULL;
+static Thread* s_pWriter = NULL;
+static volatile long s_nStop = 0;
+
+static volatile long s_nLevel = LOG_DEBUG;
+static volatile long s_nRateLimit = LOG_RATE_LIMIT;
+static volatile long s_nRateSecond = 0;		// second the count below is for
+static volatile long s_nRateLines = 0;
+
+static volatile bool s_bBinary = false;
+static double s_fOpened = 0;
+static int s_nFormatsWritten = 0;		// writer thread only
+
+static volatile long s_nWritten = 0;
+static volatile long s_nRateLimited = 0;
+static volatile long s_nOverflowed = 0;
+
+// Formatting happens here, on the calling thread, before the line is
+// copied into the queue.
+static THREAD_LOCAL char s_szFormat[LOG_BUFFER + 1];
+
+// A format string seen in binary mode, and the argument types it takes.
+// Formats are kept by pointer, so they must be string literals, as every
+// log_Logf call in the tree passes.
+struct LogFormat
+{
+	const char* m_szFormat;
+	int m_nId;
+	bool m_bPacked;						// false: format it as text instead
+	char m_szTypes[LOGFMT_MAX_ARGS + 1];
+};
+
+static Mutex s_formatLock;
+static std::vector<const LogFormat*> s_formats;		// by id; never freed
+static std::map<const char*, const LogFormat*> s_formatIds;
+static THREAD_LOCAL const LogFormat* s_aFormatCache[LOG_FORMAT_CACHE];
 
 #ifdef WINDOWS
 static HWND m_hWndLog = NULL;
+static Mutex s_windowLock;
+static std::string s_strWindow;		// written, not yet in the log window
 #endif
 
-int log_Open( const char *szFilename, void* hWnd )
+
+//////////////////////////////////////////////////////////////////////
+// Queue
+//////////////////////////////////////////////////////////////////////
+
+LogQueue::LogQueue()
+{
+	for( long i = 0; i < LOG_QUEUE; i++ )
+		m_aSlots[i].m_nSequence = i;
+	m_nEnqueue = 0;
+	m_nDequeue = 0;
+}
+
+// Any thread. Returns a slot to fill and publish, or NULL, without
+// waiting, if the queue is full.
+LogSlot* LogQueue::Claim()
+{
+	long nPos = atomic_Load( &m_nEnqueue );
+	for( ;; )
+	{
+		LogSlot* pSlot = &m_aSlots[nPos & (LOG_QUEUE - 1)];
+		long nDiff = (long)((unsigned long) atomic_Load( &pSlot->m_nSequence ) - (unsigned long) nPos);
+		if( nDiff == 0 )
+		{
+			// claim the slot; another producer may get there first.
+			if( atomic_CompareExchange( &m_nEnqueue, nPos, (long)((unsigned long) nPos + 1) ) )
+			{
+				pSlot->m_nPosition = nPos;
+				return pSlot;
+			}
+			nPos = atomic_Load( &m_nEnqueue );
+		}
+		else if( nDiff < 0 ) return NULL;		// still holds a line from a lap ago
+		else nPos = atomic_Load( &m_nEnqueue );
+	}
+}
+
+// Hand a filled slot to the writer.
+void LogQueue::Publish( LogSlot* pSlot )
+{
+	atomic_Store( &pSlot->m_nSequence, (long)((unsigned long) pSlot->m_nPosition + 1) );
+}
+
+// Writer thread only. Returns the oldest line, or NULL if it is not
+// finished; one still being filled in holds up the lines behind it.
+LogSlot* LogQueue::Peek()
+{
+	LogSlot* pSlot = &m_aSlots[m_nDequeue & (LOG_QUEUE - 1)];
+	if( atomic_Load( &pSlot->m_nSequence ) != (long)((unsigned long) m_nDequeue + 1) ) return NULL;
+	return pSlot;
+}
+
+// Free the slot from Peek for the position a lap on.
+void LogQueue::Release( LogSlot* pSlot )
+{
+	atomic_Store( &pSlot->m_nSequence, (long)((unsigned long) m_nDequeue + LOG_QUEUE) );
+	m_nDequeue = (long)((unsigned long) m_nDequeue + 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Writer
+//////////////////////////////////////////////////////////////////////
+
+#ifdef WINDOWS
+void fixNewlines(std::string& str)
+{
+	std::string::size_type pos = 0;
+	while ( (pos = str.find("\n", pos)) != std::string::npos ) {
+		str.replace( pos, 1, "\r\n" );
+		pos += 2; // len of replacement text
+	}
+}
+
+void writeToLogWindow(const char* buf)
+{
+	std::string str(buf);
+	fixNewlines(str);
+
+	//SetWindowRedraw( m_hWndLog, FALSE );
+	LRESULT nLen = SendMessage( m_hWndLog, WM_GETTEXTLENGTH, 0, 0 );
+	SendMessage( m_hWndLog, EM_SETSEL, (WPARAM)nLen, (LPARAM)nLen );
+	SendMessage( m_hWndLog, EM_REPLACESEL, (WPARAM)FALSE, (LPARAM)str.c_str() );
+	//SetWindowRedraw( m_hWndLog, TRUE );
+	//InvalidateRect( m_hWndLog, NULL, FALSE );
+}
+#endif
+
+static const char* levelPrefix( int nLevel )
+{
+	switch( nLevel )
+	{
+	case LOG_DEBUG: return "debug: ";
+	case LOG_WARN: return "warning: ";
+	case LOG_ERROR: return "error: ";
+	}
+	return "";
+}
+
+static void echoLine( int nLevel, const char* szText )
+{
+	const char* szPrefix = levelPrefix( nLevel );
+
+#ifdef WINDOWS
+	// Keep the line for the log window
+	if( m_hWndLog )
+	{
+		MutexLock lock( s_windowLock );
+		s_strWindow.append( szPrefix );
+		s_strWindow.append( szText );
+		s_strWindow.append( "\n" );
+	}
+#else
+	// Write to the console
+	printf( "%s%s\n", szPrefix, szText );
+#endif
+}
+
+static void writeBinary( char cTag, int nLevel, double fTime )
+{
+	unsigned char nLevelByte = (unsigned char) nLevel;
+	fputc( cTag, m_file );
+	fwrite( &nLevelByte, 1, 1, m_file );
+	fwrite( &fTime, 8, 1, m_file );
+}
+
+// Define every format up to 'nId' that this file has not seen yet.
+static void writeFormats( int nId )
+{
+	while( s_nFormatsWritten <= nId )
+	{
+		const LogFormat* pFormat;
+		{
+			MutexLock lock( s_formatLock );
+			pFormat = s_formats[s_nFormatsWritten];
+		}
+		unsigned int nFormat = (unsigned int) pFormat->m_nId;
+		size_t nLen = strlen( pFormat->m_szFormat );
+		unsigned short nShort = (unsigned short)(nLen > 0xffff ? 0xffff : nLen);
+		fputc( 'F', m_file );
+		fwrite( &nFormat, 4, 1, m_file );
+		fwrite( &nShort, 2, 1, m_file );
+		fwrite( pFormat->m_szFormat, 1, nShort, m_file );
+		s_nFormatsWritten++;
+	}
+}
+
+static void writeLine( int nLevel, double fTime, const char* szText )
+{
+	if( !s_bBinary )
+	{
+		// Write the line to the log file
+		if( m_file ) fprintf( m_file, "%s%s\n", levelPrefix( nLevel ), szText );
+		echoLine( nLevel, szText );
+	}
+	else
+	{
+		if( m_file )
+		{
+			size_t nLen = strlen( szText );
+			unsigned short nShort = (unsigned short)(nLen > 0xffff ? 0xffff : nLen);
+			writeBinary( 'T', nLevel, fTime );
+			fwrite( &nShort, 2, 1, m_file );
+			fwrite( szText, 1, nShort, m_file );
+		}
+		if( nLevel >= LOG_BINARY_ECHO ) echoLine( nLevel, szText );
+	}
+	atomic_Add( &s_nWritten, 1 );
+}
+
+// A binary record: its arguments are written as they are, and expanded
+// only if the line is to be shown.
+static void writeRecord( const LogSlot* pSlot )
+{
+	const LogFormat* pFormat;
+	{
+		MutexLock lock( s_formatLock );
+		pFormat = s_formats[pSlot->m_nFormat];
+	}
+	if( m_file )
+	{
+		writeFormats( pSlot->m_nFormat );
+		unsigned int nFormat = (unsigned int) pSlot->m_nFormat;
+		unsigned short nSize = (unsigned short) pSlot->m_nSize;
+		writeBinary( 'R', pSlot->m_nLevel, pSlot->m_fTime );
+		fwrite( &nFormat, 4, 1, m_file );
+		fwrite( &nSize, 2, 1, m_file );
+		fwrite( pSlot->m_szText, 1, nSize, m_file );
+	}
+	if( pSlot->m_nLevel >= LOG_BINARY_ECHO )
+	{
+		static char szLine[LOG_BUFFER + 1];
+		logfmt_Format( pFormat->m_szFormat, pSlot->m_szText, pSlot->m_nSize, szLine, sizeof(szLine) );
+		echoLine( pSlot->m_nLevel, szLine );
+	}
+	atomic_Add( &s_nWritten, 1 );
+}
+
+// Write everything in the queue, and say if any lines were dropped since
+// the last time. Returns the number of lines written.
+static int drainQueue( long* pRateLimited, long* pOverflowed )
+{
+	char szNote[80];
+	int nLines = 0;
+
+	LogSlot* pSlot;
+	while( (pSlot = s_queue.Peek()) != NULL )
+	{
+		if( pSlot->m_nFormat >= 0 ) writeRecord( pSlot );
+		else writeLine( pSlot->m_nLevel, pSlot->m_fTime, pSlot->m_szText );
+		s_queue.Release( pSlot );
+		nLines++;
+	}
+	double fNow = timer_Now() - s_fOpened;
+
+	long nRateLimited = atomic_Load( &s_nRateLimited );
+	if( nRateLimited != *pRateLimited )
+	{
+		sprintf( szNote, "-------- %ld lines dropped by the rate limit", nRateLimited - *pRateLimited );
+		writeLine( LOG_WARN, fNow, szNote );
+		*pRateLimited = nRateLimited;
+		nLines++;
+	}
+	long nOverflowed = atomic_Load( &s_nOverflowed );
+	if( nOverflowed != *pOverflowed )
+	{
+		sprintf( szNote, "-------- %ld lines dropped, log queue full", nOverflowed - *pOverflowed );
+		writeLine( LOG_WARN, fNow, szNote );
+		*pOverflowed = nOverflowed;
+		nLines++;
+	}
+
+	if( nLines )
+	{
+		if( m_file ) fflush( m_file );
+#ifndef WINDOWS
+		fflush( stdout );
+#endif
+	}
+	return nLines;
+}
+
+static void writerMain( void* pArg )
 {
+	long nRateLimited = atomic_Load( &s_nRateLimited );
+	long nOverflowed = atomic_Load( &s_nOverflowed );
+
+	for( ;; )
+	{
+		// read the flag first, so the lines queued before log_Close set
+		// it are all written by the drain below.
+		bool bStop = atomic_Load( &s_nStop ) != 0;
+		if( !drainQueue( &nRateLimited, &nOverflowed ) )
+		{
+			if( bStop ) break;
+			thread_Sleep( LOG_WRITER_SLEEP );
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Open and close
+//////////////////////////////////////////////////////////////////////
+
+// Mains that return early, or call exit, still get their last lines.
+static void closeAtExit()
+{
+	log_Close();
+}
+
+static int openLog( const char *szFilename, void* hWnd, bool bBinary )
+{
+	static bool bAtExit = false;
 	static char szTimeString[30];
 	time_t tmNow;
+	int nResult = 0;
 
-	if( m_file ) log_Close();
+	if( s_pWriter ) log_Close();
+	if( !bAtExit ) bAtExit = atexit( closeAtExit ) == 0;
 
 #ifdef WINDOWS
 	// Keep the window handle
@@ -44,8 +410,22 @@ int log_Open( const char *szFilename, void* hWnd )
 #endif
 
 	// Open the file for append
-	m_file = fopen( szFilename, "wt" );
-	if( !m_file ) return ferror(m_file);
+	m_file = fopen( szFilename, bBinary ? "wb" : "wt" );
+	if( !m_file ) nResult = errno ? errno : -1;
+
+	s_bBinary = bBinary;
+	s_fOpened = timer_Now();
+	s_nFormatsWritten = 0;
+	if( bBinary && m_file )
+	{
+		int nVersion = LOGFMT_VERSION;
+		fwrite( LOGFMT_MAGIC, 1, 4, m_file );
+		fwrite( &nVersion, 4, 1, m_file );
+	}
+
+	// Start the writer; lines logged before now have been waiting for it
+	atomic_Store( &s_nStop, 0 );
+	s_pWriter = thread_Start( writerMain, NULL );
 
 	// Log the current time
 	tmNow = time(NULL);
@@ -53,12 +433,22 @@ int log_Open( const char *szFilename, void* hWnd )
 	szTimeString[24] = '\0';
 	log_Logf( "-------- Log opened %s", szTimeString );
 
-	return 0;
+	return nResult;
+}
+
+int log_Open( const char *szFilename, void* hWnd )
+{
+	return openLog( szFilename, hWnd, false );
+}
+
+int log_OpenBinary( const char *szFilename, void* hWnd )
+{
+	return openLog( szFilename, hWnd, true );
 }
 
 int log_Close()
 {
-	if( m_file )
+	if( s_pWriter )
 	{
 		static char szTimeString[30];
 		time_t tmNow;
@@ -69,86 +459,196 @@ int log_Close()
 		szTimeString[24] = '\0';
 		log_Logf( "-------- Log closed %s", szTimeString );
 
+		// The writer empties the queue before it stops
+		atomic_Store( &s_nStop, 1 );
+		thread_Join( s_pWriter );
+		s_pWriter = NULL;
+		log_Pump();
+
 		// Close the file
-		fclose( m_file );
+		if( m_file ) fclose( m_file );
 		m_file = NULL;
 	}
 
 	return 0;
 }
 
+void log_Pump()
+{
 #ifdef WINDOWS
-void fixNewlines(std::string& str)
+	std::string str;
+	{
+		MutexLock lock( s_windowLock );
+		str.swap( s_strWindow );
+	}
+	if( m_hWndLog && !str.empty() ) writeToLogWindow( str.c_str() );
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Logging
+//////////////////////////////////////////////////////////////////////
+
+// Count the line against this second's allowance.
+static bool withinRateLimit( int nLevel )
 {
-	std::string::size_type pos = 0;
-	while ( (pos = str.find("\n", pos)) != std::string::npos ) {
-		str.replace( pos, 1, "\r\n" );
-		pos += 2; // len of replacement text
+	long nLimit = s_nRateLimit;
+	if( nLimit <= 0 || nLevel >= LOG_ERROR ) return true;
+
+	long nSecond = (long) timer_Now();
+	long nRateSecond = atomic_Load( &s_nRateSecond );
+	if( nSecond != nRateSecond && atomic_CompareExchange( &s_nRateSecond, nRateSecond, nSecond ) )
+		atomic_Store( &s_nRateLines, 0 );
+
+	if( atomic_Add( &s_nRateLines, 1 ) > nLimit )
+	{
+		atomic_Add( &s_nRateLimited, 1 );
+		return false;
 	}
+	return true;
 }
 
-void writeToLogWindow(const char* buf)
+// A slot for a line, stamped with the time in binary logs.
+static LogSlot* claimSlot( int nLevel )
 {
-	std::string str(buf);
-	str.append("\n");
-	fixNewlines(str);
+	LogSlot* pSlot = s_queue.Claim();
+	if( !pSlot )
+	{
+		atomic_Add( &s_nOverflowed, 1 );
+		return NULL;
+	}
+	pSlot->m_nLevel = nLevel;
+	pSlot->m_fTime = s_bBinary ? timer_Now() - s_fOpened : 0;
+	return pSlot;
+}
 
-	//SetWindowRedraw( m_hWndLog, FALSE );
-	LRESULT nLen = SendMessage( m_hWndLog, WM_GETTEXTLENGTH, 0, 0 );
-	SendMessage( m_hWndLog, EM_SETSEL, (WPARAM)nLen, (LPARAM)nLen );
-	SendMessage( m_hWndLog, EM_REPLACESEL, (WPARAM)FALSE, (LPARAM)str.c_str() );
-	//SetWindowRedraw( m_hWndLog, TRUE );
-	//InvalidateRect( m_hWndLog, NULL, FALSE );
+static void queueLine( int nLevel, const char* szText, size_t nLen )
+{
+	LogSlot* pSlot = claimSlot( nLevel );
+	if( !pSlot ) return;
+	if( nLen > LOG_BUFFER ) nLen = LOG_BUFFER;
+	memcpy( pSlot->m_szText, szText, nLen );
+	pSlot->m_szText[nLen] = '\0';
+	pSlot->m_nFormat = -1;
+	s_queue.Publish( pSlot );
 }
-#endif
 
-int log_Logf( const char *fmt, ... )
+// The types of 'fmt', from this thread's cache if it has used the format
+// before; otherwise from the shared list, which gives it an id.
+static const LogFormat* findFormat( const char* fmt )
 {
-	va_list vaArgs;
-	static char szBuffer[LOG_BUFFER + 1];
+	const LogFormat*& pCached = s_aFormatCache[((size_t) fmt >> 3) & (LOG_FORMAT_CACHE - 1)];
+	if( pCached && pCached->m_szFormat == fmt ) return pCached;
+
+	MutexLock lock( s_formatLock );
+	std::map<const char*, const LogFormat*>::iterator it = s_formatIds.find( fmt );
+	if( it != s_formatIds.end() ) return pCached = it->second;
+
+	LogFormat* pFormat = new LogFormat();
+	pFormat->m_szFormat = fmt;
+	pFormat->m_nId = (int) s_formats.size();
+	pFormat->m_bPacked = logfmt_Parse( fmt, pFormat->m_szTypes );
+	s_formats.push_back( pFormat );
+	s_formatIds[fmt] = pFormat;
+	return pCached = pFormat;
+}
 
-	// Build a line from the arguments
-	va_start( vaArgs, fmt );
-	vsprintf( szBuffer, fmt, vaArgs );
-	va_end( vaArgs );
+int log_Write( int nLevel, const char *msg )
+{
+	if( nLevel < s_nLevel || !withinRateLimit( nLevel ) ) return 0;
+
+	// Longer lines go out in pieces
+	size_t nLen = strlen( msg );
+	while( nLen > LOG_BUFFER )
+	{
+		queueLine( nLevel, msg, LOG_BUFFER );
+		msg += LOG_BUFFER;
+		nLen -= LOG_BUFFER;
+	}
+	queueLine( nLevel, msg, nLen );
 
-	// Write the line to the log file
-	fprintf( m_file, "%s\n", szBuffer );
+	return 0;
+}
 
-#ifdef WINDOWS
-#ifdef _DEBUG
-	// Write the line to the debugger
-	//OutputDebugString( szLine );
-#endif
-	// Add the line to the log window
-	if( m_hWndLog ) writeToLogWindow(szBuffer);
-#else
-	// Write to the console
-	printf( "%s\n", szBuffer );
-#endif
+static int writeArgs( int nLevel, const char *fmt, va_list vaArgs )
+{
+	if( nLevel < s_nLevel || !withinRateLimit( nLevel ) ) return 0;
+
+	// Binary logs keep the arguments, to be formatted when read
+	if( s_bBinary )
+	{
+		const LogFormat* pFormat = findFormat( fmt );
+		if( pFormat->m_bPacked )
+		{
+			LogSlot* pSlot = claimSlot( nLevel );
+			if( !pSlot ) return 0;
+			int nSize = logfmt_Pack( pFormat->m_szTypes, vaArgs, pSlot->m_szText, LOG_BUFFER );
+			if( nSize >= 0 )
+			{
+				pSlot->m_nFormat = pFormat->m_nId;
+				pSlot->m_nSize = nSize;
+			}
+			else
+			{
+				// LOGFMT_MAX_ARGS numbers always fit, so this is unreachable.
+				strcpy( pSlot->m_szText, "(log arguments too large)" );
+				pSlot->m_nFormat = -1;
+			}
+			s_queue.Publish( pSlot );
+			return 0;
+		}
+	}
+
+	// Build a line from the arguments
+	int nLen = vsnprintf( s_szFormat, LOG_BUFFER + 1, fmt, vaArgs );
+	s_szFormat[LOG_BUFFER] = '\0';
+	queueLine( nLevel, s_szFormat, nLen < 0 || nLen > LOG_BUFFER ? strlen( s_szFormat ) : nLen );
 
 	return 0;
 }
 
+int log_Writef( int nLevel, const char *fmt, ... )
+{
+	va_list vaArgs;
+	va_start( vaArgs, fmt );
+	int nResult = writeArgs( nLevel, fmt, vaArgs );
+	va_end( vaArgs );
+	return nResult;
+}
+
+int log_Logf( const char *fmt, ... )
+{
+	va_list vaArgs;
+	va_start( vaArgs, fmt );
+	int nResult = writeArgs( LOG_INFO, fmt, vaArgs );
+	va_end( vaArgs );
+	return nResult;
+}
 
 int log_Log( const char *msg )
 {
-	// Write the line to the log file
-	fprintf( m_file, "%s\n", msg );
+	return log_Write( LOG_INFO, msg );
+}
+
+void log_SetLevel( int nLevel )
+{
+	s_nLevel = nLevel;
+}
 
-	// Write the line to the debugger
-#ifdef _DEBUG
-//	OutputDebugString( msg );
-//	OutputDebugString( "\n" );
-#endif
+int log_GetLevel()
+{
+	return (int) s_nLevel;
+}
 
-#ifdef WINDOWS
-	// Add the line to the log window
-	if( m_hWndLog ) writeToLogWindow(msg);
-#else
-	// Write to the console
-	printf( "%s\n", msg );
-#endif
+void log_SetRateLimit( int nLinesPerSecond )
+{
+	s_nRateLimit = nLinesPerSecond;
+}
 
-	return 0;
+void log_GetStats( LogStats* pStats )
+{
+	pStats->m_nWritten = atomic_Load( &s_nWritten );
+	pStats->m_nRateLimited = atomic_Load( &s_nRateLimited );
+	pStats->m_nOverflowed = atomic_Load( &s_nOverflowed );
 }
@@ -5,9 +5,30 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-// Initialise the logger
+// Lines are queued by the calling thread and written by a background
+// thread, so logging never waits on the disk or the console. The queue
+// holds LOG_QUEUE lines of up to LOG_BUFFER characters; lines that find
+// it full are dropped, and the writer reports how many.
+
+enum LogLevel
+{
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARN,
+	LOG_ERROR
+};
+
+// Initialise the logger, and start the writer thread
 //
 int log_Open( const char *szFilename, void* hWnd );
+
+// Log to a binary file instead, decoded by the logdecode tool. Lines
+// from log_Logf and log_Writef keep their format's id, a timestamp and
+// the raw arguments, so logging costs a few stores; the format strings
+// must be string literals. Only warnings and errors reach the console.
+int log_OpenBinary( const char *szFilename, void* hWnd );
+
+// Write out everything queued, stop the writer and close the file
 int log_Close();
 
 // Log an error
@@ -15,4 +36,31 @@ int log_Close();
 int log_Log( const char *msg );
 int log_Logf( const char *fmt, ... );
 
+// Log at a level; log_Log and log_Logf are LOG_INFO.
+//
+int log_Write( int nLevel, const char *msg );
+int log_Writef( int nLevel, const char *fmt, ... );
+
+// Lines below 'nLevel' are dropped before they are formatted.
+void log_SetLevel( int nLevel );
+int log_GetLevel();
+
+// Drop lines beyond 'nLinesPerSecond' so a runaway loop cannot flood the
+// log; errors are always let through. 0 turns the limit off.
+void log_SetRateLimit( int nLinesPerSecond );
+
+struct LogStats
+{
+	long m_nWritten;		// lines written out
+	long m_nRateLimited;	// dropped by the rate limit
+	long m_nOverflowed;		// dropped because the queue was full
+};
+
+void log_GetStats( LogStats* pStats );
+
+// Windows: copy the lines written since the last call into the log
+// window. Call from the thread that owns the window; the writer thread
+// never touches it. Does nothing elsewhere.
+void log_Pump();
+
 #endif // LOGGER_H
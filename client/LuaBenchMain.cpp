@@ -0,0 +1,123 @@
+// LuaBenchMain.cpp: measures the cost of the Lua scene-graph bindings
+//
+// Drives LuaController with no display over a null renderer, so only the
+// Lua side of a frame is timed. By default the bench script (see
+// data/bench_bindings.lua) is run, which times each sg.* binding and the
+// Node methods wrapping them and logs the cost per call.
+//
+// With -frames N the core.lua scene is run instead, for N frames under
+// the sampling profiler (LuaProfiler.h), which logs the hottest Lua
+// functions, lines and C bindings per frame every -report frames.
+//
+//   luabench [-script file.lua]
+//   luabench -frames N [-interval instructions] [-report N] [-step ms]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Logger.h"
+#include "Timer.h"
+#include "LuaController.h"
+#include "LuaProfiler.h"
+#include "QSGNullRenderer.h"
+
+
+LuaController* g_controller = 0;
+
+const char *c_logFilename = "luabench.log";
+const char *c_apiFilename = "api_init.lua";
+const char *c_coreFilename = "core.lua";
+const char *c_packFilename = "data.qpak";
+
+struct LuaBenchOptions
+{
+	const char* m_szScript;
+	int m_nFrames;				// frames of core.lua to profile, or 0
+	int m_nInterval;			// VM instructions between samples
+	int m_nReportFrames;
+	double m_fStep;				// ms per frame given to update
+};
+
+
+// ---------------------------------------------------------------------
+
+bool ParseOptions(int argc, char** argv, LuaBenchOptions* options)
+{
+	options->m_szScript = "bench_bindings.lua";
+	options->m_nFrames = 0;
+	options->m_nInterval = PROFILER_INTERVAL;
+	options->m_nReportFrames = 0;
+	options->m_fStep = 1000.0 / 60;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-script")) options->m_szScript = value;
+		else if (!strcmp(arg, "-frames")) options->m_nFrames = atoi(value);
+		else if (!strcmp(arg, "-interval")) options->m_nInterval = atoi(value);
+		else if (!strcmp(arg, "-report")) options->m_nReportFrames = atoi(value);
+		else if (!strcmp(arg, "-step")) options->m_fStep = atof(value);
+		else return false;
+		++i;
+	}
+
+	return options->m_nFrames >= 0 && options->m_nInterval > 0 &&
+		options->m_nReportFrames >= 0 && options->m_fStep >= 0;
+}
+
+int main(int argc, char** argv)
+{
+	LuaBenchOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s [-script file.lua]\n"
+			"       %s -frames N [-interval instructions] [-report N] [-step ms]\n",
+			argv[0], argv[0]);
+		return 2;
+	}
+
+	log_Open( c_logFilename, NULL );
+
+	ref_ptr<QSGRenderer> renderer = new QSGNullRenderer();
+	renderer->initialise();
+	g_controller = new LuaController(renderer);
+
+	// use the asset pack if there is one; loose files otherwise
+	g_controller->mountPack(c_packFilename);
+
+	if (!options.m_nFrames) {
+		g_controller->execLua(options.m_szScript);
+	}
+	else {
+		// Started before the scripts run, so the coroutines they schedule
+		// inherit the hook; started again to drop what loading them cost.
+		g_controller->startProfiler(options.m_nInterval, options.m_nReportFrames);
+		g_controller->execLua(c_apiFilename);
+		g_controller->execLua(c_coreFilename);
+		g_controller->resize(800, 600);
+
+		// Without a report interval, report once over all the frames.
+		g_controller->startProfiler(options.m_nInterval, options.m_nReportFrames);
+		double start = timer_Now();
+		for (int i = 0; i < options.m_nFrames; ++i) {
+			g_controller->update(options.m_fStep);
+			g_controller->render();
+		}
+		double elapsed = timer_Now() - start;
+		if (!options.m_nReportFrames) profiler_Report();
+		log_Logf("%d frames, %.3f ms per frame while profiling", options.m_nFrames,
+			elapsed * 1000 / options.m_nFrames);
+	}
+
+	delete g_controller; // manually tracked.
+	g_controller = 0;
+	renderer = 0;
+	log_Close();
+
+	return 0;
+}
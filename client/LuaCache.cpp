@@ -0,0 +1,128 @@
+// LuaCache.cpp: compiled Lua chunks, cached by the hash of their source
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "LuaCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+static LuaCacheStats s_stats;
+
+static bool readFile( const char* szFilename, std::vector<unsigned char>& bytes )
+{
+	FILE* pFile = fopen( szFilename, "rb" );
+	if( !pFile ) return false;
+	unsigned char buffer[16384];
+	size_t nGot;
+	while( (nGot = fread( buffer, 1, sizeof(buffer), pFile )) > 0 )
+		bytes.insert( bytes.end(), buffer, buffer + nGot );
+	fclose( pFile );
+	return true;
+}
+
+static bool writeFile( const char* szFilename, const std::vector<unsigned char>& bytes )
+{
+	FILE* pFile = fopen( szFilename, "wb" );
+	if( !pFile ) return false;
+	bool bOk = fwrite( &bytes[0], 1, bytes.size(), pFile ) == bytes.size();
+	if( fclose( pFile ) ) bOk = false;
+	if( !bOk ) remove( szFilename );	// never leave half a chunk behind
+	return bOk;
+}
+
+static int dumpWriter( lua_State* L, const void* p, size_t nSize, void* pData )
+{
+	std::vector<unsigned char>* pOut = (std::vector<unsigned char>*) pData;
+	pOut->insert( pOut->end(), (const unsigned char*) p, (const unsigned char*) p + nSize );
+	return 0;
+}
+
+// Push the chunk in a cache if it was compiled from this source, which
+// may be NULL to take it on trust.
+static bool loadCached( lua_State* L, const unsigned char* pCache, size_t nCache,
+	const std::vector<unsigned char>* pSource, const char* szChunkname )
+{
+	if( nCache <= sizeof(LuaCacheHeader) ) return false;
+	LuaCacheHeader header;
+	memcpy( &header, pCache, sizeof(header) );
+	if( memcmp( header.magic, LUACACHE_MAGIC, 4 ) || header.version != LUACACHE_VERSION ) return false;
+	if( pSource )
+	{
+		size_t nSize = pSource->size();
+		if( header.sourceSize != nSize ) return false;
+		if( header.sourceHash != luacache_Hash( nSize ? &(*pSource)[0] : NULL, nSize ) ) return false;
+	}
+	if( luaL_loadbuffer( L, (const char*) pCache + sizeof(header), nCache - sizeof(header), szChunkname ) )
+	{
+		lua_pop( L, 1 );	// built by another Lua, most likely
+		return false;
+	}
+	s_stats.m_nCached++;
+	return true;
+}
+
+unsigned long long luacache_Hash( const void* pData, size_t nSize )
+{
+	const unsigned char* p = (const unsigned char*) pData;
+	unsigned long long nHash = 14695981039346656037ULL;
+	for( size_t i = 0; i < nSize; i++ )
+	{
+		nHash ^= p[i];
+		nHash *= 1099511628211ULL;
+	}
+	return nHash;
+}
+
+int luacache_Compile( lua_State* L, const char* pSource, size_t nSize, const char* szFilename,
+	std::vector<unsigned char>& cache )
+{
+	// named as luaL_loadfile names it, for the same messages and tracebacks.
+	lua_pushfstring( L, "@%s", szFilename );
+	int nStatus = luaL_loadbuffer( L, pSource, nSize, lua_tostring( L, -1 ) );
+	lua_remove( L, -2 );
+	if( nStatus ) return nStatus;
+
+	LuaCacheHeader header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, LUACACHE_MAGIC, 4 );
+	header.version = LUACACHE_VERSION;
+	header.sourceSize = (unsigned int) nSize;
+	header.sourceHash = luacache_Hash( pSource, nSize );
+	cache.assign( (const unsigned char*) &header, (const unsigned char*) &header + sizeof(header) );
+	lua_dump( L, dumpWriter, &cache );
+	s_stats.m_nCompiled++;
+	return 0;
+}
+
+int luacache_LoadFile( lua_State* L, const char* szFilename, const unsigned char* pPacked, size_t nPacked )
+{
+	std::vector<unsigned char> source;
+	bool bSource = readFile( szFilename, source );
+	std::string strChunkname = std::string( "@" ) + szFilename;
+
+	if( pPacked && loadCached( L, pPacked, nPacked, bSource ? &source : NULL, strChunkname.c_str() ) )
+		return 0;
+	if( !bSource ) return luaL_loadfile( L, szFilename );	// for its message
+
+	std::string strCache = std::string( szFilename ) + "c";
+	std::vector<unsigned char> cache;
+	if( readFile( strCache.c_str(), cache ) &&
+		loadCached( L, cache.empty() ? NULL : &cache[0], cache.size(), &source, strChunkname.c_str() ) )
+		return 0;
+
+	int nStatus = luacache_Compile( L, source.empty() ? "" : (const char*) &source[0], source.size(), szFilename, cache );
+	if( !nStatus && writeFile( strCache.c_str(), cache ) ) s_stats.m_nWritten++;
+	return nStatus;
+}
+
+void luacache_GetStats( LuaCacheStats* pStats )
+{
+	*pStats = s_stats;
+}
@@ -0,0 +1,64 @@
+// LuaCache.h: compiled Lua chunks, cached by the hash of their source
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_LUACACHE_H
+#define FGM_LUACACHE_H
+
+#include <stddef.h>
+#include <vector>
+
+struct lua_State;
+
+// A script's chunk, as lua_dump writes it, is kept beside its source in a
+// file of the same name with a 'c' added (core.lua, core.luac), or under
+// that name in an asset pack, where mkpack compiles every script it finds.
+// Loading a chunk skips the parser: lundump reads the functions straight
+// back.
+//
+// A cache starts with a LuaCacheHeader holding the size and a 64-bit
+// FNV-1a hash of the source it was compiled from. When the source has
+// changed since, it is compiled again and the file beside it rewritten,
+// so editing a script and calling reload() works as it always has. A
+// chunk in a pack is used as it is when there is no source to check it
+// against; one beside its source never is.
+//
+// Chunks keep their debug information, so tracebacks and the profiler
+// see the same lines. Bytecode depends on how Lua was built (the number
+// type, sizes and byte order); a chunk lundump rejects is ignored and the
+// source compiled instead.
+
+#define LUACACHE_MAGIC		"QLUC"
+#define LUACACHE_VERSION	1
+
+struct LuaCacheHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int sourceSize;
+	unsigned int reserved;
+	unsigned long long sourceHash;
+};
+
+struct LuaCacheStats
+{
+	long m_nCached;			// chunks loaded from a cache
+	long m_nCompiled;		// scripts compiled from source
+	long m_nWritten;		// caches written beside their source
+};
+
+// Load a script as luaL_loadfile does: 0 with its function pushed, or an
+// error code with the message pushed. pPacked is its cache from an asset
+// pack, or NULL.
+int luacache_LoadFile( lua_State* L, const char* szFilename, const unsigned char* pPacked, size_t nPacked );
+
+// Compile a script into the bytes of its cache. Returns 0 with its
+// function pushed, or an error code with the message pushed.
+int luacache_Compile( lua_State* L, const char* pSource, size_t nSize, const char* szFilename,
+	std::vector<unsigned char>& cache );
+
+unsigned long long luacache_Hash( const void* pData, size_t nSize );
+
+void luacache_GetStats( LuaCacheStats* pStats );
+
+#endif // FGM_LUACACHE_H
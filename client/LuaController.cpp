@@ -6,7 +6,25 @@
 #include "QSGClipView.h"
 #include "QSGTexture.h"
 #include "QSGGraphic.h"
+#include "QSGRecordingRenderer.h"
 #include "Logger.h"
+#include "Codec.h"
+#include "NetStats.h"
+#include "Replication.h"
+#include "Interpolation.h"
+#include "LuaProfiler.h"
+#include "LuaCache.h"
+#include "FrameStats.h"
+#include "QSGFrameGraph.h"
+#include "TraceEvents.h"
+#include "JpegSimd.h"
+#include "PngDecode.h"
+#include "QSGBlockTexture.h"
+#include "QSGSoftwareSpans.h"
+#include "Audio.h"
+#include "AudioMix.h"
+
+#include <string.h>
 
 extern "C" {
 #include "lua.h"
@@ -22,8 +40,10 @@ static int printToConsole(lua_State* L);
 static int quitApplication(lua_State* L);
 static int setWindowTitle(lua_State* L);
 static int report(lua_State *L, int status);
+static int loaderLua(lua_State* L);
 
-LuaController::LuaController(QSGRenderer* renderer)
+LuaController::LuaController(QSGRenderer* renderer) :
+	m_premultiply(false), m_width(0), m_height(0)
 {
 	// Create Lua states
 	m_lua = luaL_newstate();
@@ -31,9 +51,39 @@ LuaController::LuaController(QSGRenderer* renderer)
 	// Open all libs on the system state
 	luaL_openlibs(m_lua);
 
+	// require Lua modules through the bytecode cache (see LuaCache.h)
+	lua_getglobal(m_lua, "package");
+	lua_getfield(m_lua, -1, "loaders");
+	lua_pushvalue(m_lua, -2);
+	lua_pushcclosure(m_lua, loaderLua, 1);
+	lua_rawseti(m_lua, -2, 2);
+	lua_pop(m_lua, 2);
+
 	// Open the luasocket lib
 	report(m_lua, lua_cpcall(m_lua, luaopen_socket_core, 0));
 
+	// Open the message codec lib (encode, decode)
+	report(m_lua, lua_cpcall(m_lua, luaopen_codec, 0));
+
+	// Open the network stats lib
+	report(m_lua, lua_cpcall(m_lua, luaopen_net, 0));
+	report(m_lua, lua_cpcall(m_lua, net_WatchLuaSockets, 0));
+
+	// Open the entity snapshot lib
+	report(m_lua, lua_cpcall(m_lua, luaopen_replication, 0));
+
+	// Open the Lua profiler lib
+	report(m_lua, lua_cpcall(m_lua, luaopen_profiler, 0));
+
+	// Open the frame timing lib
+	report(m_lua, lua_cpcall(m_lua, luaopen_frametime, 0));
+
+	// Open the trace zone lib
+	report(m_lua, lua_cpcall(m_lua, luaopen_trace, 0));
+
+	// Decode JPEGs with the best loops this CPU has
+	jpeg_InstallSimd(qsgSpanCpuLevel());
+
 	report(m_lua, lua_cpcall(m_lua, registerLuaFuncs, 0));
 
 	m_viewport = new QSGViewport();
@@ -43,13 +93,24 @@ LuaController::LuaController(QSGRenderer* renderer)
 
 LuaController::~LuaController()
 {
+	profiler_Stop();
+	trace_Stop(); // a trace left running is written on the way out.
 	lua_close(m_lua);
 	m_lua = NULL;
+
+	LuaCacheStats stats;
+	luacache_GetStats(&stats);
+	log_Logf("Lua: %ld chunks from the cache, %ld compiled, %ld cached",
+		stats.m_nCached, stats.m_nCompiled, stats.m_nWritten);
 }
 
 void LuaController::resize(int width, int height)
 {
+	m_width = width;
+	m_height = height;
+	TRACE_ZONE("sg_size_change", "lua");
 	m_renderer->setViewportSize(width, height);
+	placeFrameGraph();
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_size_change");
@@ -63,6 +124,7 @@ void LuaController::resize(int width, int height)
 
 void LuaController::mouseMove(int x, int y)
 {
+	TRACE_ZONE("sg_mouse_move", "lua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_mouse_move");
@@ -76,6 +138,7 @@ void LuaController::mouseMove(int x, int y)
 
 void LuaController::mouseButton(int button, int down)
 {
+	TRACE_ZONE("sg_mouse_button", "lua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_mouse_button");
@@ -89,6 +152,7 @@ void LuaController::mouseButton(int button, int down)
 
 void LuaController::keyPress(int key, int down)
 {
+	TRACE_ZONE("sg_key_press", "lua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_key_press");
@@ -102,6 +166,7 @@ void LuaController::keyPress(int key, int down)
 
 void LuaController::keyChars(char* bytes, int len)
 {
+	TRACE_ZONE("sg_key_char", "lua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_key_char");
@@ -114,17 +179,97 @@ void LuaController::keyChars(char* bytes, int len)
 
 bool LuaController::execLua(const char* filename)
 {
+	TRACE_ZONE(g_bTracing ? trace_Intern(filename) : filename, "execLua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback); // push traceback function
-	if (!report(L, luaL_loadfile(L, filename))) {
+	if (!report(L, loadLua(L, filename))) {
 		report(L, lua_pcall(L, 0, 0, -2));
 	}
 	lua_pop(L, 1); // pop traceback function
 	return true;
 }
 
+int LuaController::loadLua(lua_State* L, const char* filename)
+{
+	// a chunk compiled into a pack is named for its script, plus 'c'.
+	QSGAssetPack* pack = NULL;
+	const QSGPackEntry* entry = findAsset((std::string(filename) + "c").c_str(), &pack);
+	if (entry && entry->kind == QSGPackFile)
+		return luacache_LoadFile(L, filename, pack->data(entry), (size_t) entry->size);
+	return luacache_LoadFile(L, filename, NULL, 0);
+}
+
+bool LuaController::hasLua(const char* filename)
+{
+	QSGAssetPack* pack = NULL;
+	if (findAsset((std::string(filename) + "c").c_str(), &pack)) return true;
+	FILE* file = fopen(filename, "rb");
+	if (!file) return false;
+	fclose(file);
+	return true;
+}
+
+// package.loaders[2] in place of Lua's own: searches package.path the
+// same way, but a module only in a pack is found too, and modules load
+// through loadLua. The package table is the upvalue.
+static int loaderLua(lua_State* L)
+{
+	const char* name = luaL_checkstring(L, 1);
+	name = luaL_gsub(L, name, ".", LUA_DIRSEP);
+	lua_getfield(L, lua_upvalueindex(1), "path");
+	const char* path = lua_tostring(L, -1);
+	if (!path) return luaL_error(L, LUA_QL("package.path") " must be a string");
+
+	lua_pushliteral(L, ""); // error accumulator
+	while (*path) {
+		if (*path == *LUA_PATHSEP) {
+			++path;
+			continue;
+		}
+		const char* end = strchr(path, *LUA_PATHSEP);
+		if (!end) end = path + strlen(path);
+		lua_pushlstring(L, path, end - path);
+		path = end;
+		const char* filename = luaL_gsub(L, lua_tostring(L, -1), LUA_PATH_MARK, name);
+		lua_remove(L, -2); // template
+		if (g_controller->hasLua(filename)) {
+			if (g_controller->loadLua(L, filename) != 0)
+				luaL_error(L, "error loading module " LUA_QS " from file " LUA_QS ":\n\t%s",
+					lua_tostring(L, 1), filename, lua_tostring(L, -1));
+			return 1;
+		}
+		lua_pushfstring(L, "\n\tno file " LUA_QS, filename);
+		lua_remove(L, -2); // filename
+		lua_concat(L, 2);
+	}
+	return 1; // not found; the message says where it looked
+}
+
+bool LuaController::mountPack(const char* filename)
+{
+	QSGAssetPack* pack = QSGAssetPack::open(filename);
+	if (!pack) return false;
+	m_packs.push_back(pack);
+	m_textureCache.clear(); // its files may now come from the pack
+	log_Logf("Mounted %s, %d assets", filename, pack->count());
+	return true;
+}
+
+const QSGPackEntry* LuaController::findAsset(const char* name, QSGAssetPack** pack)
+{
+	for (size_t i = m_packs.size(); i-- > 0; ) {
+		const QSGPackEntry* entry = m_packs[i]->find(name);
+		if (entry) {
+			*pack = m_packs[i];
+			return entry;
+		}
+	}
+	return NULL;
+}
+
 void LuaController::update(double delta)
 {
+	TRACE_ZONE("sg_update", "lua");
 	lua_State* L = this->m_lua;
 	lua_pushcfunction(L, xlua_traceback);
 	lua_getglobal(L, "sg_update");
@@ -133,18 +278,78 @@ void LuaController::update(double delta)
 	if (result) lua_remove(L, -2); // xlua_traceback
 	else lua_pop(L, 1); // xlua_traceback
 	report(L, result);
+	frame_Mark(FRAME_UPDATE);
+
+	// Move networked entities after the scripts have fed this frame's
+	// snapshots in.
+	{
+		TRACE_ZONE("interpolate", "net");
+		EntityInterpolator::UpdateAll(delta * 0.001);
+	}
+	frame_Mark(FRAME_INTERPOLATE);
+
+	profiler_EndFrame();
 }
 
 bool LuaController::render(void)
 {
+	TRACE_ZONE("render", "sg");
 	m_renderer->render(m_viewport);
+	frame_Mark(FRAME_RENDER);
+
+	double gpuTime;
+	int age;
+	if (m_renderer->getGpuTime(&gpuTime, &age))
+		frame_SetGpuTime(gpuTime, age);
+
+	if (m_recorder && !m_recorder->isCapturing()) {
+		if (m_recorder->saveTrace(m_captureFile.c_str())) {
+			log_Logf("Captured %d frames to %s (%u bytes)", m_recorder->getFramesCaptured(),
+				m_captureFile.c_str(), (unsigned int) m_recorder->getTraceSize());
+		}
+		m_renderer = m_recorder->getTarget();
+		m_recorder = 0;
+	}
+	return true;
+}
+
+void LuaController::showFrameGraph(bool show)
+{
+	if (show && !m_frameGraph) {
+		m_frameGraph = new QSGFrameGraph();
+		placeFrameGraph();
+	}
+	else if (!show) m_frameGraph = 0;
+	m_viewport->setOverlay(m_frameGraph);
+}
+
+// Keep the frame graph in the bottom-left corner.
+void LuaController::placeFrameGraph(void)
+{
+	if (m_frameGraph)
+		m_frameGraph->m_transform.pos = QSGVec2(10 - m_width * 0.5f, 10 - m_height * 0.5f);
+}
+
+void LuaController::startProfiler(int interval, int reportFrames)
+{
+	profiler_Start(m_lua, interval, reportFrames);
+}
+
+bool LuaController::captureFrames(const char* filename, int frames)
+{
+	if (m_recorder || frames < 1) return false; // one at a time.
+	m_recorder = new QSGRecordingRenderer(m_renderer);
+	m_recorder->startCapture(frames, m_width, m_height);
+	m_captureFile = filename;
+	m_renderer = m_recorder;
 	return true;
 }
 
 int LuaController::createLuaObject(QSGObject* obj)
 {
-	obj->retain(); // hold a ref for lua
-	m_objects.insert(obj); // add to set of valid objects
+	// hold a ref for lua, once, and count the loads of shared textures
+	// so that each sg.destroy gives back one of them.
+	if (!m_objects[obj]++) obj->retain(); // add to set of valid objects
 	lua_pushlightuserdata(m_lua, obj); // push u
 	return 1; // return u
 }
@@ -153,11 +358,12 @@ void LuaController::destroyLuaObject(QSGObject* obj)
 {
 	// Lua can have many uncounted refs to the object, so check if the
 	// object still exists before trying to access it.
-	if (m_objects.find(obj) != m_objects.end())
+	std::map<QSGObject*, int>::iterator it = m_objects.find(obj);
+	if (it != m_objects.end() && !--it->second)
 	{
 		// Remove from the index of lua objects and
 		// drop the ref we were keeping for lua.
-		m_objects.erase(obj);
+		m_objects.erase(it);
 		obj->release();
 	}
 }
@@ -190,6 +396,60 @@ int printToConsole (lua_State *L) {
 	return 0;
 }
 
+static const char* const log_level_names[] = {"debug", "info", "warn", "error", NULL};
+
+static int log_write(lua_State *L, int level) {
+	log_Write(level, luaL_checkstring(L, 1));
+	return 0;
+}
+
+static int log_debug(lua_State *L) { return log_write(L, LOG_DEBUG); }
+static int log_info(lua_State *L) { return log_write(L, LOG_INFO); }
+static int log_warn(lua_State *L) { return log_write(L, LOG_WARN); }
+static int log_error(lua_State *L) { return log_write(L, LOG_ERROR); }
+
+// log.setLevel('debug'|'info'|'warn'|'error'); print is 'info'.
+static int log_set_level(lua_State *L) {
+	log_SetLevel(luaL_checkoption(L, 1, NULL, log_level_names));
+	return 0;
+}
+
+static int log_get_level(lua_State *L) {
+	lua_pushstring(L, log_level_names[log_GetLevel()]);
+	return 1;
+}
+
+// log.setRateLimit(linesPerSecond); 0 turns the limit off.
+static int log_set_rate_limit(lua_State *L) {
+	log_SetRateLimit(luaL_checkint(L, 1));
+	return 0;
+}
+
+static int log_get_stats(lua_State *L) {
+	LogStats stats;
+	log_GetStats(&stats);
+	lua_createtable(L, 0, 3);
+	lua_pushnumber(L, stats.m_nWritten);
+	lua_setfield(L, -2, "written");
+	lua_pushnumber(L, stats.m_nRateLimited);
+	lua_setfield(L, -2, "rateLimited");
+	lua_pushnumber(L, stats.m_nOverflowed);
+	lua_setfield(L, -2, "overflowed");
+	return 1;
+}
+
+static const luaL_Reg log_methods[] = {
+	{"debug", log_debug},
+	{"info", log_info},
+	{"warn", log_warn},
+	{"error", log_error},
+	{"setLevel", log_set_level},
+	{"getLevel", log_get_level},
+	{"setRateLimit", log_set_rate_limit},
+	{"getStats", log_get_stats},
+	{NULL, NULL}
+};
+
 int quitApplication (lua_State *L)
 {
 	//PostQuitMessage(0);
@@ -314,13 +574,19 @@ int clip_set_shape(lua_State *L) {
 	return 0;
 }
 
+// force blend mode if the texture contains alpha, and say how it is stored.
+static void set_texture_flags(QSGTransformNode* node, QSGTexture* tex) {
+	if (tex->m_components == 4) node->m_transform.flags |= QSGTransformNeedsBlend;
+	else node->m_transform.flags &= ~QSGTransformNeedsBlend;
+	if (tex->m_premultiplied) node->m_transform.flags |= QSGTransformPremultiplied;
+	else node->m_transform.flags &= ~QSGTransformPremultiplied;
+}
+
 int frame_set_texture(lua_State *L) {
 	QSGFrame* node = g_controller->toObject<QSGFrame>(1);
 	QSGTexture* tex = g_controller->toObject<QSGTexture>(2);
 	node->m_texture = tex;
-	// force blend mode if the texture contains alpha.
-	if (tex->m_components == 4) node->m_transform.flags |= QSGTransformNeedsBlend;
-	else node->m_transform.flags &= ~QSGTransformNeedsBlend;
+	set_texture_flags(node, tex);
 	return 0;
 }
 
@@ -328,9 +594,7 @@ int graphic_set_texture(lua_State *L) {
 	QSGGraphic* node = g_controller->toObject<QSGGraphic>(1);
 	QSGTexture* tex = g_controller->toObject<QSGTexture>(2);
 	node->m_texture = tex;
-	// force blend mode if the texture contains alpha.
-	if (tex->m_components == 4) node->m_transform.flags |= QSGTransformNeedsBlend;
-	else node->m_transform.flags &= ~QSGTransformNeedsBlend;
+	set_texture_flags(node, tex);
 	return 0;
 }
 
@@ -387,32 +651,166 @@ int graphic_set_geometry(lua_State *L) {
 	return 0;
 }
 
-int load_texture(lua_State *L) {
-	const char* filename = luaL_checklstring(L, 1, NULL);
+static bool read_file(const char* filename, std::vector<unsigned char>& bytes)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file) return false;
+	unsigned char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + got);
+	fclose(file);
+	return true;
+}
+
+// PNGs are decoded straight into the texture's buffer; anything that
+// png_Decode cannot take goes through stb_image.
+static stbi_uc* decode_texture(const unsigned char* bytes, int size, int* width, int* height, int* comp)
+{
+	if (png_Info(bytes, size, width, height, comp)) {
+		stbi_uc* data = (stbi_uc*) malloc(*width * *height * *comp);
+		if (data && png_Decode(bytes, size, data, *width * *comp, *comp))
+			return data;
+		free(data);
+	}
+	return stbi_load_from_memory(bytes, size, width, height, comp, STBI_default);
+}
+
+// A texture for the blocks of a DDS or KTX file; m_data is up to the caller.
+static QSGTexture* new_block_texture(const QSGBlockImage& image)
+{
+	QSGTexture* tex = new QSGTexture();
+	tex->m_format = image.format;
+	tex->m_width = image.width;
+	tex->m_height = image.height;
+	tex->m_components = qsgBlockComponents(image.format);
+	tex->m_levels = image.levels;
+	return tex;
+}
+
+// NULL with the reason in *reason if the file cannot be read or decoded;
+// the caller raises the error, outside any trace zone.
+static QSGTexture* read_texture(const char* filename, const char** reason) {
+	QSGAssetPack* pack = NULL;
+	const QSGPackEntry* entry = g_controller->findAsset(filename, &pack);
+	if (entry && entry->kind == QSGPackTexels) {
+		// decoded when the pack was built; point into the mapping.
+		QSGTexture* tex = new QSGTexture();
+		tex->m_data = (unsigned char*) pack->data(entry);
+		tex->m_width = (int) entry->width;
+		tex->m_height = (int) entry->height;
+		tex->m_components = (int) entry->components;
+		tex->m_premultiplied = (entry->flags & QSGPackPremultiplied) != 0;
+		tex->m_owner = pack;
+		return tex;
+	}
+	QSGBlockImage blocks;
+	if (entry && qsgParseBlockFile(pack->data(entry), (size_t) entry->size, &blocks)) {
+		// compressed blocks go to the GPU as they are, from the mapping.
+		QSGTexture* tex = new_block_texture(blocks);
+		tex->m_data = (unsigned char*) blocks.blocks;
+		tex->m_premultiplied = (entry->flags & QSGPackPremultiplied) != 0;
+		tex->m_owner = pack;
+		return tex;
+	}
 	int width, height, comp;
-	stbi_uc* data = stbi_load(filename, &width, &height, &comp, STBI_default);
-	if (!data) {
-		luaL_error(L, "load failed: %s (%s)", filename, stbi_failure_reason());
+	stbi_uc* data = NULL;
+	if (entry) {
+		data = decode_texture(pack->data(entry), (int) entry->size, &width, &height, &comp);
 	}
-	/* zero out texels that have zero alpha. this will break clever shader
-	// tricks, but we can't have white/garbage pixels adjacent to blended
-	// pixels otherwise the garbage will bleed into the image.
-	if (comp == 4) {
-		size_t len = width * height * 4;
-		for (size_t i = 0; i < len; i += 4) {
-			if (data[i+3] == 0) {
-				data[i] = data[i+1] = data[i+2] = 0;
-			}
+	else {
+		std::vector<unsigned char> bytes;
+		if (!read_file(filename, bytes)) {
+			*reason = "can't fopen";
+			return NULL;
 		}
-	}*/
+		if (!bytes.empty() && qsgParseBlockFile(&bytes[0], bytes.size(), &blocks)) {
+			QSGTexture* tex = new_block_texture(blocks);
+			tex->m_data = (unsigned char*) malloc(blocks.size);
+			memcpy(tex->m_data, blocks.blocks, blocks.size);
+			return tex;
+		}
+		if (!bytes.empty()) {
+			data = decode_texture(&bytes[0], (int) bytes.size(), &width, &height, &comp);
+		}
+	}
+	if (!data) {
+		*reason = stbi_failure_reason();
+		return NULL;
+	}
+	// clear texels are black once premultiplied, so the garbage colour
+	// they often hold cannot bleed into the edges of the image.
+	if (g_controller->m_premultiply)
+		qsgPremultiply(data, (size_t) width * height, comp);
 	QSGTexture* tex = new QSGTexture();
 	tex->m_data = data;
 	tex->m_width = width;
 	tex->m_height = height;
 	tex->m_components = comp;
+	tex->m_premultiplied = g_controller->m_premultiply;
+	return tex;
+}
+
+// The texture loaded from this file, read now if it is not shared yet;
+// NULL with the reason in *reason if it cannot be read.
+static QSGTexture* find_texture(const char* filename, const char** reason) {
+	std::string name = QSGAssetPack::canonicalName(filename);
+	QSGTexture* tex = g_controller->m_textureCache.find(name);
+	if (!tex) {
+		TRACE_ZONE(g_bTracing ? trace_Intern(filename) : filename, "loadTexture");
+		tex = read_texture(filename, reason);
+		if (tex) g_controller->m_textureCache.insert(name, tex);
+	}
+	return tex;
+}
+
+// sg.loadTexture(filename) shares the texture already loaded from the
+// same file (QSGTextureCache.h), so it keeps the premultiplied alpha,
+// or not, that it was loaded with. Each load is given back by one
+// sg.destroy; the texture stays valid until all of them are.
+int load_texture(lua_State *L) {
+	const char* filename = luaL_checklstring(L, 1, NULL);
+	const char* reason = NULL;
+	QSGTexture* tex = find_texture(filename, &reason);
+	// raised here, where no destructor is waiting to run.
+	if (!tex) return luaL_error(L, "load failed: %s (%s)", filename, reason);
 	return g_controller->createLuaObject(tex);
 }
 
+// sg.getTextureCacheStats() returns loads shared, loads read from files,
+// and the textures being shared.
+int get_texture_cache_stats(lua_State *L) {
+	const QSGTextureCache& cache = g_controller->m_textureCache;
+	lua_pushnumber(L, cache.hits());
+	lua_pushnumber(L, cache.misses());
+	lua_pushnumber(L, (lua_Number) cache.size());
+	return 3;
+}
+
+// In QSGTextureFilter order.
+const char* textureFilters[] = {
+	"linear",
+	"nearest",
+	"mipmap",
+	"trilinear",
+	NULL
+};
+
+// sg.setTextureFilter(texture, filter) picks how the texture is sampled;
+// the mipmapped filters build its mip levels when it is next drawn.
+int set_texture_filter(lua_State *L) {
+	QSGTexture* tex = g_controller->toObject<QSGTexture>(1);
+	tex->m_filter = luaL_checkoption(L, 2, NULL, textureFilters);
+	return 0;
+}
+
+// sg.setPremultiply(on) premultiplies the alpha of textures loaded from
+// now on; those already loaded keep theirs, and still draw correctly.
+int set_premultiply(lua_State *L) {
+	g_controller->m_premultiply = lua_toboolean(L, 1) != 0;
+	return 0;
+}
+
 int get_tetxure_size(lua_State *L) {
 	QSGTexture* tex = g_controller->toObject<QSGTexture>(1);
 	lua_pushnumber(L, tex->m_width);
@@ -443,6 +841,28 @@ static int sg_destroy(lua_State* L)
 	return 0;
 }
 
+// sg.mountPack(filename) maps an asset pack; false if it cannot be read.
+static int mount_pack(lua_State* L)
+{
+	lua_pushboolean(L, g_controller->mountPack(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+// sg.showFrameGraph(on) draws the frame times over the scene.
+static int show_frame_graph(lua_State* L)
+{
+	g_controller->showFrameGraph(lua_toboolean(L, 1) != 0);
+	return 0;
+}
+
+static int capture_frames(lua_State* L)
+{
+	const char* filename = luaL_checkstring(L, 1);
+	int frames = luaL_optint(L, 2, 1);
+	lua_pushboolean(L, g_controller->captureFrames(filename, frames));
+	return 1;
+}
+
 static const luaL_Reg sg_methods[] = {
 	{"createTransform", create_transform_node},
 	{"createFrame", create_frame},
@@ -460,178 +880,156 @@ static const luaL_Reg sg_methods[] = {
 	{"setGeometry", graphic_set_geometry},
 	{"loadTexture", load_texture},
 	{"getTextureSize", get_tetxure_size},
+	{"setTextureFilter", set_texture_filter},
+	{"setPremultiply", set_premultiply},
+	{"getTextureCacheStats", get_texture_cache_stats},
 	{"setOutline", set_outline},
 	{"setBlendMode", set_blend_mode},
 	{"setBackground", viewport_set_bg},
 	{"setScene", viewport_set_scene},
 	{"destroy", sg_destroy},
+	{"captureFrames", capture_frames},
+	{"showFrameGraph", show_frame_graph},
+	{"mountPack", mount_pack},
 	{NULL, NULL}
 };
 
-static int encode(lua_State *L) {
-	luaL_Buffer b;
-	const char* fmt = luaL_checkstring(L, 1);
-	luaL_buffinit(L, &b);
-	int arg = 2;
-	for(;;)
-	{
-		switch (*fmt)
-		{
-		case '\0': {
-			luaL_pushresult(&b);
-			return 1;
-		}
-		case 'B':
-		case 'b': {
-			lua_Integer v = lua_tointeger(L, arg);
-			luaL_addchar(&b, v);
-			break;
-		}
-		case 'H':
-		case 'h': {
-			lua_Integer v = lua_tointeger(L, arg);
-			luaL_addchar(&b, (v >> 8));
-			luaL_addchar(&b, v);
-			break;
-		}
-		case 'I':
-		case 'i': {
-			lua_Integer v = lua_tointeger(L, arg);
-			luaL_addchar(&b, (v >> 24));
-			luaL_addchar(&b, (v >> 16));
-			luaL_addchar(&b, (v >> 8));
-			luaL_addchar(&b, v);
-			break;
-		}
-		case 'S': {
-			size_t len = 0;
-			const char* data = lua_tolstring(L, arg, &len);
-			if (len > 65535) len = 65535;
-			luaL_addchar(&b, (len >> 8));
-			luaL_addchar(&b, len);
-			luaL_addlstring(&b, data, len);
-			break;
-		}
-		case 's': {
-			size_t len = 0;
-			const char* data = lua_tolstring(L, arg, &len);
-			if (len > 255) len = 255;
-			luaL_addchar(&b, len);
-			luaL_addlstring(&b, data, len);
-			break;
-		}
-		default:
-			luaL_error(L, "unknown format specifier '%c' in encode", *fmt);
-		}
-		++arg;
-		++fmt;
+// The sound loaded from this file, loading it now if it is not yet;
+// false if the file cannot be read.
+static bool find_sound(const char* filename, int* sound) {
+	std::string name = QSGAssetPack::canonicalName(filename);
+	std::map<std::string, int>::iterator it = g_controller->m_sounds.find(name);
+	if (it != g_controller->m_sounds.end()) {
+		*sound = it->second;
+		return true;
+	}
+	QSGAssetPack* pack = NULL;
+	const QSGPackEntry* entry = g_controller->findAsset(filename, &pack);
+	if (entry && entry->kind == QSGPackFile) {
+		*sound = audio_LoadSound((const unsigned char*) pack->data(entry), (int) entry->size);
+	}
+	else {
+		std::vector<unsigned char> bytes;
+		if (!read_file(filename, bytes) || bytes.empty()) return false;
+		*sound = audio_LoadSound(&bytes[0], (int) bytes.size());
 	}
+	if (*sound) g_controller->m_sounds[name] = *sound;
+	return true;
 }
 
-static int decode(lua_State *L) {
-	size_t nargs = 0;
-	const char* fmt = luaL_checklstring(L, 1, &nargs);
-	// make sure nargs is within (int) range.
-	if (nargs > LUAI_MAXCSTACK) nargs = LUAI_MAXCSTACK+1;
-	lua_checkstack(L, (int)nargs);
-	size_t size = 0;
-	const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 2, &size);
-	size_t datasize = size;
-	for (;;)
-	{
-		switch (*fmt)
-		{
-		case '\0':
-			return (int)nargs;
-		case 'B': {
-			if (size < 1) break;
-			lua_pushinteger(L, data[0]);
-			data += 1;
-			size -= 1;
-			break;
-		}
-		case 'b': {
-			if (size < 1) break;
-			lua_pushinteger(L, (signed char) data[0]);
-			data += 1;
-			size -= 1;
-			break;
-		}
-		case 'H': {
-			if (size < 2) break;
-			lua_Integer v = ((lua_Integer) data[0]) << 8;
-			v |= data[1];
-			lua_pushinteger(L, v);
-			data += 2;
-			size -= 2;
-			break;
-		}
-		case 'h': {
-			if (size < 2) break;
-			lua_Integer v = ((lua_Integer)(signed char)data[0]) << 8;
-			v |= data[1];
-			lua_pushinteger(L, v);
-			data += 2;
-			size -= 2;
-			break;
-		}
-		case 'I': {
-			if (size < 4) break;
-			unsigned long v = ((unsigned long)data[0]) << 24;
-			v |= ((unsigned long)data[1]) << 16;
-			v |= ((unsigned long)data[2]) << 8;
-			v |= data[3];
-			lua_pushnumber(L, v);
-			data += 4;
-			size -= 4;
-			break;
-		}
-		case 'i': {
-			if (size < 4) break;
-			lua_Integer v = ((lua_Integer)(signed char)data[0]) << 24;
-			v |= ((lua_Integer)data[1]) << 16;
-			v |= ((lua_Integer)data[2]) << 8;
-			v |= data[3];
-			lua_pushinteger(L, v);
-			data += 4;
-			size -= 4;
-			break;
-		}
-		case 'S': {
-			if (size < 2) break;
-			size_t len = ((size_t) data[0]) << 8;
-			len |= data[1];
-			if (size - 2 < len) break;
-			lua_pushlstring(L, (const char*)(data + 2), len);
-			data += 2 + len;
-			size -= 2 + len;
-			break;
-		}
-		case 's': {
-			if (size < 1) break;
-			size_t len = data[0];
-			if (size - 1 < len) break;
-			lua_pushlstring(L, (const char*)(data + 1), len);
-			data += 1 + len;
-			size -= 1 + len;
-			break;
-		}
-		default:
-			luaL_error(L, "unknown format specifier '%c' in decode", *fmt);
-		}
-		fmt++;
-	}
-	luaL_error(L, "data truncated at offset  '%c' in decode", *fmt);
+// audio.loadSound(filename) decodes an Ogg Vorbis file, from a mounted
+// pack or the data directory, for playSound. Each file is loaded once;
+// 0 when there is no audio.
+static int load_sound(lua_State *L) {
+	const char* filename = luaL_checkstring(L, 1);
+	int sound = 0;
+	// raised here, where no destructor is waiting to run.
+	if (!find_sound(filename, &sound)) return luaL_error(L, "load failed: %s (can't fopen)", filename);
+	lua_pushnumber(L, sound);
+	return 1;
+}
+
+// audio.playSound(sound, gain, pan, pitch) returns a voice for setVoice
+// and stopVoice; pan runs from -1 (left) to 1 (right).
+static int play_sound(lua_State *L) {
+	lua_pushnumber(L, audio_PlaySound(luaL_checkint(L, 1), (float) luaL_optnumber(L, 2, 1),
+		(float) luaL_optnumber(L, 3, 0), (float) luaL_optnumber(L, 4, 1)));
+	return 1;
+}
+
+// audio.setVoice(voice, gain, pan, pitch)
+static int set_voice(lua_State *L) {
+	audio_SetVoice(luaL_checkint(L, 1), (float) luaL_optnumber(L, 2, 1),
+		(float) luaL_optnumber(L, 3, 0), (float) luaL_optnumber(L, 4, 1));
+	return 0;
 }
 
+static int stop_voice(lua_State *L) {
+	audio_StopVoice(luaL_checkint(L, 1));
+	return 0;
+}
+
+// audio.setResampler("linear" or "polyphase")
+static int set_resampler(lua_State *L) {
+	static const char* const names[] = { "linear", "polyphase", NULL };
+	audio_SetResampler(luaL_checkoption(L, 1, NULL, names) == 0 ? MIX_LINEAR : MIX_POLYPHASE);
+	return 0;
+}
+
+// audio.playMusic(filename, loop) streams a file from the data directory.
+static int play_music(lua_State *L) {
+	audio_PlayMusic(luaL_checkstring(L, 1), lua_toboolean(L, 2) != 0);
+	return 0;
+}
+
+static int stop_music(lua_State *L) {
+	audio_StopMusic();
+	return 0;
+}
+
+static int set_music_gain(lua_State *L) {
+	audio_SetMusicGain((float) luaL_checknumber(L, 1));
+	return 0;
+}
+
+static int set_audio_gain(lua_State *L) {
+	audio_SetMasterGain((float) luaL_checknumber(L, 1));
+	return 0;
+}
+
+static int get_audio_stats(lua_State *L) {
+	AudioStats stats;
+	audio_GetStats(&stats);
+	lua_createtable(L, 0, 12);
+	lua_pushnumber(L, stats.m_nPeriods);
+	lua_setfield(L, -2, "periods");
+	lua_pushnumber(L, stats.m_nUnderruns);
+	lua_setfield(L, -2, "underruns");
+	lua_pushnumber(L, stats.m_nStarved);
+	lua_setfield(L, -2, "starved");
+	lua_pushnumber(L, stats.m_nDropped);
+	lua_setfield(L, -2, "dropped");
+	lua_pushnumber(L, stats.m_nVoices);
+	lua_setfield(L, -2, "voices");
+	lua_pushnumber(L, stats.m_nSounds);
+	lua_setfield(L, -2, "sounds");
+	lua_pushnumber(L, stats.m_nStolen);
+	lua_setfield(L, -2, "stolen");
+	lua_pushnumber(L, stats.m_nMixLast);
+	lua_setfield(L, -2, "mixLast");
+	lua_pushnumber(L, stats.m_nMixMean);
+	lua_setfield(L, -2, "mixMean");
+	lua_pushnumber(L, stats.m_nMixMax);
+	lua_setfield(L, -2, "mixMax");
+	lua_pushnumber(L, stats.m_nBudget);
+	lua_setfield(L, -2, "budget");
+	lua_pushnumber(L, stats.m_nOverBudget);
+	lua_setfield(L, -2, "overBudget");
+	return 1;
+}
+
+static const luaL_Reg audio_methods[] = {
+	{"loadSound", load_sound},
+	{"playSound", play_sound},
+	{"setVoice", set_voice},
+	{"stopVoice", stop_voice},
+	{"setResampler", set_resampler},
+	{"playMusic", play_music},
+	{"stopMusic", stop_music},
+	{"setMusicGain", set_music_gain},
+	{"setGain", set_audio_gain},
+	{"getStats", get_audio_stats},
+	{NULL, NULL}
+};
+
 int registerLuaFuncs(lua_State *L)
 {
 	lua_register(L, "print", printToConsole);
 	lua_register(L, "quit", quitApplication);
-	lua_register(L, "encode", encode);
-	lua_register(L, "decode", decode);
 	lua_register(L, "SetWindowTitle", setWindowTitle);
 	luaL_register(L, "sg", sg_methods);
+	luaL_register(L, "log", log_methods);
+	luaL_register(L, "audio", audio_methods);
 	return 0;
 }
 
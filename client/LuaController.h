@@ -1,6 +1,10 @@
 #pragma once
-#include <set>
+#include <map>
+#include <string>
+#include <vector>
 #include "QSGObject.h"
+#include "QSGAssetPack.h"
+#include "QSGTextureCache.h"
 
 struct lua_State;
 class QSGViewport;
@@ -8,6 +12,8 @@ class QSGRenderer;
 class QSGNode;
 class QSGTransformNode;
 class QSGFrame;
+class QSGRecordingRenderer;
+class QSGFrameGraph;
 
 class LuaController
 {
@@ -25,6 +31,29 @@ public:
 	void keyPress(int key, int down);
 	void keyChars(char* bytes, int len);
 
+	// Record the next frames rendered into a render trace file, which
+	// is written when the last of them has been drawn.
+	bool captureFrames(const char* filename, int frames);
+
+	// Sample the running scripts and time calls into C, logging the
+	// hottest every reportFrames frames (see LuaProfiler.h).
+	void startProfiler(int interval, int reportFrames);
+
+	// Draw the recent frame times (see FrameStats.h) over the scene.
+	void showFrameGraph(bool show);
+
+	// Map an asset pack (see QSGAssetPack.h); textures are looked for in
+	// the packs, newest first, before the data directory.
+	bool mountPack(const char* filename);
+	const QSGPackEntry* findAsset(const char* name, QSGAssetPack** pack);
+
+	// Load a script as luaL_loadfile does, from its compiled chunk in a
+	// pack or beside it when that is still current (see LuaCache.h).
+	// execLua and require load through this, onto the stack of L, which
+	// may be a coroutine's.
+	int loadLua(lua_State* L, const char* filename);
+	bool hasLua(const char* filename);
+
 public: // internal
 	int createLuaObject(QSGObject* obj);
 	void destroyLuaObject(QSGObject* obj);
@@ -33,14 +62,36 @@ public: // internal
 
 protected:
 	void log(const char* message);
+	void placeFrameGraph(void);
 
 public: // for lua calls
 	ref_ptr<QSGViewport> m_viewport;
 
+	// Premultiply the alpha of textures as they load (sg.setPremultiply).
+	bool m_premultiply;
+
+	// Textures by file, shared by sg.loadTexture.
+	QSGTextureCache m_textureCache;
+
+	// Sound ids (Audio.h) by file, for audio.loadSound.
+	std::map<std::string, int> m_sounds;
+
 protected:
 	struct lua_State* m_lua;
 	ref_ptr<QSGRenderer> m_renderer;
-	std::set<QSGObject*> m_objects;
+	// Objects Lua holds, with the number of times each was handed out
+	// (shared textures are handed out once per load).
+	std::map<QSGObject*, int> m_objects;
+	int m_width;
+	int m_height;
+
+	// Stands in for m_renderer while frames are being captured.
+	ref_ptr<QSGRecordingRenderer> m_recorder;
+	std::string m_captureFile;
+
+	ref_ptr<QSGFrameGraph> m_frameGraph;
+
+	std::vector< ref_ptr<QSGAssetPack> > m_packs;
 };
 
 // hax, so lua can find the controller.
@@ -0,0 +1,283 @@
+// LuaProfiler.cpp: sampling profiler for Lua code and its C bindings
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "LuaProfiler.h"
+#include "Timer.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+// Entries shown in each table of a report.
+#define PROFILER_TOP	10
+
+struct ProfileSamples
+{
+	ProfileSamples() : m_nSamples(0) {}
+	std::string m_strName;
+	long m_nSamples;
+};
+
+struct ProfileCalls
+{
+	ProfileCalls() : m_nCalls(0), m_fSeconds(0) {}
+	std::string m_strName;
+	long m_nCalls;
+	double m_fSeconds;
+};
+
+// A C function that has been called and not yet returned.
+struct ProfileActive
+{
+	lua_CFunction m_pFunc;
+	double m_fStart;
+};
+
+typedef std::map<std::string, ProfileSamples> SampleMap;
+typedef std::map<lua_CFunction, ProfileCalls> CallMap;
+
+static lua_State* s_pState = NULL;		// state being profiled
+static lua_State* s_pMain = NULL;		// main thread of the library's state
+static int s_nInterval = PROFILER_INTERVAL;
+static int s_nReportFrames = 0;
+static int s_nFrames = 0;
+static long s_nSamples = 0;
+static SampleMap s_functions;
+static SampleMap s_lines;
+static CallMap s_calls;
+static std::vector<ProfileActive> s_active;
+
+
+//////////////////////////////////////////////////////////////////////
+// Hook
+//////////////////////////////////////////////////////////////////////
+
+static void sample( lua_State* L, lua_Debug* ar )
+{
+	if( !lua_getinfo( L, "Sln", ar ) ) return;
+	++s_nSamples;
+
+	char szKey[LUA_IDSIZE + 32];
+	sprintf( szKey, "%s:%d", ar->short_src, ar->linedefined );
+	ProfileSamples& func = s_functions[szKey];
+	if( func.m_strName.empty() || (ar->name && func.m_strName[0] == '(') ) {
+		// the name depends on the caller; keep the first real one.
+		char szName[LUA_IDSIZE + 96];
+		if( *ar->what == 'm' ) sprintf( szName, "(main chunk) %s", ar->short_src );
+		else sprintf( szName, "%s (%s)", ar->name ? ar->name : "(anonymous)", szKey );
+		func.m_strName = szName;
+	}
+	++func.m_nSamples;
+
+	sprintf( szKey, "%s:%d", ar->short_src, ar->currentline );
+	ProfileSamples& line = s_lines[szKey];
+	if( line.m_strName.empty() ) line.m_strName = szKey;
+	++line.m_nSamples;
+}
+
+static lua_CFunction getCFunction( lua_State* L, lua_Debug* ar )
+{
+	if( !lua_getinfo( L, "Sf", ar ) ) return NULL;
+	lua_CFunction pFunc = (*ar->what == 'C') ? lua_tocfunction( L, -1 ) : NULL;
+	lua_pop( L, 1 );
+	return pFunc;
+}
+
+static void hook( lua_State* L, lua_Debug* ar )
+{
+	// coroutines keep the hook they were created with; drop it once
+	// profiling has stopped.
+	if( !s_pState ) {
+		lua_sethook( L, NULL, 0, 0 );
+		return;
+	}
+
+	switch( ar->event )
+	{
+	case LUA_HOOKCOUNT:
+		sample( L, ar );
+		break;
+
+	case LUA_HOOKCALL: {
+		lua_CFunction pFunc = getCFunction( L, ar );
+		if( !pFunc ) break;
+		ProfileCalls& calls = s_calls[pFunc];
+		if( calls.m_strName.empty() && lua_getinfo( L, "n", ar ) && ar->name )
+			calls.m_strName = ar->name;
+		ProfileActive active = { pFunc, timer_Now() };
+		s_active.push_back( active );
+		break;
+	}
+
+	case LUA_HOOKRET: {
+		double fNow = timer_Now();
+		lua_CFunction pFunc = getCFunction( L, ar );
+		if( !pFunc ) break;
+		// Errors unwind C functions without return events, so look
+		// past any that were left behind.
+		for( size_t i = s_active.size(); i-- > 0; ) {
+			if( s_active[i].m_pFunc == pFunc ) {
+				ProfileCalls& calls = s_calls[pFunc];
+				++calls.m_nCalls;
+				calls.m_fSeconds += fNow - s_active[i].m_fStart;
+				s_active.resize( i );
+				break;
+			}
+		}
+		break;
+	}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Control
+//////////////////////////////////////////////////////////////////////
+
+static void reset()
+{
+	s_nFrames = 0;
+	s_nSamples = 0;
+	s_functions.clear();
+	s_lines.clear();
+	s_calls.clear();
+}
+
+void profiler_Start( lua_State* L, int nInterval, int nReportFrames )
+{
+	profiler_Stop();
+	s_pState = L;
+	s_nInterval = nInterval > 0 ? nInterval : PROFILER_INTERVAL;
+	s_nReportFrames = nReportFrames > 0 ? nReportFrames : 0;
+	s_active.clear();
+	reset();
+	lua_sethook( L, hook, LUA_MASKCOUNT | LUA_MASKCALL | LUA_MASKRET, s_nInterval );
+}
+
+void profiler_Stop()
+{
+	if( s_pState ) lua_sethook( s_pState, NULL, 0, 0 );
+	s_pState = NULL;
+	s_active.clear();
+}
+
+bool profiler_IsRunning()
+{
+	return s_pState != NULL;
+}
+
+void profiler_EndFrame()
+{
+	if( !s_pState ) return;
+	++s_nFrames;
+	if( s_nReportFrames && s_nFrames >= s_nReportFrames )
+		profiler_Report();
+}
+
+static bool bySamples( const ProfileSamples* a, const ProfileSamples* b )
+{
+	return a->m_nSamples > b->m_nSamples;
+}
+
+static bool bySeconds( const ProfileCalls* a, const ProfileCalls* b )
+{
+	return a->m_fSeconds > b->m_fSeconds;
+}
+
+static void logSamples( const char* szTitle, const SampleMap& samples, double fPerFrame )
+{
+	std::vector<const ProfileSamples*> sorted;
+	for( SampleMap::const_iterator it = samples.begin(); it != samples.end(); ++it )
+		sorted.push_back( &it->second );
+	std::sort( sorted.begin(), sorted.end(), bySamples );
+
+	log_Logf( "  %s: samples/frame, share", szTitle );
+	for( size_t i = 0; i < sorted.size() && i < PROFILER_TOP; ++i ) {
+		log_Logf( "  %9.2f %5.1f%%  %s", sorted[i]->m_nSamples * fPerFrame,
+			100.0 * sorted[i]->m_nSamples / s_nSamples, sorted[i]->m_strName.c_str() );
+	}
+}
+
+void profiler_Report()
+{
+	double fPerFrame = 1.0 / (s_nFrames ? s_nFrames : 1);
+	log_Logf( "Lua profile: %d frames, %ld samples at %d instructions",
+		s_nFrames, s_nSamples, s_nInterval );
+
+	if( s_nSamples ) {
+		logSamples( "Lua functions", s_functions, fPerFrame );
+		logSamples( "Lua lines", s_lines, fPerFrame );
+	}
+
+	std::vector<const ProfileCalls*> sorted;
+	for( CallMap::const_iterator it = s_calls.begin(); it != s_calls.end(); ++it )
+		if( it->second.m_nCalls ) sorted.push_back( &it->second );
+	std::sort( sorted.begin(), sorted.end(), bySeconds );
+
+	if( !sorted.empty() ) {
+		log_Log( "  C functions: calls/frame, us/frame, us/call (including callees)" );
+		for( size_t i = 0; i < sorted.size() && i < PROFILER_TOP; ++i ) {
+			const ProfileCalls* c = sorted[i];
+			log_Logf( "  %9.1f %9.1f %7.3f  %s", c->m_nCalls * fPerFrame,
+				c->m_fSeconds * 1e6 * fPerFrame, c->m_fSeconds * 1e6 / c->m_nCalls,
+				c->m_strName.empty() ? "?" : c->m_strName.c_str() );
+		}
+	}
+
+	reset();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Lua library
+//////////////////////////////////////////////////////////////////////
+
+// profiler.start([instructions[, reportFrames]])
+static int profiler_start(lua_State *L) {
+	int nInterval = luaL_optint(L, 1, PROFILER_INTERVAL);
+	int nReportFrames = luaL_optint(L, 2, PROFILER_REPORT_FRAMES);
+	profiler_Start(s_pMain, nInterval, nReportFrames);
+	return 0;
+}
+
+static int profiler_stop(lua_State *L) {
+	profiler_Stop();
+	return 0;
+}
+
+static int profiler_report(lua_State *L) {
+	profiler_Report();
+	return 0;
+}
+
+// profiler.clock() returns seconds from a high resolution timer, for
+// timing code from Lua; only differences are meaningful.
+static int profiler_clock(lua_State *L) {
+	lua_pushnumber(L, timer_Now());
+	return 1;
+}
+
+static const luaL_Reg profiler_funcs[] = {
+	{"start", profiler_start},
+	{"stop", profiler_stop},
+	{"report", profiler_report},
+	{"clock", profiler_clock},
+	{NULL, NULL}
+};
+
+int luaopen_profiler( lua_State* L )
+{
+	s_pMain = L;
+	luaL_register(L, "profiler", profiler_funcs);
+	return 1;
+}
@@ -0,0 +1,40 @@
+// LuaProfiler.h: sampling profiler for Lua code and its C bindings
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_LUAPROFILER_H
+#define FGM_LUAPROFILER_H
+
+struct lua_State;
+
+// Default VM instructions between samples.
+#define PROFILER_INTERVAL		1000
+
+// Default frames between reports to the log.
+#define PROFILER_REPORT_FRAMES	300
+
+// Install a debug hook on the state. Every 'nInterval' VM instructions
+// the running Lua function and line are sampled; calls to C functions
+// are counted and timed from their call and return events, since no VM
+// instructions run inside them. The hottest of each are logged, per
+// frame, every 'nReportFrames' frames (0 to report only on request).
+// The hook slows scripts down, C calls most of all, so compare profiles
+// with each other rather than with unprofiled frame times. Coroutines
+// created while the hook is installed inherit it, so start before the
+// scripts schedule their tasks to see those too.
+//
+void profiler_Start( lua_State* L, int nInterval, int nReportFrames );
+void profiler_Stop();
+bool profiler_IsRunning();
+
+// Mark the end of a frame; reports when the report interval is up.
+void profiler_EndFrame();
+
+// Log what has been gathered since the last report, and start again.
+void profiler_Report();
+
+// Register the profiler library with Lua. Call this on the main thread;
+// profiler.start() from a coroutine still profiles the main thread.
+int luaopen_profiler( lua_State* L );
+
+#endif // FGM_LUAPROFILER_H
@@ -0,0 +1,623 @@
+// NetStats.cpp: per-connection network statistics and traffic shaping
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "NetStats.h"
+#include "Compression.h"
+#include "Logger.h"
+#include "Timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <new>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+// Bytes the shaper lets through in one go, as a fraction of a second.
+#define SHAPER_BURST 0.1
+
+NetShaper g_netShaper = { 0, 0, 0, 0 };
+bool g_bNetCompression = false;
+
+typedef std::vector<NetStats*> NetStatsList;
+static NetStatsList s_connections;
+static NetStats s_closed; // accumulated from closed connections
+
+
+//////////////////////////////////////////////////////////////////////
+// NetStats
+//////////////////////////////////////////////////////////////////////
+
+NetStats::NetStats()
+{
+	Reset();
+	m_szName[0] = '\0';
+	m_pSendCompression = NULL;
+	m_pReceiveCompression = NULL;
+}
+
+void NetStats::Reset()
+{
+	m_nPacketsSent = 0;
+	m_nPacketsReceived = 0;
+	m_nBytesSent = 0;
+	m_nBytesReceived = 0;
+	m_nPacketsDropped = 0;
+	m_fRtt = 0;
+	m_fRttVar = 0;
+	m_fRttMin = 0;
+	m_fRttMax = 0;
+	m_nRttSamples = 0;
+	memset( m_aSendQueue, 0, sizeof(m_aSendQueue) );
+	memset( m_aReceiveQueue, 0, sizeof(m_aReceiveQueue) );
+}
+
+void NetStats::AddRttSample( double fSeconds )
+{
+	// Smoothing as for the TCP retransmit timer (RFC 2988).
+	if( !m_nRttSamples )
+	{
+		m_fRtt = fSeconds;
+		m_fRttVar = fSeconds * 0.5;
+		m_fRttMin = m_fRttMax = fSeconds;
+	}
+	else
+	{
+		m_fRttVar = 0.75 * m_fRttVar + 0.25 * fabs( m_fRtt - fSeconds );
+		m_fRtt = 0.875 * m_fRtt + 0.125 * fSeconds;
+		if( fSeconds < m_fRttMin ) m_fRttMin = fSeconds;
+		if( fSeconds > m_fRttMax ) m_fRttMax = fSeconds;
+	}
+	m_nRttSamples++;
+}
+
+static int histogramBucket( int nDepth )
+{
+	int nBucket = 0;
+	while( nDepth > 0 && nBucket < NET_HISTOGRAM_SIZE - 1 )
+	{
+		nDepth >>= 1;
+		nBucket++;
+	}
+	return nBucket;
+}
+
+void NetStats::SampleQueues( int nSend, int nReceive )
+{
+	m_aSendQueue[histogramBucket( nSend )]++;
+	m_aReceiveQueue[histogramBucket( nReceive )]++;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Registry
+//////////////////////////////////////////////////////////////////////
+
+static void addCounters( NetStats* pTotal, const NetStats* pStats )
+{
+	pTotal->m_nPacketsSent += pStats->m_nPacketsSent;
+	pTotal->m_nPacketsReceived += pStats->m_nPacketsReceived;
+	pTotal->m_nBytesSent += pStats->m_nBytesSent;
+	pTotal->m_nBytesReceived += pStats->m_nBytesReceived;
+	pTotal->m_nPacketsDropped += pStats->m_nPacketsDropped;
+	for( int i = 0; i < NET_HISTOGRAM_SIZE; i++ )
+	{
+		pTotal->m_aSendQueue[i] += pStats->m_aSendQueue[i];
+		pTotal->m_aReceiveQueue[i] += pStats->m_aReceiveQueue[i];
+	}
+}
+
+void net_Register( NetStats* pStats )
+{
+	s_connections.push_back( pStats );
+}
+
+void net_Unregister( NetStats* pStats )
+{
+	NetStatsList::iterator it = std::find( s_connections.begin(), s_connections.end(), pStats );
+	if( it != s_connections.end() )
+	{
+		addCounters( &s_closed, pStats );
+		s_connections.erase( it );
+	}
+}
+
+void net_GetTotals( NetStats* pTotals )
+{
+	pTotals->Reset();
+	strcpy( pTotals->m_szName, "total" );
+	addCounters( pTotals, &s_closed );
+	for( NetStatsList::iterator it = s_connections.begin(); it != s_connections.end(); ++it )
+		addCounters( pTotals, *it );
+}
+
+static void logStats( const NetStats* pStats )
+{
+	log_Logf( "net %s: sent %ld packets %ld bytes, received %ld packets %ld bytes, dropped %ld",
+		pStats->m_szName[0] ? pStats->m_szName : "?",
+		pStats->m_nPacketsSent, pStats->m_nBytesSent,
+		pStats->m_nPacketsReceived, pStats->m_nBytesReceived,
+		pStats->m_nPacketsDropped );
+
+	if( pStats->m_nRttSamples )
+	{
+		log_Logf( "    rtt %.1f ms (+/- %.1f, min %.1f, max %.1f, %ld samples)",
+			pStats->m_fRtt * 1000, pStats->m_fRttVar * 1000,
+			pStats->m_fRttMin * 1000, pStats->m_fRttMax * 1000,
+			pStats->m_nRttSamples );
+	}
+
+	// Each direction is compressed only if its sender enabled it.
+	if( pStats->m_pSendCompression )
+	{
+		log_Logf( "    compression: send %.2f (%.1f ms)",
+			pStats->m_pSendCompression->GetRatio(),
+			pStats->m_pSendCompression->m_fSeconds * 1000 );
+	}
+	if( pStats->m_pReceiveCompression )
+	{
+		log_Logf( "    compression: receive %.2f (%.1f ms)",
+			pStats->m_pReceiveCompression->GetRatio(),
+			pStats->m_pReceiveCompression->m_fSeconds * 1000 );
+	}
+
+	char szSend[NET_HISTOGRAM_SIZE * 12 + 1], szReceive[NET_HISTOGRAM_SIZE * 12 + 1];
+	char* pSend = szSend;
+	char* pReceive = szReceive;
+	for( int i = 0; i < NET_HISTOGRAM_SIZE; i++ )
+	{
+		pSend += sprintf( pSend, " %ld", pStats->m_aSendQueue[i] );
+		pReceive += sprintf( pReceive, " %ld", pStats->m_aReceiveQueue[i] );
+	}
+	log_Logf( "    send queue:%s", szSend );
+	log_Logf( "    receive queue:%s", szReceive );
+}
+
+void net_LogStats()
+{
+	for( NetStatsList::iterator it = s_connections.begin(); it != s_connections.end(); ++it )
+		logStats( *it );
+
+	NetStats totals;
+	net_GetTotals( &totals );
+	logStats( &totals );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Traffic shaping
+//////////////////////////////////////////////////////////////////////
+
+long net_ShapeAllowance( double& fAvail, double& fLast, double fNow )
+{
+	long nBandwidth = g_netShaper.m_nBandwidth;
+	if( !nBandwidth ) return -1;
+
+	double fBurst = nBandwidth * SHAPER_BURST;
+	if( fBurst < PACKET_HEADER_SIZE ) fBurst = PACKET_HEADER_SIZE;
+
+	fAvail += (fNow - fLast) * nBandwidth;
+	fLast = fNow;
+	if( fAvail > fBurst ) fAvail = fBurst;
+
+	return fAvail > 0 ? (long)fAvail : 0;
+}
+
+bool net_ShapeDelays()
+{
+	return g_netShaper.m_fLatency > 0 || g_netShaper.m_fJitter > 0;
+}
+
+double net_ShapeDue( double fNow, double fLastDue )
+{
+	double fDue = fNow + g_netShaper.m_fLatency;
+	if( g_netShaper.m_fJitter > 0 )
+		fDue += g_netShaper.m_fJitter * rand() / (double)RAND_MAX;
+
+	// Keep the stream in order, as TCP would.
+	return fDue < fLastDue ? fLastDue : fDue;
+}
+
+bool net_ShapeDrops()
+{
+	return g_netShaper.m_fLoss > 0 && rand() < g_netShaper.m_fLoss * RAND_MAX;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Lua bindings
+//////////////////////////////////////////////////////////////////////
+
+static void push_histogram(lua_State *L, const long* pBuckets) {
+	lua_createtable(L, NET_HISTOGRAM_SIZE, 0);
+	for (int i = 0; i < NET_HISTOGRAM_SIZE; ++i) {
+		lua_pushnumber(L, (lua_Number) pBuckets[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+}
+
+static void set_number(lua_State *L, const char* key, double value) {
+	lua_pushnumber(L, value);
+	lua_setfield(L, -2, key);
+}
+
+static void push_stats(lua_State *L, const NetStats* pStats) {
+	lua_createtable(L, 0, 16);
+	lua_pushstring(L, pStats->m_szName);
+	lua_setfield(L, -2, "name");
+	set_number(L, "packetsSent", pStats->m_nPacketsSent);
+	set_number(L, "packetsReceived", pStats->m_nPacketsReceived);
+	set_number(L, "bytesSent", pStats->m_nBytesSent);
+	set_number(L, "bytesReceived", pStats->m_nBytesReceived);
+	set_number(L, "packetsDropped", pStats->m_nPacketsDropped);
+	if (pStats->m_nRttSamples) {
+		// milliseconds, like the times passed to sg_update.
+		set_number(L, "rtt", pStats->m_fRtt * 1000);
+		set_number(L, "rttVar", pStats->m_fRttVar * 1000);
+		set_number(L, "rttMin", pStats->m_fRttMin * 1000);
+		set_number(L, "rttMax", pStats->m_fRttMax * 1000);
+	}
+	if (pStats->m_pSendCompression) {
+		set_number(L, "sendRatio", pStats->m_pSendCompression->GetRatio());
+		set_number(L, "sendCompressTime", pStats->m_pSendCompression->m_fSeconds * 1000);
+	}
+	if (pStats->m_pReceiveCompression) {
+		set_number(L, "receiveRatio", pStats->m_pReceiveCompression->GetRatio());
+		set_number(L, "receiveCompressTime", pStats->m_pReceiveCompression->m_fSeconds * 1000);
+	}
+	push_histogram(L, pStats->m_aSendQueue);
+	lua_setfield(L, -2, "sendQueue");
+	push_histogram(L, pStats->m_aReceiveQueue);
+	lua_setfield(L, -2, "receiveQueue");
+}
+
+// net.getStats() returns a list of per-connection stats and the totals.
+static int net_get_stats(lua_State *L) {
+	int n = (int) s_connections.size();
+	lua_createtable(L, n, 0);
+	for (int i = 0; i < n; ++i) {
+		push_stats(L, s_connections[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	NetStats totals;
+	net_GetTotals(&totals);
+	push_stats(L, &totals);
+	return 2;
+}
+
+static int net_log_stats(lua_State *L) {
+	net_LogStats();
+	return 0;
+}
+
+static int net_reset_stats(lua_State *L) {
+	s_closed.Reset();
+	for (NetStatsList::iterator it = s_connections.begin(); it != s_connections.end(); ++it)
+		(*it)->Reset();
+	return 0;
+}
+
+// net.setShaper { latency=ms, jitter=ms, bandwidth=bytes/s, loss=0..1 }
+// Fields left out are reset to zero; net.setShaper() turns it off.
+static int net_set_shaper(lua_State *L) {
+	NetShaper shaper = { 0, 0, 0, 0 };
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		lua_getfield(L, 1, "latency");
+		shaper.m_fLatency = lua_tonumber(L, -1) * 0.001;
+		lua_getfield(L, 1, "jitter");
+		shaper.m_fJitter = lua_tonumber(L, -1) * 0.001;
+		lua_getfield(L, 1, "bandwidth");
+		shaper.m_nBandwidth = (long) lua_tonumber(L, -1);
+		lua_getfield(L, 1, "loss");
+		shaper.m_fLoss = lua_tonumber(L, -1);
+		lua_pop(L, 4);
+	}
+	if (shaper.m_fLatency < 0 || shaper.m_fJitter < 0 || shaper.m_nBandwidth < 0 ||
+		shaper.m_fLoss < 0 || shaper.m_fLoss > 1)
+		luaL_argerror(L, 1, "shaper settings out of range");
+	g_netShaper = shaper;
+	return 0;
+}
+
+static int net_get_shaper(lua_State *L) {
+	lua_createtable(L, 0, 4);
+	set_number(L, "latency", g_netShaper.m_fLatency * 1000);
+	set_number(L, "jitter", g_netShaper.m_fJitter * 1000);
+	set_number(L, "bandwidth", (double) g_netShaper.m_nBandwidth);
+	set_number(L, "loss", g_netShaper.m_fLoss);
+	return 1;
+}
+
+// net.setCompression(on) switches compression of what each Socket sends
+// on or off, from its next packet.
+static int net_set_compression(lua_State *L) {
+	g_bNetCompression = lua_toboolean(L, 1) != 0;
+	return 0;
+}
+
+static int net_get_compression(lua_State *L) {
+	lua_pushboolean(L, g_bNetCompression);
+	return 1;
+}
+
+static const luaL_Reg net_funcs[] = {
+	{"getStats", net_get_stats},
+	{"logStats", net_log_stats},
+	{"resetStats", net_reset_stats},
+	{"setShaper", net_set_shaper},
+	{"getShaper", net_get_shaper},
+	{"setCompression", net_set_compression},
+	{"getCompression", net_get_compression},
+	{NULL, NULL}
+};
+
+int luaopen_net( lua_State* L )
+{
+	luaL_register(L, "net", net_funcs);
+	return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// luasocket connections
+//////////////////////////////////////////////////////////////////////
+
+// Data taken by a send and held back by the shaper.
+struct LuaDelayedSend
+{
+	double m_fDue;
+	std::string m_data;
+	size_t m_nSent;
+};
+
+// Stats and shaper state for one luasocket TCP object, a userdata in a
+// weak table keyed by the object, so it goes when the object is collected.
+struct LuaSocketStats
+{
+	LuaSocketStats() : m_fPingSent(0), m_fSendAllowance(0), m_fReceiveAllowance(0),
+		m_fSendShaped(0), m_fReceiveShaped(0)
+	{
+	}
+
+	NetStats m_stats;
+	double m_fPingSent;		// time of the send awaiting a reply, or 0
+	std::deque<LuaDelayedSend> m_lstDelayed;
+	double m_fSendAllowance;
+	double m_fReceiveAllowance;
+	double m_fSendShaped;
+	double m_fReceiveShaped;
+};
+
+static char s_watchKey;		// registry key of the weak table
+static char s_sendKey;		// registry key of luasocket's own send
+
+static int stats_gc(lua_State *L) {
+	LuaSocketStats* watch = (LuaSocketStats*) lua_touserdata(L, 1);
+	net_Unregister(&watch->m_stats);	// if close has not already
+	watch->~LuaSocketStats();
+	return 0;
+}
+
+// The stats of the TCP object at index 1, registered on first use.
+static LuaSocketStats* socket_stats(lua_State *L) {
+	lua_pushlightuserdata(L, &s_watchKey);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_pushvalue(L, 1);
+	lua_rawget(L, -2);
+	LuaSocketStats* watch = (LuaSocketStats*) lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	if (!watch) {
+		watch = (LuaSocketStats*) lua_newuserdata(L, sizeof(LuaSocketStats));
+		new (watch) LuaSocketStats();
+		strcpy(watch->m_stats.m_szName, "tcp");
+		lua_createtable(L, 0, 1);
+		lua_pushcfunction(L, stats_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, 1);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+		lua_pop(L, 1);
+		net_Register(&watch->m_stats);
+	}
+	lua_pop(L, 1);
+	return watch;
+}
+
+// Call the wrapped method (upvalue 1) with the arguments; returns the
+// number of results, which replace the arguments on the stack.
+static int call_wrapped(lua_State *L) {
+	int args = lua_gettop(L);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	lua_call(L, args, LUA_MULTRET);
+	return lua_gettop(L);
+}
+
+// tcp:connect(address, port) names the connection, and a connect that
+// completes at once times the handshake as a round trip.
+static int watch_connect(lua_State *L) {
+	LuaSocketStats* watch = socket_stats(L);
+	snprintf(watch->m_stats.m_szName, sizeof(watch->m_stats.m_szName), "%s:%d",
+		luaL_optstring(L, 2, "?"), (int) luaL_optinteger(L, 3, 0));
+	double start = timer_Now();
+	int results = call_wrapped(L);
+	if (lua_toboolean(L, 1)) watch->m_stats.AddRttSample(timer_Now() - start);
+	return results;
+}
+
+static bool shaping() {
+	return net_ShapeDelays() || g_netShaper.m_nBandwidth || g_netShaper.m_fLoss > 0;
+}
+
+// Send the held back data of the TCP object at index 1 that is due and
+// that the bandwidth lets through, or all of it, until a send takes less
+// than it is given.
+static void flush_sends(lua_State *L, LuaSocketStats* watch, double now, bool all) {
+	while (!watch->m_lstDelayed.empty()) {
+		LuaDelayedSend& front = watch->m_lstDelayed.front();
+		if (!all && front.m_fDue > now) break;
+		size_t length = front.m_data.size() - front.m_nSent;
+		long allowance = all ? -1 : net_ShapeAllowance(watch->m_fSendAllowance, watch->m_fSendShaped, now);
+		if (!allowance) break;
+		if (allowance > 0 && length > (size_t) allowance) length = (size_t) allowance;
+
+		lua_pushlightuserdata(L, &s_sendKey);
+		lua_rawget(L, LUA_REGISTRYINDEX);
+		lua_pushvalue(L, 1);
+		lua_pushlstring(L, front.m_data.data() + front.m_nSent, length);
+		lua_call(L, 2, 3);
+		long sent = (long) (lua_isnumber(L, -3) ? lua_tonumber(L, -3) : lua_tonumber(L, -1));
+		lua_pop(L, 3);
+		if (sent <= 0) break;
+
+		if (allowance > 0) watch->m_fSendAllowance -= sent;
+		watch->m_stats.m_nBytesSent += sent;
+		front.m_nSent += sent;
+		if (front.m_nSent < front.m_data.size()) break;
+		watch->m_stats.m_nPacketsSent++;
+		watch->m_lstDelayed.pop_front();
+	}
+}
+
+// tcp:send(data, i, j) returns the index of the last byte sent, first on
+// success or third on failure. A send starts a round trip unless one is
+// already waiting for its reply. While the shaper is on, the bytes are
+// held back, or lost, and the send reports them all sent.
+static int watch_send(lua_State *L) {
+	LuaSocketStats* watch = socket_stats(L);
+	size_t size = 0;
+	const char* data = luaL_checklstring(L, 2, &size);
+	long start = (long) luaL_optnumber(L, 3, 1);
+	if (start < 0) start = (long) (size + start + 1);
+	if (start < 1) start = 1;
+	if (shaping() || !watch->m_lstDelayed.empty()) {
+		long end = (long) luaL_optnumber(L, 4, -1);
+		if (end < 0) end = (long) (size + end + 1);
+		if (end > (long) size) end = (long) size;
+		double now = timer_Now();
+		if (end >= start && net_ShapeDrops()) {
+			watch->m_stats.m_nPacketsDropped++;
+		}
+		else if (end >= start) {
+			double last = watch->m_lstDelayed.empty() ? 0 : watch->m_lstDelayed.back().m_fDue;
+			watch->m_lstDelayed.push_back(LuaDelayedSend());
+			LuaDelayedSend& delayed = watch->m_lstDelayed.back();
+			delayed.m_fDue = net_ShapeDelays() ? net_ShapeDue(now, last) : (now > last ? now : last);
+			delayed.m_data.assign(data + start - 1, (size_t) (end - start + 1));
+			delayed.m_nSent = 0;
+			if (!watch->m_fPingSent) watch->m_fPingSent = now;
+		}
+		flush_sends(L, watch, now, false);
+		watch->m_stats.SampleQueues((int) watch->m_lstDelayed.size(), 0);
+		lua_pushnumber(L, (lua_Number) (end < start ? start - 1 : end));
+		return 1;
+	}
+	watch->m_stats.SampleQueues(0, 0);
+	int results = call_wrapped(L);
+	long last = (long) (lua_isnumber(L, 1) ? lua_tonumber(L, 1) : lua_tonumber(L, 3));
+	long sent = last - start + 1;
+	if (sent > 0) {
+		watch->m_stats.m_nBytesSent += sent;
+		watch->m_stats.m_nPacketsSent++;
+		if (!watch->m_fPingSent) watch->m_fPingSent = timer_Now();
+	}
+	return results;
+}
+
+// tcp:receive(pattern, prefix) returns the data, or nil, an error and
+// the part received, after the prefix. Data after a send is its reply.
+// While the shaper's bandwidth is used up it times out at once.
+static int watch_receive(lua_State *L) {
+	LuaSocketStats* watch = socket_stats(L);
+	double now = timer_Now();
+	flush_sends(L, watch, now, false);
+	watch->m_stats.SampleQueues((int) watch->m_lstDelayed.size(), 0);
+	size_t prefix = lua_type(L, 3) == LUA_TSTRING ? lua_objlen(L, 3) : 0;
+	long allowance = net_ShapeAllowance(watch->m_fReceiveAllowance, watch->m_fReceiveShaped, now);
+	if (!allowance) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+		if (prefix) lua_pushvalue(L, 3);
+		else lua_pushliteral(L, "");
+		return 3;
+	}
+	int results = call_wrapped(L);
+	size_t got = lua_isstring(L, 1) ? lua_objlen(L, 1) : (lua_isstring(L, 3) ? lua_objlen(L, 3) : 0);
+	got = got > prefix ? got - prefix : 0;
+	if (got > 0) {
+		if (allowance > 0) watch->m_fReceiveAllowance -= (double) got;
+		watch->m_stats.m_nBytesReceived += (long) got;
+		watch->m_stats.m_nPacketsReceived++;
+		if (watch->m_fPingSent) {
+			watch->m_stats.AddRttSample(timer_Now() - watch->m_fPingSent);
+			watch->m_fPingSent = 0;
+		}
+	}
+	return results;
+}
+
+// tcp:close() sends what the shaper still holds back, as the stream
+// would have before closing, and moves the connection's counters into
+// the totals.
+static int watch_close(lua_State *L) {
+	LuaSocketStats* watch = socket_stats(L);
+	flush_sends(L, watch, timer_Now(), true);
+	watch->m_lstDelayed.clear();
+	net_Unregister(&watch->m_stats);
+	return call_wrapped(L);
+}
+
+// Replace a method in the __index table of a luasocket class.
+static void wrap_method(lua_State *L, const char* classname, const char* name, lua_CFunction wrapper) {
+	luaL_getmetatable(L, classname);
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "__index");
+		lua_getfield(L, -1, name);
+		if (lua_isfunction(L, -1)) {
+			lua_pushcclosure(L, wrapper, 1);
+			lua_setfield(L, -2, name);
+		}
+		else lua_pop(L, 1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+int net_WatchLuaSockets( lua_State* L )
+{
+	lua_pushlightuserdata(L, &s_watchKey);
+	lua_createtable(L, 0, 0);
+	lua_createtable(L, 0, 1);
+	lua_pushliteral(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+
+	// flush_sends calls luasocket's send itself.
+	luaL_getmetatable(L, "tcp{client}");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "__index");
+		lua_pushlightuserdata(L, &s_sendKey);
+		lua_getfield(L, -2, "send");
+		lua_rawset(L, LUA_REGISTRYINDEX);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	wrap_method(L, "tcp{master}", "connect", watch_connect);
+	wrap_method(L, "tcp{client}", "send", watch_send);
+	wrap_method(L, "tcp{client}", "receive", watch_receive);
+	wrap_method(L, "tcp{client}", "close", watch_close);
+	return 0;
+}
@@ -0,0 +1,110 @@
+// NetStats.h: per-connection network statistics and traffic shaping
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_NETSTATS_H
+#define FGM_NETSTATS_H
+
+struct lua_State;
+struct CompressionStats;
+
+// Queue depth histogram buckets: 0, 1, 2-3, 4-7, ... 1024+
+#define NET_HISTOGRAM_SIZE	12
+
+// Counters for one connection. Sockets, and the TCP objects of luasocket
+// (net_WatchLuaSockets), register their stats so they can be listed from
+// Lua and the log.
+//
+struct NetStats
+{
+	NetStats();
+
+	void Reset();
+
+	// Feed a measured round trip (seconds) into the smoothed estimate.
+	void AddRttSample( double fSeconds );
+
+	// Record the current depth of the send and receive queues.
+	void SampleQueues( int nSend, int nReceive );
+
+	char m_szName[32];
+	long m_nPacketsSent;
+	long m_nPacketsReceived;
+	long m_nBytesSent;
+	long m_nBytesReceived;
+	long m_nPacketsDropped;		// by the traffic shaper
+
+	double m_fRtt;				// smoothed round trip time
+	double m_fRttVar;			// mean deviation of the above
+	double m_fRttMin;
+	double m_fRttMax;
+	long m_nRttSamples;
+
+	long m_aSendQueue[NET_HISTOGRAM_SIZE];
+	long m_aReceiveQueue[NET_HISTOGRAM_SIZE];
+
+	// Set while the connection is compressing.
+	const CompressionStats* m_pSendCompression;
+	const CompressionStats* m_pReceiveCompression;
+};
+
+// Simulated network conditions, applied to every Socket and luasocket
+// TCP object (net_WatchLuaSockets). All zero means the shaper is off.
+//
+struct NetShaper
+{
+	double m_fLatency;		// seconds added in each direction
+	double m_fJitter;		// up to this many more seconds, at random
+	long m_nBandwidth;		// bytes per second in each direction
+	double m_fLoss;			// fraction of outgoing packets dropped
+};
+
+extern NetShaper g_netShaper;
+
+// Bytes the shaper lets through now from a bucket holding fAvail bytes
+// when last filled at fLast, or -1 if bandwidth is not limited. Take
+// what is sent from fAvail; going below zero is paid back before any
+// more is let through.
+long net_ShapeAllowance( double& fAvail, double& fLast, double fNow );
+
+// Whether data sent now is held back, and until when: after the latency
+// and jitter, and not before fLastDue, so a stream stays in order.
+bool net_ShapeDelays();
+double net_ShapeDue( double fNow, double fLastDue );
+
+// Whether the shaper loses a packet sent now.
+bool net_ShapeDrops();
+
+// Whether Sockets compress what they send (Socket::EnableCompression),
+// set from Lua by net.setCompression. luasocket's objects never do.
+extern bool g_bNetCompression;
+
+// Registry of live connections
+//
+void net_Register( NetStats* pStats );
+void net_Unregister( NetStats* pStats );
+
+// Totals over every connection, open or closed.
+void net_GetTotals( NetStats* pTotals );
+
+// Write the stats of every connection to the log.
+void net_LogStats();
+
+// Register the net library with Lua.
+int luaopen_net( lua_State* L );
+
+// Count the traffic of luasocket's TCP objects, once socket.core is
+// open: the bytes each send takes and each receive returns. Each object
+// is a connection from its first use until it is closed or collected;
+// a send and the next data received are a round trip, as is a connect
+// that completes at once.
+//
+// The shaper applies to them too. A send is lost whole or taken whole;
+// what is taken goes out after the latency and jitter, as bandwidth
+// allows, on a later send or receive of the same object, or on close.
+// Receives return nothing while the bandwidth is used up. The latency
+// is added to what they send only: luasocket reads as the caller asks,
+// so received data cannot be held back without changing what it gets.
+int net_WatchLuaSockets( lua_State* L );
+
+#endif // FGM_NETSTATS_H
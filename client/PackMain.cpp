@@ -0,0 +1,390 @@
+// PackMain.cpp: builds an asset pack from the data directory
+//
+// Walks the directory and packs every image stb_image can read into one
+// file (see QSGAssetPack.h) for the clients to map at startup. Images are
+// decoded here, exactly as sg.loadTexture would decode them, so loading
+// one at runtime is a lookup; with -raw they are stored as the original
+// files and decoded from the mapping instead, for a smaller pack. The
+// pack shadows the loose files, so build it again after changing them.
+//
+// With -compress bc, RGB images are stored as BC1 and RGBA as BC3; with
+// -compress etc, RGB images are stored as ETC1 (which has no alpha). The
+// GPU samples these as they are, in a quarter to a sixth of the memory.
+// Grey images are left alone: they are mostly glyphs, whose edges
+// suffer in 4x4 blocks. DDS and KTX files are packed as they are.
+//
+// Renderers build mip levels for textures drawn with a mipmapped filter,
+// but cannot build them from blocks; -mips stores a full chain in each
+// BC file, a third more again, so compressed textures can minify too.
+// ETC1 goes in KTX files, whose mip levels are ignored (QSGBlockTexture.h),
+// so -mips is refused with -compress etc.
+//
+// With -premultiply, images are stored with premultiplied alpha, as
+// sg.setPremultiply loads them; mip levels are built after, as they
+// have to be for clear texels not to bleed into their neighbours.
+//
+// Lua scripts are compiled and packed as the chunks LuaCache.h loads, so
+// the clients start without parsing them; a script edited since the pack
+// was built is compiled from its source again instead.
+//
+//   mkpack [-out data.qpak] [-raw | [-premultiply] [-compress bc [-mips] | -compress etc]]
+//          [directory]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "QSGAssetPack.h"
+#include "QSGBlockTexture.h"
+#include "QSGMipmap.h"
+#include "QSGSoftwareSpans.h"
+#include "JpegSimd.h"
+#include "LuaCache.h"
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "stb_image.h"
+}
+
+struct PackOptions
+{
+	const char* m_szOutput;
+	const char* m_szDirectory;
+	bool m_bRaw;				// keep the files, not decoded texels
+	int m_nCompress;			// 0, QSGTextureBC1 (and BC3) or QSGTextureETC1
+	bool m_bMips;				// compress every mip level, not just the first
+	bool m_bPremultiply;		// multiply colours by alpha
+};
+
+// One asset on its way into the pack.
+struct PackItem
+{
+	std::string m_name;			// relative to the directory
+	QSGPackEntry m_entry;
+	std::vector<unsigned char> m_bytes;
+};
+
+static bool SortByName(const PackItem* a, const PackItem* b)
+{
+	return a->m_name < b->m_name;
+}
+
+static bool IsImage(const std::string& name)
+{
+	static const char* extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".dds", ".ktx", NULL };
+	std::string lower = name;
+	for (size_t i = 0; i < lower.size(); ++i)
+		if (lower[i] >= 'A' && lower[i] <= 'Z') lower[i] += 'a' - 'A';
+	for (int i = 0; extensions[i]; ++i) {
+		size_t len = strlen(extensions[i]);
+		if (lower.size() > len && !lower.compare(lower.size() - len, len, extensions[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool IsScript(const std::string& name)
+{
+	return name.size() > 4 && !name.compare(name.size() - 4, 4, ".lua");
+}
+
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& bytes)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) return false;
+	unsigned char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + got);
+	fclose(file);
+	return true;
+}
+
+// Find the images and scripts under 'dir', naming them from 'prefix'.
+static void FindAssets(const std::string& dir, const std::string& prefix, std::vector<std::string>& names,
+	std::vector<std::string>& scripts)
+{
+	DIR* d = opendir(dir.c_str());
+	if (!d) return;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] == '.') continue;
+		std::string path = dir + "/" + ent->d_name;
+		std::string name = prefix + ent->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st)) continue;
+		if (S_ISDIR(st.st_mode)) FindAssets(path, name + "/", names, scripts);
+		else if (S_ISREG(st.st_mode) && IsImage(name)) names.push_back(name);
+		else if (S_ISREG(st.st_mode) && IsScript(name)) scripts.push_back(name);
+	}
+	closedir(d);
+}
+
+// The format to compress an image to, or 0 to keep its texels.
+static int CompressFormat(const PackOptions& options, int components)
+{
+	if (components < 3) return 0;
+	if (options.m_nCompress == QSGTextureBC1)
+		return components == 4 ? QSGTextureBC3 : QSGTextureBC1;
+	if (options.m_nCompress == QSGTextureETC1)
+		return components == 3 ? QSGTextureETC1 : 0;
+	return 0;
+}
+
+static bool LoadItem(const PackOptions& options, PackItem* item)
+{
+	std::string path = std::string(options.m_szDirectory) + "/" + item->m_name;
+	memset(&item->m_entry, 0, sizeof(item->m_entry));
+	if (!ReadFile(path, item->m_bytes)) {
+		fprintf(stderr, "cannot read %s\n", path.c_str());
+		return false;
+	}
+	if (options.m_bRaw) {
+		item->m_entry.kind = QSGPackFile;
+		return true;
+	}
+	QSGBlockImage blocks;
+	if (!item->m_bytes.empty() && qsgParseBlockFile(&item->m_bytes[0], item->m_bytes.size(), &blocks)) {
+		item->m_entry.kind = QSGPackBlocks;
+		item->m_entry.width = blocks.width;
+		item->m_entry.height = blocks.height;
+		item->m_entry.components = qsgBlockComponents(blocks.format);
+		return true;
+	}
+
+	int width, height, comp;
+	stbi_uc* data = stbi_load_from_memory(&item->m_bytes[0], (int) item->m_bytes.size(),
+		&width, &height, &comp, STBI_default);
+	if (!data) {
+		fprintf(stderr, "cannot decode %s (%s)\n", path.c_str(), stbi_failure_reason());
+		return false;
+	}
+	item->m_entry.width = width;
+	item->m_entry.height = height;
+	if (options.m_bPremultiply) {
+		qsgPremultiply(data, (size_t) width * height, comp);
+		item->m_entry.flags |= QSGPackPremultiplied;
+	}
+	int format = CompressFormat(options, comp);
+	if (format) {
+		int levels = options.m_bMips ? qsgMipLevels(width, height) : 1;
+		std::vector<unsigned char> chain(data, data + (size_t) width * height * comp);
+		chain.resize(qsgMipChainSize(width, height, comp, levels));
+		qsgBuildMipChain(&chain[0], width, height, comp, levels);
+		std::vector<unsigned char> encoded, level;
+		const unsigned char* texels = &chain[0];
+		for (int i = 0; i < levels; ++i) {
+			int w = qsgMipSize(width, i), h = qsgMipSize(height, i);
+			qsgEncodeBlocks(format, texels, comp, w, h, level);
+			encoded.insert(encoded.end(), level.begin(), level.end());
+			texels += (size_t) w * h * comp;
+		}
+		QSGBlockImage image = { format, width, height, levels, &encoded[0], encoded.size() };
+		qsgWriteBlockFile(image, item->m_bytes);
+		item->m_entry.kind = QSGPackBlocks;
+		item->m_entry.components = qsgBlockComponents(format);
+	}
+	else {
+		item->m_entry.kind = QSGPackTexels;
+		item->m_entry.components = comp;
+		item->m_bytes.assign(data, data + (size_t) width * height * comp);
+	}
+	stbi_image_free(data);
+	return true;
+}
+
+// A script compiled, under its name plus 'c'.
+static bool LoadScript(lua_State* L, const PackOptions& options, const std::string& name, PackItem* item)
+{
+	std::string path = std::string(options.m_szDirectory) + "/" + name;
+	std::vector<unsigned char> source;
+	item->m_name = name + "c";
+	memset(&item->m_entry, 0, sizeof(item->m_entry));
+	item->m_entry.kind = QSGPackFile;
+	if (!ReadFile(path, source)) {
+		fprintf(stderr, "cannot read %s\n", path.c_str());
+		return false;
+	}
+	if (luacache_Compile(L, source.empty() ? "" : (const char*) &source[0], source.size(), name.c_str(), item->m_bytes)) {
+		fprintf(stderr, "cannot compile %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+		return false;
+	}
+	lua_pop(L, 1);
+	return true;
+}
+
+static bool WritePadding(FILE* file, unsigned long long* offset, unsigned long long align)
+{
+	static const unsigned char zeros[QSG_PACK_ALIGN] = { 0 };
+	size_t pad = (size_t)((align - *offset % align) % align);
+	*offset += pad;
+	return fwrite(zeros, 1, pad, file) == pad;
+}
+
+static bool WritePack(const char* filename, std::vector<PackItem*>& items)
+{
+	// layout: header, index, names, then the assets.
+	std::string names;
+	for (size_t i = 0; i < items.size(); ++i) {
+		items[i]->m_entry.nameOffset = (unsigned int) names.size();
+		names += items[i]->m_name;
+		names += '\0';
+	}
+	if (names.empty()) names += '\0';
+
+	QSGPackHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, QSG_PACK_MAGIC, 4);
+	header.version = QSG_PACK_VERSION;
+	header.count = (unsigned int) items.size();
+	header.namesSize = (unsigned int) names.size();
+	header.indexOffset = sizeof(header);
+
+	unsigned long long offset = header.indexOffset + items.size() * sizeof(QSGPackEntry) + names.size();
+	for (size_t i = 0; i < items.size(); ++i) {
+		offset = (offset + QSG_PACK_ALIGN - 1) / QSG_PACK_ALIGN * QSG_PACK_ALIGN;
+		items[i]->m_entry.offset = offset;
+		items[i]->m_entry.size = items[i]->m_bytes.size();
+		offset += items[i]->m_bytes.size();
+	}
+
+	FILE* file = fopen(filename, "wb");
+	if (!file) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; ok && i < items.size(); ++i)
+		ok = fwrite(&items[i]->m_entry, sizeof(QSGPackEntry), 1, file) == 1;
+	ok = ok && fwrite(names.data(), 1, names.size(), file) == names.size();
+	offset = header.indexOffset + items.size() * sizeof(QSGPackEntry) + names.size();
+	for (size_t i = 0; ok && i < items.size(); ++i) {
+		ok = WritePadding(file, &offset, QSG_PACK_ALIGN);
+		const std::vector<unsigned char>& bytes = items[i]->m_bytes;
+		if (ok && !bytes.empty()) ok = fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+		offset += bytes.size();
+	}
+	if (fclose(file)) ok = false;
+	return ok;
+}
+
+bool ParseOptions(int argc, char** argv, PackOptions* options)
+{
+	options->m_szOutput = "data.qpak";
+	options->m_szDirectory = NULL;
+	options->m_bRaw = false;
+	options->m_nCompress = 0;
+	options->m_bMips = false;
+	options->m_bPremultiply = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (!strcmp(arg, "-raw")) {
+			options->m_bRaw = true;
+			continue;
+		}
+		if (!strcmp(arg, "-mips")) {
+			options->m_bMips = true;
+			continue;
+		}
+		if (!strcmp(arg, "-premultiply")) {
+			options->m_bPremultiply = true;
+			continue;
+		}
+		if (arg[0] != '-') {
+			if (options->m_szDirectory) return false;
+			options->m_szDirectory = arg;
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-out")) options->m_szOutput = value;
+		else if (!strcmp(arg, "-compress")) {
+			if (!strcmp(value, "bc")) options->m_nCompress = QSGTextureBC1;
+			else if (!strcmp(value, "etc")) options->m_nCompress = QSGTextureETC1;
+			else return false;
+		}
+		else return false;
+		++i;
+	}
+
+	if (!options->m_szDirectory) options->m_szDirectory = ".";
+	if (options->m_bMips && options->m_nCompress != QSGTextureBC1) return false;
+	return !(options->m_bRaw && (options->m_nCompress || options->m_bPremultiply));
+}
+
+int main(int argc, char** argv)
+{
+	PackOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s [-out data.qpak] [-raw | [-premultiply] [-compress bc [-mips] | -compress etc]]\n"
+			"       [directory]\n", argv[0]);
+		return 2;
+	}
+
+	jpeg_InstallSimd(qsgSpanCpuLevel());
+
+	std::vector<std::string> names, scripts;
+	FindAssets(options.m_szDirectory, "", names, scripts);
+
+	std::vector<PackItem*> items;
+	unsigned long long files = 0, packed = 0;
+	int compressed = 0;
+	for (size_t i = 0; i < names.size(); ++i) {
+		PackItem* item = new PackItem();
+		item->m_name = names[i];
+		if (!LoadItem(options, item)) {
+			delete item;
+			continue;
+		}
+		struct stat st;
+		std::string path = std::string(options.m_szDirectory) + "/" + names[i];
+		if (!stat(path.c_str(), &st)) files += st.st_size;
+		packed += item->m_bytes.size();
+		if (item->m_entry.kind == QSGPackBlocks) ++compressed;
+		items.push_back(item);
+	}
+	lua_State* L = luaL_newstate();
+	int compiled = 0;
+	for (size_t i = 0; i < scripts.size(); ++i) {
+		PackItem* item = new PackItem();
+		if (!LoadScript(L, options, scripts[i], item)) {
+			delete item;
+			continue;
+		}
+		struct stat st;
+		std::string path = std::string(options.m_szDirectory) + "/" + scripts[i];
+		if (!stat(path.c_str(), &st)) files += st.st_size;
+		packed += item->m_bytes.size();
+		++compiled;
+		items.push_back(item);
+	}
+	lua_close(L);
+	std::sort(items.begin(), items.end(), SortByName);
+
+	bool ok = WritePack(options.m_szOutput, items);
+	for (size_t i = 0; i < items.size(); ++i)
+		delete items[i];
+	if (!ok) {
+		fprintf(stderr, "cannot write %s\n", options.m_szOutput);
+		return 1;
+	}
+
+	// read it back the way the clients will.
+	ref_ptr<QSGAssetPack> pack = QSGAssetPack::open(options.m_szOutput);
+	if (!pack) {
+		fprintf(stderr, "%s failed validation\n", options.m_szOutput);
+		return 1;
+	}
+	printf("%s: %d %s (%d compressed), %d scripts, %llu bytes of files, %llu bytes packed\n", options.m_szOutput,
+		pack->count() - compiled, options.m_bRaw ? "files" : "images", compressed, compiled, files, packed);
+	return 0;
+}
@@ -13,7 +13,9 @@ extern HACCEL m_hAccelTable;
 void Packet::UnpackHeader()
 {
 	int len = UNPACK_UINT16(m_pData, 0);
-	m_pData[len] = 0; // terminate packet.
+	if( len == PACKET_CONTROL ) len = PACKET_CONTROL_SIZE;
+	SetLength( len );
+	m_pData[PACKET_HEADER_SIZE + len] = 0; // terminate packet.
 }
 
 bool Packet::CloseMessage()
@@ -26,3 +28,11 @@ bool Packet::CloseMessage()
 
 	return (len > 0); // packet contains some data?
 }
+
+void Packet::CloseControl( int nCode )
+{
+	Clear();
+	WriteByte( nCode );
+	m_pData[0] = (unsigned char) (PACKET_CONTROL >> 8);
+	m_pData[1] = (unsigned char) (PACKET_CONTROL);
+}
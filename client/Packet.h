@@ -7,9 +7,15 @@
 
 #include <string.h> // memcpy
 
-#define MAX_PACKET_DATA		65535
+#define MAX_PACKET_DATA		65534
 #define PACKET_HEADER_SIZE	2
 
+// A header holding PACKET_CONTROL in place of a length starts a control
+// frame: PACKET_CONTROL_SIZE bytes for the connection, not the game. No
+// packet is that long, so packets look the same with or without them.
+#define PACKET_CONTROL		0xFFFF
+#define PACKET_CONTROL_SIZE	1
+
 #define PACKET_DATA_LENGTH ((int)(m_pPtr - m_pData) - PACKET_HEADER_SIZE)
 #define TOTAL_PACKET_SIZE ((int)(m_pPtr - m_pData))
 
@@ -38,6 +44,7 @@ public:
 	//
 	void Clear();
 	bool CloseMessage();
+	void CloseControl( int nCode );
 
 	inline void WriteByte( int data );
 	inline void WriteInt16( int data );
@@ -47,6 +54,7 @@ public:
 	// Packet receiving functions
 	//
 	void UnpackHeader();
+	inline bool IsControl() const;
 
 	inline int ReadByte();
 	inline int ReadInt16();
@@ -60,6 +68,7 @@ public:
 	inline int GetPacketSize() { return TOTAL_PACKET_SIZE; }
 	inline unsigned char* GetData() { return m_pData + PACKET_HEADER_SIZE; }
 	inline int GetLength() { return PACKET_DATA_LENGTH; }
+	inline void SetLength( int len ) { m_pPtr = m_pData + PACKET_HEADER_SIZE + len; }
 
 	// Reference counting
 	//
@@ -84,6 +93,11 @@ inline void Packet::Clear()
 	m_pPtr = m_pData + PACKET_HEADER_SIZE;
 }
 
+inline bool Packet::IsControl() const
+{
+	return m_pData[0] == (PACKET_CONTROL >> 8) && m_pData[1] == (PACKET_CONTROL & 255);
+}
+
 inline int Packet::ReadByte()
 {
 	return *m_pPtr++;
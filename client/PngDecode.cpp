@@ -0,0 +1,593 @@
+// PngDecode.cpp: PNG decoding straight into a caller's texture buffer
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "PngDecode.h"
+#include "QSGSoftwareSpans.h"
+#include "Thread.h"
+#include "stb_image.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PNG_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+// Images that inflate to at least this many bytes are inflated on a
+// thread of their own while this one unfilters the rows.
+#define PNG_THREAD_MIN		(64 * 1024)
+
+// Inflate progress is published about this often, in whole rows.
+#define PNG_PROGRESS_STEP	4096
+
+#define PNG_TYPE(a,b,c,d)	(((unsigned int) (a) << 24) + ((b) << 16) + ((c) << 8) + (d))
+
+enum PngFilter
+{
+	PNG_NONE = 0,
+	PNG_SUB,
+	PNG_UP,
+	PNG_AVG,
+	PNG_PAETH,
+};
+
+struct PngImage
+{
+	int m_nWidth;
+	int m_nHeight;
+	int m_nChannels;			// per pixel in the filtered rows; 1 for palettes
+	int m_nComponents;			// after palette or colour key expansion
+	int m_nPalette;				// components in the palette, or 0
+	int m_nPaletteSize;
+	unsigned char m_palette[256 * 4];
+	bool m_bColourKey;			// tRNS on a grey or RGB image
+	unsigned char m_key[3];
+	const unsigned char* m_pCompressed;		// the zlib stream from the IDATs
+	int m_nCompressed;
+	int m_nIdat;
+	std::vector<unsigned char> m_joined;	// when there is more than one IDAT
+};
+
+// Shared with the inflate thread.
+struct PngInflate
+{
+	unsigned char* m_pRaw;		// filtered rows, each after its filter byte
+	int m_nRawSize;
+	const unsigned char* m_pIn;
+	int m_nIn;
+	int m_nStep;
+	volatile long m_nInflated;	// bytes of m_pRaw that are final
+	volatile long m_bDone;
+	int m_nResult;				// from stbi_zlib_decode_buffer_progress
+};
+
+typedef void (*UnfilterFunc)( int nFilter, unsigned char* pCur, const unsigned char* pRaw,
+	const unsigned char* pPrior, int nBytes, int nBpp );
+
+static const char* s_szFailure = "";
+static UnfilterFunc s_unfilter = NULL;
+
+
+// ---------------------------------------------------------------------
+
+static bool fail( const char* szReason )
+{
+	s_szFailure = szReason;
+	return false;
+}
+
+static unsigned int get32( const unsigned char* p )
+{
+	return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Copy the data of every IDAT into one buffer for the inflate.
+static void joinIdat( const unsigned char* pData, PngImage* pImage )
+{
+	std::vector<unsigned char>& joined = pImage->m_joined;
+	joined.reserve( pImage->m_nCompressed );
+	for (const unsigned char* p = pData + 8; ; ) {
+		unsigned int nLength = get32( p );
+		unsigned int nType = get32( p + 4 );
+		if (nType == PNG_TYPE('I','E','N','D')) break;
+		if (nType == PNG_TYPE('I','D','A','T')) joined.insert( joined.end(), p + 8, p + 8 + nLength );
+		p += nLength + 12;
+	}
+	pImage->m_pCompressed = &joined[0];
+}
+
+// Read the chunks, with the same checks as stb_image. With bJoin the
+// IDAT data is found (and joined if it is split), ready to inflate.
+static bool parsePng( const unsigned char* pData, int nSize, PngImage* pImage, bool bJoin )
+{
+	static const unsigned char sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	if (nSize < 8 || memcmp( pData, sig, 8 )) return fail( "not a PNG" );
+
+	int nColour = 0;
+	pImage->m_nPalette = 0;
+	pImage->m_nPaletteSize = 0;
+	pImage->m_bColourKey = false;
+	pImage->m_pCompressed = NULL;
+	pImage->m_nCompressed = 0;
+	pImage->m_nIdat = 0;
+	pImage->m_joined.clear();
+
+	const unsigned char* p = pData + 8;
+	const unsigned char* pEnd = pData + nSize;
+	for (bool bFirst = true; ; bFirst = false) {
+		if (pEnd - p < 12) return fail( "truncated PNG" );
+		unsigned int nLength = get32( p );
+		unsigned int nType = get32( p + 4 );
+		const unsigned char* c = p + 8;
+		if (nLength > (unsigned int) (pEnd - c) - 4) return fail( "truncated PNG" );
+		if (bFirst && nType != PNG_TYPE('I','H','D','R')) return fail( "first not IHDR" );
+
+		switch (nType) {
+		case PNG_TYPE('I','H','D','R'):
+			if (!bFirst) return fail( "multiple IHDR" );
+			if (nLength != 13) return fail( "bad IHDR len" );
+			pImage->m_nWidth = (int) get32( c );
+			pImage->m_nHeight = (int) get32( c + 4 );
+			if (get32( c ) > (1 << 24) || get32( c + 4 ) > (1 << 24)) return fail( "too large" );
+			if (!pImage->m_nWidth || !pImage->m_nHeight) return fail( "0-pixel image" );
+			if (c[8] != 8) return fail( "8bit only" );
+			nColour = c[9];
+			if (nColour > 6 || (nColour != 3 && (nColour & 1))) return fail( "bad ctype" );
+			if (c[10]) return fail( "bad comp method" );
+			if (c[11]) return fail( "bad filter method" );
+			if (c[12] > 1) return fail( "bad interlace method" );
+			if (c[12]) return fail( "interlaced" );
+			pImage->m_nChannels = nColour == 3 ? 1 : (nColour & 2 ? 3 : 1) + (nColour & 4 ? 1 : 0);
+			if ((1 << 30) / pImage->m_nWidth / 4 < pImage->m_nHeight) return fail( "too large" );
+			break;
+
+		case PNG_TYPE('P','L','T','E'):
+			if (nLength > 256 * 3 || nLength % 3) return fail( "invalid PLTE" );
+			pImage->m_nPaletteSize = nLength / 3;
+			for (unsigned int i = 0; i < nLength / 3; ++i) {
+				memcpy( &pImage->m_palette[i * 4], c + i * 3, 3 );
+				pImage->m_palette[i * 4 + 3] = 255;
+			}
+			break;
+
+		case PNG_TYPE('t','R','N','S'):
+			if (pImage->m_pCompressed) return fail( "tRNS after IDAT" );
+			if (nColour == 3) {
+				if (!pImage->m_nPaletteSize) return fail( "tRNS before PLTE" );
+				if (nLength > (unsigned int) pImage->m_nPaletteSize) return fail( "bad tRNS len" );
+				pImage->m_nPalette = 4;
+				for (unsigned int i = 0; i < nLength; ++i)
+					pImage->m_palette[i * 4 + 3] = c[i];
+			}
+			else {
+				if (!(pImage->m_nChannels & 1)) return fail( "tRNS with alpha" );
+				if (nLength != (unsigned int) pImage->m_nChannels * 2) return fail( "bad tRNS len" );
+				// stb_image keeps the low byte of each 16-bit sample
+				pImage->m_bColourKey = true;
+				for (int k = 0; k < pImage->m_nChannels; ++k)
+					pImage->m_key[k] = c[k * 2 + 1];
+			}
+			break;
+
+		case PNG_TYPE('I','D','A','T'):
+			if (nColour == 3 && !pImage->m_nPaletteSize) return fail( "no PLTE" );
+			if (!pImage->m_pCompressed) pImage->m_pCompressed = c;
+			pImage->m_nCompressed += (int) nLength;
+			pImage->m_nIdat++;
+			break;
+
+		case PNG_TYPE('I','E','N','D'):
+			if (!pImage->m_pCompressed) return fail( "no IDAT" );
+			if (bJoin && pImage->m_nIdat > 1) joinIdat( pData, pImage );
+			if (nColour == 3 && !pImage->m_nPalette) pImage->m_nPalette = 3;
+			pImage->m_nComponents = pImage->m_nPalette ? pImage->m_nPalette :
+				pImage->m_nChannels + (pImage->m_bColourKey ? 1 : 0);
+			return true;
+
+		default:
+			// critical chunks must be understood
+			if (!(nType & (1 << 29))) return fail( "unknown critical chunk" );
+			break;
+		}
+		p = c + nLength + 4;
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// Unfiltering. The first row is unfiltered against a row of zeros,
+// which is what the PNG specification's first-row rules amount to.
+
+static inline int paeth( int a, int b, int c )
+{
+	int p = a + b - c;
+	int pa = abs( p - a );
+	int pb = abs( p - b );
+	int pc = abs( p - c );
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+static void unfilterRow( int nFilter, unsigned char* pCur, const unsigned char* pRaw,
+	const unsigned char* pPrior, int nBytes, int nBpp )
+{
+	int i;
+	switch (nFilter) {
+	case PNG_NONE:
+		memcpy( pCur, pRaw, nBytes );
+		break;
+	case PNG_SUB:
+		for (i = 0; i < nBpp; ++i) pCur[i] = pRaw[i];
+		for (; i < nBytes; ++i) pCur[i] = (unsigned char) (pRaw[i] + pCur[i - nBpp]);
+		break;
+	case PNG_UP:
+		for (i = 0; i < nBytes; ++i) pCur[i] = (unsigned char) (pRaw[i] + pPrior[i]);
+		break;
+	case PNG_AVG:
+		for (i = 0; i < nBpp; ++i) pCur[i] = (unsigned char) (pRaw[i] + (pPrior[i] >> 1));
+		for (; i < nBytes; ++i) pCur[i] = (unsigned char) (pRaw[i] + ((pPrior[i] + pCur[i - nBpp]) >> 1));
+		break;
+	case PNG_PAETH:
+		for (i = 0; i < nBpp; ++i) pCur[i] = (unsigned char) (pRaw[i] + pPrior[i]);
+		for (; i < nBytes; ++i)
+			pCur[i] = (unsigned char) (pRaw[i] + paeth( pCur[i - nBpp], pPrior[i], pPrior[i - nBpp] ));
+		break;
+	}
+}
+
+#ifdef PNG_SIMD_X86
+
+// Sub, Avg and Paeth depend on the pixel to the left, so for 3 and 4
+// byte pixels they are done a pixel at a time with the channels side by
+// side (as libpng does). Sub on 1, 2 and 4 byte pixels is a running sum,
+// done 16 bytes at a time; Up has no dependency at all.
+
+// Three byte pixels are put together in a register; a memcpy of three
+// bytes goes through the stack and stalls on the store forwarding.
+template<int BPP> static inline __m128i loadPixel( const unsigned char* p )
+{
+	int n;
+	if (BPP == 4) memcpy( &n, p, 4 );
+	else n = p[0] | (p[1] << 8) | (p[2] << 16);
+	return _mm_cvtsi32_si128( n );
+}
+
+template<int BPP> static inline void storePixel( unsigned char* p, __m128i v )
+{
+	int n = _mm_cvtsi128_si32( v );
+	if (BPP == 4) memcpy( p, &n, 4 );
+	else {
+		p[0] = (unsigned char) n;
+		p[1] = (unsigned char) (n >> 8);
+		p[2] = (unsigned char) (n >> 16);
+	}
+}
+
+// The last pixel of a 16-byte run, in every pixel.
+template<int BPP> static inline __m128i lastPixel( __m128i x )
+{
+	if (BPP == 4) return _mm_shuffle_epi32( x, 0xff );
+	if (BPP == 1) {
+		x = _mm_srli_epi16( x, 8 );
+		x = _mm_or_si128( x, _mm_slli_epi16( x, 8 ) );
+	}
+	return _mm_shuffle_epi32( _mm_shufflehi_epi16( x, 0xff ), 0xff );
+}
+
+template<int BPP> static void subRunSSE2( unsigned char* pCur, const unsigned char* pRaw, int nBytes )
+{
+	__m128i carry = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= nBytes; i += 16) {
+		__m128i x = _mm_loadu_si128( (const __m128i*) (pRaw + i) );
+		if (BPP == 1) x = _mm_add_epi8( x, _mm_slli_si128( x, 1 ) );
+		if (BPP <= 2) x = _mm_add_epi8( x, _mm_slli_si128( x, 2 ) );
+		x = _mm_add_epi8( x, _mm_slli_si128( x, 4 ) );
+		x = _mm_add_epi8( x, _mm_slli_si128( x, 8 ) );
+		x = _mm_add_epi8( x, carry );
+		_mm_storeu_si128( (__m128i*) (pCur + i), x );
+		carry = lastPixel<BPP>( x );
+	}
+	for (; i < nBytes; ++i)
+		pCur[i] = (unsigned char) (pRaw[i] + (i >= BPP ? pCur[i - BPP] : 0));
+}
+
+template<int BPP> static void subPixelsSSE2( unsigned char* pCur, const unsigned char* pRaw, int nBytes )
+{
+	__m128i a = _mm_setzero_si128();
+	for (int i = 0; i < nBytes; i += BPP) {
+		a = _mm_add_epi8( a, loadPixel<BPP>( pRaw + i ) );
+		storePixel<BPP>( pCur + i, a );
+	}
+}
+
+template<int BPP> static void avgPixelsSSE2( unsigned char* pCur, const unsigned char* pRaw,
+	const unsigned char* pPrior, int nBytes )
+{
+	__m128i one = _mm_set1_epi8( 1 );
+	__m128i a = _mm_setzero_si128();
+	for (int i = 0; i < nBytes; i += BPP) {
+		__m128i b = loadPixel<BPP>( pPrior + i );
+		// _mm_avg_epu8 rounds up; take off the odd bit to round down
+		__m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+		a = _mm_add_epi8( avg, loadPixel<BPP>( pRaw + i ) );
+		storePixel<BPP>( pCur + i, a );
+	}
+}
+
+static inline __m128i abs16( __m128i x )
+{
+	return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+static inline __m128i select16( __m128i mask, __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+template<int BPP> static void paethPixelsSSE2( unsigned char* pCur, const unsigned char* pRaw,
+	const unsigned char* pPrior, int nBytes )
+{
+	// a is to the left, b above, c above and to the left; 16-bit lanes
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	for (int i = 0; i < nBytes; i += BPP) {
+		__m128i b = _mm_unpacklo_epi8( loadPixel<BPP>( pPrior + i ), zero );
+		__m128i pa = _mm_sub_epi16( b, c );		// p - a
+		__m128i pb = _mm_sub_epi16( a, c );		// p - b
+		__m128i pc = _mm_add_epi16( pa, pb );	// p - c
+		pa = abs16( pa );
+		pb = abs16( pb );
+		pc = abs16( pc );
+		// ties go to a, then b, as in paeth()
+		__m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+		__m128i nearest = select16( _mm_cmpeq_epi16( smallest, pa ), a,
+			select16( _mm_cmpeq_epi16( smallest, pb ), b, c ) );
+		__m128i d = _mm_add_epi16( nearest, _mm_unpacklo_epi8( loadPixel<BPP>( pRaw + i ), zero ) );
+		a = _mm_and_si128( d, _mm_set1_epi16( 0xff ) );
+		storePixel<BPP>( pCur + i, _mm_packus_epi16( a, a ) );
+		c = b;
+	}
+}
+
+static void unfilterRowSSE2( int nFilter, unsigned char* pCur, const unsigned char* pRaw,
+	const unsigned char* pPrior, int nBytes, int nBpp )
+{
+	switch (nFilter) {
+	case PNG_UP: {
+		int i = 0;
+		for (; i + 16 <= nBytes; i += 16) {
+			__m128i raw = _mm_loadu_si128( (const __m128i*) (pRaw + i) );
+			__m128i prior = _mm_loadu_si128( (const __m128i*) (pPrior + i) );
+			_mm_storeu_si128( (__m128i*) (pCur + i), _mm_add_epi8( raw, prior ) );
+		}
+		for (; i < nBytes; ++i) pCur[i] = (unsigned char) (pRaw[i] + pPrior[i]);
+		return;
+	}
+	case PNG_SUB:
+		switch (nBpp) {
+		case 1: subRunSSE2<1>( pCur, pRaw, nBytes ); return;
+		case 2: subRunSSE2<2>( pCur, pRaw, nBytes ); return;
+		case 3: subPixelsSSE2<3>( pCur, pRaw, nBytes ); return;
+		case 4: subRunSSE2<4>( pCur, pRaw, nBytes ); return;
+		}
+		break;
+	case PNG_AVG:
+		if (nBpp == 3) { avgPixelsSSE2<3>( pCur, pRaw, pPrior, nBytes ); return; }
+		if (nBpp == 4) { avgPixelsSSE2<4>( pCur, pRaw, pPrior, nBytes ); return; }
+		break;
+	case PNG_PAETH:
+		if (nBpp == 3) { paethPixelsSSE2<3>( pCur, pRaw, pPrior, nBytes ); return; }
+		if (nBpp == 4) { paethPixelsSSE2<4>( pCur, pRaw, pPrior, nBytes ); return; }
+		break;
+	}
+	unfilterRow( nFilter, pCur, pRaw, pPrior, nBytes, nBpp );
+}
+
+#endif // PNG_SIMD_X86
+
+static UnfilterFunc chooseUnfilter( void )
+{
+#ifdef PNG_SIMD_X86
+	if (qsgSpanCpuLevel() >= QSGSpanSSE2) return unfilterRowSSE2;
+#endif
+	return unfilterRow;
+}
+
+
+// ---------------------------------------------------------------------
+// Conversion, for when the pixels wanted are not the filtered ones.
+
+static inline unsigned char computeY( int r, int g, int b )
+{
+	return (unsigned char) (((r * 77) + (g * 150) + (29 * b)) >> 8);
+}
+
+// One row of filtered pixels to nComponents, through the palette or
+// colour key first; the conversions are stb_image's convert_format.
+static void convertRow( const PngImage& image, const unsigned char* pSrc, unsigned char* pDst, int nComponents )
+{
+	int nChannels = image.m_nChannels;
+	int nWidth = image.m_nWidth;
+
+	// the usual cases: palettes to RGB or RGBA, and keys to alpha
+	if (image.m_nPalette && nComponents == 4) {
+		for (int x = 0; x < nWidth; ++x, pDst += 4)
+			memcpy( pDst, &image.m_palette[pSrc[x] * 4], 4 );
+		return;
+	}
+	if (image.m_nPalette && nComponents == 3) {
+		for (int x = 0; x < nWidth; ++x, pDst += 3) {
+			const unsigned char* pEntry = &image.m_palette[pSrc[x] * 4];
+			pDst[0] = pEntry[0];
+			pDst[1] = pEntry[1];
+			pDst[2] = pEntry[2];
+		}
+		return;
+	}
+	if (image.m_bColourKey && nChannels == 3 && nComponents == 4) {
+		const unsigned char* k = image.m_key;
+		for (int x = 0; x < nWidth; ++x, pSrc += 3, pDst += 4) {
+			pDst[0] = pSrc[0];
+			pDst[1] = pSrc[1];
+			pDst[2] = pSrc[2];
+			pDst[3] = (pSrc[0] == k[0] && pSrc[1] == k[1] && pSrc[2] == k[2]) ? 0 : 255;
+		}
+		return;
+	}
+	if (image.m_bColourKey && nChannels == 1 && nComponents == 2) {
+		for (int x = 0; x < nWidth; ++x, pDst += 2) {
+			pDst[0] = pSrc[x];
+			pDst[1] = pSrc[x] == image.m_key[0] ? 0 : 255;
+		}
+		return;
+	}
+
+	for (int x = 0; x < nWidth; ++x, pSrc += nChannels, pDst += nComponents) {
+		unsigned char px[4];
+		int n = image.m_nComponents;
+		if (image.m_nPalette)
+			memcpy( px, &image.m_palette[pSrc[0] * 4], 4 );
+		else {
+			memcpy( px, pSrc, nChannels );
+			if (image.m_bColourKey) {
+				bool bKey = !memcmp( pSrc, image.m_key, nChannels );
+				px[nChannels] = bKey ? 0 : 255;
+			}
+		}
+
+		switch (n * 8 + nComponents) {
+		case 1 * 8 + 2: pDst[0] = px[0]; pDst[1] = 255; break;
+		case 1 * 8 + 3: pDst[0] = pDst[1] = pDst[2] = px[0]; break;
+		case 1 * 8 + 4: pDst[0] = pDst[1] = pDst[2] = px[0]; pDst[3] = 255; break;
+		case 2 * 8 + 1: pDst[0] = px[0]; break;
+		case 2 * 8 + 3: pDst[0] = pDst[1] = pDst[2] = px[0]; break;
+		case 2 * 8 + 4: pDst[0] = pDst[1] = pDst[2] = px[0]; pDst[3] = px[1]; break;
+		case 3 * 8 + 1: pDst[0] = computeY( px[0], px[1], px[2] ); break;
+		case 3 * 8 + 2: pDst[0] = computeY( px[0], px[1], px[2] ); pDst[1] = 255; break;
+		case 3 * 8 + 4: memcpy( pDst, px, 3 ); pDst[3] = 255; break;
+		case 4 * 8 + 1: pDst[0] = computeY( px[0], px[1], px[2] ); break;
+		case 4 * 8 + 2: pDst[0] = computeY( px[0], px[1], px[2] ); pDst[1] = px[3]; break;
+		case 4 * 8 + 3: memcpy( pDst, px, 3 ); break;
+		default: memcpy( pDst, px, nComponents ); break;
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// The pipeline.
+
+static int inflateProgress( void* pUser, int nBytes )
+{
+	PngInflate* pInflate = (PngInflate*) pUser;
+	atomic_Store( &pInflate->m_nInflated, nBytes );
+	return nBytes + pInflate->m_nStep;
+}
+
+static void inflateMain( void* pArg )
+{
+	PngInflate* pInflate = (PngInflate*) pArg;
+	pInflate->m_nResult = stbi_zlib_decode_buffer_progress( (char*) pInflate->m_pRaw,
+		pInflate->m_nRawSize, (const char*) pInflate->m_pIn, pInflate->m_nIn,
+		inflateProgress, pInflate, pInflate->m_nStep );
+	if (pInflate->m_nResult >= 0)
+		atomic_Store( &pInflate->m_nInflated, pInflate->m_nResult );
+	atomic_Store( &pInflate->m_bDone, 1 );
+}
+
+// Wait until nBytes are inflated, or the inflate has stopped short.
+static long waitForBytes( PngInflate* pInflate, long nBytes )
+{
+	long n;
+	while ((n = atomic_Load( &pInflate->m_nInflated )) < nBytes) {
+		if (atomic_Load( &pInflate->m_bDone ))
+			return atomic_Load( &pInflate->m_nInflated );
+		thread_Sleep( 0 );
+	}
+	return n;
+}
+
+bool png_Info( const unsigned char* pData, int nSize, int* pWidth, int* pHeight, int* pComponents )
+{
+	PngImage image;
+	if (!parsePng( pData, nSize, &image, false )) return false;
+	*pWidth = image.m_nWidth;
+	*pHeight = image.m_nHeight;
+	*pComponents = image.m_nComponents;
+	return true;
+}
+
+bool png_Decode( const unsigned char* pData, int nSize, unsigned char* pOut, int nStride, int nComponents )
+{
+	if (nComponents < 1 || nComponents > 4) return fail( "bad components" );
+	PngImage image;
+	if (!parsePng( pData, nSize, &image, true )) return false;
+
+	int nRowBytes = image.m_nWidth * image.m_nChannels;
+	int nRowSize = nRowBytes + 1;		// with the filter byte
+	PngInflate inflate;
+	inflate.m_nRawSize = nRowSize * image.m_nHeight;
+	inflate.m_pRaw = (unsigned char*) malloc( inflate.m_nRawSize );
+	if (!inflate.m_pRaw) return fail( "out of memory" );
+	inflate.m_pIn = image.m_pCompressed;
+	inflate.m_nIn = image.m_nCompressed;
+	inflate.m_nStep = nRowSize * (PNG_PROGRESS_STEP / nRowSize + 1);
+	inflate.m_nInflated = 0;
+	inflate.m_bDone = 0;
+	inflate.m_nResult = -1;
+
+	// Small images are not worth a thread, and nor is a single CPU;
+	// inflate those up front.
+	Thread* pThread = NULL;
+	if (inflate.m_nRawSize >= PNG_THREAD_MIN && thread_CpuCount() > 1)
+		pThread = thread_Start( inflateMain, &inflate );
+	if (!pThread) {
+		inflateMain( &inflate );
+		std::vector<unsigned char>().swap( image.m_joined );
+	}
+
+	if (!s_unfilter) s_unfilter = chooseUnfilter();
+
+	// Rows already in the caller's format are unfiltered in place there;
+	// the rest go through two rows of scratch.
+	bool bDirect = !image.m_nPalette && !image.m_bColourKey && image.m_nChannels == nComponents;
+	std::vector<unsigned char> zero( nRowBytes, 0 );
+	std::vector<unsigned char> scratch( bDirect ? 0 : nRowBytes * 2 );
+	const unsigned char* pPrior = &zero[0];
+	bool bOk = true;
+	for (int y = 0; y < image.m_nHeight; ++y) {
+		long nNeed = (long) nRowSize * (y + 1);
+		if (waitForBytes( &inflate, nNeed ) < nNeed) {
+			bOk = false;
+			break;
+		}
+		const unsigned char* pRaw = inflate.m_pRaw + nRowSize * y;
+		if (pRaw[0] > PNG_PAETH) {
+			bOk = fail( "invalid filter" );
+			break;
+		}
+		unsigned char* pRow = pOut + (size_t) nStride * y;
+		unsigned char* pCur = bDirect ? pRow : &scratch[(y & 1) * nRowBytes];
+		s_unfilter( pRaw[0], pCur, pRaw + 1, pPrior, nRowBytes, image.m_nChannels );
+		if (!bDirect) convertRow( image, pCur, pRow, nComponents );
+		pPrior = pCur;
+	}
+
+	if (pThread) thread_Join( pThread );
+	free( inflate.m_pRaw );
+
+	// stb_image wants exactly the image's bytes, no more.
+	if (inflate.m_nResult < 0) return fail( stbi_failure_reason() );
+	if (inflate.m_nResult != inflate.m_nRawSize) return fail( "not enough pixels" );
+	return bOk;
+}
+
+const char* png_FailureReason( void )
+{
+	return s_szFailure;
+}
@@ -0,0 +1,33 @@
+// PngDecode.h: PNG decoding straight into a caller's texture buffer
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_PNGDECODE_H
+#define FGM_PNGDECODE_H
+
+// stb_image inflates a whole PNG into one buffer, unfilters that into a
+// second and converts the result into a third. Here each row is
+// unfiltered as soon as it has been inflated (with the inflate on its
+// own thread for big images) and converted straight into the caller's
+// buffer, so only the inflated image is held alongside it. The Sub, Up,
+// Avg and Paeth filters use SSE2 where the CPU has it.
+//
+// Only 8-bit images that are not interlaced are decoded; png_Decode fails
+// on the rest, and callers fall back to stb_image. Pixels are the same as
+// stb_image gives.
+//
+// Unlike stbi_load, an image with a tRNS colour key counts its alpha in
+// the components; stbi_load returns the alpha but leaves it out of comp.
+
+// The size of the image and the components in its pixels once any
+// palette or colour key is applied; false if pData is not a PNG.
+bool png_Info( const unsigned char* pData, int nSize, int* pWidth, int* pHeight, int* pComponents );
+
+// Decode into pOut, which has nStride bytes per row and nComponents
+// (1 to 4) per pixel, converted as stbi_load would for req_comp.
+bool png_Decode( const unsigned char* pData, int nSize, unsigned char* pOut, int nStride, int nComponents );
+
+// Why the last png_Info or png_Decode failed.
+const char* png_FailureReason( void );
+
+#endif
@@ -0,0 +1,139 @@
+#include "QSGAssetPack.h"
+#include "QSGBlockTexture.h"
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+QSGAssetPack::QSGAssetPack(void) :
+	m_base(NULL), m_size(0), m_entries(NULL), m_names(NULL), m_count(0)
+{
+#ifdef WINDOWS
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+#endif
+}
+
+QSGAssetPack::~QSGAssetPack(void)
+{
+#ifdef WINDOWS
+	if (m_base) UnmapViewOfFile(m_base);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+	if (m_base) munmap((void*) m_base, m_size);
+#endif
+}
+
+QSGAssetPack* QSGAssetPack::open(const char* filename)
+{
+	QSGAssetPack* pack = new QSGAssetPack();
+	pack->m_filename = filename;
+
+#ifdef WINDOWS
+	pack->m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pack->m_file != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(pack->m_file, &size) && size.QuadPart > 0) {
+			pack->m_size = (size_t) size.QuadPart;
+			pack->m_mapping = CreateFileMappingA(pack->m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (pack->m_mapping)
+				pack->m_base = (const unsigned char*) MapViewOfFile(pack->m_mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+	}
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd >= 0) {
+		struct stat st;
+		if (!fstat(fd, &st) && st.st_size > 0) {
+			void* base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (base != MAP_FAILED) {
+				pack->m_base = (const unsigned char*) base;
+				pack->m_size = (size_t) st.st_size;
+			}
+		}
+		close(fd); // the mapping keeps the file open.
+	}
+#endif
+
+	if (!pack->m_base || !pack->validate()) {
+		delete pack;
+		return NULL;
+	}
+	return pack;
+}
+
+// Check every offset against the file, so a truncated or damaged pack is
+// refused here rather than read past the end of the mapping later.
+bool QSGAssetPack::validate(void)
+{
+	if (m_size < sizeof(QSGPackHeader)) return false;
+	const QSGPackHeader* header = (const QSGPackHeader*) m_base;
+	if (memcmp(header->magic, QSG_PACK_MAGIC, 4) || header->version != QSG_PACK_VERSION)
+		return false;
+
+	unsigned long long indexSize = (unsigned long long) header->count * sizeof(QSGPackEntry);
+	if (header->indexOffset % 8 || header->indexOffset > m_size ||
+		indexSize + header->namesSize > m_size - header->indexOffset)
+		return false;
+	m_entries = (const QSGPackEntry*)(m_base + header->indexOffset);
+	m_names = (const char*)(m_entries + header->count);
+	m_count = header->count;
+	if (header->namesSize == 0 || m_names[header->namesSize - 1] != '\0') return false;
+
+	for (unsigned int i = 0; i < m_count; ++i) {
+		const QSGPackEntry& entry = m_entries[i];
+		if (entry.nameOffset >= header->namesSize) return false;
+		if (entry.offset > m_size || entry.size > m_size - entry.offset) return false;
+		if (i > 0 && strcmp(name(&m_entries[i - 1]), name(&entry)) >= 0) return false;
+		if (entry.kind == QSGPackTexels) {
+			if (entry.components < 1 || entry.components > 4 ||
+				(unsigned long long) entry.width * entry.height * entry.components != entry.size)
+				return false;
+		}
+		else if (entry.kind == QSGPackBlocks) {
+			QSGBlockImage image;
+			if (!qsgParseBlockFile(data(&entry), (size_t) entry.size, &image) ||
+				(unsigned int) image.width != entry.width || (unsigned int) image.height != entry.height)
+				return false;
+		}
+		else if (entry.kind != QSGPackFile) return false;
+	}
+	return true;
+}
+
+const QSGPackEntry* QSGAssetPack::find(const char* path) const
+{
+	std::string key = canonicalName(path);
+	unsigned int lo = 0, hi = m_count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		int cmp = strcmp(name(&m_entries[mid]), key.c_str());
+		if (cmp == 0) return &m_entries[mid];
+		if (cmp < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return NULL;
+}
+
+std::string QSGAssetPack::canonicalName(const char* path)
+{
+	std::string result;
+	result.reserve(strlen(path));
+	const char* p = path;
+	while (*p) {
+		// at the start of each directory name: skip separators and "./".
+		if (*p == '/' || *p == '\\') { ++p; continue; }
+		if (p[0] == '.' && (p[1] == '/' || p[1] == '\\')) { p += 2; continue; }
+		if (!result.empty()) result += '/';
+		while (*p && *p != '/' && *p != '\\') result += *p++;
+	}
+	return result;
+}
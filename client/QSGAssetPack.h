@@ -0,0 +1,85 @@
+#pragma once
+#include "QSGObject.h"
+#include <string>
+
+// An asset pack holds the files of the data directory in one file, which
+// is mapped into memory rather than read, so loading an asset is a lookup
+// instead of an open, a read and a decode.
+//
+// The file is a header, an index sorted by name, the names, and then the
+// assets, each starting on a QSG_PACK_ALIGN boundary. Numbers are little-
+// endian. Names are paths relative to the data directory with '/' between
+// directories, as scripts pass them to sg.loadTexture. An asset is either
+// the bytes of the original file or, for images, texels already decoded,
+// which textures point into and the renderers upload straight from. The
+// texels may be block-compressed, in a DDS or KTX file (QSGBlockTexture.h).
+
+#define QSG_PACK_MAGIC		"QPAK"
+#define QSG_PACK_VERSION	1
+#define QSG_PACK_ALIGN		64
+
+enum QSGPackKind {
+	QSGPackFile = 0,			// the file as it was on disk
+	QSGPackTexels = 1,			// decoded rows, top first, no padding
+	QSGPackBlocks = 2,			// a DDS or KTX file of compressed texels
+};
+
+enum QSGPackFlags {
+	QSGPackPremultiplied = 1,	// texels or blocks with premultiplied alpha
+};
+
+struct QSGPackHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int count;			// entries in the index
+	unsigned int namesSize;		// bytes of names after the index
+	unsigned long long indexOffset;
+};
+
+struct QSGPackEntry
+{
+	unsigned int nameOffset;	// into the names; nul-terminated
+	unsigned int kind;			// QSGPackKind
+	unsigned int width;			// texels and blocks only
+	unsigned int height;
+	unsigned int components;
+	unsigned int flags;			// QSGPackFlags
+	unsigned long long offset;	// from the start of the file
+	unsigned long long size;
+};
+
+class QSGAssetPack :
+	public QSGObject
+{
+public:
+	// Map a pack; NULL if it cannot be opened or fails validation.
+	static QSGAssetPack* open(const char* filename);
+	virtual ~QSGAssetPack(void);
+
+	// The entry for a name, or NULL. Names are canonicalised first.
+	const QSGPackEntry* find(const char* name) const;
+
+	inline const unsigned char* data(const QSGPackEntry* entry) const { return m_base + entry->offset; }
+	inline const char* name(const QSGPackEntry* entry) const { return m_names + entry->nameOffset; }
+	inline int count(void) const { return (int) m_count; }
+	inline const std::string& filename(void) const { return m_filename; }
+
+	// Backslashes become '/', and "./" and repeated separators go.
+	static std::string canonicalName(const char* path);
+
+private:
+	QSGAssetPack(void);
+	bool validate(void);
+
+	const unsigned char* m_base;
+	size_t m_size;
+	const QSGPackEntry* m_entries;
+	const char* m_names;
+	unsigned int m_count;
+	std::string m_filename;
+#ifdef WINDOWS
+	void* m_file;
+	void* m_mapping;
+#endif
+};
@@ -0,0 +1,665 @@
+#include "QSGBlockTexture.h"
+#include "QSGMipmap.h"
+#include <string.h>
+
+// The GL formats, as KTX files name them.
+#define QSG_GL_COMPRESSED_RGB_S3TC_DXT1		0x83F0
+#define QSG_GL_COMPRESSED_RGBA_S3TC_DXT1	0x83F1
+#define QSG_GL_COMPRESSED_RGBA_S3TC_DXT5	0x83F3
+#define QSG_GL_ETC1_RGB8					0x8D64
+#define QSG_GL_RGB							0x1907
+#define QSG_GL_RGBA							0x1908
+
+#define QSG_DDS_HEADER_SIZE		128		// "DDS " and the DDS_HEADER
+#define QSG_DDSD_FLAGS			0x81007	// caps, height, width, pixel format, linear size
+#define QSG_DDSD_MIPMAPCOUNT	0x20000
+#define QSG_DDPF_FOURCC			0x4
+#define QSG_DDSCAPS_TEXTURE		0x1000
+#define QSG_DDSCAPS_MIPMAPS		0x400008	// complex, mipmap
+
+#define QSG_KTX_HEADER_SIZE		64
+
+static const unsigned char ktxIdentifier[12] = {
+	0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+// The ETC1 intensity modifiers: the small and large step of each table.
+static const int etcTables[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+	{ 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+static unsigned int readLE32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned int readBE32(const unsigned char* p)
+{
+	return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void writeLE32(std::vector<unsigned char>& out, unsigned int n)
+{
+	out.push_back((unsigned char) n);
+	out.push_back((unsigned char) (n >> 8));
+	out.push_back((unsigned char) (n >> 16));
+	out.push_back((unsigned char) (n >> 24));
+}
+
+static inline int clampByte(int n)
+{
+	return n < 0 ? 0 : (n > 255 ? 255 : n);
+}
+
+size_t qsgBlockSize(int format, int width, int height)
+{
+	size_t blocks = (size_t) ((width + 3) / 4) * ((height + 3) / 4);
+	switch (format) {
+	case QSGTextureBC1:
+	case QSGTextureETC1: return blocks * 8;
+	case QSGTextureBC3: return blocks * 16;
+	}
+	return 0;
+}
+
+size_t qsgBlockChainSize(int format, int width, int height, int levels)
+{
+	size_t size = 0;
+	for (int level = 0; level < levels; ++level)
+		size += qsgBlockSize(format, qsgMipSize(width, level), qsgMipSize(height, level));
+	return size;
+}
+
+int qsgBlockComponents(int format)
+{
+	return format == QSGTextureBC3 ? 4 : 3;
+}
+
+// ---------------------------------------------------------------------
+// Files
+
+static bool parseDDS(const unsigned char* data, size_t size, QSGBlockImage* image)
+{
+	if (size < QSG_DDS_HEADER_SIZE || readLE32(data + 4) != 124) return false;
+	if (!(readLE32(data + 80) & QSG_DDPF_FOURCC)) return false;
+	if (!memcmp(data + 84, "DXT1", 4)) image->format = QSGTextureBC1;
+	else if (!memcmp(data + 84, "DXT5", 4)) image->format = QSGTextureBC3;
+	else return false;
+	image->height = (int) readLE32(data + 12);
+	image->width = (int) readLE32(data + 16);
+	image->levels = (readLE32(data + 8) & QSG_DDSD_MIPMAPCOUNT) ? (int) readLE32(data + 28) : 1;
+	image->blocks = data + QSG_DDS_HEADER_SIZE;
+	image->size = size - QSG_DDS_HEADER_SIZE;
+	return true;
+}
+
+static bool parseKTX(const unsigned char* data, size_t size, QSGBlockImage* image)
+{
+	if (size < QSG_KTX_HEADER_SIZE + 4) return false;
+	// the endianness field reads 0x04030201 in the byte order the file
+	// was written in; blocks are bytes, so only the header needs it.
+	unsigned int (*read32)(const unsigned char*);
+	if (readLE32(data + 12) == 0x04030201) read32 = readLE32;
+	else if (readBE32(data + 12) == 0x04030201) read32 = readBE32;
+	else return false;
+	if (read32(data + 16) != 0) return false;				// glType: compressed
+	switch (read32(data + 28)) {
+	case QSG_GL_COMPRESSED_RGB_S3TC_DXT1:
+	case QSG_GL_COMPRESSED_RGBA_S3TC_DXT1: image->format = QSGTextureBC1; break;
+	case QSG_GL_COMPRESSED_RGBA_S3TC_DXT5: image->format = QSGTextureBC3; break;
+	case QSG_GL_ETC1_RGB8: image->format = QSGTextureETC1; break;
+	default: return false;
+	}
+	// 2D only: no depth, no array, one face.
+	if (read32(data + 44) > 1 || read32(data + 48) != 0 || read32(data + 52) != 1)
+		return false;
+	image->width = (int) read32(data + 36);
+	image->height = (int) read32(data + 40);
+	// each level has its own size before it, so the levels after the
+	// first are not one run of blocks with it; they are ignored.
+	image->levels = 1;
+	unsigned int keyValues = read32(data + 60);
+	if (keyValues > size - QSG_KTX_HEADER_SIZE - 4) return false;
+	const unsigned char* level = data + QSG_KTX_HEADER_SIZE + keyValues;
+	image->size = read32(level);
+	image->blocks = level + 4;
+	if (image->size > size - (image->blocks - data)) return false;
+	return true;
+}
+
+bool qsgParseBlockFile(const unsigned char* data, size_t size, QSGBlockImage* image)
+{
+	bool ok = false;
+	if (size >= 4 && !memcmp(data, "DDS ", 4))
+		ok = parseDDS(data, size, image);
+	else if (size >= sizeof(ktxIdentifier) && !memcmp(data, ktxIdentifier, sizeof(ktxIdentifier)))
+		ok = parseKTX(data, size, image);
+	if (!ok) return false;
+	if (image->width <= 0 || image->height <= 0 || image->width > 65536 || image->height > 65536)
+		return false;
+	if (qsgBlockSize(image->format, image->width, image->height) > image->size) return false;
+	// keep the levels that are all there, down to 1x1 at most.
+	int maxLevels = qsgMipLevels(image->width, image->height);
+	if (image->levels < 1) image->levels = 1;
+	if (image->levels > maxLevels) image->levels = maxLevels;
+	while (qsgBlockChainSize(image->format, image->width, image->height, image->levels) > image->size)
+		--image->levels;
+	image->size = qsgBlockChainSize(image->format, image->width, image->height, image->levels);
+	return true;
+}
+
+void qsgWriteBlockFile(const QSGBlockImage& image, std::vector<unsigned char>& file)
+{
+	file.clear();
+	if (image.format == QSGTextureETC1) {
+		file.insert(file.end(), ktxIdentifier, ktxIdentifier + sizeof(ktxIdentifier));
+		writeLE32(file, 0x04030201);
+		writeLE32(file, 0);						// glType
+		writeLE32(file, 1);						// glTypeSize
+		writeLE32(file, 0);						// glFormat
+		writeLE32(file, QSG_GL_ETC1_RGB8);
+		writeLE32(file, QSG_GL_RGB);
+		writeLE32(file, image.width);
+		writeLE32(file, image.height);
+		writeLE32(file, 0);						// depth
+		writeLE32(file, 0);						// array elements
+		writeLE32(file, 1);						// faces
+		writeLE32(file, 1);						// mip levels
+		writeLE32(file, 0);						// key/value bytes
+		size_t size = qsgBlockSize(image.format, image.width, image.height);
+		writeLE32(file, (unsigned int) size);
+		file.insert(file.end(), image.blocks, image.blocks + size);
+		return;
+	}
+	bool mips = image.levels > 1;
+	file.insert(file.end(), (const unsigned char*) "DDS ", (const unsigned char*) "DDS " + 4);
+	writeLE32(file, 124);
+	writeLE32(file, QSG_DDSD_FLAGS | (mips ? QSG_DDSD_MIPMAPCOUNT : 0));
+	writeLE32(file, image.height);
+	writeLE32(file, image.width);
+	writeLE32(file, (unsigned int) qsgBlockSize(image.format, image.width, image.height));	// linear size
+	writeLE32(file, 0);						// depth
+	writeLE32(file, mips ? image.levels : 1);
+	for (int i = 0; i < 11; ++i) writeLE32(file, 0);
+	writeLE32(file, 32);					// pixel format size
+	writeLE32(file, QSG_DDPF_FOURCC);
+	file.insert(file.end(), (const unsigned char*) "DXT", (const unsigned char*) "DXT" + 3);
+	file.push_back(image.format == QSGTextureBC3 ? '5' : '1');
+	for (int i = 0; i < 5; ++i) writeLE32(file, 0);	// bit count and masks
+	writeLE32(file, QSG_DDSCAPS_TEXTURE | (mips ? QSG_DDSCAPS_MIPMAPS : 0));
+	for (int i = 0; i < 4; ++i) writeLE32(file, 0);	// caps 2 to 4, reserved
+	file.insert(file.end(), image.blocks, image.blocks + image.size);
+}
+
+// ---------------------------------------------------------------------
+// Decoding. Each block decodes to 16 RGBA texels, row by row.
+
+static void unpack565(unsigned int c, int* rgb)
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The four colours of a BC1 block. BC3 always uses the four colour
+// mode; BC1 blocks with c0 <= c1 have three and black.
+static void colourPalette(unsigned int c0, unsigned int c1, bool fourColours, int palette[4][3])
+{
+	unpack565(c0, palette[0]);
+	unpack565(c1, palette[1]);
+	for (int k = 0; k < 3; ++k) {
+		int a = palette[0][k], b = palette[1][k];
+		if (fourColours || c0 > c1) {
+			palette[2][k] = (2 * a + b + 1) / 3;
+			palette[3][k] = (a + 2 * b + 1) / 3;
+		}
+		else {
+			palette[2][k] = (a + b + 1) / 2;
+			palette[3][k] = 0;
+		}
+	}
+}
+
+static void decodeColourBlock(const unsigned char* block, bool fourColours, unsigned char* texels)
+{
+	int palette[4][3];
+	colourPalette(block[0] | (block[1] << 8), block[2] | (block[3] << 8), fourColours, palette);
+	unsigned int indices = readLE32(block + 4);
+	for (int i = 0; i < 16; ++i, indices >>= 2) {
+		const int* c = palette[indices & 3];
+		texels[i * 4 + 0] = (unsigned char) c[0];
+		texels[i * 4 + 1] = (unsigned char) c[1];
+		texels[i * 4 + 2] = (unsigned char) c[2];
+		texels[i * 4 + 3] = 255;
+	}
+}
+
+static void alphaPalette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int i = 1; i < 7; ++i)
+			palette[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+	}
+	else {
+		for (int i = 1; i < 5; ++i)
+			palette[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void decodeAlphaBlock(const unsigned char* block, unsigned char* texels)
+{
+	int palette[8];
+	alphaPalette(block[0], block[1], palette);
+	unsigned long long indices = 0;
+	for (int i = 5; i >= 0; --i)
+		indices = (indices << 8) | block[2 + i];
+	for (int i = 0; i < 16; ++i, indices >>= 3)
+		texels[i * 4 + 3] = (unsigned char) palette[indices & 7];
+}
+
+static inline int etcExpand4(int c) { return (c << 4) | c; }
+static inline int etcExpand5(int c) { return (c << 3) | (c >> 2); }
+
+static void decodeEtc1Block(const unsigned char* block, unsigned char* texels)
+{
+	unsigned int high = (block[0] << 24) | (block[1] << 16) | (block[2] << 8) | block[3];
+	unsigned int low = (block[4] << 24) | (block[5] << 16) | (block[6] << 8) | block[7];
+	int base[2][3];
+	if (high & 2) {
+		for (int k = 0; k < 3; ++k) {
+			int c = (high >> (27 - k * 8)) & 31;
+			int d = (high >> (24 - k * 8)) & 7;
+			if (d >= 4) d -= 8;
+			base[0][k] = etcExpand5(c);
+			base[1][k] = etcExpand5((c + d) & 31);
+		}
+	}
+	else {
+		for (int k = 0; k < 3; ++k) {
+			base[0][k] = etcExpand4((high >> (28 - k * 8)) & 15);
+			base[1][k] = etcExpand4((high >> (24 - k * 8)) & 15);
+		}
+	}
+	int tables[2] = { (int) (high >> 5) & 7, (int) (high >> 2) & 7 };
+	bool flip = (high & 1) != 0;
+	for (int x = 0; x < 4; ++x) {
+		for (int y = 0; y < 4; ++y) {
+			int sub = flip ? (y >= 2) : (x >= 2);
+			int bit = x * 4 + y;
+			int index = (((low >> (16 + bit)) & 1) << 1) | ((low >> bit) & 1);
+			int step = etcTables[tables[sub]][index & 1];
+			int modifier = index & 2 ? -step : step;
+			unsigned char* t = texels + (y * 4 + x) * 4;
+			t[0] = (unsigned char) clampByte(base[sub][0] + modifier);
+			t[1] = (unsigned char) clampByte(base[sub][1] + modifier);
+			t[2] = (unsigned char) clampByte(base[sub][2] + modifier);
+			t[3] = 255;
+		}
+	}
+}
+
+void qsgDecodeBlocks(int format, const unsigned char* blocks, int width, int height,
+	unsigned char* rgba)
+{
+	size_t blockBytes = format == QSGTextureBC3 ? 16 : 8;
+	unsigned char texels[16 * 4];
+	for (int by = 0; by < height; by += 4) {
+		for (int bx = 0; bx < width; bx += 4, blocks += blockBytes) {
+			switch (format) {
+			case QSGTextureBC1: decodeColourBlock(blocks, false, texels); break;
+			case QSGTextureBC3:
+				decodeColourBlock(blocks + 8, true, texels);
+				decodeAlphaBlock(blocks, texels);
+				break;
+			case QSGTextureETC1: decodeEtc1Block(blocks, texels); break;
+			default: return;
+			}
+			// edge blocks hang off the image
+			int w = width - bx < 4 ? width - bx : 4;
+			int h = height - by < 4 ? height - by : 4;
+			for (int y = 0; y < h; ++y)
+				memcpy(rgba + ((size_t) (by + y) * width + bx) * 4, texels + y * 16, w * 4);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------
+// Encoding. These aim for a good result at bake time rather than speed:
+// BC1 fits a line through the block's colours and refines the ends by
+// least squares; ETC1 tries every table for each layout and mode.
+
+static int colourError(const int* a, const unsigned char* b)
+{
+	int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+	return dr * dr + dg * dg + db * db;
+}
+
+static unsigned int pack565(const float* rgb)
+{
+	int r = (int) (rgb[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int) (rgb[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int) (rgb[2] * 31.0f / 255.0f + 0.5f);
+	r = r < 0 ? 0 : (r > 31 ? 31 : r);
+	g = g < 0 ? 0 : (g > 63 ? 63 : g);
+	b = b < 0 ? 0 : (b > 31 ? 31 : b);
+	return (r << 11) | (g << 5) | b;
+}
+
+// Pick the nearest of the four colours for each texel; the total error.
+static int colourIndices(const unsigned char texels[16][4], unsigned int c0, unsigned int c1,
+	unsigned char indices[16])
+{
+	int palette[4][3];
+	colourPalette(c0, c1, true, palette);
+	int total = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0, bestError = colourError(palette[0], texels[i]);
+		for (int j = 1; j < 4; ++j) {
+			int error = colourError(palette[j], texels[i]);
+			if (error < bestError) { best = j; bestError = error; }
+		}
+		indices[i] = (unsigned char) best;
+		total += bestError;
+	}
+	return total;
+}
+
+// The ends that fit the chosen indices best, by least squares.
+static bool refineEnds(const unsigned char texels[16][4], const unsigned char indices[16],
+	float* end0, float* end1)
+{
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		float a = weights[indices[i]], b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int k = 0; k < 3; ++k) {
+			ax[k] += a * texels[i][k];
+			bx[k] += b * texels[i][k];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (det < 1e-6f && det > -1e-6f) return false;
+	for (int k = 0; k < 3; ++k) {
+		end0[k] = (ax[k] * bb - bx[k] * ab) / det;
+		end1[k] = (bx[k] * aa - ax[k] * ab) / det;
+	}
+	return true;
+}
+
+static void encodeColourBlock(const unsigned char texels[16][4], unsigned char* block)
+{
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+		for (int k = 0; k < 3; ++k) mean[k] += texels[i][k] / 16.0f;
+
+	// principal axis of the colours, by power iteration
+	float cov[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+	float axis[3] = { 1, 1, 1 };
+	for (int n = 0; n < 8; ++n) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float m = x > y ? x : y;
+		m = m > z ? m : z;
+		m = m > -x ? m : -x;
+		m = m > -y ? m : -y;
+		m = m > -z ? m : -z;
+		if (m < 1e-6f) break;
+		axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+	}
+
+	// the ends of the colours along it, pulled in a little
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; ++i) {
+		float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] +
+			(texels[i][2] - mean[2]) * axis[2];
+		if (t < lo) lo = t;
+		if (t > hi) hi = t;
+	}
+	float len = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float end0[3], end1[3];
+	for (int k = 0; k < 3; ++k) {
+		float d = len > 1e-6f ? axis[k] / len : 0.0f;
+		float inset = (hi - lo) / 16.0f;
+		end0[k] = mean[k] + d * (hi - inset);
+		end1[k] = mean[k] + d * (lo + inset);
+	}
+
+	unsigned int c0 = pack565(end0), c1 = pack565(end1);
+	unsigned char indices[16], refined[16];
+	int error = colourIndices(texels, c0, c1, indices);
+	for (int pass = 0; pass < 2 && error > 0; ++pass) {
+		if (!refineEnds(texels, indices, end0, end1)) break;
+		unsigned int r0 = pack565(end0), r1 = pack565(end1);
+		int refinedError = colourIndices(texels, r0, r1, refined);
+		if (refinedError >= error) break;
+		c0 = r0;
+		c1 = r1;
+		error = refinedError;
+		memcpy(indices, refined, 16);
+	}
+
+	// c0 > c1 selects the four colour mode in BC1; swap the ends to get it.
+	static const unsigned char swapped[4] = { 1, 0, 3, 2 };
+	if (c0 < c1) {
+		unsigned int c = c0; c0 = c1; c1 = c;
+		for (int i = 0; i < 16; ++i) indices[i] = swapped[indices[i]];
+	}
+	else if (c0 == c1) {
+		memset(indices, 0, 16);
+	}
+	block[0] = (unsigned char) c0;
+	block[1] = (unsigned char) (c0 >> 8);
+	block[2] = (unsigned char) c1;
+	block[3] = (unsigned char) (c1 >> 8);
+	unsigned int bits = 0;
+	for (int i = 15; i >= 0; --i) bits = (bits << 2) | indices[i];
+	block[4] = (unsigned char) bits;
+	block[5] = (unsigned char) (bits >> 8);
+	block[6] = (unsigned char) (bits >> 16);
+	block[7] = (unsigned char) (bits >> 24);
+}
+
+static int alphaIndices(const unsigned char texels[16][4], int a0, int a1, unsigned char indices[16])
+{
+	int palette[8];
+	alphaPalette(a0, a1, palette);
+	int total = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0, bestError = 1 << 30;
+		for (int j = 0; j < 8; ++j) {
+			int d = palette[j] - texels[i][3];
+			if (d * d < bestError) { best = j; bestError = d * d; }
+		}
+		indices[i] = (unsigned char) best;
+		total += bestError;
+	}
+	return total;
+}
+
+static void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char* block)
+{
+	// Eight steps between the extremes, or six between the extremes
+	// other than 0 and 255, which the second mode has exactly.
+	int lo = 255, hi = 0, innerLo = 255, innerHi = 0;
+	for (int i = 0; i < 16; ++i) {
+		int a = texels[i][3];
+		if (a < lo) lo = a;
+		if (a > hi) hi = a;
+		if (a != 0 && a != 255) {
+			if (a < innerLo) innerLo = a;
+			if (a > innerHi) innerHi = a;
+		}
+	}
+	if (innerLo > innerHi) innerLo = innerHi = 0;
+	unsigned char indices[16], indices6[16];
+	int a0 = hi, a1 = lo;
+	int error = alphaIndices(texels, a0, a1, indices);
+	int error6 = alphaIndices(texels, innerLo, innerHi, indices6);
+	if (error6 < error) {
+		a0 = innerLo;
+		a1 = innerHi;
+		memcpy(indices, indices6, 16);
+	}
+	block[0] = (unsigned char) a0;
+	block[1] = (unsigned char) a1;
+	unsigned long long bits = 0;
+	for (int i = 15; i >= 0; --i) bits = (bits << 3) | indices[i];
+	for (int i = 0; i < 6; ++i, bits >>= 8)
+		block[2 + i] = (unsigned char) bits;
+}
+
+// The best table and indices for 8 texels around one base colour.
+static int etcSubBlock(const unsigned char* const texels[8], const int* base, int* table,
+	unsigned char indices[8])
+{
+	int bestTotal = 1 << 30;
+	for (int t = 0; t < 8; ++t) {
+		int total = 0;
+		unsigned char chosen[8];
+		for (int i = 0; i < 8; ++i) {
+			int bestError = 1 << 30;
+			for (int index = 0; index < 4; ++index) {
+				int step = etcTables[t][index & 1];
+				int modifier = index & 2 ? -step : step;
+				int c[3] = {
+					clampByte(base[0] + modifier), clampByte(base[1] + modifier), clampByte(base[2] + modifier)
+				};
+				int error = colourError(c, texels[i]);
+				if (error < bestError) { bestError = error; chosen[i] = (unsigned char) index; }
+			}
+			total += bestError;
+		}
+		if (total < bestTotal) {
+			bestTotal = total;
+			*table = t;
+			memcpy(indices, chosen, 8);
+		}
+	}
+	return bestTotal;
+}
+
+static void encodeEtc1Block(const unsigned char texels[16][4], unsigned char* block)
+{
+	int bestError = 1 << 30;
+	unsigned int bestHigh = 0, bestLow = 0;
+	for (int flip = 0; flip < 2; ++flip) {
+		// the two halves: left and right, or with flip top and bottom
+		const unsigned char* sub[2][8];
+		int bits[2][8];
+		float mean[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+		int count[2] = { 0, 0 };
+		for (int y = 0; y < 4; ++y) {
+			for (int x = 0; x < 4; ++x) {
+				int s = flip ? (y >= 2) : (x >= 2);
+				const unsigned char* t = texels[y * 4 + x];
+				sub[s][count[s]] = t;
+				bits[s][count[s]] = x * 4 + y;
+				for (int k = 0; k < 3; ++k) mean[s][k] += t[k] / 8.0f;
+				count[s]++;
+			}
+		}
+
+		int q5[2][3], q4[2][3];
+		for (int s = 0; s < 2; ++s) {
+			for (int k = 0; k < 3; ++k) {
+				q5[s][k] = (int) (mean[s][k] * 31.0f / 255.0f + 0.5f);
+				q4[s][k] = (int) (mean[s][k] * 15.0f / 255.0f + 0.5f);
+			}
+		}
+		bool canDiffer = true;
+		for (int k = 0; k < 3; ++k) {
+			int d = q5[1][k] - q5[0][k];
+			if (d < -4 || d > 3) canDiffer = false;
+		}
+
+		for (int differential = 0; differential < 2; ++differential) {
+			if (differential && !canDiffer) continue;
+			int base[2][3];
+			for (int s = 0; s < 2; ++s)
+				for (int k = 0; k < 3; ++k)
+					base[s][k] = differential ? etcExpand5(q5[s][k]) : etcExpand4(q4[s][k]);
+
+			int tables[2], error = 0;
+			unsigned char indices[2][8];
+			for (int s = 0; s < 2; ++s)
+				error += etcSubBlock(sub[s], base[s], &tables[s], indices[s]);
+			if (error >= bestError) continue;
+
+			unsigned int high = (tables[0] << 5) | (tables[1] << 2) | (differential << 1) | flip;
+			for (int k = 0; k < 3; ++k) {
+				if (differential)
+					high |= (q5[0][k] << (27 - k * 8)) | (((q5[1][k] - q5[0][k]) & 7) << (24 - k * 8));
+				else
+					high |= (q4[0][k] << (28 - k * 8)) | (q4[1][k] << (24 - k * 8));
+			}
+			unsigned int low = 0;
+			for (int s = 0; s < 2; ++s) {
+				for (int i = 0; i < 8; ++i) {
+					low |= (unsigned int) (indices[s][i] >> 1) << (16 + bits[s][i]);
+					low |= (unsigned int) (indices[s][i] & 1) << bits[s][i];
+				}
+			}
+			bestError = error;
+			bestHigh = high;
+			bestLow = low;
+		}
+	}
+	for (int i = 0; i < 4; ++i) {
+		block[i] = (unsigned char) (bestHigh >> (24 - i * 8));
+		block[4 + i] = (unsigned char) (bestLow >> (24 - i * 8));
+	}
+}
+
+void qsgEncodeBlocks(int format, const unsigned char* texels, int components,
+	int width, int height, std::vector<unsigned char>& out)
+{
+	out.resize(qsgBlockSize(format, width, height));
+	unsigned char* block = out.empty() ? NULL : &out[0];
+	unsigned char rgba[16][4];
+	for (int by = 0; by < height; by += 4) {
+		for (int bx = 0; bx < width; bx += 4) {
+			// texels past the edge repeat the last row and column
+			for (int y = 0; y < 4; ++y) {
+				for (int x = 0; x < 4; ++x) {
+					int sx = bx + x < width ? bx + x : width - 1;
+					int sy = by + y < height ? by + y : height - 1;
+					const unsigned char* in = texels + ((size_t) sy * width + sx) * components;
+					unsigned char* t = rgba[y * 4 + x];
+					if (components < 3) t[0] = t[1] = t[2] = in[0];
+					else { t[0] = in[0]; t[1] = in[1]; t[2] = in[2]; }
+					t[3] = components == 2 ? in[1] : (components == 4 ? in[3] : 255);
+				}
+			}
+			switch (format) {
+			case QSGTextureBC1:
+				encodeColourBlock(rgba, block);
+				block += 8;
+				break;
+			case QSGTextureBC3:
+				encodeAlphaBlock(rgba, block);
+				encodeColourBlock(rgba, block + 8);
+				block += 16;
+				break;
+			case QSGTextureETC1:
+				encodeEtc1Block(rgba, block);
+				block += 8;
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+// Block-compressed texels: BC1 (DXT1) and BC3 (DXT5) for the S3TC
+// extension, and ETC1 for GL ES class hardware. Each stores 4x4 texel
+// blocks in 8 bytes (BC1, ETC1) or 16 (BC3), against 48 or 64 bytes of
+// RGB or RGBA, and the GPU samples them in that form.
+//
+// Files are DDS (BC1 and BC3) or KTX version 1 (any of the three), the
+// latter in either byte order. The mip levels of a DDS file are used, as
+// far as they go; the mip levels of a KTX file are ignored, and only its
+// first level is used. QSGOpenGLRenderer uploads the blocks as
+// they are when the driver has the format, and decodes them otherwise,
+// as the software renderer always does.
+
+enum QSGTextureFormat {
+	QSGTextureRaw = 0,		// m_components bytes per texel, no padding
+	QSGTextureBC1,			// opaque RGB; 1-bit alpha is not used
+	QSGTextureBC3,			// RGB as BC1 plus 8-bit alpha
+	QSGTextureETC1,			// opaque RGB
+	QSGTextureFormatCount
+};
+
+// The texels of a DDS or KTX file, pointing into its bytes.
+struct QSGBlockImage
+{
+	int format;						// QSGTextureFormat
+	int width;
+	int height;
+	int levels;						// mip levels at blocks, largest first
+	const unsigned char* blocks;
+	size_t size;					// of all the levels
+};
+
+// Bytes of blocks for an image; 0 for QSGTextureRaw.
+size_t qsgBlockSize(int format, int width, int height);
+
+// Bytes of blocks for the first levels of a mip chain (QSGMipmap.h).
+size_t qsgBlockChainSize(int format, int width, int height, int levels);
+
+// Components the texels decode to: 3 for the opaque formats, 4 for BC3.
+int qsgBlockComponents(int format);
+
+// Find the levels in a DDS or KTX file; false if it is neither, or
+// holds a format not listed above.
+bool qsgParseBlockFile(const unsigned char* data, size_t size, QSGBlockImage* image);
+
+// Write blocks as a DDS (BC1, BC3) or KTX (ETC1) file. KTX files get
+// the first level only.
+void qsgWriteBlockFile(const QSGBlockImage& image, std::vector<unsigned char>& file);
+
+// Decode blocks to RGBA bytes, width * 4 per row. BC1 and BC3 colours
+// are interpolated in thirds with rounding, as most GPUs do.
+void qsgDecodeBlocks(int format, const unsigned char* blocks, int width, int height,
+	unsigned char* rgba);
+
+// Encode texels with 1 to 4 components per texel; grey is treated as RGB
+// and any alpha is dropped for the opaque formats. out is resized to
+// qsgBlockSize.
+void qsgEncodeBlocks(int format, const unsigned char* texels, int components,
+	int width, int height, std::vector<unsigned char>& out);
@@ -0,0 +1,70 @@
+#include "QSGFrameGraph.h"
+#include "QSGRenderer.h"
+
+QSGFrameGraph::QSGFrameGraph(void) :
+	m_barWidth(2), m_pixelsPerMs(4), m_height(200)
+{
+	m_background.col = QSGColour(0, 0, 0, 0.5f);
+	m_phases[FRAME_INPUT].col = QSGColour(0.5f, 0.5f, 0.5f);
+	m_phases[FRAME_UPDATE].col = QSGColour(0.2f, 0.8f, 0.2f);
+	m_phases[FRAME_INTERPOLATE].col = QSGColour(0.2f, 0.8f, 0.8f);
+	m_phases[FRAME_RENDER].col = QSGColour(0.9f, 0.6f, 0.1f);
+	m_phases[FRAME_SWAP].col = QSGColour(0.8f, 0.2f, 0.2f);
+	m_gpu.col = QSGWhite;
+	m_lines.col = QSGColour(1, 1, 1, 0.5f);
+}
+
+QSGFrameGraph::~QSGFrameGraph(void)
+{
+}
+
+void QSGFrameGraph::renderContent(QSGRenderer* renderer)
+{
+	float width = getWidth();
+	int count = frame_GetCount();
+	renderer->clearTexture();
+
+	renderer->pushTransform(&m_background);
+	renderer->renderQuad(0, 0, width, m_height);
+	renderer->popTransform();
+
+	// One transform per phase, so the colour changes five times rather
+	// than for every bar.
+	float scale = m_pixelsPerMs * 1000;
+	for (int phase = 0; phase < FRAME_PHASES; ++phase) {
+		renderer->pushTransform(&m_phases[phase]);
+		for (int age = 0; age < count; ++age) {
+			const FrameSample* frame = frame_GetSample(age);
+			float below = 0;
+			for (int i = 0; i < phase; ++i) below += (float) frame->m_aPhase[i];
+			float bottom = below * scale;
+			float top = bottom + (float) frame->m_aPhase[phase] * scale;
+			if (bottom >= m_height) continue;
+			if (top > m_height) top = m_height;
+			if (top - bottom < 0.5f) continue;
+			float right = width - age * m_barWidth;
+			renderer->renderQuad(right - m_barWidth, bottom, right, top);
+		}
+		renderer->popTransform();
+	}
+
+	renderer->pushTransform(&m_gpu);
+	for (int age = 0; age < count; ++age) {
+		const FrameSample* frame = frame_GetSample(age);
+		if (frame->m_fGpu < 0) continue;
+		float y = (float) frame->m_fGpu * scale;
+		if (y > m_height - 1) y = m_height - 1;
+		float right = width - age * m_barWidth;
+		renderer->renderQuad(right - m_barWidth, y, right, y + 1);
+	}
+	renderer->popTransform();
+
+	renderer->pushTransform(&m_lines);
+	float fps60 = m_pixelsPerMs * 1000.0f / 60;
+	float fps30 = m_pixelsPerMs * 1000.0f / 30;
+	if (fps60 < m_height) renderer->renderQuad(0, fps60, width, fps60 + 1);
+	if (fps30 < m_height) renderer->renderQuad(0, fps30, width, fps30 + 1);
+	renderer->popTransform();
+
+	renderChildren(renderer);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "QSGTransformNode.h"
+#include "FrameStats.h"
+
+// Draws the frame times kept by FrameStats as a bar per frame, stacked
+// by phase and newest on the right, with the GPU time of each frame as
+// a white tick. Lines mark 60 and 30 frames per second. The transform
+// places the bottom-left corner.
+class QSGFrameGraph :
+	public QSGTransformNode
+{
+public:
+	QSGFrameGraph(void);
+	virtual ~QSGFrameGraph(void);
+
+	inline float getWidth(void) const { return m_barWidth * FRAME_HISTORY; }
+	inline float getHeight(void) const { return m_height; }
+
+public:
+	virtual void renderContent(QSGRenderer* renderer);
+
+public:
+	float m_barWidth;		// pixels per frame
+	float m_pixelsPerMs;
+	float m_height;			// bars are cut off here
+
+protected:
+	QSGTransform m_background;
+	QSGTransform m_phases[FRAME_PHASES];
+	QSGTransform m_gpu;
+	QSGTransform m_lines;
+};
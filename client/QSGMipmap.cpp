@@ -0,0 +1,102 @@
+#include "QSGMipmap.h"
+#include "QSGSoftwareSpans.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define QSG_MIP_X86
+#include <emmintrin.h>
+#endif
+
+int qsgMipLevels(int width, int height)
+{
+	int size = width > height ? width : height;
+	int levels = 1;
+	while (size > 1) {
+		size >>= 1;
+		++levels;
+	}
+	return levels;
+}
+
+size_t qsgMipChainSize(int width, int height, int components, int levels)
+{
+	size_t size = 0;
+	for (int level = 0; level < levels; ++level)
+		size += (size_t) qsgMipSize(width, level) * qsgMipSize(height, level) * components;
+	return size;
+}
+
+// Texels from first to count of one row of the smaller level, from two
+// rows of the larger. Columns past the edge of a one texel wide level
+// repeat the last one.
+static void downsampleRow(const unsigned char* row0, const unsigned char* row1, int width,
+	int components, int first, int count, unsigned char* out)
+{
+	for (int x = first; x < count; ++x) {
+		int x0 = 2 * x, x1 = 2 * x + 1 < width ? 2 * x + 1 : width - 1;
+		const unsigned char* a = row0 + x0 * components;
+		const unsigned char* b = row0 + x1 * components;
+		const unsigned char* c = row1 + x0 * components;
+		const unsigned char* d = row1 + x1 * components;
+		unsigned char* o = out + x * components;
+		for (int k = 0; k < components; ++k)
+			o[k] = (unsigned char) ((a[k] + b[k] + c[k] + d[k] + 2) >> 2);
+	}
+}
+
+#ifdef QSG_MIP_X86
+
+// RGBA, four texels of each row to two out: the rows are summed in 16
+// bit lanes, then each texel is added to its right-hand neighbour.
+static int downsampleRowSSE2(const unsigned char* row0, const unsigned char* row1, int count,
+	unsigned char* out)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i two = _mm_set1_epi16(2);
+	int x = 0;
+	for (; x + 2 <= count; x += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (row0 + x * 8));
+		__m128i b = _mm_loadu_si128((const __m128i*) (row1 + x * 8));
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+		__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+		_mm_storel_epi64((__m128i*) (out + x * 4), _mm_packus_epi16(sum, zero));
+	}
+	return x;
+}
+
+#endif
+
+void qsgDownsample(const unsigned char* src, int width, int height, int components,
+	unsigned char* dst)
+{
+	int outWidth = qsgMipSize(width, 1), outHeight = qsgMipSize(height, 1);
+	size_t stride = (size_t) width * components;
+#ifdef QSG_MIP_X86
+	bool simd = components == 4 && width > 1 && qsgSpanLevel() >= QSGSpanSSE2;
+#endif
+	for (int y = 0; y < outHeight; ++y) {
+		int y1 = 2 * y + 1 < height ? 2 * y + 1 : height - 1;
+		const unsigned char* row0 = src + 2 * y * stride;
+		const unsigned char* row1 = src + y1 * stride;
+		unsigned char* out = dst + (size_t) y * outWidth * components;
+		int x = 0;
+#ifdef QSG_MIP_X86
+		if (simd) x = downsampleRowSSE2(row0, row1, outWidth, out);
+#endif
+		downsampleRow(row0, row1, width, components, x, outWidth, out);
+	}
+}
+
+void qsgBuildMipChain(unsigned char* texels, int width, int height, int components,
+	int levels)
+{
+	for (int level = 1; level < levels; ++level) {
+		unsigned char* next = texels + (size_t) width * height * components;
+		qsgDownsample(texels, width, height, components, next);
+		texels = next;
+		width = qsgMipSize(width, 1);
+		height = qsgMipSize(height, 1);
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+// Mip levels for textures drawn smaller than their size. Each level is
+// half the size of the one above, rounded down but never below 1 as GL
+// sizes them, and each texel is the rounded mean of the 2x2 texels above
+// it (a box filter). At odd sizes the last row or column of the larger
+// level is left out, as most GL drivers do.
+//
+// A chain is stored largest level first, one after another, with rows
+// of width * components bytes and no padding.
+
+// Levels in a full chain down to 1x1, counting the base level.
+int qsgMipLevels(int width, int height);
+
+// The width or height of a level.
+inline int qsgMipSize(int size, int level)
+{
+	size >>= level;
+	return size > 0 ? size : 1;
+}
+
+// Bytes of the first levels of a chain, from the base level on.
+size_t qsgMipChainSize(int width, int height, int components, int levels);
+
+// Halve one level into dst, which holds qsgMipSize(width, 1) by
+// qsgMipSize(height, 1) texels. RGBA uses SSE2 at the span level in
+// use (QSGSoftwareSpans.h), with exactly the same results.
+void qsgDownsample(const unsigned char* src, int width, int height, int components,
+	unsigned char* dst);
+
+// Fill in levels 1 to levels - 1 after the base level at texels, which
+// has room for qsgMipChainSize bytes.
+void qsgBuildMipChain(unsigned char* texels, int width, int height, int components,
+	int levels);
@@ -1,5 +1,6 @@
 #pragma once
 #include "QSGObject.h"
+#include <stddef.h>
 #include <list>
 
 class QSGNode :
@@ -0,0 +1,30 @@
+#pragma once
+#include "QSGRenderer.h"
+#include "QSGNode.h"
+
+// Visits the scene and draws nothing, for measuring the cost of the scene
+// graph and its callers apart from any real rendering.
+class QSGNullRenderer :
+	public QSGRenderer
+{
+public:
+	QSGNullRenderer(void) {}
+	virtual ~QSGNullRenderer(void) {}
+
+public:
+	virtual void initialise(void) {}
+	virtual void shutdown(void) {}
+	virtual void setViewportSize(int width, int height) {}
+	virtual void render(QSGNode* scene) { scene->render(this); }
+
+public:
+	virtual void clear(QSGColour clearColour) {}
+	virtual void pushTransform(QSGTransform* trans) {}
+	virtual void popTransform(void) {}
+	virtual void setTexture(QSGTexture* texture) {}
+	virtual void clearTexture(void) {}
+	virtual void renderQuad(float left, float bottom, float right, float top) {}
+	virtual void renderGeometry(QSGGeometry* geometry) {}
+	virtual void setScissor(float left, float bottom, float right, float top) {}
+	virtual void clearScissor(void) {}
+};
@@ -1,8 +1,169 @@
 #include "QSGOpenGLRenderer.h"
 #include "QSGTransform.h"
 #include "QSGTexture.h"
+#include "QSGBlockTexture.h"
+#include "QSGMipmap.h"
 #include "QSGGeometry.h"
 #include "QSGNode.h"
+#include "Logger.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifndef WINDOWS
+#include <GL/glx.h>
+#endif
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// GL_ARB_timer_query, core in GL 3.3; the entry points are looked up at
+// run time since opengl32.dll only exports GL 1.1.
+#define QSG_GL_QUERY_RESULT				0x8866
+#define QSG_GL_QUERY_RESULT_AVAILABLE	0x8867
+#define QSG_GL_TIME_ELAPSED				0x88BF
+
+typedef unsigned long long qsgGLuint64;
+typedef void (APIENTRY *qsgGenQueriesProc)(GLsizei n, GLuint* ids);
+typedef void (APIENTRY *qsgDeleteQueriesProc)(GLsizei n, const GLuint* ids);
+typedef void (APIENTRY *qsgBeginQueryProc)(GLenum target, GLuint id);
+typedef void (APIENTRY *qsgEndQueryProc)(GLenum target);
+typedef void (APIENTRY *qsgGetQueryObjectivProc)(GLuint id, GLenum pname, GLint* params);
+typedef void (APIENTRY *qsgGetQueryObjectui64vProc)(GLuint id, GLenum pname, qsgGLuint64* params);
+
+static qsgGenQueriesProc qsgGenQueries = NULL;
+static qsgDeleteQueriesProc qsgDeleteQueries = NULL;
+static qsgBeginQueryProc qsgBeginQuery = NULL;
+static qsgEndQueryProc qsgEndQuery = NULL;
+static qsgGetQueryObjectivProc qsgGetQueryObjectiv = NULL;
+static qsgGetQueryObjectui64vProc qsgGetQueryObjectui64v = NULL;
+
+// Block-compressed textures: glCompressedTexImage2D is GL 1.3, and the
+// formats come from extensions. ETC2 decoders read ETC1 blocks as ETC1,
+// so GL_ARB_ES3_compatibility takes ETC1 as the ETC2 RGB format.
+#define QSG_GL_COMPRESSED_RGB_S3TC_DXT1		0x83F0
+#define QSG_GL_COMPRESSED_RGBA_S3TC_DXT5	0x83F3
+#define QSG_GL_ETC1_RGB8					0x8D64
+#define QSG_GL_COMPRESSED_RGB8_ETC2			0x9274
+
+typedef void (APIENTRY *qsgCompressedTexImage2DProc)(GLenum target, GLint level,
+	GLenum internalFormat, GLsizei width, GLsizei height, GLint border,
+	GLsizei imageSize, const void* data);
+
+static qsgCompressedTexImage2DProc qsgCompressedTexImage2D = NULL;
+
+// Mip levels: glGenerateMipmap is GL 3.0 and GL_ARB_framebuffer_object,
+// or glGenerateMipmapEXT with GL_EXT_framebuffer_object. Without either
+// the levels are built on the CPU. GL_TEXTURE_MAX_LEVEL (GL 1.2) stops
+// sampling at the last level a block file has.
+#define QSG_GL_TEXTURE_MAX_LEVEL			0x813D
+
+typedef void (APIENTRY *qsgGenerateMipmapProc)(GLenum target);
+
+static qsgGenerateMipmapProc qsgGenerateMipmap = NULL;
+
+static void* getProcAddress(const char* name)
+{
+#ifdef WINDOWS
+	return (void*) wglGetProcAddress(name);
+#else
+	return (void*) glXGetProcAddressARB((const GLubyte*) name);
+#endif
+}
+
+static bool hasExtension(const char* name)
+{
+	const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+	if (!extensions) return false;
+	size_t len = strlen(name);
+	for (const char* p = strstr(extensions, name); p; p = strstr(p + len, name)) {
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+	}
+	return false;
+}
+
+static bool hasVersion(int wantMajor, int wantMinor)
+{
+	const char* version = (const char*) glGetString(GL_VERSION);
+	int major = 0, minor = 0;
+	if (version) {
+		major = atoi(version);
+		const char* dot = strchr(version, '.');
+		if (dot) minor = atoi(dot + 1);
+	}
+	return major > wantMajor || (major == wantMajor && minor >= wantMinor);
+}
+
+// Look up the timer query entry points for the current context.
+static bool loadTimerQueries(void)
+{
+	const char* getResult = NULL;
+	if (hasVersion(3, 3) || hasExtension("GL_ARB_timer_query"))
+		getResult = "glGetQueryObjectui64v";
+	else if (hasExtension("GL_EXT_timer_query"))
+		getResult = "glGetQueryObjectui64vEXT";
+	if (!getResult) return false;
+
+	qsgGenQueries = (qsgGenQueriesProc) getProcAddress("glGenQueries");
+	qsgDeleteQueries = (qsgDeleteQueriesProc) getProcAddress("glDeleteQueries");
+	qsgBeginQuery = (qsgBeginQueryProc) getProcAddress("glBeginQuery");
+	qsgEndQuery = (qsgEndQueryProc) getProcAddress("glEndQuery");
+	qsgGetQueryObjectiv = (qsgGetQueryObjectivProc) getProcAddress("glGetQueryObjectiv");
+	qsgGetQueryObjectui64v = (qsgGetQueryObjectui64vProc) getProcAddress(getResult);
+	return qsgGenQueries && qsgDeleteQueries && qsgBeginQuery && qsgEndQuery &&
+		qsgGetQueryObjectiv && qsgGetQueryObjectui64v;
+}
+
+// The GL format to upload each QSGTextureFormat as, or 0 where the
+// blocks have to be decoded first.
+static void loadBlockFormats(GLenum* formats)
+{
+	for (int i = 0; i < QSGTextureFormatCount; ++i) formats[i] = 0;
+	qsgCompressedTexImage2D = (qsgCompressedTexImage2DProc) getProcAddress("glCompressedTexImage2D");
+	if (!qsgCompressedTexImage2D)
+		qsgCompressedTexImage2D = (qsgCompressedTexImage2DProc) getProcAddress("glCompressedTexImage2DARB");
+	if (!qsgCompressedTexImage2D) return;
+	if (hasExtension("GL_EXT_texture_compression_s3tc")) {
+		formats[QSGTextureBC1] = QSG_GL_COMPRESSED_RGB_S3TC_DXT1;
+		formats[QSGTextureBC3] = QSG_GL_COMPRESSED_RGBA_S3TC_DXT5;
+	}
+	if (hasExtension("GL_OES_compressed_ETC1_RGB8_texture"))
+		formats[QSGTextureETC1] = QSG_GL_ETC1_RGB8;
+	else if (hasExtension("GL_ARB_ES3_compatibility"))
+		formats[QSGTextureETC1] = QSG_GL_COMPRESSED_RGB8_ETC2;
+}
+
+static void loadGenerateMipmap(void)
+{
+	qsgGenerateMipmap = NULL;
+	if (hasVersion(3, 0) || hasExtension("GL_ARB_framebuffer_object"))
+		qsgGenerateMipmap = (qsgGenerateMipmapProc) getProcAddress("glGenerateMipmap");
+	else if (hasExtension("GL_EXT_framebuffer_object"))
+		qsgGenerateMipmap = (qsgGenerateMipmapProc) getProcAddress("glGenerateMipmapEXT");
+}
+
+// The GL format of raw texels, or 0.
+static GLenum texelFormat(int components)
+{
+	switch (components)
+	{
+	case 1: return GL_LUMINANCE; // or GL_ALPHA?
+	case 2: return GL_LUMINANCE_ALPHA;
+	case 3: return GL_RGB;
+	case 4: return GL_RGBA;
+	}
+	return 0; // invalid
+}
+
+// If this is ever needed on any platform, make sure row alignment is
+// one byte for RGB images since we don't pad texel row data.
+static void setUnpackAlignment(int components)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, components == 3 ? 1 : components);
+}
 
 QSGOpenGLRenderer::~QSGOpenGLRenderer(void)
 {
@@ -17,16 +178,38 @@ void QSGOpenGLRenderer::initialise(void)
 	//glDepthFunc( GL_LEQUAL );
 	glHint( GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST ); // for now.
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	m_straightAlpha = true;
 
 	glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
 	//glFrontFace( GL_CCW );
 	glDisable( GL_CULL_FACE ); // for now.
 
 	// glEnable(GL_MULTISAMPLE_ARB); // TODO
+
+	m_timerQueries = loadTimerQueries();
+	if (m_timerQueries) {
+		qsgGenQueries(QSG_GPU_QUERIES, m_queries);
+		for (int i = 0; i < QSG_GPU_QUERIES; ++i) m_queryFrames[i] = -1;
+	}
+	else log_Log("QSGOpenGLRenderer: no timer queries; GPU frame times are not measured");
+
+	loadBlockFormats(m_blockFormats);
+	if (!m_blockFormats[QSGTextureBC1])
+		log_Log("QSGOpenGLRenderer: no S3TC; BC1 and BC3 textures are decoded before upload");
+	if (!m_blockFormats[QSGTextureETC1])
+		log_Log("QSGOpenGLRenderer: no ETC1; ETC1 textures are decoded before upload");
+
+	loadGenerateMipmap();
+	if (!qsgGenerateMipmap)
+		log_Log("QSGOpenGLRenderer: no glGenerateMipmap; mip levels are built on the CPU");
 }
 
 void QSGOpenGLRenderer::shutdown(void)
 {
+	if (m_timerQueries) {
+		qsgDeleteQueries(QSG_GPU_QUERIES, m_queries);
+		m_timerQueries = false;
+	}
 }
 
 void QSGOpenGLRenderer::setViewportSize(int width, int height)
@@ -48,7 +231,53 @@ void QSGOpenGLRenderer::setViewportSize(int width, int height)
 
 void QSGOpenGLRenderer::render(QSGNode* scene)
 {
+	int frame = m_frames++;
+	if (!m_timerQueries) {
+		scene->render(this);
+		return;
+	}
+
+	// Use a free query; if the GPU is so far behind that none are free,
+	// this frame goes unmeasured.
+	readTimerQueries();
+	int slot = frame % QSG_GPU_QUERIES;
+	bool timed = m_queryFrames[slot] < 0;
+	if (timed) {
+		qsgBeginQuery(QSG_GL_TIME_ELAPSED, m_queries[slot]);
+		m_queryFrames[slot] = frame;
+	}
 	scene->render(this);
+	if (timed) qsgEndQuery(QSG_GL_TIME_ELAPSED);
+}
+
+// Collect any results that have arrived, without waiting for the rest.
+// This runs before a frame is drawn rather than after, since asking for
+// the results of the frame just submitted makes some drivers flush it.
+void QSGOpenGLRenderer::readTimerQueries(void)
+{
+	for (int i = 0; i < QSG_GPU_QUERIES; ++i) {
+		if (m_queryFrames[i] < 0) continue;
+		GLint available = 0;
+		qsgGetQueryObjectiv(m_queries[i], QSG_GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) continue;
+		qsgGLuint64 nanoseconds = 0;
+		qsgGetQueryObjectui64v(m_queries[i], QSG_GL_QUERY_RESULT, &nanoseconds);
+		// over a second is garbage; llvmpipe gives that for its first query.
+		if (nanoseconds < 1000000000ull && m_queryFrames[i] > m_gpuFrame) {
+			m_gpuTime = nanoseconds * 1e-9;
+			m_gpuFrame = m_queryFrames[i];
+		}
+		m_queryFrames[i] = -1;
+	}
+}
+
+bool QSGOpenGLRenderer::getGpuTime(double* seconds, int* age)
+{
+	if (!m_timerQueries || m_gpuFrame < 0) return false;
+	*seconds = m_gpuTime;
+	*age = m_frames - 1 - m_gpuFrame;
+	m_gpuFrame = -1;
+	return true;
 }
 
 void QSGOpenGLRenderer::clear(QSGColour colour)
@@ -65,28 +294,28 @@ void QSGOpenGLRenderer::pushTransform(QSGTransform* trans)
 	glPushMatrix();
 
 	// TODO: cumulative colour change
-	glColor4f(trans->col.r, trans->col.g, trans->col.b, trans->col.a);
+	const QSGColour& col = trans->col;
 
 	// Enable blending if:
 	// - the colour alpha is not opaque, or
 	// - the texture has an alpha channel, or
 	// - blend mode is additive (might be a luminance texture)
-	if (trans->col.a != 1 || trans->flags & (QSGTransformNeedsBlend | QSGTransformBlendAdd)) {
+	//
+	// Premultiplied textures and additive blending share one function,
+	// GL_ONE, GL_ONE_MINUS_SRC_ALPHA, so switching between them costs no
+	// state change: the colour is premultiplied to tint a premultiplied
+	// texture, and additive draws have an alpha of zero, which leaves the
+	// destination as it is. Textures loaded with straight alpha keep the
+	// old function.
+	if (col.a != 1 || trans->flags & (QSGTransformNeedsBlend | QSGTransformBlendAdd)) {
 		if (!m_blending) {
 			glEnable(GL_BLEND);
 			m_blending = true;
 		}
-		if (trans->flags & QSGTransformBlendAdd) {
-			if (!m_additive) {
-				glBlendFunc(GL_ONE, GL_ONE);
-				m_additive = true;
-			}
-		}
-		else {
-			if (m_additive) {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				m_additive = false;
-			}
+		bool straight = !(trans->flags & (QSGTransformBlendAdd | QSGTransformPremultiplied));
+		if (straight != m_straightAlpha) {
+			glBlendFunc(straight ? GL_SRC_ALPHA : GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+			m_straightAlpha = straight;
 		}
 	}
 	else {
@@ -95,6 +324,12 @@ void QSGOpenGLRenderer::pushTransform(QSGTransform* trans)
 			m_blending = false;
 		}
 	}
+	if (trans->flags & QSGTransformBlendAdd)
+		glColor4f(col.r, col.g, col.b, 0);
+	else if (m_blending && !m_straightAlpha)
+		glColor4f(col.r * col.a, col.g * col.a, col.b * col.a, col.a);
+	else
+		glColor4f(col.r, col.g, col.b, col.a);
 
 	// Apply SRT transform.
 	glTranslatef(trans->pos.x, trans->pos.y, 0);
@@ -118,6 +353,8 @@ void QSGOpenGLRenderer::setTexture(class QSGTexture* texture)
 	if (texture->m_renderData)
 	{
 		glBindTexture(GL_TEXTURE_2D, texture->m_renderData);
+		if (texture->m_renderFilter != texture->filter())
+			setTextureFilter(texture);
 	}
 	else
 	{
@@ -183,10 +420,10 @@ void QSGOpenGLRenderer::setScissor(float left, float bottom, float right, float
 	GLfloat matrix[16], tx, ty;
 	GLint i_left, i_bottom, i_right, i_top;
 
-	// get current transform origin in screen space (hax)
+	// get current transform origin in screen space (hax: ignores rotation)
 	glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
-	tx = this->m_width * 0.5f + matrix[3];
-	ty = this->m_height * 0.5f + matrix[7];
+	tx = this->m_width * 0.5f + matrix[12];
+	ty = this->m_height * 0.5f + matrix[13];
 
 	i_left = (GLint) (tx + left);
 	i_right = (GLint) (tx + right);
@@ -213,29 +450,104 @@ void QSGOpenGLRenderer::resolveTexture(QSGTexture* texture)
 	glGenTextures(1, &id);
 	texture->m_renderData = id;
 
-	GLenum fmt;
-	switch (texture->m_components)
-	{
-	case 1: fmt = GL_LUMINANCE; break; // or GL_ALPHA?
-	case 2: fmt = GL_LUMINANCE_ALPHA; break;
-	case 3: fmt = GL_RGB; break;
-	case 4: fmt = GL_RGBA; break;
-	default: /* invalid */ return;
+	if (texture->m_format != QSGTextureRaw) {
+		resolveBlockTexture(texture);
+		return;
 	}
 
-	// If this is ever needed on any platform, make sure row alignment is
-	// one byte for RGB images since we don't pad texel row data.
-	GLint align;
-	if (texture->m_components == 3) align = 1;
-	else align = texture->m_components;
+	GLenum fmt = texelFormat(texture->m_components);
+	if (!fmt) return;
 
 	glBindTexture(GL_TEXTURE_2D, id);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, align);
+	setUnpackAlignment(texture->m_components);
 	glTexImage2D(GL_TEXTURE_2D, 0, texture->m_components,
 		texture->m_width, texture->m_height, 0, fmt,
 		GL_UNSIGNED_BYTE, texture->m_data);
+	setTextureParameters();
+	setTextureFilter(texture);
+}
+
+void QSGOpenGLRenderer::resolveBlockTexture(QSGTexture* texture)
+{
+	int format = texture->m_format;
+	if (format < 0 || format >= QSGTextureFormatCount || !texture->m_data) return;
+
+	glBindTexture(GL_TEXTURE_2D, texture->m_renderData);
+	const unsigned char* blocks = texture->m_data;
+	std::vector<unsigned char> rgba;
+	for (int level = 0; level < texture->m_levels; ++level) {
+		int width = qsgMipSize(texture->m_width, level);
+		int height = qsgMipSize(texture->m_height, level);
+		size_t size = qsgBlockSize(format, width, height);
+		if (m_blockFormats[format]) {
+			qsgCompressedTexImage2D(GL_TEXTURE_2D, level, m_blockFormats[format],
+				width, height, 0, (GLsizei) size, blocks);
+		}
+		else {
+			// the driver cannot take the blocks; send what they decode to.
+			rgba.resize((size_t) width * height * 4);
+			qsgDecodeBlocks(format, blocks, width, height, &rgba[0]);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexImage2D(GL_TEXTURE_2D, level, qsgBlockComponents(format),
+				width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+		}
+		blocks += size;
+	}
+	glTexParameteri(GL_TEXTURE_2D, QSG_GL_TEXTURE_MAX_LEVEL, texture->m_levels - 1);
+	setTextureParameters();
+	setTextureFilter(texture);
+}
+
+void QSGOpenGLRenderer::setTextureParameters(void)
+{
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE ); // GL_CLAMP | GL_REPEAT
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE ); // GL_CLAMP | GL_REPEAT
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR ); // GL_NEAREST | GL_LINEAR
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR ); // GL_NEAREST | GL_LINEAR
+}
+
+// Filter the bound texture as it asks, building the mip levels of a raw
+// texture the first time a mipmapped filter needs them.
+void QSGOpenGLRenderer::setTextureFilter(QSGTexture* texture)
+{
+	int filter = texture->filter();
+	GLint magFilter = GL_LINEAR, minFilter = GL_LINEAR;
+	switch (filter) {
+	case QSGFilterNearest: magFilter = minFilter = GL_NEAREST; break;
+	case QSGFilterMipmap: minFilter = GL_LINEAR_MIPMAP_NEAREST; break;
+	case QSGFilterTrilinear: minFilter = GL_LINEAR_MIPMAP_LINEAR; break;
+	}
+	if (minFilter != GL_LINEAR && minFilter != GL_NEAREST && texture->m_format == QSGTextureRaw) {
+		GLint levelWidth = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 1, GL_TEXTURE_WIDTH, &levelWidth);
+		if (!levelWidth) buildMipmaps(texture);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+	texture->m_renderFilter = filter;
+}
+
+// Levels 1 and down for the bound raw texture, on the GPU if it can.
+void QSGOpenGLRenderer::buildMipmaps(QSGTexture* texture)
+{
+	if (qsgGenerateMipmap) {
+		qsgGenerateMipmap(GL_TEXTURE_2D);
+		return;
+	}
+	int width = texture->m_width, height = texture->m_height;
+	int components = texture->m_components;
+	if (!texture->m_data || !texelFormat(components)) return;
+	int levels = qsgMipLevels(width, height);
+	std::vector<unsigned char> chain(qsgMipChainSize(width, height, components, levels));
+	memcpy(&chain[0], texture->m_data, (size_t) width * height * components);
+	qsgBuildMipChain(&chain[0], width, height, components, levels);
+
+	setUnpackAlignment(components);
+	const unsigned char* texels = &chain[0];
+	for (int level = 0; level < levels; ++level) {
+		int w = qsgMipSize(width, level), h = qsgMipSize(height, level);
+		if (level > 0) {
+			glTexImage2D(GL_TEXTURE_2D, level, components, w, h, 0,
+				texelFormat(components), GL_UNSIGNED_BYTE, texels);
+		}
+		texels += (size_t) w * h * components;
+	}
 }
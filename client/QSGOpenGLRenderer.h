@@ -1,5 +1,6 @@
 #pragma once
 #include "QSGRenderer.h"
+#include "QSGBlockTexture.h"
 
 #ifdef WINDOWS
 #include <windows.h> // for gl.
@@ -13,13 +14,18 @@
 #define GL_CLAMP_TO_EDGE 0x812F
 #endif
 
+// Timer queries in flight; results are read this many frames late so
+// that reading them never waits for the GPU.
+#define QSG_GPU_QUERIES 4
+
 class QSGOpenGLRenderer :
 	public QSGRenderer
 {
 public:
 	QSGOpenGLRenderer(void) : m_width(0), m_height(0),
-		m_texturing(false), m_blending(false), m_additive(false),
-		m_arrays(false) {}
+		m_texturing(false), m_blending(false), m_straightAlpha(true),
+		m_arrays(false), m_timerQueries(false), m_frames(0),
+		m_gpuTime(0), m_gpuFrame(-1) {}
 	virtual ~QSGOpenGLRenderer(void);
 
 public:
@@ -27,6 +33,7 @@ public:
 	virtual void shutdown(void);
 	virtual void setViewportSize(int width, int height);
 	virtual void render(QSGNode* scene);
+	virtual bool getGpuTime(double* seconds, int* age);
 
 public:
 	virtual void clear(QSGColour clearColour);
@@ -41,12 +48,28 @@ public:
 
 protected:
 	void resolveTexture(QSGTexture* texture);
+	void resolveBlockTexture(QSGTexture* texture);
+	void setTextureParameters(void);
+	void setTextureFilter(QSGTexture* texture);
+	void buildMipmaps(QSGTexture* texture);
+	void readTimerQueries(void);
 
 protected:
 	int m_width;
 	int m_height;
 	bool m_texturing;
 	bool m_blending;
-	bool m_additive;
+	bool m_straightAlpha;	// blending with GL_SRC_ALPHA rather than GL_ONE
 	bool m_arrays;
+
+	// GL_TIME_ELAPSED queries around each render, when supported.
+	bool m_timerQueries;
+	GLuint m_queries[QSG_GPU_QUERIES];
+	int m_queryFrames[QSG_GPU_QUERIES];	// frame measured, or -1 if free
+	int m_frames;
+	double m_gpuTime;
+	int m_gpuFrame;						// frame of m_gpuTime, or -1 once read
+
+	// GL format for each QSGTextureFormat, or 0 to decode before upload.
+	GLenum m_blockFormats[QSGTextureFormatCount];
 };
@@ -0,0 +1,296 @@
+#include "QSGRecordingRenderer.h"
+#include "QSGTrace.h"
+#include "QSGTransform.h"
+#include "QSGTexture.h"
+#include "QSGBlockTexture.h"
+#include "QSGGeometry.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void QSGRecordingScene::render(QSGRenderer* renderer)
+{
+	m_scene->render(m_recorder);
+}
+
+QSGRecordingRenderer::QSGRecordingRenderer(QSGRenderer* target) :
+	m_target(target), m_recording(false), m_framesLeft(0), m_framesCaptured(0),
+	m_width(0), m_height(0), m_nextGeometryId(0)
+{
+	m_proxy.m_recorder = this;
+}
+
+QSGRecordingRenderer::~QSGRecordingRenderer(void)
+{
+}
+
+void QSGRecordingRenderer::startCapture(int frames, int width, int height)
+{
+	m_trace.clear();
+	m_held.clear();
+	m_textureIds.clear();
+	m_textureFilters.clear();
+	m_geometry.clear();
+	m_nextGeometryId = 0;
+	m_framesLeft = frames;
+	m_framesCaptured = 0;
+	m_width = width;
+	m_height = height;
+
+	m_trace.insert(m_trace.end(), QSG_TRACE_MAGIC, QSG_TRACE_MAGIC + strlen(QSG_TRACE_MAGIC));
+	writeUInt(QSG_TRACE_VERSION);
+}
+
+bool QSGRecordingRenderer::saveTrace(const char* filename)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		log_Logf("QSGRecordingRenderer: cannot open %s", filename);
+		return false;
+	}
+	bool ok = m_trace.empty() || fwrite(&m_trace[0], 1, m_trace.size(), file) == m_trace.size();
+	if (fclose(file)) ok = false;
+	if (!ok) log_Logf("QSGRecordingRenderer: cannot write %s", filename);
+	return ok;
+}
+
+void QSGRecordingRenderer::initialise(void)
+{
+	m_target->initialise();
+}
+
+void QSGRecordingRenderer::shutdown(void)
+{
+	m_target->shutdown();
+}
+
+void QSGRecordingRenderer::setViewportSize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_target->setViewportSize(width, height);
+}
+
+void QSGRecordingRenderer::render(QSGNode* scene)
+{
+	if (!isCapturing()) {
+		m_target->render(scene);
+		return;
+	}
+
+	writeOp(QSGTraceBeginFrame);
+	writeUInt(m_width);
+	writeUInt(m_height);
+
+	m_recording = true;
+	m_proxy.m_scene = scene;
+	m_target->render(&m_proxy);
+	m_proxy.m_scene = NULL;
+	m_recording = false;
+
+	writeOp(QSGTraceEndFrame);
+	--m_framesLeft;
+	++m_framesCaptured;
+}
+
+bool QSGRecordingRenderer::getGpuTime(double* seconds, int* age)
+{
+	return m_target->getGpuTime(seconds, age);
+}
+
+void QSGRecordingRenderer::clear(QSGColour colour)
+{
+	if (m_recording) {
+		writeOp(QSGTraceClear);
+		writeFloat(colour.r);
+		writeFloat(colour.g);
+		writeFloat(colour.b);
+		writeFloat(colour.a);
+	}
+	m_target->clear(colour);
+}
+
+void QSGRecordingRenderer::pushTransform(QSGTransform* trans)
+{
+	if (!m_recording) {
+		m_target->pushTransform(trans);
+		return;
+	}
+
+	unsigned int fields = 0;
+	if (trans->pos.x != 0 || trans->pos.y != 0) fields |= QSGTracePos;
+	if (trans->angle != 0) fields |= QSGTraceAngle;
+	if (trans->scale.x != 1 || trans->scale.y != 1) fields |= QSGTraceScale;
+	if (trans->col.r != 1 || trans->col.g != 1 || trans->col.b != 1 || trans->col.a != 1)
+		fields |= QSGTraceColour;
+
+	writeOp(QSGTracePushTransform);
+	m_trace.push_back((unsigned char) fields);
+	writeUInt(trans->flags);
+	if (fields & QSGTracePos) { writeFloat(trans->pos.x); writeFloat(trans->pos.y); }
+	if (fields & QSGTraceAngle) writeFloat(trans->angle);
+	if (fields & QSGTraceScale) { writeFloat(trans->scale.x); writeFloat(trans->scale.y); }
+	if (fields & QSGTraceColour) {
+		writeFloat(trans->col.r);
+		writeFloat(trans->col.g);
+		writeFloat(trans->col.b);
+		writeFloat(trans->col.a);
+	}
+	m_target->pushTransform(trans);
+}
+
+void QSGRecordingRenderer::popTransform(void)
+{
+	if (m_recording) writeOp(QSGTracePopTransform);
+	m_target->popTransform();
+}
+
+void QSGRecordingRenderer::setTexture(QSGTexture* texture)
+{
+	if (m_recording) {
+		unsigned int id = defineTexture(texture);
+		std::map<QSGTexture*, int>::iterator it = m_textureFilters.find(texture);
+		int filter = it != m_textureFilters.end() ? it->second : QSGFilterLinear;
+		if (texture->m_filter != filter) {
+			writeOp(QSGTraceTextureFilter);
+			writeUInt(id);
+			writeUInt(texture->m_filter);
+			m_textureFilters[texture] = texture->m_filter;
+		}
+		writeOp(QSGTraceSetTexture);
+		writeUInt(id);
+	}
+	m_target->setTexture(texture);
+}
+
+void QSGRecordingRenderer::clearTexture(void)
+{
+	if (m_recording) writeOp(QSGTraceClearTexture);
+	m_target->clearTexture();
+}
+
+void QSGRecordingRenderer::renderQuad(float left, float bottom, float right, float top)
+{
+	if (m_recording) {
+		writeOp(QSGTraceQuad);
+		writeFloat(left);
+		writeFloat(bottom);
+		writeFloat(right);
+		writeFloat(top);
+	}
+	m_target->renderQuad(left, bottom, right, top);
+}
+
+void QSGRecordingRenderer::renderGeometry(QSGGeometry* geometry)
+{
+	if (m_recording) {
+		unsigned int id = defineGeometry(geometry);
+		writeOp(QSGTraceGeometry);
+		writeUInt(id);
+	}
+	m_target->renderGeometry(geometry);
+}
+
+void QSGRecordingRenderer::setScissor(float left, float bottom, float right, float top)
+{
+	if (m_recording) {
+		writeOp(QSGTraceScissor);
+		writeFloat(left);
+		writeFloat(bottom);
+		writeFloat(right);
+		writeFloat(top);
+	}
+	m_target->setScissor(left, bottom, right, top);
+}
+
+void QSGRecordingRenderer::clearScissor(void)
+{
+	if (m_recording) writeOp(QSGTraceClearScissor);
+	m_target->clearScissor();
+}
+
+void QSGRecordingRenderer::writeOp(int op)
+{
+	m_trace.push_back((unsigned char) op);
+}
+
+void QSGRecordingRenderer::writeUInt(unsigned int value)
+{
+	while (value >= 0x80) {
+		m_trace.push_back((unsigned char) (value | 0x80));
+		value >>= 7;
+	}
+	m_trace.push_back((unsigned char) value);
+}
+
+void QSGRecordingRenderer::writeFloat(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	m_trace.push_back((unsigned char) bits);
+	m_trace.push_back((unsigned char) (bits >> 8));
+	m_trace.push_back((unsigned char) (bits >> 16));
+	m_trace.push_back((unsigned char) (bits >> 24));
+}
+
+unsigned int QSGRecordingRenderer::defineTexture(QSGTexture* texture)
+{
+	std::map<QSGTexture*, unsigned int>::iterator it = m_textureIds.find(texture);
+	if (it != m_textureIds.end()) return it->second;
+
+	unsigned int id = (unsigned int) m_textureIds.size();
+	m_textureIds[texture] = id;
+	m_held.push_back(texture);
+
+	// Traces hold plain texels, so block formats are decoded to RGBA.
+	const unsigned char* texels = texture->m_data;
+	std::vector<unsigned char> decoded;
+	int components = texture->m_components;
+	if (texture->m_format != QSGTextureRaw && texels) {
+		decoded.resize((size_t) texture->m_width * texture->m_height * 4);
+		qsgDecodeBlocks(texture->m_format, texels, texture->m_width, texture->m_height, &decoded[0]);
+		texels = &decoded[0];
+		components = 4;
+	}
+	if (!texels || components < 1 || components > 4) components = 0;
+	int width = components ? texture->m_width : 0;
+	int height = components ? texture->m_height : 0;
+	writeOp(QSGTraceDefineTexture);
+	writeUInt(id);
+	writeUInt(width);
+	writeUInt(height);
+	writeUInt(components);
+	if (components)
+		m_trace.insert(m_trace.end(), texels, texels + (size_t) width * height * components);
+	return id;
+}
+
+unsigned int QSGRecordingRenderer::defineGeometry(QSGGeometry* geometry)
+{
+	std::map<QSGGeometry*, GeometryRecord>::iterator it = m_geometry.find(geometry);
+	if (it != m_geometry.end()) {
+		GeometryRecord& last = it->second;
+		if (last.quads == geometry->quads && last.verts == geometry->verts &&
+			last.coords == geometry->coords && last.indices == geometry->indices)
+			return last.id;
+	}
+
+	GeometryRecord& record = m_geometry[geometry];
+	record.id = m_nextGeometryId++;
+	record.quads = geometry->quads;
+	record.verts = geometry->verts;
+	record.coords = geometry->coords;
+	record.indices = geometry->indices;
+
+	writeOp(QSGTraceDefineGeometry);
+	writeUInt(record.id);
+	m_trace.push_back(geometry->quads ? 1 : 0);
+	writeUInt((unsigned int) geometry->verts.size());
+	writeUInt((unsigned int) geometry->coords.size());
+	writeUInt((unsigned int) geometry->indices.size());
+	for (size_t i = 0; i < geometry->verts.size(); ++i) writeFloat(geometry->verts[i]);
+	for (size_t i = 0; i < geometry->coords.size(); ++i) writeFloat(geometry->coords[i]);
+	for (size_t i = 0; i < geometry->indices.size(); ++i) writeUInt(geometry->indices[i]);
+	return record.id;
+}
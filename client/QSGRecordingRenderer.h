@@ -0,0 +1,101 @@
+#pragma once
+#include "QSGRenderer.h"
+#include "QSGNode.h"
+#include "QSGTexture.h"
+#include <vector>
+#include <map>
+
+class QSGRecordingRenderer;
+
+// Stands in for the scene during a recorded frame, so the target renderer
+// sets up the frame as usual but the scene draws through the recorder.
+class QSGRecordingScene :
+	public QSGNode
+{
+public:
+	QSGRecordingScene(void) : m_recorder(NULL), m_scene(NULL) {}
+	virtual void render(QSGRenderer* renderer);
+public:
+	QSGRecordingRenderer* m_recorder;
+	QSGNode* m_scene;
+};
+
+// Passes every call through to another renderer, and while capturing also
+// appends it to a render trace (see QSGTrace.h) that can be saved and
+// replayed without the scene that produced it.
+class QSGRecordingRenderer :
+	public QSGRenderer
+{
+public:
+	QSGRecordingRenderer(QSGRenderer* target);
+	virtual ~QSGRecordingRenderer(void);
+
+public:
+	// Record the next 'frames' calls to render(). The viewport size is
+	// needed because it was set before recording started.
+	void startCapture(int frames, int width, int height);
+	inline bool isCapturing(void) const { return m_framesLeft > 0; }
+	inline int getFramesCaptured(void) const { return m_framesCaptured; }
+	inline size_t getTraceSize(void) const { return m_trace.size(); }
+
+	// Write out the trace recorded so far.
+	bool saveTrace(const char* filename);
+
+	inline QSGRenderer* getTarget(void) { return m_target; }
+
+public:
+	virtual void initialise(void);
+	virtual void shutdown(void);
+	virtual void setViewportSize(int width, int height);
+	virtual void render(QSGNode* scene);
+	virtual bool getGpuTime(double* seconds, int* age);
+
+public:
+	virtual void clear(QSGColour clearColour);
+	virtual void pushTransform(QSGTransform* trans);
+	virtual void popTransform(void);
+	virtual void setTexture(QSGTexture* texture);
+	virtual void clearTexture(void);
+	virtual void renderQuad(float left, float bottom, float right, float top);
+	virtual void renderGeometry(QSGGeometry* geometry);
+	virtual void setScissor(float left, float bottom, float right, float top);
+	virtual void clearScissor(void);
+
+protected:
+	void writeOp(int op);
+	void writeUInt(unsigned int value);
+	void writeFloat(float value);
+	unsigned int defineTexture(QSGTexture* texture);
+	unsigned int defineGeometry(QSGGeometry* geometry);
+
+protected:
+	// Contents of a geometry when it was last defined; it is defined
+	// again if Lua has changed it since.
+	struct GeometryRecord
+	{
+		unsigned int id;
+		bool quads;
+		std::vector<float> verts;
+		std::vector<float> coords;
+		std::vector<unsigned short> indices;
+	};
+
+	ref_ptr<QSGRenderer> m_target;
+	QSGRecordingScene m_proxy;
+	bool m_recording;		// inside a captured frame
+
+	int m_framesLeft;
+	int m_framesCaptured;
+	int m_width;
+	int m_height;
+	std::vector<unsigned char> m_trace;
+
+	// Textures seen in this capture are held, so that their addresses
+	// stay unique until it is saved. Geometry lives inside its graphic
+	// and cannot be held, but it is matched by contents anyway.
+	std::vector<ref_ptr<QSGTexture> > m_held;
+	std::map<QSGTexture*, unsigned int> m_textureIds;
+	std::map<QSGTexture*, int> m_textureFilters;	// as last recorded
+	std::map<QSGGeometry*, GeometryRecord> m_geometry;
+	unsigned int m_nextGeometryId;
+};
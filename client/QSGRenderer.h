@@ -27,6 +27,11 @@ public:
 	// Can be called after initialise.
 	virtual void render(QSGNode* scene) = 0;
 
+	// Time the GPU took to draw a recent call to render(), if it can be
+	// measured; 'age' is how many calls ago, 0 for the last one. Each
+	// measurement is returned once.
+	virtual bool getGpuTime(double* seconds, int* age) { return false; }
+
 
 	// This is the interface used by scene graph elements to draw
 	// their content when this renderer visits the graph.
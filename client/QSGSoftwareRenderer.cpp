@@ -0,0 +1,420 @@
+#include "QSGSoftwareRenderer.h"
+#include "QSGTransform.h"
+#include "QSGTexture.h"
+#include "QSGBlockTexture.h"
+#include "QSGMipmap.h"
+#include "QSGGeometry.h"
+#include "QSGNode.h"
+
+#include <math.h>
+
+// Largest 16.16 texel coordinate we hand to the span loops, so that
+// stepping along a span cannot overflow.
+#define QSG_SOFT_MAX_FIXED 1073741823.0f
+
+static inline int toFixed(float x)
+{
+	x *= 65536.0f;
+	if (x > QSG_SOFT_MAX_FIXED) return (int) QSG_SOFT_MAX_FIXED;
+	if (x < -QSG_SOFT_MAX_FIXED) return -(int) QSG_SOFT_MAX_FIXED;
+	return (int) floorf(x + 0.5f);
+}
+
+// First pixel whose centre is at or after x.
+static inline int firstPixel(float x)
+{
+	return (int) ceilf(x - 0.5f);
+}
+
+QSGSoftwareRenderer::~QSGSoftwareRenderer(void)
+{
+}
+
+void QSGSoftwareRenderer::initialise(void)
+{
+	m_span.colour = qsgPackColour(1, 1, 1, 1);
+	m_span.blend = QSGSpanReplace;
+	m_span.texels = NULL;
+	m_span.texWidth = m_span.texHeight = 0;
+	m_span.nearest = false;
+}
+
+void QSGSoftwareRenderer::shutdown(void)
+{
+}
+
+void QSGSoftwareRenderer::setViewportSize(int width, int height)
+{
+	if (width < 0) width = 0;
+	if (height < 0) height = 0;
+	m_width = width;
+	m_height = height;
+	m_pixels.assign(width * height, 0);
+	clearScissor();
+}
+
+void QSGSoftwareRenderer::render(QSGNode* scene)
+{
+	scene->render(this);
+}
+
+void QSGSoftwareRenderer::clear(QSGColour colour)
+{
+	// Like glClear, this honours the scissor.
+	QSGSpanState fill;
+	fill.colour = qsgPackColour(colour.r, colour.g, colour.b, 1);
+	fill.blend = QSGSpanReplace;
+	fill.texels = NULL;
+	fill.nearest = false;
+	for (int y = m_clipTop; y < m_clipBottom; ++y)
+		qsgDrawSpan(&m_pixels[y * m_width + m_clipLeft], m_clipRight - m_clipLeft, fill, 0, 0, 0, 0);
+
+	m_matrix = QSGAffine();
+}
+
+void QSGSoftwareRenderer::pushTransform(QSGTransform* trans)
+{
+	m_stack.push_back(m_matrix);
+
+	// Colour and blending are state, as in the GL renderer: they are set
+	// here and not restored by popTransform.
+	// Premultiplied textures are tinted by a premultiplied colour.
+	const QSGColour& col = trans->col;
+	m_span.colour = qsgPackColour(col.r, col.g, col.b, col.a);
+	if (col.a != 1 || trans->flags & (QSGTransformNeedsBlend | QSGTransformBlendAdd)) {
+		if (trans->flags & QSGTransformBlendAdd)
+			m_span.blend = QSGSpanAdd;
+		else if (trans->flags & QSGTransformPremultiplied) {
+			m_span.blend = QSGSpanPremultiplied;
+			m_span.colour = qsgPackColour(col.r * col.a, col.g * col.a, col.b * col.a, col.a);
+		}
+		else
+			m_span.blend = QSGSpanAlpha;
+	}
+	else
+		m_span.blend = QSGSpanReplace;
+
+	// Apply SRT transform.
+	QSGAffine& m = m_matrix;
+	m.tx += m.a * trans->pos.x + m.c * trans->pos.y;
+	m.ty += m.b * trans->pos.x + m.d * trans->pos.y;
+	if (trans->angle > 0.00001 || trans->angle < -0.00001) {
+		float r = trans->angle * 3.14159265f / 180.0f;
+		float cs = cosf(r), sn = sinf(r);
+		float a = m.a * cs + m.c * sn, c = m.c * cs - m.a * sn;
+		float b = m.b * cs + m.d * sn, d = m.d * cs - m.b * sn;
+		m.a = a; m.b = b; m.c = c; m.d = d;
+	}
+	m.a *= trans->scale.x; m.b *= trans->scale.x;
+	m.c *= trans->scale.y; m.d *= trans->scale.y;
+}
+
+void QSGSoftwareRenderer::popTransform()
+{
+	if (!m_stack.empty()) {
+		m_matrix = m_stack.back();
+		m_stack.pop_back();
+	}
+}
+
+void QSGSoftwareRenderer::setTexture(QSGTexture* texture)
+{
+	if (!texture->m_renderData)
+		resolveTexture(texture);
+
+	size_t index = texture->m_renderData - 1;
+	if (index >= m_textures.size() || m_textures[index].texels.empty()) {
+		clearTexture(); // nothing usable, like an incomplete GL texture.
+		return;
+	}
+	Texels& texels = m_textures[index];
+	m_filter = texture->filter();
+	if (m_filter >= QSGFilterMipmap && texels.levels.size() < 2)
+		buildLevels(texture, &texels);
+	m_texture = texture;
+	m_texels = &texels;
+	m_span.nearest = m_filter == QSGFilterNearest;
+	selectLevel(1);
+}
+
+void QSGSoftwareRenderer::clearTexture(void)
+{
+	m_texture = NULL;
+	m_texels = NULL;
+	m_span.texels = NULL;
+}
+
+// Draw from the level for 'scale' base level texels per pixel. GL rounds
+// log2(scale) to the nearest level, so each starts at sqrt(2) times the
+// scale of the one before.
+void QSGSoftwareRenderer::selectLevel(float scale)
+{
+	int level = 0;
+	if (m_filter >= QSGFilterMipmap) {
+		int last = (int) m_texels->levels.size() - 1;
+		float start = 1.41421356f;
+		while (level < last && scale > start) {
+			++level;
+			start *= 2;
+		}
+	}
+	m_span.texels = &m_texels->texels[m_texels->levels[level]];
+	m_span.texWidth = qsgMipSize(m_texture->m_width, level);
+	m_span.texHeight = qsgMipSize(m_texture->m_height, level);
+}
+
+void QSGSoftwareRenderer::renderQuad(float left, float bottom, float right, float top)
+{
+	// Texture coordinates as in the GL renderer: t = 0 at the top.
+	Vertex v[4];
+	transformVertex(left, bottom, 0, 1, &v[0]);
+	transformVertex(right, bottom, 1, 1, &v[1]);
+	transformVertex(right, top, 1, 0, &v[2]);
+	transformVertex(left, top, 0, 0, &v[3]);
+
+	if (m_matrix.b == 0 && m_matrix.c == 0) {
+		drawRect(v[3], v[1]);
+	}
+	else {
+		drawTriangle(v[0], v[1], v[2]);
+		drawTriangle(v[0], v[2], v[3]);
+	}
+}
+
+void QSGSoftwareRenderer::renderGeometry(QSGGeometry* geometry)
+{
+	size_t count = geometry->indices.size();
+	size_t numVerts = geometry->verts.size() / 2;
+	bool hasCoords = geometry->coords.size() >= numVerts * 2;
+	size_t step = geometry->quads ? 4 : 3;
+
+	for (size_t i = 0; i + step <= count; i += step) {
+		Vertex v[4];
+		bool valid = true;
+		for (size_t k = 0; k < step; ++k) {
+			size_t index = geometry->indices[i + k];
+			if (index >= numVerts) {
+				valid = false;
+				break;
+			}
+			const float* p = &geometry->verts[index * 2];
+			const float* c = hasCoords ? &geometry->coords[index * 2] : NULL;
+			transformVertex(p[0], p[1], c ? c[0] : 0, c ? c[1] : 0, &v[k]);
+		}
+		if (!valid) continue;
+
+		drawTriangle(v[0], v[1], v[2]);
+		if (step == 4) drawTriangle(v[0], v[2], v[3]);
+	}
+}
+
+void QSGSoftwareRenderer::setScissor(float left, float bottom, float right, float top)
+{
+	// Origin of the current transform in window space, y up.
+	float tx = m_width * 0.5f + m_matrix.tx;
+	float ty = m_height * 0.5f + m_matrix.ty;
+
+	int i_left = (int) (tx + left);
+	int i_right = (int) (tx + right);
+	int i_bottom = (int) (ty + bottom);
+	int i_top = (int) (ty + top);
+
+	if (i_left < 0) i_left = 0;
+	if (i_bottom < 0) i_bottom = 0;
+	if (i_right > m_width) i_right = m_width;
+	if (i_top > m_height) i_top = m_height;
+	if (i_right < i_left) i_right = i_left;
+	if (i_top < i_bottom) i_top = i_bottom;
+
+	m_clipLeft = i_left;
+	m_clipRight = i_right;
+	m_clipTop = m_height - i_top;
+	m_clipBottom = m_height - i_bottom;
+	m_scissoring = true;
+}
+
+void QSGSoftwareRenderer::clearScissor(void)
+{
+	m_clipLeft = m_clipTop = 0;
+	m_clipRight = m_width;
+	m_clipBottom = m_height;
+	m_scissoring = false;
+}
+
+void QSGSoftwareRenderer::transformVertex(float x, float y, float s, float t, Vertex* out)
+{
+	const QSGAffine& m = m_matrix;
+	out->x = m_width * 0.5f + (m.a * x + m.c * y + m.tx);
+	out->y = m_height * 0.5f - (m.b * x + m.d * y + m.ty);
+	out->s = s;
+	out->t = t;
+}
+
+// X where an edge crosses the horizontal line at y. The endpoints are put
+// in a fixed order first, so two triangles sharing an edge compute the
+// same crossing and neither gaps nor overlaps appear along it.
+static inline float edgeX(const float* p, const float* q, float y)
+{
+	if (q[1] < p[1] || (q[1] == p[1] && q[0] < p[0])) {
+		const float* swap = p; p = q; q = swap;
+	}
+	return p[0] + (y - p[1]) * (q[0] - p[0]) / (q[1] - p[1]);
+}
+
+void QSGSoftwareRenderer::drawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+	// Sort by y.
+	const Vertex* p0 = &v0;
+	const Vertex* p1 = &v1;
+	const Vertex* p2 = &v2;
+	const Vertex* swap;
+	if (p1->y < p0->y) { swap = p0; p0 = p1; p1 = swap; }
+	if (p2->y < p1->y) { swap = p1; p1 = p2; p2 = swap; }
+	if (p1->y < p0->y) { swap = p0; p0 = p1; p1 = swap; }
+
+	float area = (p1->x - p0->x) * (p2->y - p0->y) - (p2->x - p0->x) * (p1->y - p0->y);
+	if (area == 0) return;
+
+	int yStart = firstPixel(p0->y);
+	int yEnd = firstPixel(p2->y);
+	if (yStart < m_clipTop) yStart = m_clipTop;
+	if (yEnd > m_clipBottom) yEnd = m_clipBottom;
+	if (yStart >= yEnd) return;
+
+	// Texture coordinates are affine across the triangle.
+	float dsdx = 0, dsdy = 0, dtdx = 0, dtdy = 0;
+	if (m_span.texels) {
+		dsdx = ((p1->s - p0->s) * (p2->y - p0->y) - (p2->s - p0->s) * (p1->y - p0->y)) / area;
+		dsdy = ((p2->s - p0->s) * (p1->x - p0->x) - (p1->s - p0->s) * (p2->x - p0->x)) / area;
+		dtdx = ((p1->t - p0->t) * (p2->y - p0->y) - (p2->t - p0->t) * (p1->y - p0->y)) / area;
+		dtdy = ((p2->t - p0->t) * (p1->x - p0->x) - (p1->t - p0->t) * (p2->x - p0->x)) / area;
+		if (m_filter >= QSGFilterMipmap) {
+			float w = (float) m_texture->m_width, h = (float) m_texture->m_height;
+			float x = (dsdx * w) * (dsdx * w) + (dtdx * h) * (dtdx * h);
+			float y = (dsdy * w) * (dsdy * w) + (dtdy * h) * (dtdy * h);
+			selectLevel(sqrtf(x > y ? x : y));
+		}
+		float w = (float) m_span.texWidth, h = (float) m_span.texHeight;
+		dsdx *= w; dsdy *= w;
+		dtdx *= h; dtdy *= h;
+	}
+	float s0 = p0->s * m_span.texWidth - 0.5f;
+	float t0 = p0->t * m_span.texHeight - 0.5f;
+	int du = toFixed(dsdx), dv = toFixed(dtdx);
+
+	for (int y = yStart; y < yEnd; ++y) {
+		float cy = y + 0.5f;
+		float xa = edgeX(&p0->x, &p2->x, cy);
+		float xb = (cy < p1->y) ? edgeX(&p0->x, &p1->x, cy) : edgeX(&p1->x, &p2->x, cy);
+		if (xb < xa) { float t = xa; xa = xb; xb = t; }
+
+		int xs = firstPixel(xa), xe = firstPixel(xb);
+		if (xs < m_clipLeft) xs = m_clipLeft;
+		if (xe > m_clipRight) xe = m_clipRight;
+		if (xs >= xe) continue;
+
+		float cx = xs + 0.5f;
+		int u = 0, v = 0;
+		if (m_span.texels) {
+			u = toFixed(s0 + dsdx * (cx - p0->x) + dsdy * (cy - p0->y));
+			v = toFixed(t0 + dtdx * (cx - p0->x) + dtdy * (cy - p0->y));
+		}
+		qsgDrawSpan(&m_pixels[y * m_width + xs], xe - xs, m_span, u, v, du, dv);
+	}
+}
+
+// Axis-aligned rectangle between two opposite corners; texture
+// coordinates vary only along x for s and along y for t.
+void QSGSoftwareRenderer::drawRect(const Vertex& c0, const Vertex& c1)
+{
+	float dx = c1.x - c0.x, dy = c1.y - c0.y;
+	if (dx == 0 || dy == 0) return;
+
+	int xs = firstPixel(dx > 0 ? c0.x : c1.x);
+	int xe = firstPixel(dx > 0 ? c1.x : c0.x);
+	int ys = firstPixel(dy > 0 ? c0.y : c1.y);
+	int ye = firstPixel(dy > 0 ? c1.y : c0.y);
+	if (xs < m_clipLeft) xs = m_clipLeft;
+	if (xe > m_clipRight) xe = m_clipRight;
+	if (ys < m_clipTop) ys = m_clipTop;
+	if (ye > m_clipBottom) ye = m_clipBottom;
+	if (xs >= xe || ys >= ye) return;
+
+	if (m_span.texels && m_filter >= QSGFilterMipmap) {
+		float x = fabsf((c1.s - c0.s) * m_texture->m_width / dx);
+		float y = fabsf((c1.t - c0.t) * m_texture->m_height / dy);
+		selectLevel(x > y ? x : y);
+	}
+	float dsdx = (c1.s - c0.s) * m_span.texWidth / dx;
+	float dtdy = (c1.t - c0.t) * m_span.texHeight / dy;
+	int u = 0, du = 0;
+	if (m_span.texels) {
+		u = toFixed(c0.s * m_span.texWidth - 0.5f + dsdx * (xs + 0.5f - c0.x));
+		du = toFixed(dsdx);
+	}
+
+	for (int y = ys; y < ye; ++y) {
+		int v = 0;
+		if (m_span.texels)
+			v = toFixed(c0.t * m_span.texHeight - 0.5f + dtdy * (y + 0.5f - c0.y));
+		qsgDrawSpan(&m_pixels[y * m_width + xs], xe - xs, m_span, u, v, du, 0);
+	}
+}
+
+void QSGSoftwareRenderer::resolveTexture(QSGTexture* texture)
+{
+	// Converted textures live as long as the renderer, as GL textures do.
+	m_textures.push_back(Texels());
+	texture->m_renderData = (unsigned long) m_textures.size();
+
+	int components = texture->m_components;
+	if (!texture->m_data || components < 1 || components > 4 ||
+		texture->m_width <= 0 || texture->m_height <= 0)
+		return;
+
+	// Expand to RGBA the way GL does for each format.
+	std::vector<unsigned int>& texels = m_textures.back().texels;
+	std::vector<size_t>& levels = m_textures.back().levels;
+	int width = texture->m_width, height = texture->m_height;
+	if (texture->m_format != QSGTextureRaw) {
+		// every level the file has, as GL gets them.
+		texels.resize(qsgMipChainSize(width, height, 1, texture->m_levels));
+		const unsigned char* blocks = texture->m_data;
+		size_t offset = 0;
+		for (int level = 0; level < texture->m_levels; ++level) {
+			int w = qsgMipSize(width, level), h = qsgMipSize(height, level);
+			qsgDecodeBlocks(texture->m_format, blocks, w, h, (unsigned char*) &texels[offset]);
+			levels.push_back(offset);
+			blocks += qsgBlockSize(texture->m_format, w, h);
+			offset += (size_t) w * h;
+		}
+		return;
+	}
+	texels.resize((size_t) width * height);
+	levels.push_back(0);
+	const unsigned char* in = texture->m_data;
+	for (size_t i = 0; i < texels.size(); ++i, in += components) {
+		unsigned char* out = (unsigned char*) &texels[i];
+		switch (components) {
+		case 1: out[0] = out[1] = out[2] = in[0]; out[3] = 255; break;
+		case 2: out[0] = out[1] = out[2] = in[0]; out[3] = in[1]; break;
+		case 3: out[0] = in[0]; out[1] = in[1]; out[2] = in[2]; out[3] = 255; break;
+		case 4: out[0] = in[0]; out[1] = in[1]; out[2] = in[2]; out[3] = in[3]; break;
+		}
+	}
+}
+
+// The rest of the chain for a raw texture, from its base level.
+void QSGSoftwareRenderer::buildLevels(QSGTexture* texture, Texels* texels)
+{
+	int width = texture->m_width, height = texture->m_height;
+	int count = qsgMipLevels(width, height);
+	texels->texels.resize(qsgMipChainSize(width, height, 1, count));
+	qsgBuildMipChain((unsigned char*) &texels->texels[0], width, height, 4, count);
+	texels->levels.clear();
+	size_t offset = 0;
+	for (int level = 0; level < count; ++level) {
+		texels->levels.push_back(offset);
+		offset += (size_t) qsgMipSize(width, level) * qsgMipSize(height, level);
+	}
+}
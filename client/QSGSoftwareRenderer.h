@@ -0,0 +1,97 @@
+#pragma once
+#include "QSGRenderer.h"
+#include "QSGSoftwareSpans.h"
+#include "QSGTexture.h"
+#include <vector>
+
+// 2D affine transform: x' = a*x + c*y + tx, y' = b*x + d*y + ty.
+class QSGAffine
+{
+public:
+	QSGAffine() : a(1), b(0), c(0), d(1), tx(0), ty(0) {}
+public:
+	float a, b, c, d, tx, ty;
+};
+
+// Renders the scene on the CPU into a 32 bit RGBA framebuffer, matching
+// what QSGOpenGLRenderer draws: tinted, bilinear textured quads and
+// geometry, straight, premultiplied and additive blending, and scissor
+// rectangles. Row 0 of the framebuffer is the top of the view.
+//
+// Mipmapped textures are drawn from one level per triangle, chosen as
+// GL_LINEAR_MIPMAP_NEAREST chooses it; the scale of a 2D transform is
+// the same across a triangle, so this is what GL draws for that filter.
+// QSGFilterTrilinear is drawn the same way, without the blend between
+// levels.
+class QSGSoftwareRenderer :
+	public QSGRenderer
+{
+public:
+	QSGSoftwareRenderer(void) : m_width(0), m_height(0),
+		m_texture(NULL), m_texels(NULL), m_filter(QSGFilterLinear),
+		m_scissoring(false) {}
+	virtual ~QSGSoftwareRenderer(void);
+
+public:
+	virtual void initialise(void);
+	virtual void shutdown(void);
+	virtual void setViewportSize(int width, int height);
+	virtual void render(QSGNode* scene);
+
+public:
+	virtual void clear(QSGColour clearColour);
+	virtual void pushTransform(QSGTransform* trans);
+	virtual void popTransform(void);
+	virtual void setTexture(QSGTexture* texture);
+	virtual void clearTexture(void);
+	virtual void renderQuad(float left, float bottom, float right, float top);
+	virtual void renderGeometry(QSGGeometry* geometry);
+	virtual void setScissor(float left, float bottom, float right, float top);
+	virtual void clearScissor(void);
+
+public:
+	inline const unsigned int* getPixels(void) const { return m_pixels.empty() ? NULL : &m_pixels[0]; }
+	inline int getWidth(void) const { return m_width; }
+	inline int getHeight(void) const { return m_height; }
+
+protected:
+	// A vertex in pixels (y down) with texture coordinates.
+	struct Vertex
+	{
+		float x, y, s, t;
+	};
+
+	void transformVertex(float x, float y, float s, float t, Vertex* out);
+	void drawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+	void drawRect(const Vertex& corner0, const Vertex& corner1);
+	void resolveTexture(QSGTexture* texture);
+	void selectLevel(float scale);
+
+	// A texture converted to RGBA: its mip levels one after another,
+	// largest first, and where each starts.
+	struct Texels
+	{
+		std::vector<unsigned int> texels;
+		std::vector<size_t> levels;
+	};
+	void buildLevels(QSGTexture* texture, Texels* texels);
+
+protected:
+	int m_width;
+	int m_height;
+	std::vector<unsigned int> m_pixels;
+
+	std::vector<QSGAffine> m_stack;
+	QSGAffine m_matrix;
+
+	QSGSpanState m_span;
+	QSGTexture* m_texture;	// resolved texture being drawn with, or NULL
+	const Texels* m_texels;	// and its levels
+	int m_filter;			// QSGTextureFilter it is drawn with
+
+	bool m_scissoring;
+	int m_clipLeft, m_clipTop, m_clipRight, m_clipBottom;	// pixels, exclusive right/bottom
+
+	// Textures converted to RGBA, indexed by QSGResource::m_renderData - 1.
+	std::vector<Texels> m_textures;
+};
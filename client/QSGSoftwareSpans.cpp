@@ -0,0 +1,508 @@
+#include "QSGSoftwareSpans.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define QSG_SPAN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define QSG_TARGET_AVX2
+#else
+#define QSG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Textured spans are sampled into a buffer this many pixels at a time,
+// then blended with the same loops as solid spans.
+#define QSG_SPAN_CHUNK 256
+
+static int s_cpuLevel = -1;
+static int s_level = -1;
+
+
+// ---------------------------------------------------------------------
+// Portable loops. The SIMD loops below use exactly the same arithmetic.
+
+// x / 255, rounded, for x in 0..65025.
+static inline unsigned int div255(unsigned int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline void blendPixel(unsigned char* d, const unsigned char* s, int blend)
+{
+	switch (blend) {
+	case QSGSpanReplace:
+		d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+		break;
+	case QSGSpanAlpha: {
+		unsigned int a = s[3], ia = 255 - a;
+		for (int c = 0; c < 4; ++c) d[c] = (unsigned char) div255(s[c] * a + d[c] * ia);
+		break;
+	}
+	case QSGSpanAdd:
+		for (int c = 0; c < 4; ++c) {
+			unsigned int x = d[c] + s[c];
+			d[c] = (unsigned char) (x > 255 ? 255 : x);
+		}
+		break;
+	case QSGSpanPremultiplied: {
+		unsigned int ia = 255 - s[3];
+		for (int c = 0; c < 4; ++c) {
+			unsigned int x = s[c] + div255(d[c] * ia);
+			d[c] = (unsigned char) (x > 255 ? 255 : x);
+		}
+		break;
+	}
+	}
+}
+
+static void fillPortable(unsigned int* dst, int count, unsigned int colour, int blend)
+{
+	const unsigned char* s = (const unsigned char*) &colour;
+	for (int i = 0; i < count; ++i)
+		blendPixel((unsigned char*) &dst[i], s, blend);
+}
+
+static void blendPortable(unsigned int* dst, const unsigned int* src, int count, int blend)
+{
+	for (int i = 0; i < count; ++i)
+		blendPixel((unsigned char*) &dst[i], (const unsigned char*) &src[i], blend);
+}
+
+static inline int clampTexel(int x, int max)
+{
+	return x < 0 ? 0 : (x > max ? max : x);
+}
+
+// Bilinear filter in two passes of 8 bit weights, then tint.
+static void samplePortable(unsigned int* out, int count, const QSGSpanState& state,
+	int u, int v, int du, int dv)
+{
+	const unsigned char* tint = (const unsigned char*) &state.colour;
+	int maxX = state.texWidth - 1, maxY = state.texHeight - 1;
+	for (int i = 0; i < count; ++i, u += du, v += dv) {
+		int fx = (u >> 8) & 255, fy = (v >> 8) & 255;
+		int x0 = clampTexel(u >> 16, maxX), x1 = clampTexel((u >> 16) + 1, maxX);
+		int y0 = clampTexel(v >> 16, maxY), y1 = clampTexel((v >> 16) + 1, maxY);
+		const unsigned int* row0 = state.texels + y0 * state.texWidth;
+		const unsigned int* row1 = state.texels + y1 * state.texWidth;
+		const unsigned char* c00 = (const unsigned char*) &row0[x0];
+		const unsigned char* c10 = (const unsigned char*) &row0[x1];
+		const unsigned char* c01 = (const unsigned char*) &row1[x0];
+		const unsigned char* c11 = (const unsigned char*) &row1[x1];
+		unsigned char* o = (unsigned char*) &out[i];
+		for (int c = 0; c < 4; ++c) {
+			unsigned int top = (c00[c] * (256 - fx) + c10[c] * fx) >> 8;
+			unsigned int bottom = (c01[c] * (256 - fx) + c11[c] * fx) >> 8;
+			unsigned int t = (top * (256 - fy) + bottom * fy) >> 8;
+			o[c] = (unsigned char) div255(t * tint[c]);
+		}
+	}
+}
+
+// The texel whose centre is nearest, then tint. Gathering the texels is
+// all the work here, so this one loop serves every level.
+static void sampleNearest(unsigned int* out, int count, const QSGSpanState& state,
+	int u, int v, int du, int dv)
+{
+	const unsigned char* tint = (const unsigned char*) &state.colour;
+	int maxX = state.texWidth - 1, maxY = state.texHeight - 1;
+	for (int i = 0; i < count; ++i, u += du, v += dv) {
+		int x = clampTexel((u + 32768) >> 16, maxX);
+		int y = clampTexel((v + 32768) >> 16, maxY);
+		const unsigned char* c = (const unsigned char*) &state.texels[y * state.texWidth + x];
+		unsigned char* o = (unsigned char*) &out[i];
+		for (int k = 0; k < 4; ++k)
+			o[k] = (unsigned char) div255(c[k] * tint[k]);
+	}
+}
+
+static void premultiplyPortable(unsigned char* texels, size_t count, int components)
+{
+	int alpha = components - 1;
+	for (size_t i = 0; i < count; ++i, texels += components) {
+		unsigned int a = texels[alpha];
+		for (int c = 0; c < alpha; ++c)
+			texels[c] = (unsigned char) div255(texels[c] * a);
+	}
+}
+
+
+#ifdef QSG_SPAN_X86
+
+// ---------------------------------------------------------------------
+// SSE2: two pixels per register as 16 bit lanes.
+
+static inline __m128i div255_sse2(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i alpha_sse2(__m128i s16)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, 0xFF), 0xFF);
+}
+
+static void fillSSE2(unsigned int* dst, int count, unsigned int colour, int blend)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i s = _mm_set1_epi32((int) colour);
+	int i = 0;
+	switch (blend) {
+	case QSGSpanReplace:
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_si128((__m128i*) (dst + i), s);
+		break;
+	case QSGSpanAlpha: {
+		__m128i s16 = _mm_unpacklo_epi8(s, zero);
+		__m128i a = alpha_sse2(s16);
+		__m128i sa = _mm_mullo_epi16(s16, a);
+		__m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+		for (; i + 4 <= count; i += 4) {
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			__m128i lo = _mm_add_epi16(sa, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+			__m128i hi = _mm_add_epi16(sa, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi)));
+		}
+		break;
+	}
+	case QSGSpanAdd:
+		for (; i + 4 <= count; i += 4) {
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epu8(d, s));
+		}
+		break;
+	case QSGSpanPremultiplied: {
+		__m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), alpha_sse2(_mm_unpacklo_epi8(s, zero)));
+		for (; i + 4 <= count; i += 4) {
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			__m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+			__m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+		}
+		break;
+	}
+	}
+	fillPortable(dst + i, count - i, colour, blend);
+}
+
+static void blendSSE2(unsigned int* dst, const unsigned int* src, int count, int blend)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i c255 = _mm_set1_epi16(255);
+	int i = 0;
+	switch (blend) {
+	case QSGSpanReplace:
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_loadu_si128((const __m128i*) (src + i)));
+		break;
+	case QSGSpanAlpha:
+		for (; i + 4 <= count; i += 4) {
+			__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			__m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+			__m128i alo = alpha_sse2(slo), ahi = alpha_sse2(shi);
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(slo, alo),
+				_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, alo)));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(shi, ahi),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, ahi)));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi)));
+		}
+		break;
+	case QSGSpanAdd:
+		for (; i + 4 <= count; i += 4) {
+			__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epu8(d, s));
+		}
+		break;
+	case QSGSpanPremultiplied:
+		for (; i + 4 <= count; i += 4) {
+			__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i d = _mm_loadu_si128((__m128i*) (dst + i));
+			__m128i ialo = _mm_sub_epi16(c255, alpha_sse2(_mm_unpacklo_epi8(s, zero)));
+			__m128i iahi = _mm_sub_epi16(c255, alpha_sse2(_mm_unpackhi_epi8(s, zero)));
+			__m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ialo));
+			__m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), iahi));
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+		}
+		break;
+	}
+	blendPortable(dst + i, src + i, count - i, blend);
+}
+
+// RGBA, four texels at a time; alpha is put back as it was.
+static size_t premultiplySSE2(unsigned char* texels, size_t count)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*) (texels + i * 4));
+		__m128i lo = _mm_unpacklo_epi8(p, zero), hi = _mm_unpackhi_epi8(p, zero);
+		lo = div255_sse2(_mm_mullo_epi16(lo, alpha_sse2(lo)));
+		hi = div255_sse2(_mm_mullo_epi16(hi, alpha_sse2(hi)));
+		__m128i out = _mm_packus_epi16(lo, hi);
+		out = _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(alphaMask, p));
+		_mm_storeu_si128((__m128i*) (texels + i * 4), out);
+	}
+	return i;
+}
+
+// One pixel at a time: the four texels are gathered into two registers
+// of [left | right] and weighted horizontally, then vertically.
+static void sampleSSE2(unsigned int* out, int count, const QSGSpanState& state,
+	int u, int v, int du, int dv)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i tint = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) state.colour), zero);
+	int maxX = state.texWidth - 1, maxY = state.texHeight - 1;
+	for (int i = 0; i < count; ++i, u += du, v += dv) {
+		int fx = (u >> 8) & 255, fy = (v >> 8) & 255;
+		int x0 = clampTexel(u >> 16, maxX), x1 = clampTexel((u >> 16) + 1, maxX);
+		int y0 = clampTexel(v >> 16, maxY), y1 = clampTexel((v >> 16) + 1, maxY);
+		const unsigned int* row0 = state.texels + y0 * state.texWidth;
+		const unsigned int* row1 = state.texels + y1 * state.texWidth;
+
+		__m128i top = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) row0[x0]), _mm_cvtsi32_si128((int) row0[x1]));
+		__m128i bottom = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) row1[x0]), _mm_cvtsi32_si128((int) row1[x1]));
+		__m128i wx = _mm_unpacklo_epi64(_mm_set1_epi16((short) (256 - fx)), _mm_set1_epi16((short) fx));
+		top = _mm_mullo_epi16(_mm_unpacklo_epi8(top, zero), wx);
+		bottom = _mm_mullo_epi16(_mm_unpacklo_epi8(bottom, zero), wx);
+		top = _mm_srli_epi16(_mm_add_epi16(top, _mm_srli_si128(top, 8)), 8);
+		bottom = _mm_srli_epi16(_mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)), 8);
+
+		__m128i wy = _mm_unpacklo_epi64(_mm_set1_epi16((short) (256 - fy)), _mm_set1_epi16((short) fy));
+		__m128i t = _mm_mullo_epi16(_mm_unpacklo_epi64(top, bottom), wy);
+		t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_si128(t, 8)), 8);
+
+		t = div255_sse2(_mm_mullo_epi16(t, tint));
+		out[i] = (unsigned int) _mm_cvtsi128_si32(_mm_packus_epi16(t, zero));
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// AVX2: the SSE2 loops at twice the width. Unpacks and packs work within
+// each 128 bit half, so pixel order is preserved.
+
+QSG_TARGET_AVX2
+static inline __m256i div255_avx2(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+QSG_TARGET_AVX2
+static inline __m256i alpha_avx2(__m256i s16)
+{
+	return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, 0xFF), 0xFF);
+}
+
+QSG_TARGET_AVX2
+static void fillAVX2(unsigned int* dst, int count, unsigned int colour, int blend)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i s = _mm256_set1_epi32((int) colour);
+	int i = 0;
+	switch (blend) {
+	case QSGSpanReplace:
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_si256((__m256i*) (dst + i), s);
+		break;
+	case QSGSpanAlpha: {
+		__m256i s16 = _mm256_unpacklo_epi8(s, zero);
+		__m256i a = alpha_avx2(s16);
+		__m256i sa = _mm256_mullo_epi16(s16, a);
+		__m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+		for (; i + 8 <= count; i += 8) {
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			__m256i lo = _mm256_add_epi16(sa, _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+			__m256i hi = _mm256_add_epi16(sa, _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi)));
+		}
+		break;
+	}
+	case QSGSpanAdd:
+		for (; i + 8 <= count; i += 8) {
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_adds_epu8(d, s));
+		}
+		break;
+	case QSGSpanPremultiplied: {
+		__m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha_avx2(_mm256_unpacklo_epi8(s, zero)));
+		for (; i + 8 <= count; i += 8) {
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			__m256i lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+			__m256i hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+		}
+		break;
+	}
+	}
+	fillSSE2(dst + i, count - i, colour, blend);
+}
+
+QSG_TARGET_AVX2
+static void blendAVX2(unsigned int* dst, const unsigned int* src, int count, int blend)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c255 = _mm256_set1_epi16(255);
+	int i = 0;
+	switch (blend) {
+	case QSGSpanReplace:
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_loadu_si256((const __m256i*) (src + i)));
+		break;
+	case QSGSpanAlpha:
+		for (; i + 8 <= count; i += 8) {
+			__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			__m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+			__m256i alo = alpha_avx2(slo), ahi = alpha_avx2(shi);
+			__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(slo, alo),
+				_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(c255, alo)));
+			__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(shi, ahi),
+				_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(c255, ahi)));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi)));
+		}
+		break;
+	case QSGSpanAdd:
+		for (; i + 8 <= count; i += 8) {
+			__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_adds_epu8(d, s));
+		}
+		break;
+	case QSGSpanPremultiplied:
+		for (; i + 8 <= count; i += 8) {
+			__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+			__m256i d = _mm256_loadu_si256((__m256i*) (dst + i));
+			__m256i ialo = _mm256_sub_epi16(c255, alpha_avx2(_mm256_unpacklo_epi8(s, zero)));
+			__m256i iahi = _mm256_sub_epi16(c255, alpha_avx2(_mm256_unpackhi_epi8(s, zero)));
+			__m256i lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ialo));
+			__m256i hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), iahi));
+			_mm256_storeu_si256((__m256i*) (dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+		}
+		break;
+	}
+	blendSSE2(dst + i, src + i, count - i, blend);
+}
+
+static int detectCpuLevel(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	if (!(info[3] & (1 << 26))) return QSGSpanPortable;
+	// AVX2 needs the OS to save the YMM registers (OSXSAVE and XCR0).
+	bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	if (maxLeaf >= 7 && osSavesYmm) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5)) return QSGSpanAVX2;
+	}
+	return QSGSpanSSE2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return QSGSpanAVX2;
+	if (__builtin_cpu_supports("sse2")) return QSGSpanSSE2;
+	return QSGSpanPortable;
+#endif
+}
+
+#else // QSG_SPAN_X86
+
+static int detectCpuLevel(void)
+{
+	return QSGSpanPortable;
+}
+
+#endif // QSG_SPAN_X86
+
+
+// ---------------------------------------------------------------------
+
+int qsgSpanCpuLevel(void)
+{
+	if (s_cpuLevel < 0) s_cpuLevel = detectCpuLevel();
+	return s_cpuLevel;
+}
+
+int qsgSpanLevel(void)
+{
+	if (s_level < 0) s_level = qsgSpanCpuLevel();
+	return s_level;
+}
+
+void qsgSetSpanLevel(int level)
+{
+	int best = qsgSpanCpuLevel();
+	s_level = level < 0 ? 0 : (level > best ? best : level);
+}
+
+unsigned int qsgPackColour(float r, float g, float b, float a)
+{
+	float in[4] = { r, g, b, a };
+	unsigned int colour;
+	unsigned char* out = (unsigned char*) &colour;
+	for (int c = 0; c < 4; ++c) {
+		float x = in[c] < 0 ? 0 : (in[c] > 1 ? 1 : in[c]);
+		out[c] = (unsigned char) (x * 255 + 0.5f);
+	}
+	return colour;
+}
+
+void qsgDrawSpan(unsigned int* dst, int count, const QSGSpanState& state,
+	int u, int v, int du, int dv)
+{
+	int level = qsgSpanLevel();
+
+	if (!state.texels) {
+#ifdef QSG_SPAN_X86
+		if (level == QSGSpanAVX2) fillAVX2(dst, count, state.colour, state.blend);
+		else if (level == QSGSpanSSE2) fillSSE2(dst, count, state.colour, state.blend);
+		else
+#endif
+		fillPortable(dst, count, state.colour, state.blend);
+		return;
+	}
+
+	unsigned int buffer[QSG_SPAN_CHUNK];
+	while (count > 0) {
+		int n = count < QSG_SPAN_CHUNK ? count : QSG_SPAN_CHUNK;
+		if (state.nearest) sampleNearest(buffer, n, state, u, v, du, dv);
+		else
+#ifdef QSG_SPAN_X86
+		if (level >= QSGSpanSSE2) sampleSSE2(buffer, n, state, u, v, du, dv);
+		else
+#endif
+		samplePortable(buffer, n, state, u, v, du, dv);
+
+#ifdef QSG_SPAN_X86
+		if (level == QSGSpanAVX2) blendAVX2(dst, buffer, n, state.blend);
+		else if (level == QSGSpanSSE2) blendSSE2(dst, buffer, n, state.blend);
+		else
+#endif
+		blendPortable(dst, buffer, n, state.blend);
+
+		dst += n;
+		count -= n;
+		u += du * n;
+		v += dv * n;
+	}
+}
+
+void qsgPremultiply(unsigned char* texels, size_t count, int components)
+{
+	if (components != 2 && components != 4) return;
+	size_t done = 0;
+#ifdef QSG_SPAN_X86
+	if (components == 4 && qsgSpanLevel() >= QSGSpanSSE2) done = premultiplySSE2(texels, count);
+#endif
+	premultiplyPortable(texels + done * components, count - done, components);
+}
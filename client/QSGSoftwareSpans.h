@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+
+// Span loops for QSGSoftwareRenderer. Pixels are 32 bits, stored as
+// R, G, B, A bytes in memory. Each loop has a portable version and SSE2
+// and AVX2 versions chosen at run time; all of them produce exactly the
+// same pixels, so software renders can be compared between machines.
+
+enum QSGSpanBlend {
+	QSGSpanReplace = 0,		// no blending
+	QSGSpanAlpha,			// src * a + dst * (1 - a)
+	QSGSpanAdd,				// src + dst, saturated
+	QSGSpanPremultiplied,	// src + dst * (1 - a), saturated; src is premultiplied
+};
+
+enum QSGSpanLevel {
+	QSGSpanPortable = 0,
+	QSGSpanSSE2,
+	QSGSpanAVX2,
+};
+
+// What to draw along a span.
+struct QSGSpanState
+{
+	unsigned int colour;			// fill colour, or tint for textures
+	int blend;						// QSGSpanBlend
+	const unsigned int* texels;		// NULL when not texturing
+	int texWidth;
+	int texHeight;
+	bool nearest;					// the nearest texel rather than bilinear
+};
+
+// The best level this CPU supports, and the level in use. Lowering the
+// level is useful for comparing paths; it cannot be raised past the CPU.
+int qsgSpanCpuLevel(void);
+int qsgSpanLevel(void);
+void qsgSetSpanLevel(int level);
+
+// Draw count pixels at dst. For textures, u and v are the position of
+// the first pixel in 16.16 fixed point texels, measured from the centre
+// of the first texel, and du and dv the step per pixel. Sampling is
+// bilinear with the edges clamped, like GL_LINEAR with GL_CLAMP_TO_EDGE,
+// or GL_NEAREST when state.nearest is set.
+void qsgDrawSpan(unsigned int* dst, int count, const QSGSpanState& state,
+	int u, int v, int du, int dv);
+
+// Pack a colour with components in 0..1.
+unsigned int qsgPackColour(float r, float g, float b, float a);
+
+// Multiply the colour of count texels by their alpha, in place, for
+// textures drawn with premultiplied alpha. Texels have 2 (grey, alpha)
+// or 4 components; others have no alpha and are left alone. Rounds as
+// the span loops do, at every level.
+void qsgPremultiply(unsigned char* texels, size_t count, int components);
@@ -1,7 +1,9 @@
 #include "QSGTexture.h"
+#include "QSGTextureCache.h"
 
 QSGTexture::~QSGTexture(void)
 {
-	if (m_data) free(m_data); // from C library
+	if (m_cache) m_cache->remove(this);
+	if (m_data && !m_owner) free(m_data); // from C library
 	m_data = NULL;
 }
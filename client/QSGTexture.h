@@ -1,15 +1,37 @@
 #pragma once
 #include "QSGResource.h"
+#include "QSGBlockTexture.h"
 #include <string>
 
+class QSGTextureCache;
+
+// How a texture is sampled. The mipmapped filters use the levels at
+// m_data when there are any and build them otherwise; block formats
+// cannot be built, so those without levels draw as QSGFilterLinear.
+enum QSGTextureFilter {
+	QSGFilterLinear = 0,		// bilinear, no mip levels (the default)
+	QSGFilterNearest,			// the nearest texel, no mip levels
+	QSGFilterMipmap,			// bilinear in the nearest mip level
+	QSGFilterTrilinear,			// bilinear in the two nearest levels, blended
+	QSGFilterCount
+};
+
 class QSGTexture :
 	public QSGResource
 {
 public:
-	QSGTexture(void) : m_data(NULL), m_width(0), m_height(0), m_components(0) {}
+	QSGTexture(void) : m_data(NULL), m_width(0), m_height(0), m_components(0),
+		m_format(0), m_levels(1), m_filter(QSGFilterLinear), m_renderFilter(-1),
+		m_premultiplied(false), m_cache(NULL) {}
 	virtual ~QSGTexture(void);
 
 public:
+	// The filter to draw with: m_filter, unless it needs mip levels
+	// that a block format does not have.
+	inline int filter(void) const {
+		if (m_filter >= QSGFilterMipmap && m_format != QSGTextureRaw && m_levels < 2) return QSGFilterLinear;
+		return m_filter;
+	}
 
 	// These are public for QSGRenderer implementations, but really they
 	// should be moved into an immutable data class that can be sent
@@ -19,4 +41,31 @@ public:
 	int m_width;
 	int m_height;
 	int m_components;
+
+	// QSGTextureFormat (QSGBlockTexture.h). Block formats have
+	// qsgBlockSize bytes at m_data, and m_components is what they
+	// decode to.
+	int m_format;
+
+	// Mip levels at m_data, largest first, counting the base level.
+	// Only block textures carry their own; renderers build the rest.
+	int m_levels;
+
+	// QSGTextureFilter. It can be changed at any time; renderers compare
+	// it with m_renderFilter, the filter they last set up, when binding.
+	int m_filter;
+	int m_renderFilter;
+
+	// Colours have been multiplied by alpha (qsgPremultiply), so that
+	// filtering never bleeds the colour of clear texels into the edges
+	// and nodes draw with the one premultiplied blend function.
+	bool m_premultiplied;
+
+	// The cache sharing this texture, and the name it is shared under.
+	QSGTextureCache* m_cache;
+	std::string m_cacheName;
+
+	// Set when m_data points into memory this object owns (such as a
+	// mapped QSGAssetPack) rather than memory from malloc.
+	ref_ptr<QSGObject> m_owner;
 };
@@ -0,0 +1,41 @@
+#include "QSGTextureCache.h"
+#include "QSGTexture.h"
+
+QSGTextureCache::~QSGTextureCache(void)
+{
+	clear();
+}
+
+QSGTexture* QSGTextureCache::find(const std::string& name)
+{
+	TextureMap::iterator it = m_textures.find(name);
+	if (it == m_textures.end()) {
+		++m_misses;
+		return NULL;
+	}
+	++m_hits;
+	return it->second;
+}
+
+void QSGTextureCache::insert(const std::string& name, QSGTexture* texture)
+{
+	TextureMap::iterator it = m_textures.find(name);
+	if (it != m_textures.end()) it->second->m_cache = NULL;
+	m_textures[name] = texture;
+	texture->m_cache = this;
+	texture->m_cacheName = name;
+}
+
+void QSGTextureCache::remove(QSGTexture* texture)
+{
+	TextureMap::iterator it = m_textures.find(texture->m_cacheName);
+	if (it != m_textures.end() && it->second == texture) m_textures.erase(it);
+	texture->m_cache = NULL;
+}
+
+void QSGTextureCache::clear(void)
+{
+	for (TextureMap::iterator it = m_textures.begin(); it != m_textures.end(); ++it)
+		it->second->m_cache = NULL;
+	m_textures.clear();
+}
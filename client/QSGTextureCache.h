@@ -0,0 +1,44 @@
+#pragma once
+#include <map>
+#include <string>
+
+class QSGTexture;
+
+// Textures by the canonical name (QSGAssetPack::canonicalName) of the
+// file they were loaded from, so that loading a file again returns the
+// texture already loaded rather than decoding and uploading it again.
+//
+// The references are weak: the cache does not keep textures alive, and
+// a texture leaves the cache when it is deleted. Textures are shared by
+// everything that loads their file, so changing one (its filter, say)
+// changes it for all of them.
+class QSGTextureCache
+{
+public:
+	QSGTextureCache(void) : m_hits(0), m_misses(0) {}
+	~QSGTextureCache(void);
+
+public:
+	// The texture loaded from this file, or NULL, counting a hit or a miss.
+	QSGTexture* find(const std::string& name);
+
+	// Share a texture just loaded from this file.
+	void insert(const std::string& name, QSGTexture* texture);
+
+	// Forget a texture being deleted; called by ~QSGTexture.
+	void remove(QSGTexture* texture);
+
+	// Forget every texture, as when a newly mounted pack may replace
+	// their files. The textures themselves are not touched.
+	void clear(void);
+
+	inline size_t size(void) const { return m_textures.size(); }
+	inline unsigned int hits(void) const { return m_hits; }
+	inline unsigned int misses(void) const { return m_misses; }
+
+protected:
+	typedef std::map<std::string, QSGTexture*> TextureMap;
+	TextureMap m_textures;
+	unsigned int m_hits;
+	unsigned int m_misses;
+};
@@ -0,0 +1,347 @@
+#include "QSGTrace.h"
+#include "QSGRenderer.h"
+#include "QSGTransform.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void QSGTraceStats::reset(void)
+{
+	for (int i = 0; i < QSGTraceOpCount; ++i) calls[i] = 0;
+	textureChanges = blendChanges = scissorChanges = triangles = 0;
+}
+
+void QSGTraceStats::add(const QSGTraceStats& other)
+{
+	for (int i = 0; i < QSGTraceOpCount; ++i) calls[i] += other.calls[i];
+	textureChanges += other.textureChanges;
+	blendChanges += other.blendChanges;
+	scissorChanges += other.scissorChanges;
+	triangles += other.triangles;
+}
+
+const char* qsgTraceOpName(int op)
+{
+	static const char* names[QSGTraceOpCount] = {
+		"?", "beginFrame", "endFrame", "clear", "pushTransform",
+		"popTransform", "setTexture", "clearTexture", "renderQuad",
+		"renderGeometry", "setScissor", "clearScissor", "defineTexture",
+		"defineGeometry", "textureFilter"
+	};
+	return (op > 0 && op < QSGTraceOpCount) ? names[op] : names[0];
+}
+
+
+// ---------------------------------------------------------------------
+
+// Bounds-checked reads from a trace; once a read runs off the end, all
+// further reads return zero and ok() is false.
+class QSGTraceReader
+{
+public:
+	QSGTraceReader(const std::vector<unsigned char>& data, size_t pos) :
+		m_data(data.empty() ? NULL : &data[0]), m_size(data.size()), m_pos(pos), m_ok(true) {}
+
+	inline bool ok(void) const { return m_ok; }
+	inline bool atEnd(void) const { return m_pos >= m_size; }
+	inline size_t pos(void) const { return m_pos; }
+
+	unsigned int readByte(void)
+	{
+		if (m_pos >= m_size) { m_ok = false; return 0; }
+		return m_data[m_pos++];
+	}
+
+	unsigned int readUInt(void)
+	{
+		unsigned int value = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			unsigned int b = readByte();
+			value |= (b & 0x7f) << shift;
+			if (!(b & 0x80)) return value;
+		}
+		m_ok = false;
+		return 0;
+	}
+
+	float readFloat(void)
+	{
+		unsigned int bits = readByte();
+		bits |= readByte() << 8;
+		bits |= readByte() << 16;
+		bits |= readByte() << 24;
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	const unsigned char* readBytes(size_t count)
+	{
+		if (count > m_size - m_pos || m_pos > m_size) { m_ok = false; return NULL; }
+		const unsigned char* p = m_data + m_pos;
+		m_pos += count;
+		return p;
+	}
+
+protected:
+	const unsigned char* m_data;
+	size_t m_size;
+	size_t m_pos;
+	bool m_ok;
+};
+
+// State tracked while playing, to count changes.
+struct QSGTracePlayState
+{
+	QSGTracePlayState() : texture(-1), blend(-1), scissoring(false) {
+		scissor[0] = scissor[1] = scissor[2] = scissor[3] = 0;
+	}
+	int texture;		// id, or -1 for none
+	int blend;			// 0 none, 1 straight, 2 premultiplied or add, -1 not yet known
+	bool scissoring;
+	float scissor[4];
+};
+
+static void readFloats(QSGTraceReader& in, float* out, int count)
+{
+	for (int i = 0; i < count; ++i) out[i] = in.readFloat();
+}
+
+
+// ---------------------------------------------------------------------
+
+bool QSGTracePlayer::load(const char* filename)
+{
+	m_data.clear();
+	m_frames.clear();
+	m_textures.clear();
+	m_geometry.clear();
+
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		log_Logf("QSGTracePlayer: cannot open %s", filename);
+		return false;
+	}
+	unsigned char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		m_data.insert(m_data.end(), buffer, buffer + got);
+	fclose(file);
+
+	if (!parse()) {
+		log_Logf("QSGTracePlayer: %s is not a valid trace", filename);
+		return false;
+	}
+	return true;
+}
+
+// Walk the whole trace once: check every command, find the frames and
+// create the textures and geometry it defines.
+bool QSGTracePlayer::parse(void)
+{
+	size_t magic = strlen(QSG_TRACE_MAGIC);
+	if (m_data.size() < magic || memcmp(&m_data[0], QSG_TRACE_MAGIC, magic))
+		return false;
+	QSGTraceReader in(m_data, magic);
+	unsigned int version = in.readUInt();
+	if (version < 1 || version > QSG_TRACE_VERSION) return false;
+
+	bool inFrame = false;
+	float f[4];
+	while (in.ok() && !in.atEnd()) {
+		int op = (int) in.readByte();
+		switch (op) {
+		case QSGTraceBeginFrame: {
+			Frame frame;
+			frame.width = (int) in.readUInt();
+			frame.height = (int) in.readUInt();
+			frame.offset = in.pos();
+			if (inFrame) m_frames.pop_back(); // unfinished
+			m_frames.push_back(frame);
+			inFrame = true;
+			break;
+		}
+		case QSGTraceEndFrame:
+			inFrame = false;
+			break;
+		case QSGTraceClear:
+		case QSGTraceQuad:
+		case QSGTraceScissor:
+			readFloats(in, f, 4);
+			break;
+		case QSGTracePushTransform: {
+			unsigned int fields = in.readByte();
+			in.readUInt();
+			if (fields & QSGTracePos) readFloats(in, f, 2);
+			if (fields & QSGTraceAngle) readFloats(in, f, 1);
+			if (fields & QSGTraceScale) readFloats(in, f, 2);
+			if (fields & QSGTraceColour) readFloats(in, f, 4);
+			break;
+		}
+		case QSGTracePopTransform:
+		case QSGTraceClearTexture:
+		case QSGTraceClearScissor:
+			break;
+		case QSGTraceSetTexture:
+			if (in.readUInt() >= m_textures.size()) return false;
+			break;
+		case QSGTraceGeometry:
+			if (in.readUInt() >= m_geometry.size()) return false;
+			break;
+		case QSGTraceTextureFilter:
+			if (in.readUInt() >= m_textures.size()) return false;
+			if (in.readUInt() >= QSGFilterCount) return false;
+			break;
+		case QSGTraceDefineTexture: {
+			if (in.readUInt() != m_textures.size()) return false;
+			unsigned int width = in.readUInt();
+			unsigned int height = in.readUInt();
+			unsigned int components = in.readUInt();
+			if (width > 65536 || height > 65536 || components > 4) return false;
+			size_t size = (size_t) width * height * components;
+			const unsigned char* texels = in.readBytes(size);
+			if (!in.ok()) return false;
+			QSGTexture* texture = new QSGTexture();
+			if (size) {
+				texture->m_data = (unsigned char*) malloc(size); // freed by QSGTexture
+				memcpy(texture->m_data, texels, size);
+			}
+			texture->m_width = (int) width;
+			texture->m_height = (int) height;
+			texture->m_components = (int) components;
+			m_textures.push_back(texture);
+			break;
+		}
+		case QSGTraceDefineGeometry: {
+			if (in.readUInt() != m_geometry.size()) return false;
+			ref_ptr<QSGGeometry> geometry = new QSGGeometry();
+			geometry->quads = in.readByte() != 0;
+			size_t numVerts = in.readUInt();
+			size_t numCoords = in.readUInt();
+			size_t numIndices = in.readUInt();
+			if (numVerts > m_data.size() || numCoords > m_data.size() || numIndices > m_data.size())
+				return false;
+			geometry->verts.resize(numVerts);
+			geometry->coords.resize(numCoords);
+			geometry->indices.resize(numIndices);
+			for (size_t i = 0; i < numVerts && in.ok(); ++i) geometry->verts[i] = in.readFloat();
+			for (size_t i = 0; i < numCoords && in.ok(); ++i) geometry->coords[i] = in.readFloat();
+			for (size_t i = 0; i < numIndices && in.ok(); ++i)
+				geometry->indices[i] = (unsigned short) in.readUInt();
+			m_geometry.push_back(geometry);
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	if (inFrame) m_frames.pop_back();
+	return in.ok();
+}
+
+void QSGTracePlayer::playFrame(int frame, QSGRenderer* renderer, QSGTraceStats* stats)
+{
+	QSGTraceReader in(m_data, m_frames[frame].offset);
+	QSGTracePlayState state;
+	float f[4];
+
+	// parse() has checked everything up to here.
+	for (;;) {
+		int op = (int) in.readByte();
+		stats->calls[op]++;
+		switch (op) {
+		case QSGTraceEndFrame:
+			return;
+		case QSGTraceClear:
+			readFloats(in, f, 4);
+			renderer->clear(QSGColour(f[0], f[1], f[2], f[3]));
+			break;
+		case QSGTracePushTransform: {
+			QSGTransform trans;
+			unsigned int fields = in.readByte();
+			trans.flags = in.readUInt();
+			if (fields & QSGTracePos) { trans.pos.x = in.readFloat(); trans.pos.y = in.readFloat(); }
+			if (fields & QSGTraceAngle) trans.angle = in.readFloat();
+			if (fields & QSGTraceScale) { trans.scale.x = in.readFloat(); trans.scale.y = in.readFloat(); }
+			if (fields & QSGTraceColour) {
+				readFloats(in, f, 4);
+				trans.col = QSGColour(f[0], f[1], f[2], f[3]);
+			}
+			// Same rule as the GL renderer uses to pick a blend function.
+			int blend = (trans.flags & QSGTransformBlendAdd) ? 2 :
+				(trans.col.a != 1 || (trans.flags & QSGTransformNeedsBlend)) ?
+				((trans.flags & QSGTransformPremultiplied) ? 2 : 1) : 0;
+			if (blend != state.blend) stats->blendChanges++;
+			state.blend = blend;
+			renderer->pushTransform(&trans);
+			break;
+		}
+		case QSGTracePopTransform:
+			renderer->popTransform();
+			break;
+		case QSGTraceSetTexture: {
+			int id = (int) in.readUInt();
+			if (id != state.texture) stats->textureChanges++;
+			state.texture = id;
+			renderer->setTexture(m_textures[id]);
+			break;
+		}
+		case QSGTraceClearTexture:
+			if (state.texture != -1) stats->textureChanges++;
+			state.texture = -1;
+			renderer->clearTexture();
+			break;
+		case QSGTraceQuad:
+			readFloats(in, f, 4);
+			stats->triangles += 2;
+			renderer->renderQuad(f[0], f[1], f[2], f[3]);
+			break;
+		case QSGTraceGeometry: {
+			QSGGeometry* geometry = m_geometry[in.readUInt()];
+			stats->triangles += geometry->quads ?
+				geometry->indices.size() / 4 * 2 : geometry->indices.size() / 3;
+			renderer->renderGeometry(geometry);
+			break;
+		}
+		case QSGTraceScissor:
+			readFloats(in, f, 4);
+			if (!state.scissoring || memcmp(f, state.scissor, sizeof(f)))
+				stats->scissorChanges++;
+			memcpy(state.scissor, f, sizeof(f));
+			state.scissoring = true;
+			renderer->setScissor(f[0], f[1], f[2], f[3]);
+			break;
+		case QSGTraceClearScissor:
+			if (state.scissoring) stats->scissorChanges++;
+			state.scissoring = false;
+			renderer->clearScissor();
+			break;
+		case QSGTraceTextureFilter: {
+			QSGTexture* texture = m_textures[in.readUInt()];
+			texture->m_filter = (int) in.readUInt();
+			break;
+		}
+		case QSGTraceDefineTexture: {
+			// created by parse(); skip the texels.
+			in.readUInt();
+			size_t width = in.readUInt(), height = in.readUInt();
+			in.readBytes(width * height * in.readUInt());
+			break;
+		}
+		case QSGTraceDefineGeometry: {
+			in.readUInt();
+			in.readByte();
+			size_t numFloats = in.readUInt();
+			numFloats += in.readUInt();
+			size_t numIndices = in.readUInt();
+			in.readBytes(numFloats * 4);
+			for (size_t i = 0; i < numIndices; ++i) in.readUInt();
+			break;
+		}
+		default:
+			return;
+		}
+	}
+}
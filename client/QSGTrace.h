@@ -0,0 +1,105 @@
+#pragma once
+#include "QSGObject.h"
+#include "QSGTexture.h"
+#include "QSGGeometry.h"
+#include <vector>
+
+class QSGRenderer;
+
+// A render trace records the calls a scene makes on its QSGRenderer, so
+// frames can be replayed later without the scripts that built the scene.
+//
+// The file is a header (magic, version) followed by commands: an opcode
+// byte and its operands. Integers are unsigned LEB128 varints and floats
+// are 32 bit little-endian. Textures and geometry are defined in the
+// stream before their first use and referred to by id after that; a
+// geometry that changes is defined again under a new id.
+//
+// Version 2 added QSGTraceTextureFilter; version 1 traces still play.
+
+#define QSG_TRACE_MAGIC		"QSGT"
+#define QSG_TRACE_VERSION	2
+
+enum QSGTraceOp {
+	QSGTraceBeginFrame = 1,		// width, height
+	QSGTraceEndFrame,
+	QSGTraceClear,				// r, g, b, a
+	QSGTracePushTransform,		// field mask, flags, then the fields present
+	QSGTracePopTransform,
+	QSGTraceSetTexture,			// texture id
+	QSGTraceClearTexture,
+	QSGTraceQuad,				// left, bottom, right, top
+	QSGTraceGeometry,			// geometry id
+	QSGTraceScissor,			// left, bottom, right, top
+	QSGTraceClearScissor,
+	QSGTraceDefineTexture,		// id, width, height, components, texels
+	QSGTraceDefineGeometry,		// id, quads, verts, coords, indices (counts then data)
+	QSGTraceTextureFilter,		// texture id, QSGTextureFilter
+	QSGTraceOpCount
+};
+
+// Transform fields written after QSGTracePushTransform; fields left at
+// their defaults are not written.
+enum QSGTraceFields {
+	QSGTracePos = 1,			// x, y
+	QSGTraceAngle = 2,			// degrees
+	QSGTraceScale = 4,			// x, y
+	QSGTraceColour = 8,			// r, g, b, a
+};
+
+// Counts gathered while replaying.
+class QSGTraceStats
+{
+public:
+	QSGTraceStats(void) { reset(); }
+	void reset(void);
+	void add(const QSGTraceStats& other);
+
+public:
+	long calls[QSGTraceOpCount];	// renderer calls, by opcode
+	long textureChanges;			// texture bound differs from the last
+	long blendChanges;				// blend mode differs from the last
+	long scissorChanges;			// scissor rectangle or enable changed
+	long triangles;					// quads count as two
+};
+
+// Name of an opcode, for reports.
+const char* qsgTraceOpName(int op);
+
+// Loads a trace and plays its frames into a renderer.
+class QSGTracePlayer
+{
+public:
+	QSGTracePlayer(void) {}
+
+public:
+	// Read and check a whole trace; returns false with a reason logged.
+	bool load(const char* filename);
+
+	inline int getFrameCount(void) const { return (int) m_frames.size(); }
+	inline int getFrameWidth(int frame) const { return m_frames[frame].width; }
+	inline int getFrameHeight(int frame) const { return m_frames[frame].height; }
+	inline size_t getTraceSize(void) const { return m_data.size(); }
+	inline size_t getTextureCount(void) const { return m_textures.size(); }
+	inline size_t getGeometryCount(void) const { return m_geometry.size(); }
+
+	// Issue the commands of one frame. Call this from inside the
+	// renderer's traversal, i.e. from a node's render().
+	void playFrame(int frame, QSGRenderer* renderer, QSGTraceStats* stats);
+
+protected:
+	bool parse(void);
+
+protected:
+	struct Frame
+	{
+		size_t offset;		// first command after QSGTraceBeginFrame
+		int width;
+		int height;
+	};
+
+	std::vector<unsigned char> m_data;
+	std::vector<Frame> m_frames;
+	std::vector<ref_ptr<QSGTexture> > m_textures;	// by id
+	std::vector<ref_ptr<QSGGeometry> > m_geometry;	// by id
+};
@@ -4,6 +4,7 @@ enum QSGTransformFlags {
 	QSGTransformNone = 0,
 	QSGTransformNeedsBlend = 1,
 	QSGTransformBlendAdd = 2,
+	QSGTransformPremultiplied = 4,	// the texture's alpha is premultiplied
 };
 
 class QSGColour
@@ -9,4 +9,5 @@ void QSGViewport::render(QSGRenderer* renderer)
 {
 	renderer->clear(m_backgroundColour);
 	renderChildren(renderer);
+	if (m_overlay) m_overlay->render(renderer);
 }
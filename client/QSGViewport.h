@@ -16,10 +16,17 @@ public:
 		m_backgroundColour = colour;
 	}
 
+	// Draw this node over the scene, whatever the scene is; NULL for none.
+	void setOverlay(QSGNode* overlay)
+	{
+		m_overlay = overlay;
+	}
+
 public:
 	virtual void render(class QSGRenderer* renderer);
 
 protected:
 	QSGColour m_backgroundColour;
+	ref_ptr<QSGNode> m_overlay;
 	ref_ptr<QSGRenderer> m_renderer;
 };
@@ -0,0 +1,219 @@
+// ReplayMain.cpp: replays render traces against a renderer, for benchmarks
+//
+// Traces are recorded by QSGRecordingRenderer, from sg.captureFrames() in
+// the client or headless -capture. Replaying needs no scripts, so changes
+// to a renderer can be timed on real scenes. Every frame of the trace is
+// played -repeat times after -warmup passes; the calls, state changes and
+// time per frame are logged, and the frame times written out as CSV.
+//
+//   replay trace.qsgt [-renderer null|soft|gl] [-repeat N] [-warmup N]
+//                     [-span N] [-timings file.csv]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <GL/gl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "Logger.h"
+#include "Timer.h"
+#include "HeadlessContext.h"
+#include "QSGTrace.h"
+#include "QSGNullRenderer.h"
+#include "QSGOpenGLRenderer.h"
+#include "QSGSoftwareRenderer.h"
+
+const char *c_logFilename = "replay.log";
+
+struct ReplayOptions
+{
+	const char* m_szTrace;
+	const char* m_szRenderer;	// null, soft or gl
+	int m_nRepeat;
+	int m_nWarmup;
+	int m_nSpanLevel;			// forced span level, or -1
+	const char* m_szTimings;
+};
+
+// Plays one frame of the trace when the renderer visits it.
+class ReplayFrame :
+	public QSGNode
+{
+public:
+	ReplayFrame(QSGTracePlayer* player) : m_player(player), m_frame(0), m_stats(NULL) {}
+	virtual void render(QSGRenderer* renderer) {
+		m_player->playFrame(m_frame, renderer, m_stats);
+	}
+public:
+	QSGTracePlayer* m_player;
+	int m_frame;
+	QSGTraceStats* m_stats;
+};
+
+
+// ---------------------------------------------------------------------
+
+static double percentile(std::vector<double>& sorted, double fraction)
+{
+	size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+void ReportStats(const QSGTraceStats& stats, int frames)
+{
+	double scale = 1.0 / frames;
+	log_Log("per frame:");
+	for (int op = QSGTraceClear; op < QSGTraceDefineTexture; ++op) {
+		if (stats.calls[op])
+			log_Logf("  %-15s %9.1f", qsgTraceOpName(op), stats.calls[op] * scale);
+	}
+	log_Logf("  %-15s %9.1f", "triangles", stats.triangles * scale);
+	log_Logf("  state changes: texture %.1f  blend %.1f  scissor %.1f",
+		stats.textureChanges * scale, stats.blendChanges * scale, stats.scissorChanges * scale);
+}
+
+void ReportTimings(const ReplayOptions& options, std::vector<double> times)
+{
+	if (options.m_szTimings) {
+		FILE* file = fopen(options.m_szTimings, "w");
+		if (file) {
+			fprintf(file, "frame,ms\n");
+			for (size_t i = 0; i < times.size(); ++i)
+				fprintf(file, "%d,%.4f\n", (int)i, times[i] * 1000);
+			fclose(file);
+		}
+		else log_Logf("ReportTimings: cannot open %s", options.m_szTimings);
+	}
+
+	std::sort(times.begin(), times.end());
+	double total = 0;
+	for (size_t i = 0; i < times.size(); ++i) total += times[i];
+	log_Logf("frame time: mean %.3f  min %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f ms",
+		total * 1000 / times.size(), times.front() * 1000,
+		percentile(times, 0.5) * 1000, percentile(times, 0.95) * 1000,
+		percentile(times, 0.99) * 1000, times.back() * 1000);
+}
+
+bool ParseOptions(int argc, char** argv, ReplayOptions* options)
+{
+	options->m_szTrace = NULL;
+	options->m_szRenderer = "null";
+	options->m_nRepeat = 10;
+	options->m_nWarmup = 1;
+	options->m_nSpanLevel = -1;
+	options->m_szTimings = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (arg[0] != '-') {
+			if (options->m_szTrace) return false;
+			options->m_szTrace = arg;
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-renderer")) options->m_szRenderer = value;
+		else if (!strcmp(arg, "-repeat")) options->m_nRepeat = atoi(value);
+		else if (!strcmp(arg, "-warmup")) options->m_nWarmup = atoi(value);
+		else if (!strcmp(arg, "-span")) options->m_nSpanLevel = atoi(value);
+		else if (!strcmp(arg, "-timings")) options->m_szTimings = value;
+		else return false;
+		++i;
+	}
+
+	return options->m_szTrace && options->m_nRepeat > 0 && options->m_nWarmup >= 0 &&
+		(!strcmp(options->m_szRenderer, "null") || !strcmp(options->m_szRenderer, "soft") ||
+		 !strcmp(options->m_szRenderer, "gl"));
+}
+
+int main(int argc, char** argv)
+{
+	ReplayOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s trace.qsgt [-renderer null|soft|gl] [-repeat N] [-warmup N]\n"
+			"       [-span N] [-timings file.csv]\n", argv[0]);
+		return 2;
+	}
+
+	log_Open( c_logFilename, NULL );
+
+	QSGTracePlayer player;
+	if (!player.load(options.m_szTrace) || !player.getFrameCount()) {
+		log_Logf("... no frames to replay in %s", options.m_szTrace);
+		log_Close();
+		return 1;
+	}
+	int frames = player.getFrameCount();
+	log_Logf("%s: %d frames, %u bytes, %u textures, %u geometry", options.m_szTrace, frames,
+		(unsigned int) player.getTraceSize(), (unsigned int) player.getTextureCount(),
+		(unsigned int) player.getGeometryCount());
+
+	bool gl = !strcmp(options.m_szRenderer, "gl");
+	ref_ptr<QSGRenderer> renderer;
+	if (gl) {
+		int width = 0, height = 0;
+		for (int i = 0; i < frames; ++i) {
+			width = std::max(width, player.getFrameWidth(i));
+			height = std::max(height, player.getFrameHeight(i));
+		}
+		if (!CreateHeadlessContext(width, height)) {
+			log_Log("... failed to create headless GL context");
+			ReleaseHeadlessContext();
+			log_Close();
+			return 1;
+		}
+		renderer = new QSGOpenGLRenderer();
+	}
+	else if (!strcmp(options.m_szRenderer, "soft")) {
+		if (options.m_nSpanLevel >= 0)
+			qsgSetSpanLevel(options.m_nSpanLevel);
+		log_Logf("span level %d of %d", qsgSpanLevel(), qsgSpanCpuLevel());
+		renderer = new QSGSoftwareRenderer();
+	}
+	else {
+		renderer = new QSGNullRenderer();
+	}
+	renderer->initialise();
+	log_Logf("renderer %s, %d passes after %d warmup", options.m_szRenderer,
+		options.m_nRepeat, options.m_nWarmup);
+
+	// Stats are the same on every pass, so only the first is counted.
+	QSGTraceStats stats, ignored;
+	std::vector<double> times;
+	times.reserve(frames * options.m_nRepeat);
+	ReplayFrame node(&player);
+	node.retain(); // on the stack; never freed by a ref.
+	int width = -1, height = -1;
+	for (int pass = 0; pass < options.m_nWarmup + options.m_nRepeat; ++pass) {
+		bool timed = pass >= options.m_nWarmup;
+		node.m_stats = (pass == options.m_nWarmup) ? &stats : &ignored;
+		for (int i = 0; i < frames; ++i) {
+			if (player.getFrameWidth(i) != width || player.getFrameHeight(i) != height) {
+				width = player.getFrameWidth(i);
+				height = player.getFrameHeight(i);
+				renderer->setViewportSize(width, height);
+			}
+			node.m_frame = i;
+			double start = timer_Now();
+			renderer->render(&node);
+			if (gl) glFinish();
+			if (timed) times.push_back(timer_Now() - start);
+		}
+	}
+
+	ReportStats(stats, frames);
+	ReportTimings(options, times);
+
+	renderer->shutdown();
+	renderer = 0; // before the context goes.
+	if (gl) ReleaseHeadlessContext();
+	log_Close();
+
+	return 0;
+}
@@ -0,0 +1,870 @@
+// Replication.cpp: delta-compressed entity snapshots
+//
+// A snapshot is sent as
+//
+//   sequence (16)  has baseline (1)  [baseline sequence (16)]
+//   records, each prefixed by a 1 bit, then a 0 bit to end
+//
+// and each record is
+//
+//   id: 1 + (gap from the previous id - 1) (4), or 0 + id (16)
+//   kind (2): UPDATE, NEW or REMOVED
+//   UPDATE: mask of changed fields (one bit per field), then for each
+//           changed field 1 + delta (7) or 0 + value (field bits)
+//   NEW: every field at full width
+//
+// Entities that did not change since the baseline are not sent at all.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Replication.h"
+#include "BitStream.h"
+#include "Packet.h"
+#include "QSGTransformNode.h"
+#include "LuaController.h"
+#include "Timer.h"
+
+#include <string.h>
+#include <math.h>
+#include <new>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+#define RECORD_UPDATE		0
+#define RECORD_NEW			1
+#define RECORD_REMOVED		2
+
+#define SEQUENCE_MASK		0xFFFF
+#define SEQUENCE_HALF		0x8000
+
+#define SENDER_METATABLE	"replication.Sender"
+#define RECEIVER_METATABLE	"replication.Receiver"
+#define INTERP_METATABLE	"replication.Interpolator"
+
+// Field names that drive a transform channel, in InterpChannel order.
+static const char* s_channelNames[INTERP_CHANNELS] = {
+	"x", "y", "angle", "sx", "sy", "r", "g", "b", "a"
+};
+
+// True if sequence a is newer than b, allowing for wrap-around.
+static inline bool sequenceNewer( int a, int b )
+{
+	int nDiff = (a - b) & SEQUENCE_MASK;
+	return nDiff != 0 && nDiff < SEQUENCE_HALF;
+}
+
+static inline bool fitsSigned( int nValue, int nBits )
+{
+	int nLimit = 1 << (nBits - 1);
+	return nValue >= -nLimit && nValue < nLimit;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SnapshotSchema
+//////////////////////////////////////////////////////////////////////
+
+bool SnapshotSchema::AddField( const char* szName, int nBits, float fScale )
+{
+	if( m_fields.size() >= SNAPSHOT_MAX_FIELDS || nBits < 2 || nBits > 32 || fScale <= 0 )
+		return false;
+
+	SnapshotField field;
+	strncpy( field.m_szName, szName, sizeof(field.m_szName) - 1 );
+	field.m_szName[sizeof(field.m_szName) - 1] = '\0';
+	field.m_nBits = nBits;
+	field.m_fScale = fScale;
+	field.m_nChannel = -1;
+	for( int c = 0; c < INTERP_CHANNELS; c++ )
+	{
+		if( !strcmp( s_channelNames[c], field.m_szName ) )
+		{
+			field.m_nChannel = c;
+			m_nChannelMask |= 1U << c;
+		}
+	}
+
+	m_fields.push_back( field );
+	return true;
+}
+
+int SnapshotSchema::Quantize( int nField, float fValue ) const
+{
+	const SnapshotField& field = m_fields[nField];
+	double fLimit = ldexp( 1.0, field.m_nBits - 1 );
+	double fScaled = floor( fValue * field.m_fScale + 0.5 );
+
+	// Clamp so the value survives the round trip at this width.
+	if( fScaled < -fLimit ) fScaled = -fLimit;
+	if( fScaled > fLimit - 1 ) fScaled = fLimit - 1;
+	return (int)fScaled;
+}
+
+float SnapshotSchema::Dequantize( int nField, int nValue ) const
+{
+	return (float)(nValue / m_fields[nField].m_fScale);
+}
+
+void SnapshotSchema::GetChannels( const int* aFields, float* aValues ) const
+{
+	int nFields = (int)m_fields.size();
+	for( int i = 0; i < nFields; i++ )
+	{
+		if( m_fields[i].m_nChannel >= 0 )
+			aValues[m_fields[i].m_nChannel] = Dequantize( i, aFields[i] );
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Snapshot helpers
+//////////////////////////////////////////////////////////////////////
+
+static Snapshot::iterator lowerBound( Snapshot& snapshot, unsigned short nId )
+{
+	Snapshot::iterator it = snapshot.begin();
+	int nCount = (int)snapshot.size();
+	while( nCount > 0 )
+	{
+		int nHalf = nCount >> 1;
+		if( it[nHalf].m_nId < nId )
+		{
+			it += nHalf + 1;
+			nCount -= nHalf + 1;
+		}
+		else
+		{
+			nCount = nHalf;
+		}
+	}
+	return it;
+}
+
+EntityState* snapshot_Find( Snapshot& snapshot, unsigned short nId )
+{
+	Snapshot::iterator it = lowerBound( snapshot, nId );
+	return (it != snapshot.end() && it->m_nId == nId) ? &*it : NULL;
+}
+
+EntityState* snapshot_Insert( Snapshot& snapshot, unsigned short nId )
+{
+	Snapshot::iterator it = lowerBound( snapshot, nId );
+	if( it == snapshot.end() || it->m_nId != nId )
+	{
+		EntityState state;
+		memset( &state, 0, sizeof(state) );
+		state.m_nId = nId;
+		it = snapshot.insert( it, state );
+	}
+	return &*it;
+}
+
+void snapshot_Remove( Snapshot& snapshot, unsigned short nId )
+{
+	Snapshot::iterator it = lowerBound( snapshot, nId );
+	if( it != snapshot.end() && it->m_nId == nId )
+		snapshot.erase( it );
+}
+
+static void writeId( BitWriter& out, unsigned short nId, int* pLastId )
+{
+	int nGap = nId - *pLastId;
+	if( nGap >= 1 && nGap <= 16 )
+	{
+		out.Write( 1, 1 );
+		out.Write( nGap - 1, 4 );
+	}
+	else
+	{
+		out.Write( 0, 1 );
+		out.Write( nId, 16 );
+	}
+	*pLastId = nId;
+}
+
+static int readId( BitReader& in, int nLastId )
+{
+	if( in.Read( 1 ) ) return nLastId + (int)in.Read( 4 ) + 1;
+	return (int)in.Read( 16 );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SnapshotSender
+//////////////////////////////////////////////////////////////////////
+
+SnapshotSender::SnapshotSender( const SnapshotSchema& schema ) :
+	m_schema(schema), m_nSequence(0), m_nAcked(SNAPSHOT_NO_SEQUENCE)
+{
+	for( int i = 0; i < SNAPSHOT_HISTORY; i++ ) m_aHistorySeq[i] = SNAPSHOT_NO_SEQUENCE;
+}
+
+void SnapshotSender::Acknowledge( int nSequence )
+{
+	nSequence &= SEQUENCE_MASK;
+
+	// Ignore acks for snapshots we never sent or that arrive late.
+	if( !sequenceNewer( m_nSequence, nSequence ) ) return;
+	if( m_nAcked != SNAPSHOT_NO_SEQUENCE && !sequenceNewer( nSequence, m_nAcked ) ) return;
+	m_nAcked = nSequence;
+}
+
+int SnapshotSender::Write( const Snapshot& current, unsigned char* pBuffer, int nCapacity )
+{
+	int nFields = m_schema.GetFieldCount();
+	int nSequence = m_nSequence;
+
+	// The newest acked snapshot is the baseline, if we still have it.
+	static const Snapshot s_empty;
+	const Snapshot* pBase = &s_empty;
+	if( m_nAcked != SNAPSHOT_NO_SEQUENCE &&
+		((nSequence - m_nAcked) & SEQUENCE_MASK) < SNAPSHOT_HISTORY &&
+		m_aHistorySeq[m_nAcked % SNAPSHOT_HISTORY] == m_nAcked )
+	{
+		pBase = &m_aHistory[m_nAcked % SNAPSHOT_HISTORY];
+	}
+
+	BitWriter out( pBuffer, nCapacity );
+	out.Write( nSequence, 16 );
+	if( pBase != &s_empty )
+	{
+		out.Write( 1, 1 );
+		out.Write( m_nAcked, 16 );
+	}
+	else
+	{
+		out.Write( 0, 1 );
+	}
+
+	int nLastId = 0;
+	Snapshot::const_iterator itCur = current.begin();
+	Snapshot::const_iterator itBase = pBase->begin();
+	while( itCur != current.end() || itBase != pBase->end() )
+	{
+		if( itBase == pBase->end() || (itCur != current.end() && itCur->m_nId < itBase->m_nId) )
+		{
+			out.Write( 1, 1 );
+			writeId( out, itCur->m_nId, &nLastId );
+			out.Write( RECORD_NEW, 2 );
+			for( int i = 0; i < nFields; i++ )
+				out.WriteSigned( itCur->m_aFields[i], m_schema.GetField( i ).m_nBits );
+			++itCur;
+		}
+		else if( itCur == current.end() || itBase->m_nId < itCur->m_nId )
+		{
+			out.Write( 1, 1 );
+			writeId( out, itBase->m_nId, &nLastId );
+			out.Write( RECORD_REMOVED, 2 );
+			++itBase;
+		}
+		else
+		{
+			unsigned int nMask = 0;
+			for( int i = 0; i < nFields; i++ )
+			{
+				if( itCur->m_aFields[i] != itBase->m_aFields[i] ) nMask |= 1U << i;
+			}
+			if( nMask )
+			{
+				out.Write( 1, 1 );
+				writeId( out, itCur->m_nId, &nLastId );
+				out.Write( RECORD_UPDATE, 2 );
+				out.Write( nMask, nFields );
+				for( int i = 0; i < nFields; i++ )
+				{
+					if( !(nMask & (1U << i)) ) continue;
+					int nDelta = (int)((unsigned int)itCur->m_aFields[i] - (unsigned int)itBase->m_aFields[i]);
+					if( fitsSigned( nDelta, SNAPSHOT_DELTA_BITS ) )
+					{
+						out.Write( 1, 1 );
+						out.WriteSigned( nDelta, SNAPSHOT_DELTA_BITS );
+					}
+					else
+					{
+						out.Write( 0, 1 );
+						out.WriteSigned( itCur->m_aFields[i], m_schema.GetField( i ).m_nBits );
+					}
+				}
+			}
+			++itCur;
+			++itBase;
+		}
+	}
+	out.Write( 0, 1 );
+
+	if( out.IsOverflowed() ) return -1;
+
+	// Keep it; the client may ack it and make it the next baseline.
+	int nSlot = nSequence % SNAPSHOT_HISTORY;
+	m_aHistory[nSlot] = current;
+	m_aHistorySeq[nSlot] = nSequence;
+	m_nSequence = (nSequence + 1) & SEQUENCE_MASK;
+
+	// Acks older than the history can no longer be used.
+	if( m_nAcked != SNAPSHOT_NO_SEQUENCE && m_aHistorySeq[m_nAcked % SNAPSHOT_HISTORY] != m_nAcked )
+		m_nAcked = SNAPSHOT_NO_SEQUENCE;
+
+	return out.GetBytes();
+}
+
+bool SnapshotSender::Write( const Snapshot& current, Packet* pPacket )
+{
+	int nLength = pPacket->GetLength();
+	int nResult = Write( current, pPacket->GetData() + nLength, MAX_PACKET_DATA - nLength );
+	if( nResult < 0 ) return false;
+	pPacket->SetLength( nLength + nResult );
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SnapshotReceiver
+//////////////////////////////////////////////////////////////////////
+
+SnapshotReceiver::SnapshotReceiver( const SnapshotSchema& schema ) :
+	m_schema(schema), m_nLatest(SNAPSHOT_NO_SEQUENCE),
+	m_pInterpolator(NULL), m_fTick(0), m_fSequenceTime(0)
+{
+	for( int i = 0; i < SNAPSHOT_HISTORY; i++ ) m_aHistorySeq[i] = SNAPSHOT_NO_SEQUENCE;
+}
+
+SnapshotReceiver::~SnapshotReceiver()
+{
+}
+
+int SnapshotReceiver::Read( Packet* pPacket )
+{
+	return Read( pPacket->GetData(), pPacket->GetLength() );
+}
+
+int SnapshotReceiver::Read( const unsigned char* pData, int nLength )
+{
+	int nFields = m_schema.GetFieldCount();
+	BitReader in( pData, nLength );
+
+	int nSequence = (int)in.Read( 16 );
+	if( in.IsOverflowed() ) return SNAPSHOT_NO_SEQUENCE;
+
+	// Drop duplicates and anything older than what we show.
+	if( m_nLatest != SNAPSHOT_NO_SEQUENCE && !sequenceNewer( nSequence, m_nLatest ) )
+		return SNAPSHOT_NO_SEQUENCE;
+
+	static const Snapshot s_empty;
+	const Snapshot* pBase = &s_empty;
+	if( in.Read( 1 ) )
+	{
+		int nBase = (int)in.Read( 16 );
+		if( m_aHistorySeq[nBase % SNAPSHOT_HISTORY] != nBase ) return SNAPSHOT_NO_SEQUENCE;
+		pBase = &m_aHistory[nBase % SNAPSHOT_HISTORY];
+	}
+
+	// Rebuild the snapshot into its history slot, walking the baseline
+	// alongside the records. The slot is not marked valid until the
+	// whole snapshot has decoded.
+	int nSlot = nSequence % SNAPSHOT_HISTORY;
+	Snapshot& next = m_aHistory[nSlot];
+	if( &next == pBase ) return SNAPSHOT_NO_SEQUENCE;
+	m_aHistorySeq[nSlot] = SNAPSHOT_NO_SEQUENCE;
+	next.clear();
+	next.reserve( pBase->size() + 16 );
+
+	Snapshot::const_iterator itBase = pBase->begin();
+	int nLastId = 0;
+	bool bFirst = true;
+	while( in.Read( 1 ) )
+	{
+		int nId = readId( in, nLastId );
+		int nKind = (int)in.Read( 2 );
+		if( in.IsOverflowed() || nId > 0xFFFF || (!bFirst && nId <= nLastId) )
+			return SNAPSHOT_NO_SEQUENCE;
+		nLastId = nId;
+		bFirst = false;
+
+		while( itBase != pBase->end() && itBase->m_nId < nId ) next.push_back( *itBase++ );
+		bool bInBase = (itBase != pBase->end() && itBase->m_nId == nId);
+
+		switch( nKind )
+		{
+		case RECORD_NEW:
+			{
+				EntityState state;
+				memset( &state, 0, sizeof(state) );
+				state.m_nId = (unsigned short)nId;
+				for( int i = 0; i < nFields; i++ )
+					state.m_aFields[i] = in.ReadSigned( m_schema.GetField( i ).m_nBits );
+				next.push_back( state );
+			}
+			break;
+
+		case RECORD_UPDATE:
+			{
+				if( !bInBase ) return SNAPSHOT_NO_SEQUENCE;
+				EntityState state = *itBase;
+				unsigned int nMask = in.Read( nFields );
+				for( int i = 0; i < nFields; i++ )
+				{
+					if( !(nMask & (1U << i)) ) continue;
+					if( in.Read( 1 ) )
+						state.m_aFields[i] = (int)((unsigned int)state.m_aFields[i] + (unsigned int)in.ReadSigned( SNAPSHOT_DELTA_BITS ));
+					else
+						state.m_aFields[i] = in.ReadSigned( m_schema.GetField( i ).m_nBits );
+				}
+				next.push_back( state );
+			}
+			break;
+
+		case RECORD_REMOVED:
+			if( !bInBase ) return SNAPSHOT_NO_SEQUENCE;
+			break;
+
+		default:
+			return SNAPSHOT_NO_SEQUENCE;
+		}
+
+		if( bInBase ) ++itBase;
+	}
+	while( itBase != pBase->end() ) next.push_back( *itBase++ );
+
+	if( in.IsOverflowed() ) return SNAPSHOT_NO_SEQUENCE;
+	int nPrevious = m_nLatest;
+	m_aHistorySeq[nSlot] = nSequence;
+	m_nLatest = nSequence;
+
+	// Compare with what is on screen, which may be newer than the
+	// baseline the server used.
+	m_lstAdded.clear();
+	m_lstRemoved.clear();
+	m_lstChanged.clear();
+	Snapshot::const_iterator itOld = m_current.begin();
+	Snapshot::const_iterator itNew = next.begin();
+	while( itOld != m_current.end() || itNew != next.end() )
+	{
+		if( itOld == m_current.end() || (itNew != next.end() && itNew->m_nId < itOld->m_nId) )
+		{
+			m_lstAdded.push_back( itNew->m_nId );
+			m_lstChanged.push_back( itNew->m_nId );
+			++itNew;
+		}
+		else if( itNew == next.end() || itOld->m_nId < itNew->m_nId )
+		{
+			m_lstRemoved.push_back( itOld->m_nId );
+			++itOld;
+		}
+		else
+		{
+			if( memcmp( itOld->m_aFields, itNew->m_aFields, nFields * sizeof(int) ) )
+				m_lstChanged.push_back( itNew->m_nId );
+			++itOld;
+			++itNew;
+		}
+	}
+	m_current = next;
+
+	if( m_pInterpolator )
+	{
+		for( size_t i = 0; i < m_lstRemoved.size(); i++ ) m_pInterpolator->Remove( m_lstRemoved[i] );
+		AddSamples( nSequence, nPrevious );
+		return nSequence;
+	}
+
+	for( size_t i = 0; i < m_lstRemoved.size(); i++ ) Unbind( m_lstRemoved[i] );
+
+	if( !m_bindings.empty() )
+	{
+		for( size_t i = 0; i < m_lstChanged.size(); i++ )
+		{
+			BindingMap::iterator it = m_bindings.find( m_lstChanged[i] );
+			if( it != m_bindings.end() )
+				ApplyEntity( *snapshot_Find( m_current, m_lstChanged[i] ), it->second );
+		}
+	}
+
+	return nSequence;
+}
+
+void SnapshotReceiver::AddSamples( int nSequence, int nPrevious )
+{
+	// Every entity gets a sample each snapshot, changed or not, so a
+	// stop is not smeared across the gap to its next move.
+	double fTime;
+	if( m_fTick > 0 )
+	{
+		if( nPrevious != SNAPSHOT_NO_SEQUENCE )
+			m_fSequenceTime += ((nSequence - nPrevious) & SEQUENCE_MASK) * m_fTick;
+		fTime = m_fSequenceTime;
+	}
+	else
+	{
+		fTime = timer_Now();
+	}
+
+	float aValues[INTERP_CHANNELS];
+	unsigned int nMask = m_schema.GetChannelMask();
+	for( Snapshot::iterator it = m_current.begin(); it != m_current.end(); ++it )
+	{
+		m_schema.GetChannels( it->m_aFields, aValues );
+		m_pInterpolator->AddSample( it->m_nId, fTime, aValues, nMask );
+	}
+}
+
+void SnapshotReceiver::SetInterpolator( EntityInterpolator* pInterpolator, double fTickSeconds )
+{
+	m_pInterpolator = pInterpolator;
+	m_fTick = fTickSeconds;
+
+	// Nodes bound so far move with the interpolator from now on.
+	if( pInterpolator )
+	{
+		for( BindingMap::iterator it = m_bindings.begin(); it != m_bindings.end(); ++it )
+			pInterpolator->Bind( it->first, it->second );
+		m_bindings.clear();
+	}
+}
+
+void SnapshotReceiver::Bind( unsigned short nId, QSGTransformNode* pNode )
+{
+	if( m_pInterpolator )
+	{
+		m_pInterpolator->Bind( nId, pNode );
+		return;
+	}
+
+	m_bindings[nId] = pNode;
+
+	// Show the current state straight away.
+	EntityState* pState = snapshot_Find( m_current, nId );
+	if( pState ) ApplyEntity( *pState, pNode );
+}
+
+void SnapshotReceiver::Unbind( unsigned short nId )
+{
+	if( m_pInterpolator ) m_pInterpolator->Bind( nId, NULL );
+	m_bindings.erase( nId );
+}
+
+void SnapshotReceiver::ApplyEntity( const EntityState& state, QSGTransformNode* pNode )
+{
+	float aValues[INTERP_CHANNELS];
+	m_schema.GetChannels( state.m_aFields, aValues );
+	interp_ApplyChannels( pNode->m_transform, aValues, m_schema.GetChannelMask() );
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Lua bindings
+//////////////////////////////////////////////////////////////////////
+
+// The sender keeps the entity table that scripts update with set and
+// remove; write encodes it against the last acked snapshot.
+struct LuaSender
+{
+	LuaSender( const SnapshotSchema& schema ) : m_sender(schema) {}
+
+	SnapshotSender m_sender;
+	Snapshot m_current;
+};
+
+// schema is an array of { name=, bits=, scale= } in field order.
+static void check_schema(lua_State *L, int index, SnapshotSchema* schema) {
+	luaL_checktype(L, index, LUA_TTABLE);
+	int n = (int) lua_objlen(L, index);
+	for (int i = 1; i <= n; ++i) {
+		lua_rawgeti(L, index, i);
+		if (!lua_istable(L, -1)) luaL_argerror(L, index, "schema fields must be tables");
+		lua_getfield(L, -1, "name");
+		lua_getfield(L, -2, "bits");
+		lua_getfield(L, -3, "scale");
+		const char* name = lua_tostring(L, -3);
+		int bits = (int) luaL_optinteger(L, -2, 16);
+		float scale = (float) luaL_optnumber(L, -1, 1);
+		if (!schema->AddField(name ? name : "", bits, scale))
+			luaL_argerror(L, index, "bad schema field (at most 16 fields of 2 to 32 bits)");
+		lua_pop(L, 4);
+	}
+}
+
+static unsigned short check_id(lua_State *L, int index) {
+	lua_Integer id = luaL_checkinteger(L, index);
+	if (id < 0 || id > 0xFFFF) luaL_argerror(L, index, "entity id out of range");
+	return (unsigned short) id;
+}
+
+static LuaSender* check_sender(lua_State *L, int index) {
+	return (LuaSender*) luaL_checkudata(L, index, SENDER_METATABLE);
+}
+
+static SnapshotReceiver* check_receiver(lua_State *L, int index) {
+	return (SnapshotReceiver*) luaL_checkudata(L, index, RECEIVER_METATABLE);
+}
+
+static EntityInterpolator* check_interpolator(lua_State *L, int index) {
+	return (EntityInterpolator*) luaL_checkudata(L, index, INTERP_METATABLE);
+}
+
+static const char* interp_modes[] = {
+	"linear",
+	"hermite",
+	NULL
+};
+
+// Times from Lua are in milliseconds, like the deltas given to sg_update.
+static void set_interp_options(lua_State *L, int index, EntityInterpolator* interp) {
+	lua_getfield(L, index, "delay");
+	if (!lua_isnil(L, -1)) interp->SetDelay(lua_tonumber(L, -1) * 0.001);
+	lua_getfield(L, index, "extrapolate");
+	if (!lua_isnil(L, -1)) interp->SetMaxExtrapolation(lua_tonumber(L, -1) * 0.001);
+	lua_getfield(L, index, "mode");
+	if (!lua_isnil(L, -1)) interp->SetMode(luaL_checkoption(L, -1, NULL, interp_modes));
+	lua_pop(L, 3);
+}
+
+static int replication_new_sender(lua_State *L) {
+	SnapshotSchema schema;
+	check_schema(L, 1, &schema);
+	new (lua_newuserdata(L, sizeof(LuaSender))) LuaSender(schema);
+	luaL_getmetatable(L, SENDER_METATABLE);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int replication_new_receiver(lua_State *L) {
+	SnapshotSchema schema;
+	check_schema(L, 1, &schema);
+	new (lua_newuserdata(L, sizeof(SnapshotReceiver))) SnapshotReceiver(schema);
+	luaL_getmetatable(L, RECEIVER_METATABLE);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// replication.newInterpolator { delay=ms, extrapolate=ms, mode="hermite" }
+static int replication_new_interpolator(lua_State *L) {
+	EntityInterpolator* interp = new (lua_newuserdata(L, sizeof(EntityInterpolator))) EntityInterpolator();
+	luaL_getmetatable(L, INTERP_METATABLE);
+	lua_setmetatable(L, -2);
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		set_interp_options(L, 1, interp);
+	}
+	return 1;
+}
+
+static int sender_gc(lua_State *L) {
+	LuaSender* sender = check_sender(L, 1);
+	sender->~LuaSender();
+	return 0;
+}
+
+// sender:set(id, ...) with one value per schema field.
+static int sender_set(lua_State *L) {
+	LuaSender* sender = check_sender(L, 1);
+	const SnapshotSchema& schema = sender->m_sender.GetSchema();
+	EntityState* state = snapshot_Insert(sender->m_current, check_id(L, 2));
+	int n = schema.GetFieldCount();
+	for (int i = 0; i < n; ++i)
+		state->m_aFields[i] = schema.Quantize(i, (float) lua_tonumber(L, i + 3));
+	return 0;
+}
+
+static int sender_remove(lua_State *L) {
+	LuaSender* sender = check_sender(L, 1);
+	snapshot_Remove(sender->m_current, check_id(L, 2));
+	return 0;
+}
+
+static int sender_write(lua_State *L) {
+	LuaSender* sender = check_sender(L, 1);
+	static unsigned char buf[MAX_PACKET_DATA];
+	int len = sender->m_sender.Write(sender->m_current, buf, sizeof(buf));
+	if (len < 0) luaL_error(L, "snapshot too large for a packet");
+	lua_pushlstring(L, (const char*) buf, len);
+	return 1;
+}
+
+static int sender_ack(lua_State *L) {
+	LuaSender* sender = check_sender(L, 1);
+	sender->m_sender.Acknowledge((int) luaL_checkinteger(L, 2));
+	return 0;
+}
+
+static int receiver_gc(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	receiver->~SnapshotReceiver();
+	return 0;
+}
+
+static void push_ids(lua_State *L, const std::vector<unsigned short>& ids) {
+	lua_createtable(L, (int) ids.size(), 0);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		lua_pushinteger(L, ids[i]);
+		lua_rawseti(L, -2, (int) i + 1);
+	}
+}
+
+// receiver:apply(data) returns the sequence to ack and the lists of
+// added and removed ids, or nil if the snapshot was dropped.
+static int receiver_apply(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	size_t size = 0;
+	const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 2, &size);
+	int seq = receiver->Read(data, (int) size);
+	if (seq == SNAPSHOT_NO_SEQUENCE) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushinteger(L, seq);
+	push_ids(L, receiver->m_lstAdded);
+	push_ids(L, receiver->m_lstRemoved);
+	return 3;
+}
+
+// receiver:setInterpolator(interp [, tick]) routes bound entities through
+// an interpolator; tick is the sender's snapshot interval in ms, or 0 to
+// time snapshots on arrival. receiver:setInterpolator(nil) turns it off.
+static int receiver_set_interpolator(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	EntityInterpolator* interp = NULL;
+	if (!lua_isnoneornil(L, 2)) interp = check_interpolator(L, 2);
+	double tick = luaL_optnumber(L, 3, 0) * 0.001;
+	receiver->SetInterpolator(interp, tick);
+
+	// keep the interpolator alive while the receiver uses it.
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, 1);
+	return 0;
+}
+
+static int receiver_bind(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	unsigned short id = check_id(L, 2);
+	QSGTransformNode* node = dynamic_cast<QSGTransformNode*>(g_controller->checkObject(3));
+	if (!node) luaL_argerror(L, 3, "expecting a transform node");
+	receiver->Bind(id, node);
+	return 0;
+}
+
+static int receiver_unbind(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	receiver->Unbind(check_id(L, 2));
+	return 0;
+}
+
+// receiver:get(id) returns the entity's fields, or nothing.
+static int receiver_get(lua_State *L) {
+	SnapshotReceiver* receiver = check_receiver(L, 1);
+	EntityState* state = snapshot_Find(receiver->GetCurrent(), check_id(L, 2));
+	if (!state) return 0;
+	const SnapshotSchema& schema = receiver->GetSchema();
+	int n = schema.GetFieldCount();
+	luaL_checkstack(L, n, "too many fields in get");
+	for (int i = 0; i < n; ++i)
+		lua_pushnumber(L, schema.Dequantize(i, state->m_aFields[i]));
+	return n;
+}
+
+static int interp_gc(lua_State *L) {
+	EntityInterpolator* interp = check_interpolator(L, 1);
+	interp->~EntityInterpolator();
+	return 0;
+}
+
+static int interp_set_options(lua_State *L) {
+	EntityInterpolator* interp = check_interpolator(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	set_interp_options(L, 2, interp);
+	return 0;
+}
+
+// interp:push(id, time, { x=, y=, angle=, sx=, sy=, r=, g=, b=, a= })
+// for entities that do not come from a receiver. time is in ms on the
+// sender's clock; only the fields present are driven.
+static int interp_push(lua_State *L) {
+	EntityInterpolator* interp = check_interpolator(L, 1);
+	unsigned short id = check_id(L, 2);
+	double time = luaL_checknumber(L, 3) * 0.001;
+	luaL_checktype(L, 4, LUA_TTABLE);
+	float values[INTERP_CHANNELS];
+	unsigned int mask = 0;
+	for (int c = 0; c < INTERP_CHANNELS; ++c) {
+		lua_getfield(L, 4, s_channelNames[c]);
+		values[c] = (float) lua_tonumber(L, -1);
+		if (!lua_isnil(L, -1)) mask |= 1U << c;
+		lua_pop(L, 1);
+	}
+	interp->AddSample(id, time, values, mask);
+	return 0;
+}
+
+static int interp_bind(lua_State *L) {
+	EntityInterpolator* interp = check_interpolator(L, 1);
+	unsigned short id = check_id(L, 2);
+	QSGTransformNode* node = NULL;
+	if (!lua_isnoneornil(L, 3)) {
+		node = dynamic_cast<QSGTransformNode*>(g_controller->checkObject(3));
+		if (!node) luaL_argerror(L, 3, "expecting a transform node");
+	}
+	interp->Bind(id, node);
+	return 0;
+}
+
+static int interp_remove(lua_State *L) {
+	EntityInterpolator* interp = check_interpolator(L, 1);
+	interp->Remove(check_id(L, 2));
+	return 0;
+}
+
+static const luaL_Reg sender_methods[] = {
+	{"set", sender_set},
+	{"remove", sender_remove},
+	{"write", sender_write},
+	{"ack", sender_ack},
+	{"__gc", sender_gc},
+	{NULL, NULL}
+};
+
+static const luaL_Reg receiver_methods[] = {
+	{"apply", receiver_apply},
+	{"bind", receiver_bind},
+	{"unbind", receiver_unbind},
+	{"get", receiver_get},
+	{"setInterpolator", receiver_set_interpolator},
+	{"__gc", receiver_gc},
+	{NULL, NULL}
+};
+
+static const luaL_Reg interp_methods[] = {
+	{"setOptions", interp_set_options},
+	{"push", interp_push},
+	{"bind", interp_bind},
+	{"remove", interp_remove},
+	{"__gc", interp_gc},
+	{NULL, NULL}
+};
+
+static const luaL_Reg replication_funcs[] = {
+	{"newSender", replication_new_sender},
+	{"newReceiver", replication_new_receiver},
+	{"newInterpolator", replication_new_interpolator},
+	{NULL, NULL}
+};
+
+static void register_methods(lua_State *L, const char* name, const luaL_Reg* methods) {
+	luaL_newmetatable(L, name);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_register(L, NULL, methods);
+	lua_pop(L, 1);
+}
+
+int luaopen_replication( lua_State* L )
+{
+	register_methods(L, SENDER_METATABLE, sender_methods);
+	register_methods(L, RECEIVER_METATABLE, receiver_methods);
+	register_methods(L, INTERP_METATABLE, interp_methods);
+	luaL_register(L, "replication", replication_funcs);
+	return 1;
+}
@@ -0,0 +1,174 @@
+// Replication.h: delta-compressed entity snapshots
+//
+// A server builds a Snapshot of its entities every tick and gives it to
+// the SnapshotSender of each connection. The sender encodes only what
+// changed since the last snapshot the client acknowledged, as
+// bit-packed per-field deltas. The client's SnapshotReceiver rebuilds
+// the full snapshot and writes the fields of bound entities straight
+// into their scene-graph nodes.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_REPLICATION_H
+#define FGM_REPLICATION_H
+
+#include <vector>
+#include <map>
+
+#include "QSGObject.h"
+#include "Interpolation.h"
+
+struct lua_State;
+class Packet;
+class QSGTransformNode;
+
+#define SNAPSHOT_MAX_FIELDS		16
+#define SNAPSHOT_HISTORY		32		// snapshots kept as baselines
+#define SNAPSHOT_DELTA_BITS		7		// bits for a small field change
+#define SNAPSHOT_NO_SEQUENCE	-1
+
+struct SnapshotField
+{
+	char m_szName[16];
+	int m_nBits;			// signed fixed-point width, 2 to 32
+	float m_fScale;			// fixed-point units per unit
+	int m_nChannel;			// InterpChannel it drives, or -1
+};
+
+// Describes the fields every entity carries. Both ends of a connection
+// must use the same schema. Fields named x, y, angle, sx, sy, r, g, b
+// or a drive that part of a bound node's transform.
+//
+class SnapshotSchema
+{
+public:
+	SnapshotSchema() : m_nChannelMask(0) {}
+
+	// Add a field; returns false if the schema is full or the width is
+	// out of range.
+	bool AddField( const char* szName, int nBits, float fScale );
+
+	inline int GetFieldCount() const { return (int)m_fields.size(); }
+	inline const SnapshotField& GetField( int nField ) const { return m_fields[nField]; }
+
+	int Quantize( int nField, float fValue ) const;
+	float Dequantize( int nField, int nValue ) const;
+
+	// The transform channels an entity drives, as values and a mask
+	// for interp_ApplyChannels.
+	void GetChannels( const int* aFields, float* aValues ) const;
+	inline unsigned int GetChannelMask() const { return m_nChannelMask; }
+
+protected:
+	std::vector<SnapshotField> m_fields;
+	unsigned int m_nChannelMask;
+};
+
+// The quantized state of one entity.
+//
+struct EntityState
+{
+	unsigned short m_nId;
+	int m_aFields[SNAPSHOT_MAX_FIELDS];
+};
+
+// All entities at one tick, sorted by id.
+//
+typedef std::vector<EntityState> Snapshot;
+
+// Find an entity in a snapshot, or NULL.
+EntityState* snapshot_Find( Snapshot& snapshot, unsigned short nId );
+
+// Find or insert an entity, keeping the snapshot sorted.
+EntityState* snapshot_Insert( Snapshot& snapshot, unsigned short nId );
+
+void snapshot_Remove( Snapshot& snapshot, unsigned short nId );
+
+// Server end of one connection.
+//
+class SnapshotSender
+{
+public:
+	SnapshotSender( const SnapshotSchema& schema );
+
+	// Encode 'current' against the newest acknowledged baseline and keep
+	// it as a future baseline. Returns the number of bytes written, or
+	// -1 if the buffer was too small.
+	int Write( const Snapshot& current, unsigned char* pBuffer, int nCapacity );
+
+	// Append to a packet under construction.
+	bool Write( const Snapshot& current, Packet* pPacket );
+
+	// The client has this snapshot, so it can be used as a baseline.
+	void Acknowledge( int nSequence );
+
+	inline const SnapshotSchema& GetSchema() const { return m_schema; }
+
+protected:
+	SnapshotSchema m_schema;
+	Snapshot m_aHistory[SNAPSHOT_HISTORY];
+	int m_aHistorySeq[SNAPSHOT_HISTORY];
+	int m_nSequence;
+	int m_nAcked;
+};
+
+// Client end of one connection.
+//
+class SnapshotReceiver
+{
+public:
+	SnapshotReceiver( const SnapshotSchema& schema );
+	virtual ~SnapshotReceiver();
+
+	// Decode a snapshot and apply it to bound nodes, directly or through
+	// the interpolator if one is set. Returns the sequence
+	// number to acknowledge, or SNAPSHOT_NO_SEQUENCE if the data is
+	// corrupt, stale or refers to a baseline we do not have.
+	int Read( const unsigned char* pData, int nLength );
+	int Read( Packet* pPacket );
+
+	// Drive a node from an entity's fields. The binding holds a reference
+	// to the node and is dropped when the entity is removed.
+	void Bind( unsigned short nId, QSGTransformNode* pNode );
+	void Unbind( unsigned short nId );
+
+	// Feed snapshots to an interpolator instead of writing nodes directly.
+	// With a tick interval, samples are timed by sequence number, which
+	// hides network jitter; with zero they are timed on arrival. Nodes
+	// already bound are handed to the interpolator.
+	void SetInterpolator( EntityInterpolator* pInterpolator, double fTickSeconds );
+
+	inline const SnapshotSchema& GetSchema() const { return m_schema; }
+	inline Snapshot& GetCurrent() { return m_current; }
+
+	// Entities added and removed by the last Read.
+	std::vector<unsigned short> m_lstAdded;
+	std::vector<unsigned short> m_lstRemoved;
+
+protected:
+	// Called for each bound entity that changed in the last Read.
+	virtual void ApplyEntity( const EntityState& state, QSGTransformNode* pNode );
+
+	void AddSamples( int nSequence, int nPrevious );
+
+protected:
+	typedef std::map<unsigned short, ref_ptr<QSGTransformNode> > BindingMap;
+
+	SnapshotSchema m_schema;
+	Snapshot m_aHistory[SNAPSHOT_HISTORY];
+	int m_aHistorySeq[SNAPSHOT_HISTORY];
+	Snapshot m_current;
+	int m_nLatest;
+	BindingMap m_bindings;
+	std::vector<unsigned short> m_lstChanged;
+
+	EntityInterpolator* m_pInterpolator;
+	double m_fTick;
+	double m_fSequenceTime;		// of m_nLatest, when timed by sequence
+};
+
+// Register the replication library with Lua.
+//
+int luaopen_replication( lua_State* L );
+
+#endif // FGM_REPLICATION_H
@@ -0,0 +1,376 @@
+// SceneBenchMain.cpp: microbenchmarks for the scene graph
+//
+// Builds a synthetic tree of QSGFrame, QSGClipView and QSGGraphic nodes
+// and times the operations scripts lean on: building the tree, traversal
+// with a null renderer, reparenting, transform updates, and generating a
+// frame's command list (recording it with QSGRecordingRenderer over a
+// null renderer). Each benchmark runs -repeat times and the fastest and
+// median runs are logged and written out as JSON (scenebench.json by
+// default), to compare across commits.
+//
+// Interior nodes are frames and clip views in proportion to the mix, as
+// graphics do not render children; leaves can be any of the three.
+//
+//   scenebench [-depth N] [-fanout N] [-mix frame:clip:graphic]
+//              [-iterations N] [-repeat N] [-seed N] [-json file]
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "Logger.h"
+#include "Timer.h"
+#include "QSGNullRenderer.h"
+#include "QSGRecordingRenderer.h"
+#include "QSGFrame.h"
+#include "QSGClipView.h"
+#include "QSGGraphic.h"
+
+const char *c_logFilename = "scenebench.log";
+
+struct SceneBenchOptions
+{
+	int m_nDepth;				// levels below the root
+	int m_nFanout;				// children of each interior node
+	int m_aMix[3];				// weights of frame, clip, graphic
+	int m_nIterations;			// operations per timed run
+	int m_nRepeat;				// timed runs per benchmark
+	unsigned int m_nSeed;
+	const char* m_szJson;
+};
+
+// Timings for one benchmark, per operation.
+struct BenchResult
+{
+	const char* m_szName;
+	long m_nOps;				// operations per run
+	double m_fMin;				// seconds per operation
+	double m_fMedian;
+};
+
+// The synthetic scene. Nodes do not own their children, so every node
+// is held here for the life of the scene.
+struct Scene
+{
+	ref_ptr<QSGFrame> m_root;
+	std::vector<ref_ptr<QSGTransformNode> > m_nodes;	// all but the root
+	std::vector<QSGNode*> m_interior;					// deepest parents of leaves
+	std::vector<QSGNode*> m_leaves;
+	ref_ptr<QSGTexture> m_texture;
+};
+
+static unsigned int g_seed = 1;
+
+static unsigned int nextRandom(void)
+{
+	g_seed = g_seed * 1103515245 + 12345;
+	return (g_seed >> 16) & 0x7fff;
+}
+
+static QSGTransformNode* createNode(Scene& scene, int kind)
+{
+	float size = (float)(8 + nextRandom() % 24);
+	if (kind == 0) {
+		QSGFrame* frame = new QSGFrame();
+		frame->m_texture = scene.m_texture;
+		frame->m_left = frame->m_bottom = -size;
+		frame->m_right = frame->m_top = size;
+		return frame;
+	}
+	if (kind == 1) {
+		QSGClipView* clip = new QSGClipView();
+		clip->m_left = clip->m_bottom = -size * 4;
+		clip->m_right = clip->m_top = size * 4;
+		return clip;
+	}
+	QSGGraphic* graphic = new QSGGraphic();
+	static const float verts[] = { -1, -1, 1, -1, 1, 1, -1, 1 };
+	static const float coords[] = { 0, 1, 1, 1, 1, 0, 0, 0 };
+	graphic->m_texture = scene.m_texture;
+	graphic->m_geometry.quads = true;
+	for (int i = 0; i < 8; ++i) {
+		graphic->m_geometry.verts.push_back(verts[i] * size);
+		graphic->m_geometry.coords.push_back(coords[i]);
+	}
+	for (unsigned short i = 0; i < 4; ++i) graphic->m_geometry.indices.push_back(i);
+	return graphic;
+}
+
+static int pickKind(const SceneBenchOptions& options, bool leaf)
+{
+	int total = options.m_aMix[0] + options.m_aMix[1] + (leaf ? options.m_aMix[2] : 0);
+	if (total <= 0) return 0;
+	int pick = (int)(nextRandom() % total);
+	if (pick < options.m_aMix[0]) return 0;
+	if (pick < options.m_aMix[0] + options.m_aMix[1]) return 1;
+	return 2;
+}
+
+static void buildChildren(Scene& scene, const SceneBenchOptions& options, QSGNode* parent, int depth)
+{
+	bool leaf = (depth == options.m_nDepth);
+	if (leaf) {
+		// keep the parent for reparenting leaves later.
+		if (scene.m_interior.empty() || scene.m_interior.back() != parent)
+			scene.m_interior.push_back(parent);
+	}
+	for (int i = 0; i < options.m_nFanout; ++i) {
+		QSGTransformNode* node = createNode(scene, pickKind(options, leaf));
+		node->m_transform.pos = QSGVec2((float)(nextRandom() % 200) - 100, (float)(nextRandom() % 200) - 100);
+		scene.m_nodes.push_back(node);
+		parent->appendChild(node);
+		if (leaf) scene.m_leaves.push_back(node);
+		else buildChildren(scene, options, node, depth + 1);
+	}
+}
+
+static void clearScene(Scene& scene)
+{
+	scene.m_root = 0;
+	scene.m_nodes.clear();
+	scene.m_interior.clear();
+	scene.m_leaves.clear();
+}
+
+static void buildScene(Scene& scene, const SceneBenchOptions& options)
+{
+	// a small texture, so the texture paths run; the null renderer
+	// never reads it.
+	scene.m_texture = new QSGTexture();
+	scene.m_texture->m_width = scene.m_texture->m_height = 4;
+	scene.m_texture->m_components = 4;
+	scene.m_texture->m_data = (unsigned char*) calloc(4 * 4 * 4, 1);
+
+	scene.m_root = new QSGFrame();
+	if (options.m_nDepth > 0) buildChildren(scene, options, scene.m_root, 1);
+}
+
+
+// ---------------------------------------------------------------------
+
+static double median(std::vector<double> times)
+{
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+static BenchResult makeResult(const char* name, long ops, const std::vector<double>& runs)
+{
+	BenchResult result;
+	result.m_szName = name;
+	result.m_nOps = ops;
+	result.m_fMin = *std::min_element(runs.begin(), runs.end()) / ops;
+	result.m_fMedian = median(runs) / ops;
+	return result;
+}
+
+BenchResult BenchBuild(Scene& scene, const SceneBenchOptions& options)
+{
+	std::vector<double> runs;
+	for (int r = 0; r < options.m_nRepeat; ++r) {
+		g_seed = options.m_nSeed;
+		clearScene(scene);
+		double start = timer_Now();
+		buildScene(scene, options);
+		runs.push_back(timer_Now() - start);
+	}
+	return makeResult("build", (long) scene.m_nodes.size() + 1, runs);
+}
+
+BenchResult BenchTraverse(Scene& scene, const SceneBenchOptions& options)
+{
+	QSGNullRenderer renderer;
+	renderer.retain(); // on the stack.
+	std::vector<double> runs;
+	for (int r = 0; r < options.m_nRepeat; ++r) {
+		double start = timer_Now();
+		for (int i = 0; i < options.m_nIterations; ++i)
+			renderer.render(scene.m_root);
+		runs.push_back(timer_Now() - start);
+	}
+	return makeResult("traverse_node", (long) options.m_nIterations * (scene.m_nodes.size() + 1), runs);
+}
+
+BenchResult BenchTransforms(Scene& scene, const SceneBenchOptions& options)
+{
+	// what an animation script does to every node each frame.
+	std::vector<double> runs;
+	size_t count = scene.m_nodes.size();
+	for (int r = 0; r < options.m_nRepeat; ++r) {
+		double start = timer_Now();
+		for (int i = 0; i < options.m_nIterations; ++i) {
+			float t = i * 0.016f;
+			for (size_t n = 0; n < count; ++n) {
+				QSGTransform& trans = scene.m_nodes[n]->m_transform;
+				trans.pos.x += t;
+				trans.pos.y -= t;
+				trans.angle = t * 30;
+				trans.scale = QSGVec2(1 + t * 0.01f, 1 + t * 0.01f);
+				trans.col.a = 0.5f + (n & 1) * 0.5f;
+			}
+		}
+		runs.push_back(timer_Now() - start);
+	}
+	return makeResult("transform_update", (long) options.m_nIterations * (long) count, runs);
+}
+
+// Move random leaves between the deepest parents: remove a batch, then
+// append half of it and insert the rest at random positions. Leaves have
+// no children, so this can never create a cycle.
+void BenchReparent(Scene& scene, const SceneBenchOptions& options, std::vector<BenchResult>& results)
+{
+	std::vector<double> removeRuns, appendRuns, insertRuns;
+	size_t numLeaves = scene.m_leaves.size(), numParents = scene.m_interior.size();
+	size_t batch = std::min(numLeaves, (size_t) options.m_nIterations);
+	size_t half = batch / 2;
+	if (half < 1 || !numParents) return;
+
+	std::vector<QSGNode*> leaves(batch), parents(batch);
+	std::vector<size_t> indices(batch);
+	for (int r = 0; r < options.m_nRepeat; ++r) {
+		// choose distinct leaves and where they go, outside the timing.
+		g_seed = options.m_nSeed + r;
+		for (size_t i = 0; i < batch; ++i) {
+			std::swap(scene.m_leaves[i], scene.m_leaves[i + nextRandom() % (numLeaves - i)]);
+			leaves[i] = scene.m_leaves[i];
+			parents[i] = scene.m_interior[nextRandom() % numParents];
+			indices[i] = nextRandom() % (options.m_nFanout + 1);
+		}
+
+		double start = timer_Now();
+		for (size_t i = 0; i < batch; ++i)
+			leaves[i]->getParent()->removeChild(leaves[i]);
+		double removed = timer_Now();
+		for (size_t i = 0; i < half; ++i)
+			parents[i]->appendChild(leaves[i]);
+		double appended = timer_Now();
+		for (size_t i = half; i < batch; ++i)
+			parents[i]->insertChild(indices[i], leaves[i]);
+		double inserted = timer_Now();
+
+		removeRuns.push_back(removed - start);
+		appendRuns.push_back(appended - removed);
+		insertRuns.push_back(inserted - appended);
+	}
+	results.push_back(makeResult("remove_child", (long) batch, removeRuns));
+	results.push_back(makeResult("append_child", (long) half, appendRuns));
+	results.push_back(makeResult("insert_child", (long) (batch - half), insertRuns));
+}
+
+BenchResult BenchRenderList(Scene& scene, const SceneBenchOptions& options, size_t* bytes)
+{
+	QSGRecordingRenderer* recorder = new QSGRecordingRenderer(new QSGNullRenderer());
+	ref_ptr<QSGRenderer> hold(recorder);
+	std::vector<double> runs;
+	for (int r = 0; r < options.m_nRepeat; ++r) {
+		double start = timer_Now();
+		for (int i = 0; i < options.m_nIterations; ++i) {
+			recorder->startCapture(1, 800, 600);
+			recorder->render(scene.m_root);
+		}
+		runs.push_back(timer_Now() - start);
+	}
+	*bytes = recorder->getTraceSize();
+	return makeResult("render_list", options.m_nIterations, runs);
+}
+
+
+// ---------------------------------------------------------------------
+
+void WriteJson(FILE* file, const SceneBenchOptions& options, const Scene& scene,
+	size_t listBytes, const std::vector<BenchResult>& results)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"config\": {\"depth\": %d, \"fanout\": %d, \"mix\": [%d, %d, %d], "
+		"\"nodes\": %d, \"leaves\": %d, \"iterations\": %d, \"repeat\": %d, \"seed\": %u},\n",
+		options.m_nDepth, options.m_nFanout, options.m_aMix[0], options.m_aMix[1], options.m_aMix[2],
+		(int) scene.m_nodes.size() + 1, (int) scene.m_leaves.size(),
+		options.m_nIterations, options.m_nRepeat, options.m_nSeed);
+	fprintf(file, "  \"render_list_bytes\": %u,\n", (unsigned int) listBytes);
+	fprintf(file, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult& r = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"ops\": %ld, \"min_ns\": %.2f, \"median_ns\": %.2f}%s\n",
+			r.m_szName, r.m_nOps, r.m_fMin * 1e9, r.m_fMedian * 1e9,
+			(i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+bool ParseOptions(int argc, char** argv, SceneBenchOptions* options)
+{
+	options->m_nDepth = 4;
+	options->m_nFanout = 6;
+	options->m_aMix[0] = 6;
+	options->m_aMix[1] = 1;
+	options->m_aMix[2] = 3;
+	options->m_nIterations = 200;
+	options->m_nRepeat = 7;
+	options->m_nSeed = 1;
+	options->m_szJson = "scenebench.json";
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-depth")) options->m_nDepth = atoi(value);
+		else if (!strcmp(arg, "-fanout")) options->m_nFanout = atoi(value);
+		else if (!strcmp(arg, "-iterations")) options->m_nIterations = atoi(value);
+		else if (!strcmp(arg, "-repeat")) options->m_nRepeat = atoi(value);
+		else if (!strcmp(arg, "-seed")) options->m_nSeed = (unsigned int) atoi(value);
+		else if (!strcmp(arg, "-json")) options->m_szJson = value;
+		else if (!strcmp(arg, "-mix")) {
+			if (sscanf(value, "%d:%d:%d", &options->m_aMix[0], &options->m_aMix[1], &options->m_aMix[2]) != 3)
+				return false;
+		}
+		else return false;
+		++i;
+	}
+
+	return options->m_nDepth >= 1 && options->m_nDepth <= 12 && options->m_nFanout >= 1 &&
+		options->m_nIterations > 0 && options->m_nRepeat > 0 &&
+		options->m_aMix[0] >= 0 && options->m_aMix[1] >= 0 && options->m_aMix[2] >= 0;
+}
+
+int main(int argc, char** argv)
+{
+	SceneBenchOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s [-depth N] [-fanout N] [-mix frame:clip:graphic]\n"
+			"       [-iterations N] [-repeat N] [-seed N] [-json file]\n", argv[0]);
+		return 2;
+	}
+
+	log_Open( c_logFilename, NULL );
+
+	Scene scene;
+	std::vector<BenchResult> results;
+	size_t listBytes = 0;
+	results.push_back(BenchBuild(scene, options));
+	log_Logf("%d nodes, %d leaves", (int) scene.m_nodes.size() + 1, (int) scene.m_leaves.size());
+	results.push_back(BenchTraverse(scene, options));
+	results.push_back(BenchTransforms(scene, options));
+	BenchReparent(scene, options, results);
+	results.push_back(BenchRenderList(scene, options, &listBytes));
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		log_Logf("  %-17s min %10.2f  median %10.2f ns/op", results[i].m_szName,
+			results[i].m_fMin * 1e9, results[i].m_fMedian * 1e9);
+	}
+
+	FILE* file = fopen(options.m_szJson, "w");
+	if (file) {
+		WriteJson(file, options, scene, listBytes, results);
+		fclose(file);
+	}
+	else log_Logf("cannot open %s", options.m_szJson);
+
+	log_Close();
+	return 0;
+}
@@ -4,6 +4,12 @@
 
 #include "Socket.h"
 #include "Packet.h"
+#include "Compression.h"
+#include "NetStats.h"
+#include "Timer.h"
+#include "TraceEvents.h"
+
+#include <stdio.h>
 
 // Socket headers
 //#include <sys/types.h>
@@ -13,15 +19,40 @@
 //#include <netinet/in.h>
 //#include <arpa/inet.h>
 
-// // #define SIM_LAG 10
+// Control frame codes
+#define CONTROL_COMPRESSION_OFF	0
+#define CONTROL_COMPRESSION_ON	1
 
-long g_nSimBandwidth = 0;
-long g_nAvailBandwidth = 0;
 
-long g_nPacketsSent = 0;
-long g_nPacketsReceived = 0;
-long g_nBytesSent = 0;
-long g_nBytesReceived = 0;
+//////////////////////////////////////////////////////////////////////
+// Traffic shaping
+//////////////////////////////////////////////////////////////////////
+
+// Queue a packet, holding it back if the shaper adds latency.
+static void queueShaped( Socket::DelayedQueue& lstDelayed, Socket::PacketQueue& lstReady,
+	Packet* pPacket, double fNow )
+{
+	if( !net_ShapeDelays() && lstDelayed.empty() )
+	{
+		lstReady.push_back( pPacket );
+		return;
+	}
+
+	Socket::DelayedPacket delayed;
+	delayed.m_fDue = net_ShapeDue( fNow, lstDelayed.size() ? lstDelayed.back().m_fDue : 0 );
+	delayed.m_pPacket = pPacket;
+	lstDelayed.push_back( delayed );
+}
+
+static void releaseShaped( Socket::DelayedQueue& lstDelayed, Socket::PacketQueue& lstReady,
+	double fNow )
+{
+	while( lstDelayed.size() && lstDelayed.front().m_fDue <= fNow )
+	{
+		lstReady.push_back( lstDelayed.front().m_pPacket );
+		lstDelayed.pop_front();
+	}
+}
 
 
 //////////////////////////////////////////////////////////////////////
@@ -32,6 +63,8 @@ int Socket::Connect( const char* szAddress, int nPort )
 {
 	Disconnect();
 
+	sprintf( m_stats.m_szName, "%.19s:%d", szAddress, nPort );
+
 	// Resolve the hostname to IP
 	PHOSTENT phe = gethostbyname( szAddress );
 	if( phe == NULL ) return E_UNKNOWN_HOST;
@@ -71,6 +104,7 @@ int Socket::Attach( SOCKET fd )
 		return SOCK_OK;
 
 	m_fdSocket = fd;
+	strcpy( m_stats.m_szName, "accepted" );
 
 	// Make the socket non-blocking
 	unsigned long nValue = 1;
@@ -82,13 +116,14 @@ int Socket::Attach( SOCKET fd )
 
 int Socket::UpdateSend()
 {
+	TRACE_ZONE( "UpdateSend", "net" );
 	if( m_fdSocket == INVALID_SOCKET ) return E_SOCKET;
 
-#ifdef SIM_LAG
-	static int socket_lag2 = 0;
-	if( !socket_lag2 ) socket_lag2 = SIM_LAG;
-	else { socket_lag2--; return SOCK_OK; }
-#endif
+	double fNow = timer_Now();
+	releaseShaped( m_lstDelayedSend, m_lstSend, fNow );
+	m_stats.SampleQueues( (int)m_lstSend.size(), (int)m_lstReceive.size() );
+
+	long nAllowance = net_ShapeAllowance( m_fSendAllowance, m_fSendShaped, fNow );
 
 	// Push all packets waiting to be sent
 	while( m_lstSend.size() )
@@ -99,12 +134,12 @@ int Socket::UpdateSend()
 		const char* pData = (const char*)pSending->GetPacketData() + m_nSentData;
 
 		int nSimLength = nLength;
-		if( g_nSimBandwidth )
+		if( nAllowance >= 0 )
 		{
 			// simulate bandwidth limit
-			if( !g_nAvailBandwidth ) break;
-			if( nSimLength > g_nAvailBandwidth )
-				nSimLength = g_nAvailBandwidth;
+			if( !nAllowance ) break;
+			if( nSimLength > nAllowance )
+				nSimLength = nAllowance;
 		}
 
 		// Try to send all remaining data
@@ -117,17 +152,17 @@ int Socket::UpdateSend()
 			break;
 		}
 
-		if( g_nSimBandwidth )
+		if( nAllowance >= 0 )
 		{
-			g_nAvailBandwidth -= nSent;
-			if( g_nAvailBandwidth < 0 ) g_nAvailBandwidth = 0;
+			nAllowance -= nSent;
+			m_fSendAllowance -= nSent;
 		}
 
 		if( nSent >= nLength )
 		{
 			// Finished sending this packet
-			g_nBytesSent += pSending->GetPacketSize();
-			g_nPacketsSent++;
+			m_stats.m_nBytesSent += pSending->GetPacketSize();
+			m_stats.m_nPacketsSent++;
 
 			pSending->Release();
 			m_lstSend.pop_front();
@@ -136,7 +171,7 @@ int Socket::UpdateSend()
 		else
 		{
 			// Network buffer is full, try again later
-			m_nSentData -= nSent;
+			m_nSentData += nSent;
 			break;
 		}
 	}
@@ -146,13 +181,13 @@ int Socket::UpdateSend()
 
 int Socket::UpdateReceive()
 {
+	TRACE_ZONE( "UpdateReceive", "net" );
 	if( m_fdSocket == INVALID_SOCKET ) return E_SOCKET;
 
-#ifdef SIM_LAG
-	static int socket_lag = 0;
-	if( !socket_lag ) socket_lag = SIM_LAG;
-	else { socket_lag--; return SOCK_OK; }
-#endif
+	double fNow = timer_Now();
+	releaseShaped( m_lstDelayedReceive, m_lstReceive, fNow );
+
+	long nAllowance = net_ShapeAllowance( m_fReceiveAllowance, m_fReceiveShaped, fNow );
 
 	// Shove all packets waiting to be received
 	for(;;)
@@ -165,13 +200,13 @@ int Socket::UpdateReceive()
 			byte* pBuffer = m_pReceiving->GetPacketData() + m_nReceivedData;
 
 			int nSimExpect = nExpect;
-			if( g_nSimBandwidth )
+			if( nAllowance >= 0 )
 			{
 				// simulate bandwidth limit
-				if( !g_nAvailBandwidth )
+				if( !nAllowance )
 					return SOCK_OK; // no data ready
-				if( nSimExpect > g_nAvailBandwidth )
-					nSimExpect = g_nAvailBandwidth;
+				if( nSimExpect > nAllowance )
+					nSimExpect = nAllowance;
 			}
 
 			long nReady = recv( m_fdSocket, (char*)pBuffer, nSimExpect, 0 );
@@ -184,21 +219,32 @@ int Socket::UpdateReceive()
 			}
 			if( nReady == 0 ) return E_CONN_CLOSED;
 
-			if( g_nSimBandwidth )
+			if( nAllowance >= 0 )
 			{
-				g_nAvailBandwidth -= nReady;
-				if( g_nAvailBandwidth < 0 ) g_nAvailBandwidth = 0;
+				nAllowance -= nReady;
+				m_fReceiveAllowance -= nReady;
 			}
 
 			if( nReady >= nExpect )
 			{
 				// Finished receiving the header
-				g_nBytesReceived += m_pReceiving->GetHeaderSize();
+				m_stats.m_nBytesReceived += m_pReceiving->GetHeaderSize();
 
 				m_bGotHeader = true;
 				m_nReceivedData = 0;
 
 				m_pReceiving->UnpackHeader();
+
+				// An empty packet has no data to wait for.
+				if( !m_pReceiving->GetLength() )
+				{
+					m_stats.m_nPacketsReceived++;
+
+					queueShaped( m_lstDelayedReceive, m_lstReceive, m_pReceiving, fNow );
+					m_pReceiving = NULL;
+					m_bGotHeader = false;
+					continue;
+				}
 			}
 			else
 			{
@@ -214,12 +260,12 @@ int Socket::UpdateReceive()
 			byte* pBuffer = m_pReceiving->GetData() + m_nReceivedData;
 
 			int nSimExpect = nExpect;
-			if( g_nSimBandwidth )
+			if( nAllowance >= 0 )
 			{
 				// simulate bandwidth limit
-				if( !g_nAvailBandwidth ) return SOCK_OK; // no data ready
-				if( nSimExpect > g_nAvailBandwidth )
-					nSimExpect = g_nAvailBandwidth;
+				if( !nAllowance ) return SOCK_OK; // no data ready
+				if( nSimExpect > nAllowance )
+					nSimExpect = nAllowance;
 			}
 
 			long nReady = recv( m_fdSocket, (char*)pBuffer, nSimExpect, 0 );
@@ -232,19 +278,19 @@ int Socket::UpdateReceive()
 			}
 			if( nReady == 0 ) return E_CONN_CLOSED;
 
-			if( g_nSimBandwidth )
+			if( nAllowance >= 0 )
 			{
-				g_nAvailBandwidth -= nReady;
-				if( g_nAvailBandwidth < 0 ) g_nAvailBandwidth = 0;
+				nAllowance -= nReady;
+				m_fReceiveAllowance -= nReady;
 			}
 
 			if( nReady >= nExpect )
 			{
 				// Finished receiving this packet
-				g_nBytesReceived += m_pReceiving->GetLength();
-				g_nPacketsReceived++;
+				m_stats.m_nBytesReceived += m_pReceiving->GetLength();
+				m_stats.m_nPacketsReceived++;
 
-				m_lstReceive.push_back( m_pReceiving );
+				queueShaped( m_lstDelayedReceive, m_lstReceive, m_pReceiving, fNow );
 				m_pReceiving = NULL;
 				m_nReceivedData = 0;
 				m_bGotHeader = false;
@@ -263,14 +309,177 @@ int Socket::UpdateReceive()
 
 void Socket::SendPacket( Packet* pPacket )
 {
-	m_lstSend.push_back( pPacket );
+	double fNow = timer_Now();
+
+	if( m_bCompressionSetting != g_bNetCompression )
+	{
+		m_bCompressionSetting = g_bNetCompression;
+		if( m_bCompressionSetting ) EnableCompression();
+		else DisableCompression();
+	}
+
+	// Simulated loss drops whole packets before they reach the
+	// compressor, so the stream itself stays intact.
+	if( net_ShapeDrops() )
+	{
+		m_stats.m_nPacketsDropped++;
+		return;
+	}
+
+	if( m_pCompressor )
+	{
+		// Queue a compressed copy; the caller keeps the original.
+		Packet* pCompressed = new Packet;
+		int nLength = m_pCompressor->Compress( pPacket->GetData(), pPacket->GetLength(),
+			pCompressed->GetData() );
+		if( nLength >= 0 )
+		{
+			pCompressed->SetLength( nLength );
+			pCompressed->CloseMessage();
+			queueShaped( m_lstDelayedSend, m_lstSend, pCompressed, fNow );
+			return;
+		}
+		pCompressed->Release();
+
+		// Too large to compress: send it as it is, with compression off,
+		// and start a new dictionary as the peer will.
+		SendControl( CONTROL_COMPRESSION_OFF, fNow );
+		queueShaped( m_lstDelayedSend, m_lstSend, pPacket, fNow );
+		pPacket->AddRef();
+		SendControl( CONTROL_COMPRESSION_ON, fNow );
+		m_pCompressor->Reset();
+		return;
+	}
+
+	queueShaped( m_lstDelayedSend, m_lstSend, pPacket, fNow );
 	pPacket->AddRef();
 }
 
 Packet* Socket::ReceivePacket()
 {
-	if( !m_lstReceive.size() ) return NULL;
-	Packet* pGot = m_lstReceive.front();
-	m_lstReceive.pop_front();
+	if( m_lstDelayedReceive.size() )
+		releaseShaped( m_lstDelayedReceive, m_lstReceive, timer_Now() );
+
+	Packet* pGot;
+	for(;;)
+	{
+		if( !m_lstReceive.size() ) return NULL;
+		pGot = m_lstReceive.front();
+		m_lstReceive.pop_front();
+		if( !pGot->IsControl() ) break;
+
+		int nCode = pGot->GetData()[0];
+		pGot->Release();
+		if( nCode == CONTROL_COMPRESSION_ON )
+		{
+			// A new dictionary, even if the last span never ended.
+			if( m_pDecompressor ) m_pDecompressor->Reset();
+			else m_pDecompressor = new PacketDecompressor;
+			m_bDecompressing = true;
+		}
+		else if( nCode == CONTROL_COMPRESSION_OFF )
+		{
+			m_bDecompressing = false;
+		}
+		m_stats.m_pReceiveCompression = m_bDecompressing ? &m_pDecompressor->GetStats() : NULL;
+	}
+
+	if( m_bDecompressing )
+	{
+		int nLength = 0;
+		const unsigned char* pData = m_pDecompressor->Decompress( pGot->GetData(),
+			pGot->GetLength(), &nLength );
+		if( !pData )
+		{
+			// The stream is out of step; nothing after this can be trusted.
+			pGot->Release();
+			Disconnect();
+			return NULL;
+		}
+
+		pGot->Clear();
+		pGot->WriteData( (unsigned char*)pData, nLength );
+		pGot->CloseMessage();
+		pGot->GetData()[nLength] = 0; // terminate packet.
+	}
+
 	return pGot;
 }
+
+void Socket::SendControl( int nCode, double fNow )
+{
+	Packet* pControl = new Packet;
+	pControl->CloseControl( nCode );
+	queueShaped( m_lstDelayedSend, m_lstSend, pControl, fNow );
+}
+
+void Socket::EnableCompression()
+{
+	if( m_pCompressor ) return;
+
+	SendControl( CONTROL_COMPRESSION_ON, timer_Now() );
+	m_pCompressor = new PacketCompressor;
+	m_stats.m_pSendCompression = &m_pCompressor->GetStats();
+}
+
+void Socket::DisableCompression()
+{
+	if( !m_pCompressor ) return;
+
+	SendControl( CONTROL_COMPRESSION_OFF, timer_Now() );
+	delete m_pCompressor;
+	m_pCompressor = NULL;
+	m_stats.m_pSendCompression = NULL;
+}
+
+// Both directions start uncompressed on the next connection.
+void Socket::ResetCompression()
+{
+	delete m_pCompressor;
+	m_pCompressor = NULL;
+	delete m_pDecompressor;
+	m_pDecompressor = NULL;
+	m_bDecompressing = false;
+	m_bCompressionSetting = false;
+
+	m_stats.m_pSendCompression = NULL;
+	m_stats.m_pReceiveCompression = NULL;
+}
+
+const CompressionStats* Socket::GetSendCompression()
+{
+	return m_pCompressor ? &m_pCompressor->GetStats() : NULL;
+}
+
+const CompressionStats* Socket::GetReceiveCompression()
+{
+	return m_bDecompressing ? &m_pDecompressor->GetStats() : NULL;
+}
+
+void Socket::DropDelayed()
+{
+	while( m_lstDelayedSend.size() )
+	{
+		m_lstDelayedSend.front().m_pPacket->Release();
+		m_lstDelayedSend.pop_front();
+	}
+	while( m_lstDelayedReceive.size() )
+	{
+		m_lstDelayedReceive.front().m_pPacket->Release();
+		m_lstDelayedReceive.pop_front();
+	}
+}
+
+void Socket::MarkPingSent()
+{
+	m_fPingSent = timer_Now();
+}
+
+void Socket::MarkPingReply()
+{
+	if( m_fPingSent > 0 )
+	{
+		m_stats.AddRttSample( timer_Now() - m_fPingSent );
+		m_fPingSent = 0;
+	}
+}
@@ -13,6 +13,8 @@
 
 #include <deque>
 
+#include "NetStats.h"
+
 enum SocketError {
 	SOCK_OK = 0,
 	E_SOCKET = 1,
@@ -24,6 +26,9 @@ enum SocketError {
 };
 
 class Packet;
+class PacketCompressor;
+class PacketDecompressor;
+struct CompressionStats;
 
 class Socket
 {
@@ -31,8 +36,13 @@ public:
 	// Constructor
 	//
 	Socket() : m_fdSocket(INVALID_SOCKET), m_pReceiving(NULL),
-		m_nSentData(0), m_nReceivedData(0), m_bGotHeader(false)
+		m_nSentData(0), m_nReceivedData(0), m_bGotHeader(false),
+		m_pCompressor(NULL), m_pDecompressor(NULL), m_bDecompressing(false),
+		m_bCompressionSetting(false),
+		m_fSendAllowance(0), m_fReceiveAllowance(0),
+		m_fSendShaped(0), m_fReceiveShaped(0), m_fPingSent(0)
 	{
+		net_Register( &m_stats );
 	}
 
 	// Destructor
@@ -40,6 +50,7 @@ public:
 	~Socket()
 	{
 		Disconnect();
+		net_Unregister( &m_stats );
 	}
 
 	// Connection management
@@ -51,6 +62,8 @@ public:
 	{
 		if( m_fdSocket != INVALID_SOCKET ) closesocket( m_fdSocket );
 		m_fdSocket = INVALID_SOCKET;
+		ResetCompression();
+		DropDelayed();
 	}
 
 	bool IsConnected()
@@ -66,9 +79,60 @@ public:
 	void SendPacket( Packet* pPacket );
 	Packet* ReceivePacket();
 
+	// Stream compression
+	//
+	// Compression is switched on for the packets this end sends. Enabling
+	// or disabling it queues a control frame (Packet.h) saying so, and the
+	// peer decompresses what it receives in between, so each direction is
+	// compressed only if its sender asked for it. A packet too large to
+	// compress is sent as it is between an off and an on, and starts a
+	// new dictionary; otherwise the dictionary lasts until compression is
+	// disabled or the connection is closed. SendPacket also follows
+	// net.setCompression (g_bNetCompression) each time that changes.
+	void EnableCompression();
+	void DisableCompression();
+
+	bool IsCompressing()
+	{
+		return (m_pCompressor != NULL);
+	}
+
+	bool IsDecompressing()
+	{
+		return m_bDecompressing;
+	}
+
+	const CompressionStats* GetSendCompression();
+	const CompressionStats* GetReceiveCompression();
+
+	// Statistics
+	//
+	// For round trip times, call MarkPingSent when sending a message the
+	// peer answers straight away and MarkPingReply when the answer arrives.
+	void MarkPingSent();
+	void MarkPingReply();
+
+	NetStats& GetStats()
+	{
+		return m_stats;
+	}
+
+protected:
+	void DropDelayed();
+	void SendControl( int nCode, double fNow );
+	void ResetCompression();
+
 public:
 	typedef std::deque<Packet*> PacketQueue;
 
+	// Packets held back by the traffic shaper
+	struct DelayedPacket
+	{
+		double m_fDue;
+		Packet* m_pPacket;
+	};
+	typedef std::deque<DelayedPacket> DelayedQueue;
+
 	// Allow server classes to peek
 	SOCKET m_fdSocket;
 	PacketQueue m_lstSend;
@@ -77,6 +141,18 @@ public:
 	int m_nSentData;
 	int m_nReceivedData;
 	bool m_bGotHeader;
+	PacketCompressor* m_pCompressor;
+	PacketDecompressor* m_pDecompressor;
+	bool m_bDecompressing;
+	bool m_bCompressionSetting;		// g_bNetCompression when last followed
+	DelayedQueue m_lstDelayedSend;
+	DelayedQueue m_lstDelayedReceive;
+	double m_fSendAllowance;
+	double m_fReceiveAllowance;
+	double m_fSendShaped;
+	double m_fReceiveShaped;
+	double m_fPingSent;
+	NetStats m_stats;
 };
 
 #endif // FGM_SOCKET
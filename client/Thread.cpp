@@ -0,0 +1,201 @@
+// Thread.cpp: threads, locks and atomics for the few places that need them
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Thread.h"
+
+#include <stdlib.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+struct Thread
+{
+	ThreadFunc m_pFunc;
+	void* m_pArg;
+#ifdef WINDOWS
+	HANDLE m_hThread;
+#else
+	pthread_t m_thread;
+#endif
+};
+
+#ifdef WINDOWS
+
+static DWORD WINAPI threadMain( LPVOID pParam )
+{
+	Thread* pThread = (Thread*) pParam;
+	pThread->m_pFunc( pThread->m_pArg );
+	return 0;
+}
+
+Thread* thread_Start( ThreadFunc pFunc, void* pArg )
+{
+	Thread* pThread = new Thread();
+	pThread->m_pFunc = pFunc;
+	pThread->m_pArg = pArg;
+	pThread->m_hThread = CreateThread( NULL, 0, threadMain, pThread, 0, NULL );
+	if( !pThread->m_hThread )
+	{
+		delete pThread;
+		return NULL;
+	}
+	return pThread;
+}
+
+void thread_Join( Thread* pThread )
+{
+	WaitForSingleObject( pThread->m_hThread, INFINITE );
+	CloseHandle( pThread->m_hThread );
+	delete pThread;
+}
+
+void thread_Sleep( int nMilliseconds )
+{
+	Sleep( nMilliseconds );
+}
+
+int thread_CpuCount( void )
+{
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+}
+
+long atomic_Load( volatile long* p )
+{
+	// volatile reads are acquires in MSVC (/volatile:ms, the default).
+	return *p;
+}
+
+void atomic_Store( volatile long* p, long n )
+{
+	InterlockedExchange( p, n );
+}
+
+long atomic_Add( volatile long* p, long n )
+{
+	return InterlockedExchangeAdd( p, n ) + n;
+}
+
+bool atomic_CompareExchange( volatile long* p, long nExpected, long nNew )
+{
+	return InterlockedCompareExchange( p, nNew, nExpected ) == nExpected;
+}
+
+Mutex::Mutex()
+{
+	CRITICAL_SECTION* pcs = new CRITICAL_SECTION;
+	InitializeCriticalSection( pcs );
+	m_pImpl = pcs;
+}
+
+Mutex::~Mutex()
+{
+	CRITICAL_SECTION* pcs = (CRITICAL_SECTION*) m_pImpl;
+	DeleteCriticalSection( pcs );
+	delete pcs;
+}
+
+void Mutex::Lock()
+{
+	EnterCriticalSection( (CRITICAL_SECTION*) m_pImpl );
+}
+
+void Mutex::Unlock()
+{
+	LeaveCriticalSection( (CRITICAL_SECTION*) m_pImpl );
+}
+
+#else
+
+static void* threadMain( void* pParam )
+{
+	Thread* pThread = (Thread*) pParam;
+	pThread->m_pFunc( pThread->m_pArg );
+	return NULL;
+}
+
+Thread* thread_Start( ThreadFunc pFunc, void* pArg )
+{
+	Thread* pThread = new Thread();
+	pThread->m_pFunc = pFunc;
+	pThread->m_pArg = pArg;
+	if( pthread_create( &pThread->m_thread, NULL, threadMain, pThread ) )
+	{
+		delete pThread;
+		return NULL;
+	}
+	return pThread;
+}
+
+void thread_Join( Thread* pThread )
+{
+	pthread_join( pThread->m_thread, NULL );
+	delete pThread;
+}
+
+void thread_Sleep( int nMilliseconds )
+{
+	struct timespec ts;
+	ts.tv_sec = nMilliseconds / 1000;
+	ts.tv_nsec = (nMilliseconds % 1000) * 1000000L;
+	nanosleep( &ts, NULL );
+}
+
+int thread_CpuCount( void )
+{
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+	return n > 0 ? (int) n : 1;
+}
+
+long atomic_Load( volatile long* p )
+{
+	return __atomic_load_n( p, __ATOMIC_SEQ_CST );
+}
+
+void atomic_Store( volatile long* p, long n )
+{
+	__atomic_store_n( p, n, __ATOMIC_SEQ_CST );
+}
+
+long atomic_Add( volatile long* p, long n )
+{
+	return __sync_add_and_fetch( p, n );
+}
+
+bool atomic_CompareExchange( volatile long* p, long nExpected, long nNew )
+{
+	return __sync_bool_compare_and_swap( p, nExpected, nNew );
+}
+
+Mutex::Mutex()
+{
+	pthread_mutex_t* pMutex = new pthread_mutex_t;
+	pthread_mutex_init( pMutex, NULL );
+	m_pImpl = pMutex;
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_t* pMutex = (pthread_mutex_t*) m_pImpl;
+	pthread_mutex_destroy( pMutex );
+	delete pMutex;
+}
+
+void Mutex::Lock()
+{
+	pthread_mutex_lock( (pthread_mutex_t*) m_pImpl );
+}
+
+void Mutex::Unlock()
+{
+	pthread_mutex_unlock( (pthread_mutex_t*) m_pImpl );
+}
+
+#endif
@@ -0,0 +1,65 @@
+// Thread.h: threads, locks and atomics for the few places that need them
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_THREAD_H
+#define FGM_THREAD_H
+
+#ifdef WINDOWS
+#define THREAD_LOCAL	__declspec(thread)
+#else
+#define THREAD_LOCAL	__thread
+#endif
+
+// Threads
+//
+typedef void (*ThreadFunc)( void* pArg );
+struct Thread;
+
+// Run pFunc( pArg ) on a new thread; NULL if one cannot be started.
+Thread* thread_Start( ThreadFunc pFunc, void* pArg );
+
+// Wait for the thread to return, and free it.
+void thread_Join( Thread* pThread );
+
+void thread_Sleep( int nMilliseconds );
+
+// Processors available to run threads on; at least 1.
+int thread_CpuCount( void );
+
+// Atomics. These are sequentially consistent, so a store made before
+// atomic_Store is seen by any thread that reads the new value with
+// atomic_Load.
+//
+long atomic_Load( volatile long* p );
+void atomic_Store( volatile long* p, long n );
+long atomic_Add( volatile long* p, long n );	// returns the new value
+bool atomic_CompareExchange( volatile long* p, long nExpected, long nNew );
+
+// A lock for state that is touched rarely; hot paths should not need one.
+//
+class Mutex
+{
+public:
+	Mutex();
+	~Mutex();
+	void Lock();
+	void Unlock();
+private:
+	Mutex( const Mutex& );
+	void operator=( const Mutex& );
+	void* m_pImpl;
+};
+
+class MutexLock
+{
+public:
+	MutexLock( Mutex& mutex ) : m_mutex( mutex ) { m_mutex.Lock(); }
+	~MutexLock() { m_mutex.Unlock(); }
+private:
+	MutexLock( const MutexLock& );
+	void operator=( const MutexLock& );
+	Mutex& m_mutex;
+};
+
+#endif // FGM_THREAD_H
@@ -0,0 +1,40 @@
+// Timer.cpp: high resolution timer
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Timer.h"
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef WINDOWS
+
+double timer_Now()
+{
+	static double s_fPeriod = 0;
+	LARGE_INTEGER nCount;
+
+	if( !s_fPeriod )
+	{
+		LARGE_INTEGER nFreq;
+		QueryPerformanceFrequency( &nFreq );
+		s_fPeriod = 1.0 / (double)nFreq.QuadPart;
+	}
+
+	QueryPerformanceCounter( &nCount );
+	return (double)nCount.QuadPart * s_fPeriod;
+}
+
+#else
+
+double timer_Now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#endif
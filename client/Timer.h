@@ -0,0 +1,13 @@
+// Timer.h: high resolution timer
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TIMER_H
+#define TIMER_H
+
+// Seconds since an arbitrary starting point. Only differences between
+// two readings are meaningful.
+//
+double timer_Now();
+
+#endif // TIMER_H
@@ -0,0 +1,274 @@
+// TraceEvents.cpp: scoped trace zones, saved as Chrome trace-event JSON
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TraceEvents.h"
+#include "Timer.h"
+#include "Logger.h"
+#include "Thread.h"
+
+#include <stdio.h>
+#include <string>
+#include <set>
+#include <vector>
+
+#ifdef WINDOWS
+#include <intrin.h>
+#define TRACE_BARRIER()		_ReadWriteBarrier()
+#else
+#define TRACE_BARRIER()		__asm__ __volatile__( "" ::: "memory" )
+#endif
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+struct TraceEvent
+{
+	const char* m_szName;
+	const char* m_szCategory;
+	double m_fTime;
+	char m_cPhase;				// 'B'egin or 'E'nd
+};
+
+// One per thread that has ever recorded a zone. Only that thread writes
+// to it; trace_Stop reads the events it has published through m_nCount.
+struct TraceBuffer
+{
+	std::vector<TraceEvent> m_events;
+	volatile int m_nCount;
+	long m_nDropped;
+	int m_nCapture;				// capture the events belong to
+	int m_nThread;
+	std::string m_strName;
+	std::set<std::string> m_names;	// from trace_Intern
+};
+
+volatile bool g_bTracing = false;
+
+// Guards the list of buffers, which threads add to on their first zone.
+static Mutex s_lock;
+static std::vector<TraceBuffer*> s_buffers;	// never freed; threads keep pointers
+static THREAD_LOCAL TraceBuffer* s_pBuffer = NULL;
+static std::string s_strFilename;
+static int s_nCapture = 0;
+static int s_nMaxEvents = TRACE_MAX_EVENTS;
+static double s_fStart = 0;
+
+
+//////////////////////////////////////////////////////////////////////
+// Recording
+//////////////////////////////////////////////////////////////////////
+
+static TraceBuffer* getBuffer()
+{
+	TraceBuffer* pBuffer = s_pBuffer;
+	if( !pBuffer )
+	{
+		pBuffer = new TraceBuffer();
+		pBuffer->m_nCount = 0;
+		pBuffer->m_nDropped = 0;
+		pBuffer->m_nCapture = -1;
+		s_lock.Lock();
+		s_buffers.push_back( pBuffer );
+		pBuffer->m_nThread = (int) s_buffers.size();
+		s_lock.Unlock();
+		s_pBuffer = pBuffer;
+	}
+	return pBuffer;
+}
+
+static void addEvent( const char* szName, const char* szCategory, char cPhase )
+{
+	TraceBuffer* pBuffer = getBuffer();
+
+	// The first event of a new capture empties the buffer; only the
+	// owning thread ever does this.
+	if( pBuffer->m_nCapture != s_nCapture )
+	{
+		pBuffer->m_nCount = 0;
+		pBuffer->m_nDropped = 0;
+		pBuffer->m_events.resize( s_nMaxEvents );
+		TRACE_BARRIER();
+		pBuffer->m_nCapture = s_nCapture;
+	}
+
+	int nCount = pBuffer->m_nCount;
+	if( nCount >= (int) pBuffer->m_events.size() )
+	{
+		pBuffer->m_nDropped++;
+		return;
+	}
+	TraceEvent& event = pBuffer->m_events[nCount];
+	event.m_szName = szName;
+	event.m_szCategory = szCategory;
+	event.m_fTime = timer_Now();
+	event.m_cPhase = cPhase;
+	// publish the event only once it is written.
+	TRACE_BARRIER();
+	pBuffer->m_nCount = nCount + 1;
+}
+
+void trace_Begin( const char* szName, const char* szCategory )
+{
+	if( g_bTracing ) addEvent( szName, szCategory, 'B' );
+}
+
+void trace_End()
+{
+	if( g_bTracing ) addEvent( NULL, NULL, 'E' );
+}
+
+const char* trace_Intern( const char* szName )
+{
+	TraceBuffer* pBuffer = getBuffer();
+	return pBuffer->m_names.insert( szName ).first->c_str();
+}
+
+void trace_SetThreadName( const char* szName )
+{
+	getBuffer()->m_strName = szName;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Capture
+//////////////////////////////////////////////////////////////////////
+
+void trace_Start( const char* szFilename, int nMaxEvents )
+{
+	if( g_bTracing ) trace_Stop();
+	s_strFilename = szFilename;
+	s_nMaxEvents = nMaxEvents > 0 ? nMaxEvents : TRACE_MAX_EVENTS;
+	s_nCapture++;
+	s_fStart = timer_Now();
+	g_bTracing = true;
+}
+
+static void writeString( FILE* pFile, const char* sz )
+{
+	fputc( '"', pFile );
+	for( ; *sz; sz++ )
+	{
+		unsigned char c = (unsigned char) *sz;
+		if( c == '"' || c == '\\' ) fprintf( pFile, "\\%c", c );
+		else if( c < 0x20 ) fprintf( pFile, "\\u%04x", c );
+		else fputc( c, pFile );
+	}
+	fputc( '"', pFile );
+}
+
+bool trace_Stop()
+{
+	if( !g_bTracing ) return false;
+	g_bTracing = false;
+
+	FILE* pFile = fopen( s_strFilename.c_str(), "w" );
+	if( !pFile )
+	{
+		log_Logf( "trace_Stop: cannot open %s", s_strFilename.c_str() );
+		return false;
+	}
+
+	fprintf( pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	long nEvents = 0, nDropped = 0;
+	bool bFirst = true;
+
+	s_lock.Lock();
+	for( size_t i = 0; i < s_buffers.size(); i++ )
+	{
+		TraceBuffer* pBuffer = s_buffers[i];
+		if( pBuffer->m_nCapture != s_nCapture ) continue;
+		int nCount = pBuffer->m_nCount;
+		TRACE_BARRIER();
+
+		if( !pBuffer->m_strName.empty() )
+		{
+			fprintf( pFile, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":",
+				bFirst ? "" : ",\n", pBuffer->m_nThread );
+			writeString( pFile, pBuffer->m_strName.c_str() );
+			fprintf( pFile, "}}" );
+			bFirst = false;
+		}
+
+		for( int j = 0; j < nCount; j++ )
+		{
+			const TraceEvent& event = pBuffer->m_events[j];
+			fprintf( pFile, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+				bFirst ? "" : ",\n", event.m_cPhase, pBuffer->m_nThread,
+				(event.m_fTime - s_fStart) * 1e6 );
+			if( event.m_szName )
+			{
+				fprintf( pFile, ",\"name\":" );
+				writeString( pFile, event.m_szName );
+				fprintf( pFile, ",\"cat\":" );
+				writeString( pFile, event.m_szCategory ? event.m_szCategory : "" );
+			}
+			fputc( '}', pFile );
+			bFirst = false;
+		}
+		nEvents += nCount;
+		nDropped += pBuffer->m_nDropped;
+	}
+	s_lock.Unlock();
+
+	fprintf( pFile, "\n]}\n" );
+	fclose( pFile );
+
+	log_Logf( "Trace: %ld events written to %s", nEvents, s_strFilename.c_str() );
+	if( nDropped )
+		log_Logf( "... %ld events dropped, buffers full", nDropped );
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Lua bindings
+//////////////////////////////////////////////////////////////////////
+
+// trace.start(filename[, maxEventsPerThread])
+static int trace_start(lua_State *L) {
+	const char* filename = luaL_checkstring(L, 1);
+	trace_Start(filename, luaL_optint(L, 2, TRACE_MAX_EVENTS));
+	return 0;
+}
+
+static int trace_stop(lua_State *L) {
+	lua_pushboolean(L, trace_Stop());
+	return 1;
+}
+
+// trace.beginZone(name[, category]); zones nest, and each must be
+// closed by trace.endZone() on the way out, errors included.
+static int trace_begin_zone(lua_State *L) {
+	const char* name = luaL_checkstring(L, 1);
+	const char* category = luaL_optstring(L, 2, "lua");
+	if (g_bTracing) trace_Begin(trace_Intern(name), trace_Intern(category));
+	return 0;
+}
+
+static int trace_end_zone(lua_State *L) {
+	trace_End();
+	return 0;
+}
+
+static int trace_is_tracing(lua_State *L) {
+	lua_pushboolean(L, g_bTracing);
+	return 1;
+}
+
+static const luaL_Reg trace_funcs[] = {
+	{"start", trace_start},
+	{"stop", trace_stop},
+	{"beginZone", trace_begin_zone},
+	{"endZone", trace_end_zone},
+	{"isTracing", trace_is_tracing},
+	{NULL, NULL}
+};
+
+int luaopen_trace( lua_State* L )
+{
+	luaL_register(L, "trace", trace_funcs);
+	return 1;
+}
@@ -0,0 +1,65 @@
+// TraceEvents.h: scoped trace zones, saved as Chrome trace-event JSON
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_TRACEEVENTS_H
+#define FGM_TRACEEVENTS_H
+
+struct lua_State;
+
+// Default events kept per thread during a capture.
+#define TRACE_MAX_EVENTS	(1 << 18)
+
+// Set while a capture is running; zones check this and nothing else
+// when tracing is off.
+extern volatile bool g_bTracing;
+
+// Start capturing zones on every thread, to be written to 'szFilename'
+// by trace_Stop. Each thread gets its own buffer of 'nMaxEvents', so
+// recording takes no locks; once a buffer is full that thread's later
+// zones are dropped and counted.
+//
+void trace_Start( const char* szFilename, int nMaxEvents );
+
+// Stop capturing and write the JSON, which chrome://tracing and
+// Perfetto open. Zones still running on other threads at this point
+// may be cut short.
+bool trace_Stop();
+
+// Open and close a zone on the calling thread. Names and categories
+// must stay valid until trace_Stop: string literals, or names from
+// trace_Intern.
+void trace_Begin( const char* szName, const char* szCategory );
+void trace_End();
+
+// A copy of 'szName' that lives as long as the calling thread's buffer.
+const char* trace_Intern( const char* szName );
+
+// Name the calling thread in the trace.
+void trace_SetThreadName( const char* szName );
+
+// A zone for the rest of the enclosing block.
+//
+class TraceZone
+{
+public:
+	TraceZone( const char* szName, const char* szCategory ) : m_bOpen( g_bTracing )
+	{
+		if( m_bOpen ) trace_Begin( szName, szCategory );
+	}
+	~TraceZone()
+	{
+		if( m_bOpen ) trace_End();
+	}
+private:
+	bool m_bOpen;
+};
+
+#define TRACE_ZONE_JOIN2(a, b)	a##b
+#define TRACE_ZONE_JOIN(a, b)	TRACE_ZONE_JOIN2(a, b)
+#define TRACE_ZONE(name, category)	TraceZone TRACE_ZONE_JOIN(traceZone, __LINE__)( name, category )
+
+// Register the trace library with Lua.
+int luaopen_trace( lua_State* L );
+
+#endif // FGM_TRACEEVENTS_H
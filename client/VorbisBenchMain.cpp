@@ -0,0 +1,228 @@
+// VorbisBenchMain.cpp: Ogg Vorbis decode benchmark
+//
+// Decodes each file given from memory with stb_vorbis at every level of
+// inner loops the CPU supports (VorbisSimd.h), portable first, and logs
+// the fastest of -repeat runs as samples (frames times channels) decoded
+// a second, how many times faster than real time that is, and the
+// speedup over the portable loops. Every level must decode exactly what
+// the portable loops do; a file where one does not is reported and the
+// benchmark fails. The results are also written out as JSON
+// (vorbisbench.json by default), to compare across commits.
+//
+//   vorbisbench [-repeat N] [-json file] file.ogg...
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "Logger.h"
+#include "Timer.h"
+#include "QSGSoftwareSpans.h"
+#include "VorbisSimd.h"
+#include "stb_vorbis.h"
+
+const char *c_logFilename = "vorbisbench.log";
+
+static const char* c_levelNames[] = { "portable", "sse2", "avx2" };
+
+struct VorbisBenchOptions
+{
+	int m_nRepeat;				// timed decodes per file and level
+	const char* m_szJson;
+	std::vector<const char*> m_files;
+};
+
+// Timings for one file at one level.
+struct BenchResult
+{
+	int m_nLevel;
+	double m_fMin;				// seconds for the fastest decode
+	double m_fSamplesPerSec;
+	double m_fRealtime;			// seconds of audio decoded a second
+	double m_fSpeedup;			// over the portable loops
+	bool m_bExact;				// decoded what the portable loops did
+};
+
+struct FileResult
+{
+	const char* m_szName;
+	int m_nChannels;
+	int m_nRate;
+	long m_nFrames;
+	std::vector<BenchResult> m_levels;
+};
+
+static bool readFile(const char* name, std::vector<unsigned char>& data)
+{
+	FILE* file = fopen(name, "rb");
+	if (!file) return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	bool ok = size > 0 && fread(&data[0], 1, size, file) == (size_t) size;
+	fclose(file);
+	return ok;
+}
+
+// Decode the whole file into interleaved samples; false if it will not open.
+static bool decode(const std::vector<unsigned char>& data, std::vector<float>& samples, int* channels, int* rate)
+{
+	int error = 0;
+	stb_vorbis* vorbis = stb_vorbis_open_memory((unsigned char*) &data[0], (int) data.size(), &error, NULL);
+	if (!vorbis) return false;
+	stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+	*channels = info.channels;
+	*rate = (int) info.sample_rate;
+
+	samples.clear();
+	float** output;
+	int n;
+	while ((n = stb_vorbis_get_frame_float(vorbis, NULL, &output)) > 0) {
+		size_t start = samples.size();
+		samples.resize(start + (size_t) n * info.channels);
+		float* out = &samples[start];
+		for (int i = 0; i < n; ++i)
+			for (int c = 0; c < info.channels; ++c)
+				*out++ = output[c][i];
+	}
+	stb_vorbis_close(vorbis);
+	return true;
+}
+
+// Compared as values, so a zero of either sign matches.
+static bool sameSamples(const std::vector<float>& a, const std::vector<float>& b)
+{
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (a[i] != b[i]) return false;
+	return true;
+}
+
+static bool BenchFile(const char* name, const VorbisBenchOptions& options, FileResult* result)
+{
+	std::vector<unsigned char> data;
+	if (!readFile(name, data)) {
+		log_Logf("cannot read %s", name);
+		return false;
+	}
+
+	result->m_szName = name;
+	std::vector<float> reference, samples;
+	for (int level = QSGSpanPortable; level <= qsgSpanCpuLevel(); ++level) {
+		vorbis_InstallSimd(level);
+		BenchResult bench;
+		bench.m_nLevel = level;
+		bench.m_fMin = 0;
+		for (int r = 0; r < options.m_nRepeat; ++r) {
+			double start = timer_Now();
+			if (!decode(data, samples, &result->m_nChannels, &result->m_nRate)) {
+				log_Logf("cannot decode %s", name);
+				return false;
+			}
+			double time = timer_Now() - start;
+			if (r == 0 || time < bench.m_fMin) bench.m_fMin = time;
+		}
+		if (level == QSGSpanPortable) reference.swap(samples);
+		bench.m_bExact = (level == QSGSpanPortable) || sameSamples(reference, samples);
+
+		result->m_nFrames = (long) (reference.size() / result->m_nChannels);
+		bench.m_fSamplesPerSec = reference.size() / bench.m_fMin;
+		bench.m_fRealtime = (double) result->m_nFrames / result->m_nRate / bench.m_fMin;
+		bench.m_fSpeedup = result->m_levels.empty() ? 1.0 : result->m_levels[0].m_fMin / bench.m_fMin;
+		result->m_levels.push_back(bench);
+	}
+	vorbis_InstallSimd(QSGSpanPortable);
+	return true;
+}
+
+
+// ---------------------------------------------------------------------
+
+void WriteJson(FILE* file, const VorbisBenchOptions& options, const std::vector<FileResult>& results)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"config\": {\"repeat\": %d, \"cpu_level\": \"%s\"},\n",
+		options.m_nRepeat, c_levelNames[qsgSpanCpuLevel()]);
+	fprintf(file, "  \"files\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const FileResult& f = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"channels\": %d, \"rate\": %d, \"frames\": %ld, \"levels\": [\n",
+			f.m_szName, f.m_nChannels, f.m_nRate, f.m_nFrames);
+		for (size_t j = 0; j < f.m_levels.size(); ++j) {
+			const BenchResult& r = f.m_levels[j];
+			fprintf(file, "      {\"level\": \"%s\", \"min_ms\": %.3f, \"samples_per_sec\": %.0f, "
+				"\"realtime\": %.1f, \"speedup\": %.3f, \"exact\": %s}%s\n",
+				c_levelNames[r.m_nLevel], r.m_fMin * 1e3, r.m_fSamplesPerSec, r.m_fRealtime, r.m_fSpeedup,
+				r.m_bExact ? "true" : "false", (j + 1 < f.m_levels.size()) ? "," : "");
+		}
+		fprintf(file, "    ]}%s\n", (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+bool ParseOptions(int argc, char** argv, VorbisBenchOptions* options)
+{
+	options->m_nRepeat = 5;
+	options->m_szJson = "vorbisbench.json";
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (arg[0] != '-') {
+			options->m_files.push_back(arg);
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) return false;
+		if (!strcmp(arg, "-repeat")) options->m_nRepeat = atoi(value);
+		else if (!strcmp(arg, "-json")) options->m_szJson = value;
+		else return false;
+		++i;
+	}
+
+	return options->m_nRepeat > 0 && !options->m_files.empty();
+}
+
+int main(int argc, char** argv)
+{
+	VorbisBenchOptions options;
+	if (!ParseOptions(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s [-repeat N] [-json file] file.ogg...\n", argv[0]);
+		return 2;
+	}
+
+	log_Open( c_logFilename, NULL );
+	log_Logf("cpu level %s", c_levelNames[qsgSpanCpuLevel()]);
+
+	std::vector<FileResult> results;
+	bool exact = true;
+	for (size_t i = 0; i < options.m_files.size(); ++i) {
+		FileResult result;
+		if (!BenchFile(options.m_files[i], options, &result)) continue;
+		log_Logf("%s: %d channels, %d Hz, %ld frames", result.m_szName, result.m_nChannels,
+			result.m_nRate, result.m_nFrames);
+		for (size_t j = 0; j < result.m_levels.size(); ++j) {
+			const BenchResult& r = result.m_levels[j];
+			log_Logf("  %-9s %8.3f ms %12.0f samples/s %7.1fx realtime %6.2fx%s",
+				c_levelNames[r.m_nLevel], r.m_fMin * 1e3, r.m_fSamplesPerSec, r.m_fRealtime, r.m_fSpeedup,
+				r.m_bExact ? "" : "  MISMATCH");
+			if (!r.m_bExact) exact = false;
+		}
+		results.push_back(result);
+	}
+
+	FILE* file = fopen(options.m_szJson, "w");
+	if (file) {
+		WriteJson(file, options, results);
+		fclose(file);
+	}
+	else log_Logf("cannot open %s", options.m_szJson);
+
+	log_Close();
+	return (exact && results.size() == options.m_files.size()) ? 0 : 1;
+}
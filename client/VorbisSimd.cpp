@@ -0,0 +1,522 @@
+// VorbisSimd.cpp: SSE2 and AVX2 inner loops for the stb_vorbis decoder
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "VorbisSimd.h"
+#include "QSGSoftwareSpans.h"
+#include "stb_vorbis.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define VORBIS_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define VORBIS_TARGET_AVX2
+#else
+#define VORBIS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static int s_nLevel = QSGSpanPortable;
+
+#ifdef VORBIS_SIMD_X86
+
+// Every loop below does the multiplies and adds of stb_vorbis.c in the
+// same order, without fused multiply-adds, so the samples match exactly.
+// Subtractions become adds of a value with its sign flipped, which IEEE
+// arithmetic treats as the same operation.
+
+
+// ---------------------------------------------------------------------
+// Portable pieces, as in stb_vorbis.c: the fixed last passes of step 3,
+// whose twiddles are all 0, 1 or sqrt(1/2), are mostly adds that do not
+// line up in lanes, and are left scalar.
+
+static int log2Size( int n )
+{
+	int nLog = 0;
+	while (n > 1) {
+		n >>= 1;
+		++nLog;
+	}
+	return nLog;
+}
+
+static inline void iter54( float* z )
+{
+	float k00 = z[ 0] - z[-4];
+	float y0  = z[ 0] + z[-4];
+	float y2  = z[-2] + z[-6];
+	float k22 = z[-2] - z[-6];
+
+	z[-0] = y0 + y2;
+	z[-2] = y0 - y2;
+
+	float k33 = z[-3] - z[-7];
+
+	z[-4] = k00 + k33;
+	z[-6] = k00 - k33;
+
+	float k11 = z[-1] - z[-5];
+	float y1  = z[-1] + z[-5];
+	float y3  = z[-3] + z[-7];
+
+	z[-1] = y1 + y3;
+	z[-3] = y1 - y3;
+	z[-5] = k11 - k22;
+	z[-7] = k11 + k22;
+}
+
+static void step3Ld654( int n, float* e, int i_off, const float* A, int base_n )
+{
+	int a_off = base_n >> 3;
+	float A2 = A[0+a_off];
+	float* z = e + i_off;
+	float* base = z - 16 * n;
+
+	while (z > base) {
+		float k00, k11;
+
+		k00   = z[-0] - z[-8];
+		k11   = z[-1] - z[-9];
+		z[-0] = z[-0] + z[-8];
+		z[-1] = z[-1] + z[-9];
+		z[-8] = k00;
+		z[-9] = k11;
+
+		k00    = z[ -2] - z[-10];
+		k11    = z[ -3] - z[-11];
+		z[ -2] = z[ -2] + z[-10];
+		z[ -3] = z[ -3] + z[-11];
+		z[-10] = (k00+k11) * A2;
+		z[-11] = (k11-k00) * A2;
+
+		k00    = z[-12] - z[ -4];
+		k11    = z[ -5] - z[-13];
+		z[ -4] = z[ -4] + z[-12];
+		z[ -5] = z[ -5] + z[-13];
+		z[-12] = k11;
+		z[-13] = k00;
+
+		k00    = z[-14] - z[ -6];
+		k11    = z[ -7] - z[-15];
+		z[ -6] = z[ -6] + z[-14];
+		z[ -7] = z[ -7] + z[-15];
+		z[-14] = (k00+k11) * A2;
+		z[-15] = (k00-k11) * A2;
+
+		iter54( z );
+		iter54( z - 8 );
+		z -= 16;
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// Step 3 butterflies. Each takes pairs (re, im) at e0 and e2, counting
+// down, leaves their sums at e0 and rotates their differences at e2 by a
+// twiddle (cos, sin). In a vector the pairs run backwards: the pair at
+// e0[-1], e0[0] is in the top two lanes. With d = e0 - e2, both halves
+// of the rotation come from one multiply of d and one of d with its
+// pairs swapped:
+//     e2 = d * (c, c) + (d1, d0) * (s, -s)
+
+typedef void (*Step3RLoop)( int lim, float* e, int d0, int k_off, const float* A, int k1 );
+typedef void (*Step3SLoop)( int n, float* e, int i_off, int k_off, const float* A, int a_off, int k0 );
+
+static inline __m128 signOddSSE2( void )
+{
+	return _mm_castsi128_ps( _mm_set_epi32( (int) 0x80000000, 0, (int) 0x80000000, 0 ) );
+}
+
+static inline __m128 swapPairsSSE2( __m128 v )
+{
+	return _mm_shuffle_ps( v, v, _MM_SHUFFLE(2,3,0,1) );
+}
+
+// The twiddles for the pair in the top lanes at A, and below it at A1.
+static inline void twiddlesSSE2( const float* A, const float* A1, __m128* pCos, __m128* pSin )
+{
+	__m128 t = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) A1 ), (const __m64*) A );
+	*pCos = _mm_shuffle_ps( t, t, _MM_SHUFFLE(2,2,0,0) );
+	*pSin = _mm_xor_ps( _mm_shuffle_ps( t, t, _MM_SHUFFLE(3,3,1,1) ), signOddSSE2() );
+}
+
+static inline void butterflySSE2( float* p0, float* p2, __m128 c, __m128 s )
+{
+	__m128 a = _mm_loadu_ps( p0 );
+	__m128 b = _mm_loadu_ps( p2 );
+	__m128 d = _mm_sub_ps( a, b );
+	_mm_storeu_ps( p0, _mm_add_ps( a, b ) );
+	_mm_storeu_ps( p2, _mm_add_ps( _mm_mul_ps( d, c ), _mm_mul_ps( swapPairsSSE2( d ), s ) ) );
+}
+
+// imdct_step3_inner_r_loop, which with k1 = 8 is also iteration 0.
+static void step3RLoopSSE2( int lim, float* e, int d0, int k_off, const float* A, int k1 )
+{
+	float* e0 = e + d0;
+	float* e2 = e0 + k_off;
+	__m128 c, s;
+
+	for (int i = lim >> 2; i > 0; --i) {
+		twiddlesSSE2( A, A + k1, &c, &s );
+		butterflySSE2( e0 - 3, e2 - 3, c, s );
+		twiddlesSSE2( A + k1 * 2, A + k1 * 3, &c, &s );
+		butterflySSE2( e0 - 7, e2 - 7, c, s );
+		A += k1 * 4;
+		e0 -= 8;
+		e2 -= 8;
+	}
+}
+
+// imdct_step3_inner_s_loop: four pairs a step, with the same twiddles
+// for every step.
+static void step3SLoopSSE2( int n, float* e, int i_off, int k_off, const float* A, int a_off, int k0 )
+{
+	float* e0 = e + i_off;
+	float* e2 = e0 + k_off;
+	__m128 c01, s01, c23, s23;
+	twiddlesSSE2( A, A + a_off, &c01, &s01 );
+	twiddlesSSE2( A + a_off * 2, A + a_off * 3, &c23, &s23 );
+
+	for (int i = n; i > 0; --i) {
+		butterflySSE2( e0 - 3, e2 - 3, c01, s01 );
+		butterflySSE2( e0 - 7, e2 - 7, c23, s23 );
+		e0 -= k0;
+		e2 -= k0;
+	}
+}
+
+VORBIS_TARGET_AVX2 static inline __m256 signOddAVX2( void )
+{
+	return _mm256_castsi256_ps( _mm256_set_epi32( (int) 0x80000000, 0, (int) 0x80000000, 0,
+		(int) 0x80000000, 0, (int) 0x80000000, 0 ) );
+}
+
+// Twiddles for four pairs, the top pair's at A.
+VORBIS_TARGET_AVX2 static inline void twiddlesAVX2( const float* A, const float* A1, const float* A2, const float* A3,
+	__m256* pCos, __m256* pSin )
+{
+	__m128 lo = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) A3 ), (const __m64*) A2 );
+	__m128 hi = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) A1 ), (const __m64*) A );
+	__m256 t = _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+	*pCos = _mm256_moveldup_ps( t );
+	*pSin = _mm256_xor_ps( _mm256_movehdup_ps( t ), signOddAVX2() );
+}
+
+VORBIS_TARGET_AVX2 static inline void butterflyAVX2( float* p0, float* p2, __m256 c, __m256 s )
+{
+	__m256 a = _mm256_loadu_ps( p0 );
+	__m256 b = _mm256_loadu_ps( p2 );
+	__m256 d = _mm256_sub_ps( a, b );
+	_mm256_storeu_ps( p0, _mm256_add_ps( a, b ) );
+	_mm256_storeu_ps( p2, _mm256_add_ps( _mm256_mul_ps( d, c ),
+		_mm256_mul_ps( _mm256_permute_ps( d, _MM_SHUFFLE(2,3,0,1) ), s ) ) );
+}
+
+VORBIS_TARGET_AVX2 static void step3RLoopAVX2( int lim, float* e, int d0, int k_off, const float* A, int k1 )
+{
+	float* e0 = e + d0;
+	float* e2 = e0 + k_off;
+	__m256 c, s;
+
+	for (int i = lim >> 2; i > 0; --i) {
+		twiddlesAVX2( A, A + k1, A + k1 * 2, A + k1 * 3, &c, &s );
+		butterflyAVX2( e0 - 7, e2 - 7, c, s );
+		A += k1 * 4;
+		e0 -= 8;
+		e2 -= 8;
+	}
+}
+
+VORBIS_TARGET_AVX2 static void step3SLoopAVX2( int n, float* e, int i_off, int k_off, const float* A, int a_off, int k0 )
+{
+	float* e0 = e + i_off;
+	float* e2 = e0 + k_off;
+	__m256 c, s;
+	twiddlesAVX2( A, A + a_off, A + a_off * 2, A + a_off * 3, &c, &s );
+
+	for (int i = n; i > 0; --i) {
+		butterflyAVX2( e0 - 7, e2 - 7, c, s );
+		e0 -= k0;
+		e2 -= k0;
+	}
+}
+
+
+// ---------------------------------------------------------------------
+// Inverse MDCT. stb_vorbis's inverse_mdct step by step, with comments
+// for each step there; only the step 3 butterflies differ by level.
+
+static void inverseMdct( float* buffer, int n, float* A, float* B, float* C, unsigned short* bitrev, float* buf2,
+	Step3RLoop rLoop, Step3SLoop sLoop )
+{
+	int n2 = n >> 1, n4 = n >> 2, n8 = n >> 3;
+	const __m128 signAll = _mm_castsi128_ps( _mm_set1_epi32( (int) 0x80000000 ) );
+	const __m128 signLow = _mm_castsi128_ps( _mm_set_epi32( 0, 0, (int) 0x80000000, (int) 0x80000000 ) );
+	const __m128 signOdd = signOddSSE2();
+	const __m128 signEven = _mm_castsi128_ps( _mm_set_epi32( 0, (int) 0x80000000, 0, (int) 0x80000000 ) );
+
+	// Step 0 with the copy and reflection of the spectrum, two outputs a
+	// vector: x = (e[0], e[2]) rotated by (AA[0], AA[1]), stored backwards.
+	{
+		float* d = &buf2[n2-2];
+		const float* AA = A;
+		const float* e = &buffer[0];
+		const float* e_stop = &buffer[n2];
+		while (e != e_stop) {
+			__m128 x = _mm_shuffle_ps( _mm_loadu_ps( e ), _mm_loadu_ps( e + 4 ), _MM_SHUFFLE(2,0,2,0) );
+			__m128 a = _mm_loadu_ps( AA );
+			__m128 p = _mm_mul_ps( x, a );
+			__m128 q = _mm_mul_ps( x, swapPairsSSE2( a ) );
+			__m128 r = _mm_add_ps( _mm_shuffle_ps( p, q, _MM_SHUFFLE(2,0,2,0) ),
+				_mm_xor_ps( _mm_shuffle_ps( p, q, _MM_SHUFFLE(3,1,3,1) ), signLow ) );
+			_mm_storeu_ps( d - 2, _mm_shuffle_ps( r, r, _MM_SHUFFLE(0,2,1,3) ) );
+			d -= 4;
+			AA += 4;
+			e += 8;
+		}
+
+		// The reflected half: x = (-e[2], -e[0]).
+		e = &buffer[n2-3];
+		while (d >= buf2) {
+			__m128 x = _mm_xor_ps( _mm_shuffle_ps( _mm_loadu_ps( e ), _mm_loadu_ps( e - 4 ), _MM_SHUFFLE(0,2,0,2) ),
+				signAll );
+			__m128 a = _mm_loadu_ps( AA );
+			__m128 p = _mm_mul_ps( x, a );
+			__m128 q = _mm_mul_ps( x, swapPairsSSE2( a ) );
+			__m128 r = _mm_add_ps( _mm_shuffle_ps( p, q, _MM_SHUFFLE(2,0,2,0) ),
+				_mm_xor_ps( _mm_shuffle_ps( p, q, _MM_SHUFFLE(3,1,3,1) ), signLow ) );
+			_mm_storeu_ps( d - 2, _mm_shuffle_ps( r, r, _MM_SHUFFLE(0,2,1,3) ) );
+			d -= 4;
+			AA += 4;
+			e -= 8;
+		}
+	}
+
+	float* u = buffer;
+	float* v = buf2;
+
+	// Step 2: sums to the top half, rotated differences to the bottom.
+	{
+		const float* AA = &A[n2-8];
+		float* d0 = &u[n4];
+		float* d1 = &u[0];
+		const float* e0 = &v[n4];
+		const float* e1 = &v[0];
+
+		while (AA >= A) {
+			__m128 a = _mm_loadu_ps( e0 );
+			__m128 b = _mm_loadu_ps( e1 );
+			__m128 d = _mm_sub_ps( a, b );
+			__m128 t = _mm_shuffle_ps( _mm_loadu_ps( AA + 4 ), _mm_loadu_ps( AA ), _MM_SHUFFLE(1,0,1,0) );
+			__m128 c = _mm_shuffle_ps( t, t, _MM_SHUFFLE(2,2,0,0) );
+			__m128 s = _mm_xor_ps( _mm_shuffle_ps( t, t, _MM_SHUFFLE(3,3,1,1) ), signOdd );
+			_mm_storeu_ps( d0, _mm_add_ps( a, b ) );
+			_mm_storeu_ps( d1, _mm_add_ps( _mm_mul_ps( d, c ), _mm_mul_ps( swapPairsSSE2( d ), s ) ) );
+
+			AA -= 8;
+			d0 += 4;
+			d1 += 4;
+			e0 += 4;
+			e1 += 4;
+		}
+	}
+
+	// Step 3.
+	int ld = log2Size( n );
+	int l;
+
+	rLoop( n >> 4, u, n2-1-n4*0, -(n >> 3), A, 8 );
+	rLoop( n >> 4, u, n2-1-n4*1, -(n >> 3), A, 8 );
+
+	rLoop( n >> 5, u, n2-1 - n8*0, -(n >> 4), A, 16 );
+	rLoop( n >> 5, u, n2-1 - n8*1, -(n >> 4), A, 16 );
+	rLoop( n >> 5, u, n2-1 - n8*2, -(n >> 4), A, 16 );
+	rLoop( n >> 5, u, n2-1 - n8*3, -(n >> 4), A, 16 );
+
+	for (l = 2; l < (ld-3)>>1; ++l) {
+		int k0 = n >> (l+2), k0_2 = k0>>1;
+		int lim = 1 << (l+1);
+		for (int i = 0; i < lim; ++i)
+			rLoop( n >> (l+4), u, n2-1 - k0*i, -k0_2, A, 1 << (l+3) );
+	}
+
+	for (; l < ld-6; ++l) {
+		int k0 = n >> (l+2), k1 = 1 << (l+3), k0_2 = k0>>1;
+		int rlim = n >> (l+6);
+		int lim = 1 << (l+1);
+		int i_off = n2-1;
+		const float* A0 = A;
+		for (int r = rlim; r > 0; --r) {
+			sLoop( lim, u, i_off, -k0_2, A0, k1, k0 );
+			A0 += k1*4;
+			i_off -= 8;
+		}
+	}
+
+	step3Ld654( n >> 5, u, n2-1, A, n );
+
+	// Steps 4, 5 and 6: the bit reversed gather, four floats from each of
+	// two places a step.
+	{
+		float* d0 = &v[n4-4];
+		float* d1 = &v[n2-4];
+		while (d0 >= v) {
+			__m128 x = _mm_loadu_ps( u + bitrev[0] );
+			__m128 y = _mm_loadu_ps( u + bitrev[1] );
+			_mm_storeu_ps( d1, _mm_shuffle_ps( y, x, _MM_SHUFFLE(0,1,0,1) ) );
+			_mm_storeu_ps( d0, _mm_shuffle_ps( y, x, _MM_SHUFFLE(2,3,2,3) ) );
+			d0 -= 4;
+			d1 -= 4;
+			bitrev += 2;
+		}
+	}
+
+	// Step 7, in place from both ends: two pairs from each a step.
+	{
+		float* d = v;
+		float* e = v + n2 - 4;
+
+		while (d < e) {
+			__m128 dv = _mm_loadu_ps( d );
+			__m128 ev = _mm_loadu_ps( e );
+			__m128 cc = _mm_loadu_ps( C );
+			__m128 er = _mm_shuffle_ps( ev, ev, _MM_SHUFFLE(1,0,3,2) );
+
+			__m128 a = _mm_add_ps( dv, _mm_xor_ps( er, signEven ) );		// a02, a11
+			__m128 b23 = _mm_add_ps( dv, _mm_xor_ps( er, signOdd ) );		// b2, b3
+			__m128 cv = _mm_shuffle_ps( cc, cc, _MM_SHUFFLE(3,3,1,1) );
+			__m128 cw = _mm_xor_ps( _mm_shuffle_ps( cc, cc, _MM_SHUFFLE(2,2,0,0) ), signOdd );
+			__m128 b01 = _mm_add_ps( _mm_mul_ps( a, cv ), _mm_mul_ps( swapPairsSSE2( a ), cw ) );
+
+			// e gets (b2 - b0, b1 - b3) of each pair, the pairs swapped.
+			__m128 x = _mm_sub_ps( b23, b01 );
+			__m128 y = _mm_sub_ps( b01, b23 );
+			__m128 t = _mm_shuffle_ps( x, y, _MM_SHUFFLE(3,1,2,0) );
+			_mm_storeu_ps( d, _mm_add_ps( b23, b01 ) );
+			_mm_storeu_ps( e, _mm_shuffle_ps( t, t, _MM_SHUFFLE(2,0,3,1) ) );
+
+			C += 4;
+			d += 4;
+			e -= 4;
+		}
+	}
+
+	// Step 8 and the decode kernel: four pairs a step, split into real
+	// and imaginary vectors, and pushed out to the four quarters.
+	{
+		const float* e = buf2 + n2 - 8;
+		float* d0 = &buffer[0];
+		float* d1 = &buffer[n2-4];
+		float* d2 = &buffer[n2];
+		float* d3 = &buffer[n-4];
+		B += n2 - 8;
+
+		while (e >= v) {
+			__m128 e01 = _mm_loadu_ps( e );
+			__m128 e23 = _mm_loadu_ps( e + 4 );
+			__m128 b01 = _mm_loadu_ps( B );
+			__m128 b23 = _mm_loadu_ps( B + 4 );
+			__m128 re = _mm_shuffle_ps( e01, e23, _MM_SHUFFLE(2,0,2,0) );
+			__m128 im = _mm_shuffle_ps( e01, e23, _MM_SHUFFLE(3,1,3,1) );
+			__m128 bre = _mm_shuffle_ps( b01, b23, _MM_SHUFFLE(2,0,2,0) );
+			__m128 bim = _mm_shuffle_ps( b01, b23, _MM_SHUFFLE(3,1,3,1) );
+
+			__m128 po = _mm_sub_ps( _mm_mul_ps( re, bim ), _mm_mul_ps( im, bre ) );
+			__m128 pe = _mm_sub_ps( _mm_mul_ps( _mm_xor_ps( re, signAll ), bre ), _mm_mul_ps( im, bim ) );
+
+			_mm_storeu_ps( d0, _mm_shuffle_ps( po, po, _MM_SHUFFLE(0,1,2,3) ) );
+			_mm_storeu_ps( d1, _mm_xor_ps( po, signAll ) );
+			_mm_storeu_ps( d2, _mm_shuffle_ps( pe, pe, _MM_SHUFFLE(0,1,2,3) ) );
+			_mm_storeu_ps( d3, pe );
+
+			B -= 8;
+			e -= 8;
+			d0 += 4;
+			d2 += 4;
+			d1 -= 4;
+			d3 -= 4;
+		}
+	}
+}
+
+static void inverseMdctSSE2( float* buffer, int n, float* A, float* B, float* C, unsigned short* bitrev, float* buf2 )
+{
+	inverseMdct( buffer, n, A, B, C, bitrev, buf2, step3RLoopSSE2, step3SLoopSSE2 );
+}
+
+static void inverseMdctAVX2( float* buffer, int n, float* A, float* B, float* C, unsigned short* bitrev, float* buf2 )
+{
+	inverseMdct( buffer, n, A, B, C, bitrev, buf2, step3RLoopAVX2, step3SLoopAVX2 );
+}
+
+
+// ---------------------------------------------------------------------
+// Overlap-add of a frame's start with the end of the one before it, the
+// window read forwards for one and backwards for the other.
+
+static void overlapAddSSE2( float* out, const float* prev, const float* window, int n )
+{
+	int j = 0;
+	for (; j + 4 <= n; j += 4) {
+		__m128 w = _mm_loadu_ps( window + j );
+		__m128 wr = _mm_loadu_ps( window + n - 4 - j );
+		wr = _mm_shuffle_ps( wr, wr, _MM_SHUFFLE(0,1,2,3) );
+		_mm_storeu_ps( out + j, _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( out + j ), w ),
+			_mm_mul_ps( _mm_loadu_ps( prev + j ), wr ) ) );
+	}
+	for (; j < n; ++j)
+		out[j] = out[j]*window[j] + prev[j]*window[n-1-j];
+}
+
+VORBIS_TARGET_AVX2 static void overlapAddAVX2( float* out, const float* prev, const float* window, int n )
+{
+	int j = 0;
+	for (; j + 8 <= n; j += 8) {
+		__m256 w = _mm256_loadu_ps( window + j );
+		__m256 wr = _mm256_loadu_ps( window + n - 8 - j );
+		wr = _mm256_permute_ps( _mm256_permute2f128_ps( wr, wr, 1 ), _MM_SHUFFLE(0,1,2,3) );
+		_mm256_storeu_ps( out + j, _mm256_add_ps( _mm256_mul_ps( _mm256_loadu_ps( out + j ), w ),
+			_mm256_mul_ps( _mm256_loadu_ps( prev + j ), wr ) ) );
+	}
+	for (; j < n; ++j)
+		out[j] = out[j]*window[j] + prev[j]*window[n-1-j];
+}
+
+#endif // VORBIS_SIMD_X86
+
+
+// ---------------------------------------------------------------------
+
+int vorbis_InstallSimd( int nLevel )
+{
+	if (nLevel > qsgSpanCpuLevel()) nLevel = qsgSpanCpuLevel();
+	if (nLevel < QSGSpanPortable) nLevel = QSGSpanPortable;
+
+	// NULL puts back stb_vorbis's own loops.
+	stb_vorbis_inverse_mdct_run imdct = NULL;
+	stb_vorbis_overlap_add_run overlap = NULL;
+#ifdef VORBIS_SIMD_X86
+	if (nLevel == QSGSpanSSE2) {
+		imdct = inverseMdctSSE2;
+		overlap = overlapAddSSE2;
+	}
+	else if (nLevel == QSGSpanAVX2) {
+		imdct = inverseMdctAVX2;
+		overlap = overlapAddAVX2;
+	}
+#endif
+	stb_vorbis_install_inverse_mdct( imdct );
+	stb_vorbis_install_overlap_add( overlap );
+
+	s_nLevel = nLevel;
+	return nLevel;
+}
+
+int vorbis_SimdLevel( void )
+{
+	return s_nLevel;
+}
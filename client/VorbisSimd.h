@@ -0,0 +1,23 @@
+// VorbisSimd.h: SSE2 and AVX2 inner loops for the stb_vorbis decoder
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FGM_VORBISSIMD_H
+#define FGM_VORBISSIMD_H
+
+// The inverse MDCT and the windowed overlap-add of successive frames are
+// installed into stb_vorbis through its inner loop hooks. At SSE2 every
+// step of the transform but the fixed passes of step 3 (ld654) runs four
+// floats at a time; at AVX2 the step 3 butterflies and the overlap-add
+// run eight at a time. Every level decodes exactly the same samples as
+// stb_vorbis's own loops.
+//
+// Levels are those of the software span loops (QSGSpanLevel), and are
+// capped at what qsgSpanCpuLevel() finds the CPU supports.
+
+// Install the loops for nLevel, or put back stb_vorbis's own for 0.
+// Returns the level installed. Call before any stream is decoding.
+int vorbis_InstallSimd( int nLevel );
+int vorbis_SimdLevel( void );
+
+#endif
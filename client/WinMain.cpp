@@ -4,6 +4,8 @@
 #include <mmsystem.h> // timeGetTime
 
 #include "Logger.h"
+#include "FrameStats.h"
+#include "TraceEvents.h"
 #include "LuaController.h"
 #include "QSGOpenGLRenderer.h"
 
@@ -33,6 +35,7 @@ const char *c_logWindowTitle = "Quintiqua Console";
 const char *c_logFilename = "client.log";
 const char *c_apiFilename = "api_init.lua";
 const char *c_coreFilename = "core.lua";
+const char *c_packFilename = "data.qpak";
 
 #define IDM_OPEN_LOG (WM_APP+20)
 
@@ -88,6 +91,7 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 
 	// create the log file
 	log_Open( c_logFilename, m_logBox );
+	trace_SetThreadName( "main" );
 
 	g_renderer = new QSGOpenGLRenderer();
 	if (!g_renderer)
@@ -97,6 +101,9 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	if (!g_controller)
 		return 1;
 
+	// use the asset pack if there is one; loose files otherwise
+	g_controller->mountPack(c_packFilename);
+
 	// start rendering
 	m_active = TRUE;
 
@@ -133,9 +140,13 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 				DispatchMessage( &msg );
 			}
 		}
+
+		// show what the log writer has written since
+		log_Pump();
 	}
 exit_main:
 
+	frame_LogStats();
 	delete g_controller; // manually tracked.
 	g_controller = 0;
 	g_renderer = 0; // free ref_ptr before main exits.
@@ -577,6 +588,8 @@ void UpdateAndRender()
 {
 	if (m_active)
 	{
+		frame_Begin();
+		TRACE_ZONE("frame", "frame");
 		DWORD now = timeGetTime();
 		DWORD delta = now - g_lastTime;
 		//if (delta > 0)
@@ -589,6 +602,7 @@ void UpdateAndRender()
 				ValidateRect(m_glWnd, NULL);
 			}
 		}
+		frame_End();
 	}
 }
 
@@ -617,6 +631,7 @@ BOOL RenderGLView()
 	g_controller->render();
 
 	// commit all drawing commands.
+	TRACE_ZONE("swap", "frame");
 	glFinish();
 
 	// swap the window buffers.
@@ -625,6 +640,7 @@ BOOL RenderGLView()
 		log_Log("RenderGLView: failed to swap buffers");
 		return FALSE;
 	}
+	frame_Mark(FRAME_SWAP);
 
 	return TRUE;
 }
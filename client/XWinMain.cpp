@@ -8,7 +8,10 @@
 #include <sys/time.h>
 
 #include "Logger.h"
+#include "FrameStats.h"
+#include "TraceEvents.h"
 #include "LuaController.h"
+#include "Audio.h"
 #include "QSGOpenGLRenderer.h"
 
 
@@ -42,6 +45,7 @@ const char *c_logWindowTitle = "Automata Console";
 const char *c_logFilename = "client.log";
 const char *c_apiFilename = "api_init.lua";
 const char *c_coreFilename = "core.lua";
+const char *c_packFilename = "data.qpak";
 
 // Foward declarations
 bool CreateMainWindow();
@@ -220,6 +224,7 @@ int main(int argc, char** argv)
 
 	// create the log file
 	log_Open( c_logFilename, NULL );
+	trace_SetThreadName( "main" );
 
 	if (argc > 1) disp = argv[1];
 	else disp = ":0";
@@ -316,10 +321,14 @@ int main(int argc, char** argv)
 	if (!g_renderer)
 		return 1;
 
+	audio_Open(NULL); // ALSA, or silent
 	g_controller = new LuaController(g_renderer);
 	if (!g_controller)
 		return 1;
 
+	// use the asset pack if there is one; loose files otherwise
+	g_controller->mountPack(c_packFilename);
+
 	// init lua and start client
 	g_controller->execLua(c_apiFilename);
 	g_controller->execLua(c_coreFilename);
@@ -350,9 +359,11 @@ int main(int argc, char** argv)
     XCloseDisplay(g_display);
     g_display = NULL;
 
+	frame_LogStats();
 	delete g_controller; // manually tracked.
 	g_controller = 0;
 	g_renderer = 0; // free ref_ptr before main exits.
+	audio_Close();
 
 	log_Close();
 
@@ -365,6 +376,9 @@ void UpdateAndRender()
 	time_t delta_sec;
 	double delta;
 
+	frame_Begin();
+	TRACE_ZONE("frame", "frame");
+
 	gettimeofday(&tv, NULL);
 	delta_sec = tv.tv_sec - g_lastTime.tv_sec;
 	if (delta_sec < 0) delta_sec = 0;
@@ -390,6 +404,8 @@ void UpdateAndRender()
 	g_controller->update(delta);
 
 	RenderGLView();
+
+	frame_End();
 }
 
 
@@ -428,7 +444,9 @@ bool RenderGLView()
 	// glFinish();
 
 	// swap the window buffers.
+	TRACE_ZONE("swap", "frame");
 	glXSwapBuffers(g_display, g_window);
+	frame_Mark(FRAME_SWAP);
 
 	return true;
 }
@@ -900,7 +900,7 @@ static stbi_idct_8x8 stbi_idct_installed = idct_block;
 
 extern void stbi_install_idct(stbi_idct_8x8 func)
 {
-   stbi_idct_installed = func;
+   stbi_idct_installed = func ? func : idct_block;
 }
 #endif
 
@@ -942,7 +942,7 @@ static int parse_entropy_coded_data(jpeg *z)
    reset(z);
    if (z->scan_n == 1) {
       int i,j;
-      #if STBI_SIMD
+      #if STBI_SIMD && defined(_MSC_VER)
       __declspec(align(16))
       #endif
       short data[64];
@@ -1332,7 +1332,20 @@ static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
 
 void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 {
-   stbi_YCbCr_installed = func;
+   stbi_YCbCr_installed = func ? func : YCbCr_to_RGB_row;
+}
+
+static stbi_resample_run stbi_resample_h_2_installed = resample_row_h_2;
+static stbi_resample_run stbi_resample_hv_2_installed = resample_row_hv_2;
+
+void stbi_install_resample_row_h_2(stbi_resample_run func)
+{
+   stbi_resample_h_2_installed = func ? func : resample_row_h_2;
+}
+
+void stbi_install_resample_row_hv_2(stbi_resample_run func)
+{
+   stbi_resample_hv_2_installed = func ? func : resample_row_hv_2;
 }
 #endif
 
@@ -1407,8 +1420,13 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
          else if (r->hs == 1 && r->vs == 2) r->resample = resample_row_v_2;
+         #if STBI_SIMD
+         else if (r->hs == 2 && r->vs == 1) r->resample = stbi_resample_h_2_installed;
+         else if (r->hs == 2 && r->vs == 2) r->resample = stbi_resample_hv_2_installed;
+         #else
          else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
          else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
+         #endif
          else                               r->resample = resample_row_generic;
       }
 
@@ -1618,6 +1636,11 @@ typedef struct
    char *zout_end;
    int   z_expandable;
 
+   // report progress when zout - zout_start reaches zprogress_next
+   stbi_zlib_progress progress;
+   void *progress_user;
+   int   zprogress_next;
+
    zhuffman z_length, z_distance;
 } zbuf;
 
@@ -1673,6 +1696,13 @@ __forceinline static int zhuffman_decode(zbuf *a, zhuffman *z)
    return z->value[b];
 }
 
+__forceinline static void zprogress(zbuf *z)
+{
+   int n = (int) (z->zout - z->zout_start);
+   if (n >= z->zprogress_next)
+      z->zprogress_next = z->progress(z->progress_user, n);
+}
+
 static int expand(zbuf *z, int n)  // need to make room for n bytes
 {
    char *q;
@@ -1712,6 +1742,7 @@ static int parse_huffman_block(zbuf *a)
          if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
          *a->zout++ = (char) z;
+         if (a->progress) zprogress(a);
       } else {
          uint8 *p;
          int len,dist;
@@ -1728,6 +1759,7 @@ static int parse_huffman_block(zbuf *a)
          p = (uint8 *) (a->zout - dist);
          while (len--)
             *a->zout++ = *p++;
+         if (a->progress) zprogress(a);
       }
    }
 }
@@ -1804,6 +1836,7 @@ static int parse_uncompressed_block(zbuf *a)
    memcpy(a->zout, a->zbuffer, len);
    a->zbuffer += len;
    a->zout += len;
+   if (a->progress) zprogress(a);
    return 1;
 }
 
@@ -1871,6 +1904,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->progress = NULL;
 
    return parse_zlib(a, parse_header);
 }
@@ -1907,6 +1941,25 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
       return -1;
 }
 
+int stbi_zlib_decode_buffer_progress(char *obuffer, int olen, char const *ibuffer, int ilen,
+                                     stbi_zlib_progress progress, void *user, int first)
+{
+   zbuf a;
+   a.zbuffer = (uint8 *) ibuffer;
+   a.zbuffer_end = (uint8 *) ibuffer + ilen;
+   a.zout_start = obuffer;
+   a.zout       = obuffer;
+   a.zout_end   = obuffer + olen;
+   a.z_expandable = 0;
+   a.progress = progress;
+   a.progress_user = user;
+   a.zprogress_next = first;
+   if (parse_zlib(&a, 1))
+      return (int) (a.zout - a.zout_start);
+   else
+      return -1;
+}
+
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
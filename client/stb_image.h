@@ -163,6 +163,13 @@
 
 #define STBI_VERSION 1
 
+// quintiqua: the JPEG decoder's inner loops are installed at run time by
+// JpegSimd.cpp, which needs the STBI_SIMD hooks below. Defined here so
+// every includer sees the same declarations.
+#ifndef STBI_SIMD
+#define STBI_SIMD 1
+#endif
+
 enum
 {
    STBI_default = 0, // only used for req_comp
@@ -237,6 +244,14 @@ extern char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
 extern char *stbi_zlib_decode_malloc(const char *buffer, int len, int *outlen);
 extern int   stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
+// as stbi_zlib_decode_buffer, but calls progress(user, bytes) once 'first'
+// bytes have been written to obuffer, then again each time the count
+// reaches the value that progress returned. Bytes below the count are
+// final and may be read (but not written) during the decode.
+typedef int (*stbi_zlib_progress)(void *user, int bytes);
+extern int   stbi_zlib_decode_buffer_progress(char *obuffer, int olen, const char *ibuffer, int ilen,
+                                              stbi_zlib_progress progress, void *user, int first);
+
 extern char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *outlen);
 extern int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
@@ -327,12 +342,12 @@ extern int stbi_register_loader(stbi_loader *loader);
 
 // define faster low-level operations (typically SIMD support)
 #if STBI_SIMD
-typedef void (*stbi_idct_8x8)(uint8 *out, int out_stride, short data[64], unsigned short *dequantize);
+typedef void (*stbi_idct_8x8)(stbi_uc *out, int out_stride, short data[64], unsigned short *dequantize);
 // compute an integer IDCT on "input"
 //     input[x] = data[x] * dequantize[x]
 //     write results to 'out': 64 samples, each run of 8 spaced by 'out_stride'
 //                             CLAMP results to 0..255
-typedef void (*stbi_YCbCr_to_RGB_run)(uint8 *output, uint8 const *y, uint8 const *cb, uint8 const *cr, int count, int step);
+typedef void (*stbi_YCbCr_to_RGB_run)(stbi_uc *output, stbi_uc const *y, stbi_uc const *cb, stbi_uc const *cr, int count, int step);
 // compute a conversion from YCbCr to RGB
 //     'count' pixels
 //     write pixels to 'output'; each pixel is 'step' bytes (either 3 or 4; if 4, write '255' as 4th), order R,G,B
@@ -340,8 +355,17 @@ typedef void (*stbi_YCbCr_to_RGB_run)(uint8 *output, uint8 const *y, uint8 const
 //     cb: Cb input channel; scale/biased to be 0..255
 //     cr: Cr input channel; scale/biased to be 0..255
 
+typedef stbi_uc *(*stbi_resample_run)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+// upsample one row of a subsampled component by 2 (h_2: horizontally;
+// hv_2: both ways, in_far being the neighbouring row)
+//     'w' input samples; write 2*w samples to 'out' and return it
+//     must produce exactly what the built-in resample_row_* do
+
+// passing NULL to any of these restores the built-in version
 extern void stbi_install_idct(stbi_idct_8x8 func);
 extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
+extern void stbi_install_resample_row_h_2(stbi_resample_run func);
+extern void stbi_install_resample_row_hv_2(stbi_resample_run func);
 #endif // STBI_SIMD
 
 #ifdef __cplusplus
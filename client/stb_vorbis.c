@@ -2297,16 +2297,13 @@ static void imdct_step3_inner_s_loop_ld654(int n, float *e, int i_off, float *A,
    }
 }
 
-static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
+static void inverse_mdct_builtin(float *buffer, int n, float *A, float *B, float *C, uint16 *bitrev, float *buf2)
 {
    int n2 = n >> 1, n4 = n >> 2, n8 = n >> 3, l;
    int n3_4 = n - n4, ld;
    // @OPTIMIZE: reduce register pressure by using fewer variables?
-   int save_point = temp_alloc_save(f);
-   float *buf2 = (float *) temp_alloc(f, n2 * sizeof(*buf2));
    float *u=NULL,*v=NULL;
-   // twiddle factors
-   float *A = f->A[blocktype];
+   // A: twiddle factors
 
    // IMDCT algorithm from "The use of multirate filter banks for coding of high quality digital audio"
    // See notes about bugs in that paper in less-optimal implementation 'inverse_mdct_old' after this function.
@@ -2452,7 +2449,6 @@ static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
    // step 4, 5, and 6
    // cannot be in-place because of step 5
    {
-      uint16 *bitrev = f->bit_reverse[blocktype];
       // weirdly, I'd have thought reading sequentially and writing
       // erratically would have been better than vice-versa, but in
       // fact that's not what my testing showed. (That is, with
@@ -2489,7 +2485,6 @@ static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
    // step 7   (paper output is v, now v)
    // this is now in place
    {
-      float *C = f->C[blocktype];
       float *d, *e;
 
       d = v;
@@ -2545,8 +2540,8 @@ static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
    {
       float *d0,*d1,*d2,*d3;
 
-      float *B = f->B[blocktype] + n2 - 8;
       float *e = buf2 + n2 - 8;
+      B += n2 - 8;
       d0 = &buffer[0];
       d1 = &buffer[n2-4];
       d2 = &buffer[n2];
@@ -2594,7 +2589,20 @@ static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
          d3 -= 4;
       }
    }
+}
+
+static stb_vorbis_inverse_mdct_run inverse_mdct_installed = inverse_mdct_builtin;
 
+void stb_vorbis_install_inverse_mdct(stb_vorbis_inverse_mdct_run func)
+{
+   inverse_mdct_installed = func ? func : inverse_mdct_builtin;
+}
+
+static void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
+{
+   int save_point = temp_alloc_save(f);
+   float *buf2 = (float *) temp_alloc(f, (n >> 1) * sizeof(*buf2));
+   inverse_mdct_installed(buffer, n, f->A[blocktype], f->B[blocktype], f->C[blocktype], f->bit_reverse[blocktype], buf2);
    temp_alloc_restore(f,save_point);
 }
 
@@ -3096,6 +3104,20 @@ static int vorbis_decode_packet(vorb *f, int *len, int *p_left, int *p_right)
    return vorbis_decode_packet_rest(f, len, f->mode_config + mode, *p_left, left_end, *p_right, right_end, p_left);
 }
 
+static void overlap_add_builtin(float *out, float const *prev, float const *window, int n)
+{
+   int j;
+   for (j=0; j < n; ++j)
+      out[j] = out[j]*window[j] + prev[j]*window[n-1-j];
+}
+
+static stb_vorbis_overlap_add_run overlap_add_installed = overlap_add_builtin;
+
+void stb_vorbis_install_overlap_add(stb_vorbis_overlap_add_run func)
+{
+   overlap_add_installed = func ? func : overlap_add_builtin;
+}
+
 static int vorbis_finish_frame(stb_vorbis *f, int len, int left, int right)
 {
    int prev,i,j;
@@ -3109,14 +3131,10 @@ static int vorbis_finish_frame(stb_vorbis *f, int len, int left, int right)
 
    // mixin from previous window
    if (f->previous_length) {
-      int i,j, n = f->previous_length;
+      int i, n = f->previous_length;
       float *w = get_window(f, n);
-      for (i=0; i < f->channels; ++i) {
-         for (j=0; j < n; ++j)
-            f->channel_buffers[i][left+j] =
-               f->channel_buffers[i][left+j]*w[    j] +
-               f->previous_window[i][     j]*w[n-1-j];
-      }
+      for (i=0; i < f->channels; ++i)
+         overlap_add_installed(f->channel_buffers[i]+left, f->previous_window[i], w, n);
    }
 
    prev = f->previous_length;
@@ -3788,6 +3806,7 @@ static void vorbis_deinit(stb_vorbis *p)
       setup_free(p, p->B[i]);
       setup_free(p, p->C[i]);
       setup_free(p, p->window[i]);
+      setup_free(p, p->bit_reverse[i]);
    }
    #ifndef STB_VORBIS_NO_STDIO
    if (p->close_on_free) fclose(p->f);
@@ -309,6 +309,29 @@ extern int stb_vorbis_get_samples_short(stb_vorbis *f, int channels, short **buf
 
 #endif
 
+///////////   INSTALLABLE INNER LOOPS
+
+// quintiqua: the inverse MDCT and the overlap-add of successive frames
+// are installed at run time by VorbisSimd.cpp. NOT THREADSAFE: install
+// before any stream is decoding.
+
+typedef void (*stb_vorbis_inverse_mdct_run)(float *buffer, int n, float *A, float *B, float *C, unsigned short *bitrev, float *buf2);
+// compute the inverse MDCT of 'buffer' in place: n/2 coefficients in,
+// 'n' samples out
+//     A, B, C: the twiddle factors for the block size
+//     bitrev: its bit-reverse table
+//     buf2: n/2 floats of scratch
+//     must produce exactly what the built-in inverse_mdct does
+
+typedef void (*stb_vorbis_overlap_add_run)(float *out, float const *prev, float const *window, int n);
+// window the overlapping halves of two frames and add them
+//     out[j] = out[j]*window[j] + prev[j]*window[n-1-j], for 'n' samples
+//     must produce exactly what the built-in loop does
+
+// passing NULL to either of these restores the built-in version
+extern void stb_vorbis_install_inverse_mdct(stb_vorbis_inverse_mdct_run func);
+extern void stb_vorbis_install_overlap_add(stb_vorbis_overlap_add_run func);
+
 ////////   ERROR CODES
 
 enum STBVorbisError
@@ -216,6 +216,7 @@ mouse = {}
 
 local _setBackground = sg.setBackground
 local _setScene = sg.setScene
+local _setPremultiply = sg.setPremultiply
 local _setWindowTitle = SetWindowTitle
 SetWindowTitle = nil
 
@@ -244,6 +245,53 @@ function display:getScene()
 	return _scene
 end
 
+-- Textures loaded after this have premultiplied alpha.
+function display:setPremultiply(enable)
+	_setPremultiply(enable)
+end
+
+-- Sounds and music (see client/Audio.h); all silent without audio.
+local _audio = audio
+audio = {}
+music = {}
+
+function audio:setGain(gain)
+	_audio.setGain(gain)
+end
+
+-- periods, underruns, starved, dropped, voices, sounds and stolen; and
+-- mixLast, mixMean, mixMax and overBudget against budget, in microseconds.
+function audio:getStats()
+	return _audio.getStats()
+end
+
+-- "linear" or "polyphase" (the default).
+function audio:setResampler(name)
+	_audio.setResampler(name)
+end
+
+-- Change a voice from Sound:play while it plays.
+function audio:setVoice(voice, gain, pan, pitch)
+	_audio.setVoice(voice, gain or 1, pan or 0, pitch or 1)
+end
+
+function audio:stopVoice(voice)
+	_audio.stopVoice(voice)
+end
+
+-- Streams an Ogg Vorbis file; what was playing fades out.
+function music:play(name, loop)
+	_audio.playMusic(name, loop)
+end
+
+function music:stop()
+	_audio.stopMusic()
+end
+
+function music:setGain(gain)
+	_audio.setMusicGain(gain)
+end
+
 function keyboard:setFocus(obj)
 	self._focus = obj
 end
@@ -371,6 +419,8 @@ local loadTexture = sg.loadTexture
 local setOutline = sg.setOutline
 local setBlendMode = sg.setBlendMode
 local getTextureSize = sg.getTextureSize
+local setTextureFilter = sg.setTextureFilter
+local getTextureCacheStats = sg.getTextureCacheStats
 local setGeometry = sg.setGeometry
 local setGfxTexture = sg.setGfxTexture
 
@@ -637,6 +687,7 @@ end
 
 Texture = class {}
 
+-- Textures loaded from the same file share one native texture.
 function Texture:init(name)
 	self.__id = loadTexture(name)
 end
@@ -645,6 +696,38 @@ function Texture:getSize()
 	return getTextureSize(self.__id)
 end
 
+-- 'linear' (the default), 'nearest', 'mipmap' or 'trilinear'; use one
+-- of the last two for textures drawn well below their size.
+function Texture:setFilter(filter)
+	setTextureFilter(self.__id, filter)
+end
+
+-- Returns loads that shared a texture, loads that read a file, and the
+-- number of textures being shared.
+function Texture.getCacheStats()
+	return getTextureCacheStats()
+end
+
+
+-------------------------------------------
+
+local loadSound = _audio.loadSound
+local playSound = _audio.playSound
+
+-- An Ogg Vorbis file decoded for playing whole; loading it again gives
+-- the same sound.
+Sound = class {}
+
+function Sound:init(name)
+	self.__id = loadSound(name)
+end
+
+-- gain defaults to 1, pan to 0 (centred; -1 is left, 1 right) and pitch
+-- to 1 (2 is an octave up). Returns the voice, for audio:setVoice.
+function Sound:play(gain, pan, pitch)
+	return playSound(self.__id, gain or 1, pan or 0, pitch or 1)
+end
+
 
 -------------------------------------------
 
@@ -0,0 +1,149 @@
+--[[
+
+	Binding overhead benchmark, run by luabench in place of api_init.lua
+
+	Each case calls one binding in a loop; the best of several rounds is
+	taken and the cost of the loop itself taken off, leaving the time per
+	call. math.abs is timed too, as the cheapest call into C there is.
+	Then api_init.lua is loaded and the Node methods that scripts really
+	call are timed the same way, wrapper and all.
+
+--]]
+
+local clock = profiler.clock
+local format = string.format
+local abs = math.abs
+
+local ITERATIONS = 200000
+local ROUNDS = 5
+
+local function log(fmt, ...)
+	print(format(fmt, ...))
+end
+
+-- seconds for the fastest of ROUNDS runs of fn(n)
+local function best(fn, n)
+	local fastest
+	for r = 1, ROUNDS do
+		local start = clock()
+		fn(n)
+		local t = clock() - start
+		if not fastest or t < fastest then fastest = t end
+	end
+	return fastest
+end
+
+local baseline = best(function(n)
+	for i = 1, n do end
+end, ITERATIONS)
+
+local function run(name, fn)
+	local t = best(fn, ITERATIONS) - baseline
+	if t < 0 then t = 0 end
+	log("  %-24s %8.1f ns/call", name, t * 1e9 / ITERATIONS)
+end
+
+
+-------------------------------------------
+-- sg.* as registered by LuaController
+
+local createTransform = sg.createTransform
+local createFrame = sg.createFrame
+local setParent = sg.setParent
+local setPosition = sg.setPosition
+local setAngle = sg.setAngle
+local setScale = sg.setScale
+local setColour = sg.setColour
+local setShape = sg.setShape
+local setTexture = sg.setTexture
+local loadTexture = sg.loadTexture
+local getTextureSize = sg.getTextureSize
+local setBlendMode = sg.setBlendMode
+local destroy = sg.destroy
+
+local root = createTransform()
+local other = createTransform()
+local frame = createFrame()
+local tex = loadTexture('S200N802.BMP')
+setParent(frame, root)
+
+log("luabench: %d calls, best of %d rounds, loop overhead %.1f ns",
+	ITERATIONS, ROUNDS, baseline * 1e9 / ITERATIONS)
+log("sg bindings:")
+
+run("math.abs", function(n)
+	for i = 1, n do abs(i) end
+end)
+run("setPosition", function(n)
+	for i = 1, n do setPosition(frame, i, i) end
+end)
+run("setAngle", function(n)
+	for i = 1, n do setAngle(frame, i) end
+end)
+run("setScale", function(n)
+	for i = 1, n do setScale(frame, 1, 1) end
+end)
+run("setColour", function(n)
+	for i = 1, n do setColour(frame, 1, 0.5, 0.25) end
+end)
+run("setColour (alpha)", function(n)
+	for i = 1, n do setColour(frame, 1, 0.5, 0.25, 0.5) end
+end)
+run("setShape", function(n)
+	for i = 1, n do setShape(frame, 0, 0, 16, 16) end
+end)
+run("setTexture", function(n)
+	for i = 1, n do setTexture(frame, tex) end
+end)
+run("getTextureSize", function(n)
+	for i = 1, n do getTextureSize(tex) end
+end)
+run("setBlendMode", function(n)
+	for i = 1, n do setBlendMode(frame, 'modulate') end
+end)
+run("setParent (move)", function(n)
+	-- alternate parents, so every call is a real move.
+	for i = 1, n, 2 do
+		setParent(frame, other)
+		setParent(frame, root)
+	end
+end)
+run("createFrame + destroy", function(n)
+	for i = 1, n do destroy(createFrame()) end
+end)
+
+destroy(frame)
+destroy(other)
+destroy(root)
+
+
+-------------------------------------------
+-- Node methods, through the api_init.lua wrappers
+
+dofile('api_init.lua')
+
+local parent = Node()
+local spare = Node()
+local node = Node()
+parent:addChild(node)
+
+log("Node methods:")
+
+run("Node:setPosition", function(n)
+	for i = 1, n do node:setPosition(i, i) end
+end)
+run("Node:setAngle", function(n)
+	for i = 1, n do node:setAngle(i) end
+end)
+run("Node:setScale", function(n)
+	for i = 1, n do node:setScale(1) end
+end)
+run("Node:setColour", function(n)
+	for i = 1, n do node:setColour(1, 0.5, 0.25) end
+end)
+run("Node:setParent (move)", function(n)
+	for i = 1, n, 2 do
+		node:setParent(spare)
+		node:setParent(parent)
+	end
+end)
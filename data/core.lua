@@ -12,9 +12,9 @@ function createDemo()
 	scene:addChild(bg)
 
 	local function box(x, y, w, h, r, g, b, a)
-		-- make a box with a silly texture
+		-- make a box with a silly texture; mipmapped, as they zoom
 		local f = ui.Layer {x=x, y=y, width=w, height=h, colour={r,g,b,a},
-						 texture='S200N802.BMP'}
+						 texture='S200N802.BMP', filter='mipmap'}
 		scene:addChild(f)
 		ui.draggable(f)
 		return f
@@ -88,7 +88,11 @@ function Layer:setup(args)
 	if args.angle then self:setAngle(args.angle) end
 	if args.scale then self:setScale(args.scale, args.scale) end
 	if args.colour then self:setColour(unpack(args.colour)) end
-	if args.texture then self:setTexture(Texture(args.texture)) end
+	if args.texture then
+		local tex = Texture(args.texture)
+		if args.filter then tex:setFilter(args.filter) end
+		self:setTexture(tex)
+	end
 	self:setSize(args.width or self.width or 0, args.height or self.height or 0)
 end
 